@@ -31,6 +31,7 @@ import threading
 import time
 
 from atftman import AtftManager
+from atftman import ProvisionPipeline
 from atftman import ProvisionState
 from atftman import ProvisionStatus
 from atftman import RebootCallback
@@ -44,6 +45,7 @@ from fastboot_exceptions import OsVersionNotCompatibleException
 from fastboot_exceptions import PasswordErrorException
 from fastboot_exceptions import ProductAttributesFileFormatError
 from fastboot_exceptions import ProductNotSpecifiedException
+import fastbootusb
 
 from passlib.hash import pbkdf2_sha256
 
@@ -1483,6 +1485,10 @@ class Atft(wx.Frame):
     # Indicate whether in auto provisioning mode.
     self.auto_prov = False
 
+    # The pipeline running the provision steps in auto provisioning mode if
+    # 'PIPELINE_PROVISION' is configured.
+    self.provision_pipeline = None
+
     # Indicate whether refresh is paused. If we could acquire this lock, this
     # means that the refresh is paused. We would pause the refresh during each
     # fastboot command since on Windows, a fastboot device would disappear from
@@ -1546,6 +1552,9 @@ class Atft(wx.Frame):
 
     self.ShowStartScreen()
     self.StartRefreshingDevices()
+    # List devices as soon as one is plugged in or removed instead of waiting
+    # for the next refresh.
+    self.atft_manager.StartHotplugWatcher(self._OnDeviceChanged)
 
   @staticmethod
   def _BindEventRecursive(event, widget, handler):
@@ -1755,8 +1764,16 @@ class Atft(wx.Frame):
     """Create an AtftManager object.
 
     This function exists for test mocking.
+
+    If 'FASTBOOT_TRANSPORT' is configured to 'usb' and libusb is available,
+    fastboot commands go over persistent USB connections instead of the
+    fastboot tool.
     """
-    return AtftManager(FastbootDevice, SerialMapper, self.configs)
+    fastboot_device = FastbootDevice
+    if (self.configs and self.configs.get('FASTBOOT_TRANSPORT') == 'usb' and
+        fastbootusb.IsAvailable()):
+      fastboot_device = fastbootusb.FastbootDevice
+    return AtftManager(fastboot_device, SerialMapper, self.configs)
 
   def CreateAtftLog(self):
     """Create an AtftLog object.
@@ -1874,6 +1891,22 @@ class Atft(wx.Frame):
       else:
         self.skip_reboot = False
 
+      # In auto provisioning mode, devices normally run their steps one at a
+      # time. With 'PIPELINE_PROVISION' set to True, they run them at the same
+      # time through a ProvisionPipeline instead.
+      if 'PIPELINE_PROVISION' in configs:
+        self.pipeline_provision = configs['PIPELINE_PROVISION']
+      else:
+        self.pipeline_provision = False
+
+      # With 'BATCH_PROVISION' set to True, manually provisioning several
+      # devices shares the ATFA exchanges between them if the ATFA supports
+      # batches, see AtftManager.ProvisionBatch.
+      if 'BATCH_PROVISION' in configs:
+        self.batch_provision = configs['BATCH_PROVISION']
+      else:
+        self.batch_provision = False
+
       device_usb_locations_initialized = False
       for i in range(TARGET_DEV_SIZE):
         if self.device_usb_locations[i]:
@@ -2615,6 +2648,17 @@ class Atft(wx.Frame):
       # If refresh is not paused, refresh the devices.
       self._ListDevices()
 
+  def _OnDeviceChanged(self):
+    """Refresh the device list now since a USB device is added or removed.
+
+    This is called from the hotplug watcher thread.
+    """
+    if self.refresh_pause_lock.acquire(False):
+      # Semaphore > 0, refresh is paused. The next refresh lists the change.
+      self.refresh_pause_lock.release()
+      return
+    self._CreateThread(self._ListDevices)
+
   def StopRefresh(self):
     """Stop the refresh timer if there's any.
     """
@@ -2713,6 +2757,11 @@ class Atft(wx.Frame):
     self.auto_prov = True
     self.first_key_alert_shown = False
     self.second_key_alert_shown = False
+    if self.pipeline_provision:
+      self.provision_pipeline = ProvisionPipeline(
+          self.atft_manager, self.provision_steps, self.reboot_timeout,
+          self.listing_device_lock, self._PipelineSuccessCallback,
+          self._PipelineFailureCallback)
     message = 'Automatic key provisioning start'
     self.PrintToCommandWindow(message)
     self.log.Info('Autoprov', message)
@@ -2722,6 +2771,10 @@ class Atft(wx.Frame):
     if not self.auto_prov:
       return
     self.auto_prov = False
+    if self.provision_pipeline:
+      # Steps that already started still finish.
+      self.provision_pipeline.Stop()
+      self.provision_pipeline = None
     for device in self._GetAvailableDevices():
       # Change all waiting devices' status to it's original state.
       if device.provision_status == ProvisionStatus.WAITING:
@@ -3216,6 +3269,16 @@ class Atft(wx.Frame):
     """Do the state transition for devices if in auto provisioning mode.
 
     """
+    pipeline = self.provision_pipeline
+    if pipeline:
+      # The pipeline sets the devices to waiting and ignores the ones it
+      # already runs.
+      for target_dev in self._GetAvailableDevices():
+        if (not self._is_provision_steps_finished(target_dev.provision_state)
+            and not ProvisionStatus.isFailed(target_dev.provision_status)):
+          pipeline.Submit(target_dev)
+      return
+
     # All idle devices -> waiting.
     for target_dev in self._GetAvailableDevices():
       if (target_dev.serial_number not in self.auto_dev_serials and
@@ -4391,13 +4454,19 @@ class Atft(wx.Frame):
     # Reset alert_shown
     self.first_key_alert_shown = False
     self.second_key_alert_shown = False
+    targets = []
     for serial in selected_serials:
       target = self.atft_manager.GetTargetDevice(serial)
       if (not target or
           target.provision_status == ProvisionStatus.REBOOT_IN_PROGRESS):
         continue
       if target.provision_status == ProvisionStatus.WAITING:
-        self._ProvisionTarget(target, is_som_key)
+        targets.append(target)
+    if self.batch_provision and len(targets) > 1:
+      self._ProvisionTargets(targets, is_som_key)
+      return
+    for target in targets:
+      self._ProvisionTarget(target, is_som_key)
 
   def _ProvisionTarget(self, target, is_som_key, auto_prov=False):
     """Provision the attestation key into the specific target.
@@ -4442,6 +4511,61 @@ class Atft(wx.Frame):
         'Device: ' + str(target) + ' AT-ATTEST-UUID: ' + target.at_attest_uuid)
     self._CheckLowKeyAlert()
 
+  def _ProvisionTargets(self, targets, is_som_key):
+    """Provision the attestation keys into several targets in batches.
+
+    Args:
+      targets: The targets to be provisioned.
+      is_som_key: Whether provision som key (or product key).
+    """
+    operation = 'Product Attestation Key Provisioning'
+    if is_som_key:
+      operation = 'SoM Attestation Key Provisioning'
+    atfa_dev = self.atft_manager.GetATFADevice()
+    started_targets = []
+    for target in targets:
+      if self._StartOperation(operation, target):
+        started_targets.append(target)
+    if not started_targets:
+      return
+    if not self._StartOperation(operation, atfa_dev):
+      for target in started_targets:
+        self._EndOperation(target)
+      return
+
+    provision_failed = False
+    try:
+      self.atft_manager.ProvisionBatch(started_targets, is_som_key)
+    except DeviceNotFoundException as e:
+      e.SetMsg('No Available ATFA!')
+      self._HandleException('W', e, operation, started_targets)
+      return
+    except FastbootFailure as e:
+      failed_targets = [
+          target for target in started_targets
+          if ProvisionStatus.isFailed(target.provision_status)]
+      self._HandleException('E', e, operation, failed_targets)
+      provision_failed = True
+    finally:
+      self._EndOperation(atfa_dev)
+      for target in started_targets:
+        self._EndOperation(target)
+
+    if provision_failed:
+      # If it fails, one key might also be used.
+      self._UpdateKeysLeftInATFA()
+
+    for target in started_targets:
+      if ProvisionStatus.isFailed(target.provision_status):
+        continue
+      self._SendOperationSucceedEvent(operation, target)
+      if not is_som_key:
+        self.log.Info(
+          'Key Provisioning',
+          'Device: ' + str(target) + ' AT-ATTEST-UUID: ' +
+          target.at_attest_uuid)
+    self._CheckLowKeyAlert()
+
   def _HandleStateTransition(self, target):
     """Handles the state transition for automatic key provisioning.
 
@@ -4506,6 +4630,43 @@ class Atft(wx.Frame):
     self.auto_dev_serials.remove(serial)
     self.auto_prov_lock.release()
 
+  def _PipelineSuccessCallback(self, target):
+    """Called by the provision pipeline once a target finished all steps.
+
+    Args:
+      target: The target device object.
+    """
+    self._SendOperationSucceedEvent('All steps', target)
+    if target.at_attest_uuid:
+      self.log.Info(
+        'Key Provisioning',
+        'Device: ' + str(target) + ' AT-ATTEST-UUID: ' + target.at_attest_uuid)
+    self._CheckLowKeyAlert()
+    if self.auto_prov and self._GetCachedATFAKeysLeft() == 0:
+      # No keys left, exit auto provisioning mode.
+      self._SendAlertEvent(self.atft_string.ALERT_NO_KEYS_LEFT_LEAVE_PROV)
+      self.autoprov_button.SetValue(False)
+      self.OnLeaveAutoProv()
+
+  def _PipelineFailureCallback(self, target, step, e):
+    """Called by the provision pipeline when a step failed for a target.
+
+    Args:
+      target: The target device object.
+      step: The name of the failed step.
+      e: The exception raised by the step.
+    """
+    if isinstance(e, DeviceNotFoundException):
+      e.SetMsg('No Available ATFA!')
+      self._HandleException('W', e, step, [target])
+    elif isinstance(e, ProductNotSpecifiedException):
+      self._HandleException('W', e, step, [target])
+    else:
+      self._HandleException('E', e, step, [target])
+    if step in ('ProvisionProduct', 'ProvisionSom'):
+      # If it fails, one key might also be used.
+      self._UpdateKeysLeftInATFA()
+
   def _ProcessKeyCallback(self, pathname):
     self._CreateThread(self._ProcessKey, pathname)
 
@@ -4820,6 +4981,7 @@ class Atft(wx.Frame):
     self._StoreConfigToFile()
     # Stop the refresh timer on close.
     self.StopRefresh()
+    self.atft_manager.StopHotplugWatcher()
     # Stop automatic processing keys.
     self.key_handler.StopProcessKey()
     self.DeletePendingEvents()
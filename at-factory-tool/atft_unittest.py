@@ -67,6 +67,8 @@ class MockAtft(atft.Atft):
     atft.Atft.__init__(self)
     self.provision_steps = self.DEFAULT_PROVISION_STEPS_PRODUCT
     self.skip_reboot = False
+    self.pipeline_provision = False
+    self.batch_provision = False
 
   def _MockParseConfig(self):
     self.atft_version = 'vTest'
@@ -532,6 +534,25 @@ class AtftTest(TestCase):
     self.assertEqual(False, mock_atft.auto_prov)
     mock_atft.ShowAlert.assert_called_once()
 
+  @patch('atft.ProvisionPipeline')
+  def testOnEnterAutoProvPipeline(self, mock_pipeline_class):
+    mock_atft = MockAtft()
+    mock_atft.auto_prov = False
+    mock_atft.pipeline_provision = True
+    mock_atft.atft_manager = MagicMock()
+    mock_atft.atft_manager.GetATFADevice = MagicMock()
+    mock_atft.atft_manager.GetATFADevice.return_value = MagicMock()
+    mock_atft.atft_manager.product_info = MagicMock()
+    mock_atft.atft_manager.GetCachedATFAKeysLeft.return_value = 10
+    mock_atft.PrintToCommandWindow = MagicMock()
+    mock_atft.ShowAlert = MagicMock()
+    mock_atft.autoprov_button = MagicMock()
+    mock_atft.OnEnterAutoProv()
+    self.assertEqual(True, mock_atft.auto_prov)
+    mock_pipeline_class.assert_called_once()
+    self.assertEqual(
+        mock_pipeline_class.return_value, mock_atft.provision_pipeline)
+
   # Test atft.OnLeaveAutoProv
   def testLeaveAutoProvNormal(self):
     # While leaving auto prov mode, need to check device status if the device
@@ -618,6 +639,27 @@ class AtftTest(TestCase):
     self.assertEqual(test_dev2.provision_status, ProvisionStatus.WAITING)
     self.assertEqual(1, mock_atft._CreateThread.call_count)
 
+  def testHandleAutoProvPipeline(self):
+    mock_atft = MockAtft()
+    mock_atft.provision_pipeline = MagicMock()
+    test_dev1 = TestDeviceInfo(self.TEST_SERIAL1, self.TEST_LOCATION1,
+                               ProvisionStatus.PROVISION_SUCCESS)
+    test_dev1.provision_state.bootloader_locked = True
+    test_dev1.provision_state.avb_perm_attr_set = True
+    test_dev1.provision_state.avb_locked = True
+    test_dev1.provision_state.product_provisioned = True
+    test_dev2 = TestDeviceInfo(self.TEST_SERIAL2, self.TEST_LOCATION1,
+                               ProvisionStatus.IDLE)
+    test_dev3 = TestDeviceInfo(self.TEST_SERIAL3, self.TEST_LOCATION1,
+                               ProvisionStatus.PROVISION_FAILED)
+    mock_atft._GetAvailableDevices = MagicMock()
+    mock_atft._GetAvailableDevices.return_value = [
+        test_dev1, test_dev2, test_dev3]
+    mock_atft._CreateThread = MagicMock()
+    mock_atft._HandleAutoProv()
+    mock_atft.provision_pipeline.Submit.assert_called_once_with(test_dev2)
+    mock_atft._CreateThread.assert_not_called()
+
   # Test atft._HandleKeysLeft
   def MockGetKeysLeft(self, keys_left_array):
     if keys_left_array:
@@ -1782,6 +1824,42 @@ class AtftTest(TestCase):
     mock_atft.OnManualProvision(None)
     calls = [call(test_dev1, True), call(test_dev2, True)]
 
+  def MockSetBatchAttestUuid(self, targets, is_som_key):
+    for target in targets:
+      target.at_attest_uuid = self.TEST_ATTEST_UUID
+      target.provision_status = ProvisionStatus.PROVISION_SUCCESS
+
+  def testManualProvisionBatch(self):
+    mock_atft = MockAtft()
+    mock_atft.batch_provision = True
+    mock_atft.PauseRefresh = MagicMock()
+    mock_atft.ResumeRefresh = MagicMock()
+    mock_atft._HandleException = MagicMock()
+    mock_atft._SendOperationSucceedEvent = MagicMock()
+    mock_atft._CheckLowKeyAlert = MagicMock()
+    mock_atft.atft_manager.Provision = MagicMock()
+    mock_atft.atft_manager.ProvisionBatch = MagicMock()
+    mock_atft.atft_manager.ProvisionBatch.side_effect = (
+        self.MockSetBatchAttestUuid)
+    mock_atft.atft_manager.GetTargetDevice.side_effect = (
+        self.MockGetTargetDevice)
+    test_dev1 = TestDeviceInfo(self.TEST_SERIAL1, self.TEST_LOCATION1,
+                               ProvisionStatus.WAITING)
+    test_dev2 = TestDeviceInfo(self.TEST_SERIAL2, self.TEST_LOCATION2,
+                               ProvisionStatus.WAITING)
+    test_dev3 = TestDeviceInfo(self.TEST_SERIAL3, self.TEST_LOCATION2,
+                               ProvisionStatus.REBOOT_IN_PROGRESS)
+    self.device_map[self.TEST_SERIAL1] = test_dev1
+    self.device_map[self.TEST_SERIAL2] = test_dev2
+    self.device_map[self.TEST_SERIAL3] = test_dev3
+    mock_atft._ManualProvision(
+        [self.TEST_SERIAL1, self.TEST_SERIAL2, self.TEST_SERIAL3], False)
+    mock_atft.atft_manager.ProvisionBatch.assert_called_once_with(
+        [test_dev1, test_dev2], False)
+    mock_atft.atft_manager.Provision.assert_not_called()
+    mock_atft._HandleException.assert_not_called()
+    self.assertEqual(2, mock_atft._SendOperationSucceedEvent.call_count)
+
   def testManualProvisionReprovision(self):
     mock_atft = MockAtft()
     mock_atft.PauseRefresh = MagicMock()
@@ -28,6 +28,7 @@ import struct
 import sys
 import tempfile
 import threading
+import time
 import uuid
 
 from fastboot_exceptions import DeviceCreationException
@@ -74,6 +75,118 @@ def _GetVarLen(data, index):
   return struct.unpack('<I', data[index:index + 4])[0]
 
 
+def _PackBatch(messages):
+  """Packs messages into one batch file.
+
+  A batch is a 4 byte little endian count followed by each message, prefixed
+  by its 4 byte little endian length. An empty message marks a skipped entry.
+
+  Args:
+    messages: The list of messages.
+  Returns:
+    The packed bytearray.
+  """
+  data = bytearray(struct.pack('<I', len(messages)))
+  for message in messages:
+    data += struct.pack('<I', len(message))
+    data += message
+  return data
+
+
+def _UnpackBatch(data, expected_count):
+  """Unpacks a batch file packed as in _PackBatch.
+
+  Args:
+    data: The bytearray of the batch file.
+    expected_count: The number of messages the batch should have.
+  Returns:
+    The list of messages and the offset after the last one.
+  Raises:
+    FastbootFailure: When the batch is malformed.
+  """
+  if len(data) < _VAR_LEN or _GetVarLen(data, 0) != expected_count:
+    raise FastbootFailure('ATFA device response has invalid format')
+  messages = []
+  index = _VAR_LEN
+  for _ in range(expected_count):
+    if index + _VAR_LEN > len(data):
+      raise FastbootFailure('ATFA device response has invalid format')
+    length = _GetVarLen(data, index)
+    index += _VAR_LEN
+    if index + length > len(data):
+      raise FastbootFailure('ATFA device response has invalid format')
+    messages.append(data[index:index + length])
+    index += length
+  return messages, index
+
+
+def _UploadContent(device):
+  """Uploads the staged content from a device into memory.
+
+  Fastboot controllers that transfer from memory do so directly, the others
+  go through a temporary file.
+
+  Args:
+    device: The device to upload from.
+  Returns:
+    The content as a bytearray.
+  Raises:
+    FastbootFailure: When fastboot command fails.
+  """
+  if hasattr(device, 'UploadContent'):
+    return device.UploadContent()
+  return _UploadContentWithFile(device)
+
+
+def _SupportsContentTransfer(device):
+  """Whether a device transfers content from memory without a temporary file.
+
+  Args:
+    device: The device to check.
+  Returns:
+    True if UploadContent() and DownloadContent() skip the temporary file.
+  """
+  if hasattr(device, 'SupportsContentTransfer'):
+    return device.SupportsContentTransfer()
+  return hasattr(device, 'UploadContent') and hasattr(device, 'DownloadContent')
+
+
+def _UploadContentWithFile(device):
+  tmp_file = tempfile.NamedTemporaryFile(delete=False)
+  tmp_file.close()
+  try:
+    device.Upload(tmp_file.name)
+    with open(tmp_file.name, 'rb') as content_file:
+      return bytearray(content_file.read())
+  finally:
+    os.remove(tmp_file.name)
+
+
+def _DownloadContent(device, content):
+  """Downloads content from memory to a device.
+
+  Args:
+    device: The device to download to.
+    content: The content to download.
+  Raises:
+    FastbootFailure: When fastboot command fails.
+  """
+  if hasattr(device, 'DownloadContent'):
+    device.DownloadContent(content)
+    return
+  _DownloadContentWithFile(device, content)
+
+
+def _DownloadContentWithFile(device, content):
+  tmp_file = tempfile.NamedTemporaryFile(delete=False)
+  try:
+    tmp_file.write(content)
+    tmp_file.close()
+    device.Download(tmp_file.name)
+  finally:
+    os.remove(tmp_file.name)
+
+
 class EncryptionAlgorithm(object):
   """The support encryption algorithm constant."""
   ALGORITHM_P256 = 1
@@ -216,8 +329,16 @@ class DeviceInfo(object):
   Attributes:
     serial_number: The serial number for the device.
     location: The physical USB location for the device.
+    state_cache: The results of the state probes run by CheckProvisionStatus,
+      keyed by the STATE_* names. An entry stays until an operation that may
+      change it calls InvalidateState.
   """
 
+  STATE_VBOOT = 'at-vboot-state'
+  STATE_ATTEST_UUID = 'at-attest-uuid'
+  STATE_ATTEST_DH = 'at-attest-dh'
+  STATE_SOM_KEY = 'som-key'
+
   def __init__(self, _fastboot_device_controller, serial_number,
                location=None, provision_status=ProvisionStatus.IDLE,
                provision_state=ProvisionState()):
@@ -237,12 +358,26 @@ class DeviceInfo(object):
     self.operation = None
     # The at-attest-uuid for the provisioned key in this device.
     self.at_attest_uuid = None
+    self.state_cache = {}
+
+  def InvalidateState(self, *states):
+    """Forget the cached result of the state probes.
+
+    Args:
+      states: The STATE_* names to forget. Forget all of them if empty.
+    """
+    if not states:
+      self.state_cache.clear()
+      return
+    for state in states:
+      self.state_cache.pop(state, None)
 
   def Copy(self):
     return DeviceInfo(None, self.serial_number, self.location,
                       self.provision_status, self.provision_state)
 
   def Reboot(self):
+    self.InvalidateState()
     return self._fastboot_device_controller.Reboot()
 
   def Oem(self, oem_command, err_to_out=False):
@@ -260,6 +395,20 @@ class DeviceInfo(object):
   def GetVar(self, var):
     return self._fastboot_device_controller.GetVar(var)
 
+  def SupportsContentTransfer(self):
+    return (hasattr(self._fastboot_device_controller, 'UploadContent') and
+            hasattr(self._fastboot_device_controller, 'DownloadContent'))
+
+  def UploadContent(self):
+    if hasattr(self._fastboot_device_controller, 'UploadContent'):
+      return self._fastboot_device_controller.UploadContent()
+    return _UploadContentWithFile(self)
+
+  def DownloadContent(self, content):
+    if hasattr(self._fastboot_device_controller, 'DownloadContent'):
+      return self._fastboot_device_controller.DownloadContent(content)
+    return _DownloadContentWithFile(self, content)
+
   def __eq__(self, other):
     return (self.serial_number == other.serial_number and
             self.location == other.location and
@@ -369,6 +518,11 @@ class AtftManager(object):
     # The timeout period for ATFA device reboot.
     self.ATFA_REBOOT_TIMEOUT = 30
     self.UNLOCK_CREDENTIAL = None
+    # The maximum number of devices in each step of a ProvisionPipeline, by
+    # step name. Steps not listed use ProvisionPipeline.DEFAULT_STAGE_LIMIT.
+    self.PIPELINE_STAGE_LIMITS = {}
+    # How long after a hotplug event for a new device to list devices again.
+    self.DEVICE_SETTLE_TIME = 0.5
     if configs:
       if 'ATFA_REBOOT_TIMEOUT' in configs:
         try:
@@ -385,6 +539,20 @@ class AtftManager(object):
       if 'UNLOCK_CREDENTIAL' in configs:
         self.UNLOCK_CREDENTIAL = configs['UNLOCK_CREDENTIAL']
 
+      if 'DEVICE_SETTLE_TIME' in configs:
+        try:
+          self.DEVICE_SETTLE_TIME = float(configs['DEVICE_SETTLE_TIME'])
+        except ValueError:
+          pass
+
+      if 'PIPELINE_STAGE_LIMITS' in configs:
+        try:
+          self.PIPELINE_STAGE_LIMITS = dict(
+              (step, int(limit))
+              for step, limit in configs['PIPELINE_STAGE_LIMITS'].items())
+        except (AttributeError, ValueError):
+          pass
+
     # The serial numbers for the devices that are at least seen twice.
     self.stable_serials = []
     # The serail numbers for the devices that are only seen once.
@@ -404,6 +572,12 @@ class AtftManager(object):
     # The map mapping rebooting device serial number to their reboot callback
     # objects.
     self._reboot_callbacks = {}
+    # The callback for device changes, set while the hotplug watcher runs.
+    self._hotplug_callback = None
+    # The timer calling the hotplug callback again, while one is pending.
+    self._hotplug_timer = None
+    # Guards _hotplug_timer, which ListDevices and the watcher thread set.
+    self._hotplug_lock = threading.Lock()
 
   def GetATFADevice(self):
     return self._atfa_dev_manager.GetATFADevice()
@@ -462,9 +636,88 @@ class AtftManager(object):
     # ListDevices returns a list of USBHandles
     device_serials = self._fastboot_device_controller.ListDevices()
     self.UpdateDevices(device_serials)
+    if self.pending_serials:
+      # Pending devices become stable on the next listing.
+      self._ScheduleHotplugCallback()
     self._HandleRebootCallbacks()
     self.target_devs.sort(key=AtftManager._LocationAsKey)
 
+  def StartHotplugWatcher(self, callback):
+    """Get notified as soon as a USB device is added or removed.
+
+    The callback is called from the watcher thread, and should list devices
+    with ListDevices. A new device is only used once it is listed twice (see
+    _UpdateSerials), so the callback is called again DEVICE_SETTLE_TIME after
+    a device is added or listed as pending. While the watcher runs, the serial
+    mapper keeps the USB location map up to date, so listing devices no
+    longer refreshes it.
+
+    Args:
+      callback: The function to call, without arguments.
+    Returns:
+      Whether hotplug events are available. If not, devices are only found by
+      listing them periodically.
+    """
+    if self._hotplug_callback:
+      return True
+    self._hotplug_callback = callback
+    if not self._serial_mapper.start_hotplug_watcher(self._HandleHotplugEvent):
+      self._hotplug_callback = None
+      return False
+    return True
+
+  def StopHotplugWatcher(self):
+    """Stop the watcher started by StartHotplugWatcher."""
+    if self._hotplug_callback:
+      self._serial_mapper.stop_hotplug_watcher()
+      self._hotplug_callback = None
+      with self._hotplug_lock:
+        if self._hotplug_timer:
+          self._hotplug_timer.cancel()
+          self._hotplug_timer = None
+
+  def _HandleHotplugEvent(self, serial, location, added):
+    """Handle a USB device being added or removed.
+
+    Args:
+      serial: The serial number for the device.
+      location: The USB location for the device.
+      added: Whether the device was added (or removed).
+    """
+    callback = self._hotplug_callback
+    if not callback:
+      return
+    callback()
+    if added:
+      self._ScheduleHotplugCallback()
+
+  def _ScheduleHotplugCallback(self):
+    """Call the hotplug callback again once new devices had time to settle.
+
+    At most one call is pending at a time, so listing devices while some are
+    pending does not start a timer per listing.
+    """
+    with self._hotplug_lock:
+      if not self._hotplug_callback or self._hotplug_timer:
+        return
+      self._hotplug_timer = threading.Timer(
+          self.DEVICE_SETTLE_TIME, self._HandleHotplugTimer)
+      self._hotplug_timer.daemon = True
+      self._hotplug_timer.start()
+
+  def _HandleHotplugTimer(self):
+    """Call the hotplug callback scheduled by _ScheduleHotplugCallback."""
+    with self._hotplug_lock:
+      # Cleared first, so the listing below can schedule the next call.
+      self._hotplug_timer = None
+      callback = self._hotplug_callback
+    if callback:
+      callback()
+
+  def _RefreshSerialMap(self):
+    if not self._hotplug_callback:
+      self._serial_mapper.refresh_serial_map()
+
   def UpdateDevices(self, device_serials):
     """Update device list.
 
@@ -554,7 +807,7 @@ class AtftManager(object):
     common_serials = [device.serial_number for device in self.target_devs]
 
     # Create new device object for newly added devices.
-    self._serial_mapper.refresh_serial_map()
+    self._RefreshSerialMap()
     for serial in new_targets:
       if serial not in common_serials:
         self.target_devs.append(self._CreateNewTargetDevice(serial))
@@ -595,7 +848,7 @@ class AtftManager(object):
       OsVersionNotAvailableException: When we cannot get the atfa version.
       OsVersionNotCompatibleException: When the atfa version is not compatible.
     """
-    self._serial_mapper.refresh_serial_map()
+    self._RefreshSerialMap()
     controller = self._fastboot_device_controller(atfa_serial)
     location = self._serial_mapper.get_location(atfa_serial)
     atfa_dev = DeviceInfo(controller, atfa_serial, location)
@@ -677,9 +930,31 @@ class AtftManager(object):
           state_map[key_value[0]] = key_value[1]
     return state_map
 
+  @staticmethod
+  def _ProbeState(target_dev, state, probe):
+    """Get a device state from the device state cache, probing it on a miss.
+
+    Args:
+      target_dev: The target device (DeviceInfo).
+      state: The DeviceInfo.STATE_* name of the state.
+      probe: The function that queries the state from the device.
+    Returns:
+      The state.
+    Raises:
+      Whatever the probe raises. Failed probes are not cached.
+    """
+    if state in target_dev.state_cache:
+      return target_dev.state_cache[state]
+    value = probe()
+    target_dev.state_cache[state] = value
+    return value
+
   def CheckProvisionStatus(self, target_dev):
     """Check whether the target device has been provisioned.
 
+    The device state probes are cached in target_dev.state_cache, so only the
+    states invalidated since the last check are queried from the device.
+
     Args:
       target_dev: The target device (DeviceInfo).
     Raises:
@@ -689,7 +964,9 @@ class AtftManager(object):
     new_provision_state = ProvisionState()
 
     try:
-      state_string = target_dev.GetVar('at-vboot-state')
+      state_string = self._ProbeState(
+          target_dev, DeviceInfo.STATE_VBOOT,
+          lambda: target_dev.GetVar('at-vboot-state'))
     except FastbootFailure as e:
       target_dev.provision_status = new_provision_status
       target_dev.provision_state = new_provision_state
@@ -698,17 +975,19 @@ class AtftManager(object):
     status_set = False
 
     try:
-      at_attest_uuid = target_dev.GetVar('at-attest-uuid')
-      # TODO(shanyu): We only need empty string here
-      # NOT_PROVISIONED is for test purpose.
-      if at_attest_uuid and at_attest_uuid != 'NOT_PROVISIONED':
-        target_dev.at_attest_uuid = at_attest_uuid
-        new_provision_status = ProvisionStatus.PROVISION_SUCCESS
-        status_set = True
-        new_provision_state.product_provisioned = True
+      at_attest_uuid = self._ProbeState(
+          target_dev, DeviceInfo.STATE_ATTEST_UUID,
+          lambda: target_dev.GetVar('at-attest-uuid'))
     except FastbootFailure:
       # Some board might gives error if at-attest-uuid is not set.
-      pass
+      at_attest_uuid = None
+    # TODO(shanyu): We only need empty string here
+    # NOT_PROVISIONED is for test purpose.
+    if at_attest_uuid and at_attest_uuid != 'NOT_PROVISIONED':
+      target_dev.at_attest_uuid = at_attest_uuid
+      new_provision_status = ProvisionStatus.PROVISION_SUCCESS
+      status_set = True
+      new_provision_state.product_provisioned = True
 
     # state_string should be in format:
     # (bootloader) bootloader-locked: 1
@@ -726,7 +1005,14 @@ class AtftManager(object):
         status_set = True
       new_provision_state.avb_locked = True
 
-    contain_som_key = self.CheckSomKeyStatus(target_dev)
+    try:
+      contain_som_key = self._ProbeState(
+          target_dev, DeviceInfo.STATE_SOM_KEY,
+          lambda: self._ProbeSomKey(target_dev))
+    except (FastbootFailure, NoAlgorithmAvailableException, os.error):
+      # If some command fail while trying to check som key status, we assume
+      # som key is not there
+      contain_som_key = False
 
     if contain_som_key:
       new_provision_state.som_provisioned = True
@@ -758,7 +1044,25 @@ class AtftManager(object):
     Return:
       Whether contains som key.
     """
+    try:
+      return self._ProbeSomKey(target_dev)
+    except (FastbootFailure, NoAlgorithmAvailableException, os.error):
+      # If some command fail while trying to check som key status, we assume
+      # som key is not there
+      return False
+
+  def _ProbeSomKey(self, target_dev):
+    """Checks whether the target device has som key.
 
+    Args:
+      target_dev: The target device (DeviceInfo).
+    Return:
+      Whether contains som key.
+    Raises:
+      FastbootFailure: When fastboot command fails.
+      NoAlgorithmAvailableException: When no algorithm is supported.
+      os.error: When the CA request cannot be read.
+    """
     tmp_file = tempfile.NamedTemporaryFile(delete=False)
     tmp_file.close()
     ca_request_file = tmp_file.name
@@ -774,18 +1078,9 @@ class AtftManager(object):
       target_dev.Download(op_start_file)
       target_dev.Oem('at-get-ca-request')
       target_dev.Upload(ca_request_file)
-    except (FastbootFailure, NoAlgorithmAvailableException):
-      # If some command fail while trying to check som key status, we assume
-      # som key is not there
-      os.unlink(ca_request_file)
-      return False
-
-    try:
       file_size = os.path.getsize(ca_request_file)
-    except os.error:
+    finally:
       os.unlink(ca_request_file)
-      return False
-    os.unlink(ca_request_file)
     # cleartext header                            8
     # cleartext device ephemeral public key       33
     # cleartext GCM IV                            12
@@ -813,7 +1108,8 @@ class AtftManager(object):
     """Transfer content from a device to another device.
 
     Download file from one device and store it into a tmp file. Upload file from
-    the tmp file onto another device.
+    the tmp file onto another device. Devices that can transfer content from
+    memory skip the tmp file.
 
     Args:
       src: The source device to be copied from.
@@ -821,6 +1117,9 @@ class AtftManager(object):
     Raises:
       FastbootFailure: When fastboot command fails.
     """
+    if _SupportsContentTransfer(src) and _SupportsContentTransfer(dst):
+      dst.DownloadContent(src.UploadContent())
+      return
     # create a tmp folder
     tmp_folder = tempfile.mkdtemp()
     # temperate file name is a UUID based on host ID and current time.
@@ -879,21 +1178,26 @@ class AtftManager(object):
       AtftManager.CheckDevice(atfa)
       algorithm_list = self._GetAlgorithmList(target)
       algorithm = self._ChooseAlgorithm(algorithm_list)
-      # First half of the DH key exchange
-      if not is_som_key:
-        atfa.Oem('start-provisioning ' + str(algorithm))
-      else:
-        atfa.Oem('start-provisioning ' + str(algorithm) +
-                 ' ' + str(_OPERATIONS['ISSUE_SOM']))
-      self.TransferContent(atfa, target)
-      # Second half of the DH key exchange
-      target.Oem('at-get-ca-request')
-      self.TransferContent(target, atfa)
-      # Encrypt and transfer key bundle
-      atfa.Oem('finish-provisioning')
-      self.TransferContent(atfa, target)
+      # The ATFA keeps one provisioning session, so only the steps between
+      # start-provisioning and handing the key bundle to the target hold it.
+      # Another target can start while this one stores its key.
+      with self._atfa_dev_manager.provision_lock:
+        # First half of the DH key exchange
+        if not is_som_key:
+          atfa.Oem('start-provisioning ' + str(algorithm))
+        else:
+          atfa.Oem('start-provisioning ' + str(algorithm) +
+                   ' ' + str(_OPERATIONS['ISSUE_SOM']))
+        self.TransferContent(atfa, target)
+        # Second half of the DH key exchange
+        target.Oem('at-get-ca-request')
+        self.TransferContent(target, atfa)
+        # Encrypt and transfer key bundle
+        atfa.Oem('finish-provisioning')
+        self.TransferContent(atfa, target)
       # Provision the key on device
       target.Oem('at-set-ca-response')
+      AtftManager._InvalidateProvisionedState(target, is_som_key)
 
       # After a success provision, the status should be updated.
       self.CheckProvisionStatus(target)
@@ -908,6 +1212,141 @@ class AtftManager(object):
         target.provision_status = ProvisionStatus.SOM_PROVISION_FAILED
       raise e
 
+  def ProvisionBatch(self, targets, is_som_key):
+    """Provision keys to several target devices with batched ATFA commands.
+
+    If the ATFA supports batches, the targets are grouped by algorithm and
+    each group of up to the ATFA batch size shares one start-provisioning
+    and one finish-provisioning, each with a single upload or download
+    to the ATFA. The finish reply also carries the number of keys left.
+    Otherwise each target is provisioned with Provision.
+
+    A failure on one target does not stop the others. The provision status
+    of each target tells whether it succeeded.
+
+    Args:
+      targets: The target devices to be provisioned to.
+      is_som_key: Whether provision som key (or product key).
+    Raises:
+      DeviceNotFoundException: When the ATFA is not available.
+      FastbootFailure: When fastboot command fails for any target. The
+        messages for all the failed targets are joined.
+    """
+    atfa = self._atfa_dev_manager.GetATFADevice()
+    AtftManager.CheckDevice(atfa)
+    batch_size = self._atfa_dev_manager.GetBatchSize()
+    failures = []
+    if batch_size < 2 or len(targets) < 2:
+      for target in targets:
+        try:
+          self.Provision(target, is_som_key)
+        except FastbootFailure as e:
+          failures.append(e)
+        except NoAlgorithmAvailableException:
+          AtftManager._SetProvisionFailed(target, is_som_key)
+          failures.append(AtftManager._NoAlgorithmFailure(target))
+    else:
+      groups = {}
+      for target in targets:
+        try:
+          algorithm = self._ChooseAlgorithm(self._GetAlgorithmList(target))
+          groups.setdefault(algorithm, []).append(target)
+        except FastbootFailure as e:
+          AtftManager._SetProvisionFailed(target, is_som_key)
+          failures.append(e)
+        except NoAlgorithmAvailableException:
+          AtftManager._SetProvisionFailed(target, is_som_key)
+          failures.append(AtftManager._NoAlgorithmFailure(target))
+      for algorithm, group in groups.items():
+        for i in range(0, len(group), batch_size):
+          failures += self._ProvisionChunk(
+              atfa, group[i:i + batch_size], algorithm, is_som_key)
+
+    if failures:
+      raise FastbootFailure('\n'.join(e.msg for e in failures))
+
+  def _ProvisionChunk(self, atfa, targets, algorithm, is_som_key):
+    """Provision one batch of targets that use the same algorithm.
+
+    Args:
+      atfa: The ATFA device.
+      targets: The target devices, no more than the ATFA batch size.
+      algorithm: The encryption algorithm for all the targets.
+      is_som_key: Whether provision som key (or product key).
+    Returns:
+      The list of FastbootFailure for the targets that failed.
+    Raises:
+      DeviceNotFoundException: When the ATFA is not available.
+    """
+    for target in targets:
+      if not is_som_key:
+        target.provision_status = ProvisionStatus.PROVISION_IN_PROGRESS
+      else:
+        target.provision_status = ProvisionStatus.SOM_PROVISION_IN_PROGRESS
+
+    failures = []
+    ca_requests = []
+    try:
+      with self._atfa_dev_manager.provision_lock:
+        operation_starts = self._atfa_dev_manager.StartProvisioningBatch(
+            algorithm, len(targets), is_som_key)
+        for target, operation_start in zip(targets, operation_starts):
+          try:
+            _DownloadContent(target, operation_start)
+            target.Oem('at-get-ca-request')
+            ca_requests.append(_UploadContent(target))
+          except FastbootFailure as e:
+            AtftManager._SetProvisionFailed(target, is_som_key)
+            failures.append(e)
+            ca_requests.append(bytearray())
+        ca_responses = self._atfa_dev_manager.FinishProvisioningBatch(
+            ca_requests)
+    except (FastbootFailure, DeviceNotFoundException) as e:
+      for target in targets:
+        AtftManager._SetProvisionFailed(target, is_som_key)
+      if isinstance(e, DeviceNotFoundException):
+        raise e
+      return [e]
+
+    for target, ca_request, ca_response in zip(
+        targets, ca_requests, ca_responses):
+      if not ca_request:
+        continue
+      try:
+        if not ca_response:
+          raise FastbootFailure('No key issued for ' + str(target))
+        _DownloadContent(target, ca_response)
+        target.Oem('at-set-ca-response')
+        AtftManager._InvalidateProvisionedState(target, is_som_key)
+        self.CheckProvisionStatus(target)
+        if not is_som_key and not target.provision_state.product_provisioned:
+          raise FastbootFailure('Status not updated.')
+        if is_som_key and not target.provision_state.som_provisioned:
+          raise FastbootFailure('Status not updated.')
+      except FastbootFailure as e:
+        AtftManager._SetProvisionFailed(target, is_som_key)
+        failures.append(e)
+    return failures
+
+  @staticmethod
+  def _NoAlgorithmFailure(target):
+    return FastbootFailure(
+        'No available algorithm for ' + str(target.serial_number))
+
+  @staticmethod
+  def _InvalidateProvisionedState(target, is_som_key):
+    if not is_som_key:
+      target.InvalidateState(DeviceInfo.STATE_ATTEST_UUID)
+    else:
+      target.InvalidateState(DeviceInfo.STATE_SOM_KEY)
+
+  @staticmethod
+  def _SetProvisionFailed(target, is_som_key):
+    if not is_som_key:
+      target.provision_status = ProvisionStatus.PROVISION_FAILED
+    else:
+      target.provision_status = ProvisionStatus.SOM_PROVISION_FAILED
+
   def FuseVbootKey(self, target):
     """Fuse the verified boot key to the target device.
 
@@ -936,6 +1375,7 @@ class AtftManager(object):
       # Delete the temporary file.
       os.remove(temp_file_name)
       target.Oem('fuse at-bootloader-vboot-key')
+      target.InvalidateState(DeviceInfo.STATE_VBOOT)
 
     except FastbootFailure as e:
       target.provision_status = ProvisionStatus.FUSEVBOOT_FAILED
@@ -962,6 +1402,7 @@ class AtftManager(object):
       target.Download(temp_file_name)
       os.remove(temp_file_name)
       target.Oem('fuse at-perm-attr')
+      target.InvalidateState(DeviceInfo.STATE_VBOOT)
 
       self.CheckProvisionStatus(target)
       if not target.provision_state.avb_perm_attr_set:
@@ -982,6 +1423,7 @@ class AtftManager(object):
     try:
       target.provision_status = ProvisionStatus.LOCKAVB_IN_PROGRESS
       target.Oem('at-lock-vboot')
+      target.InvalidateState(DeviceInfo.STATE_VBOOT)
       self.CheckProvisionStatus(target)
       if not target.provision_state.avb_locked:
         raise FastbootFailure('Status not updated')
@@ -1003,6 +1445,7 @@ class AtftManager(object):
       if self.UNLOCK_CREDENTIAL:
         unlock_command += ' ' + self.UNLOCK_CREDENTIAL
       target.Oem(unlock_command)
+      target.InvalidateState(DeviceInfo.STATE_VBOOT)
       self.CheckProvisionStatus(target)
       if target.provision_state.avb_locked:
         raise FastbootFailure('Status not updated')
@@ -1076,7 +1519,7 @@ class AtftManager(object):
     def RebootCallbackFunc(callback=callback, serial=serial, success=success):
       try:
         if success:
-          self._serial_mapper.refresh_serial_map()
+          self._RefreshSerialMap()
           new_target_device = self._CreateNewTargetDevice(serial, True)
           self.DeleteRebootingDevice(serial)
           self.target_devs.append(new_target_device)
@@ -1124,7 +1567,10 @@ class AtftManager(object):
       A list of available algorithms.
       Options are ALGORITHM_P256 or ALGORITHM_CURVE25519
     """
-    at_attest_dh = target.GetVar('at-attest-dh')
+    # The supported algorithms never change, so this is only queried once.
+    at_attest_dh = self._ProbeState(
+        target, DeviceInfo.STATE_ATTEST_DH,
+        lambda: target.GetVar('at-attest-dh'))
     if not at_attest_dh:
       return []
     algorithm_strings = at_attest_dh.split(',')
@@ -1260,13 +1706,84 @@ class AtfaDeviceManager(object):
         includes this atfa device manager.
     """
     self.atfa_dev = atfa_dev
+    # Held while a provisioning session is open on the ATFA.
+    self.provision_lock = threading.Lock()
+    # The number of keys the ATFA issues in one batch, None if not known yet.
+    self._batch_size = None
 
   def GetATFADevice(self):
     return self.atfa_dev
 
   def SetATFADevice(self, atfa_dev):
+    if atfa_dev is not self.atfa_dev:
+      self._batch_size = None
     self.atfa_dev = atfa_dev
 
+  def GetBatchSize(self):
+    """Get the number of keys the ATFA can issue in one batch.
+
+    The ATFA reports it in 'getvar batch-provisioning'. An ATFA that does not
+    know the variable does not support batches.
+
+    Returns:
+      The batch size, 0 if batches are not supported.
+    Raises:
+      DeviceNotFoundException: When the device is not found.
+    """
+    AtftManager.CheckDevice(self.atfa_dev)
+    if self._batch_size is None:
+      try:
+        self._batch_size = int(self.atfa_dev.GetVar('batch-provisioning'))
+      except (FastbootFailure, TypeError, ValueError):
+        self._batch_size = 0
+    return self._batch_size
+
+  def StartProvisioningBatch(self, algorithm, count, is_som_key):
+    """Start several provisioning sessions on the ATFA at once.
+
+    Args:
+      algorithm: The encryption algorithm for all the sessions.
+      count: The number of sessions.
+      is_som_key: Whether the sessions issue som keys (or product keys).
+    Returns:
+      The list of operation start messages, one per session.
+    Raises:
+      DeviceNotFoundException: When the device is not found.
+      FastbootFailure: When fastboot command fails.
+    """
+    AtftManager.CheckDevice(self.atfa_dev)
+    command = 'start-provisioning-batch ' + str(algorithm) + ' ' + str(count)
+    if is_som_key:
+      command += ' ' + str(_OPERATIONS['ISSUE_SOM'])
+    self.atfa_dev.Oem(command)
+    operation_starts, _ = _UnpackBatch(_UploadContent(self.atfa_dev), count)
+    return operation_starts
+
+  def FinishProvisioningBatch(self, ca_requests):
+    """Finish the sessions opened by StartProvisioningBatch.
+
+    The reply also updates the cached number of keys left, so there is no
+    need to call UpdateKeysLeft afterwards.
+
+    Args:
+      ca_requests: The list of CA requests, in the order of the operation
+        start messages. An empty request ends its session without a key.
+    Returns:
+      The list of CA responses. The response is empty if no key was issued.
+    Raises:
+      DeviceNotFoundException: When the device is not found.
+      FastbootFailure: When fastboot command fails.
+    """
+    AtftManager.CheckDevice(self.atfa_dev)
+    _DownloadContent(self.atfa_dev, _PackBatch(ca_requests))
+    self.atfa_dev.Oem('finish-provisioning-batch')
+    reply = _UploadContent(self.atfa_dev)
+    ca_responses, index = _UnpackBatch(reply, len(ca_requests))
+    if index + _VAR_LEN != len(reply):
+      raise FastbootFailure('ATFA device response has invalid format')
+    self.atfa_dev.keys_left = _GetVarLen(reply, index)
+    return ca_responses
+
   def GetCachedKeysLeft(self):
     if not self.atfa_dev:
       return None
@@ -1396,3 +1913,260 @@ class AtfaDeviceManager(object):
     """
     AtftManager.CheckDevice(self.atfa_dev)
     self.atfa_dev.Oem(file_type)
+
+
+class ProvisionPipeline(object):
+  """Runs the provisioning steps for many target devices at the same time.
+
+  Each submitted device runs the provision steps in order on its own thread,
+  skipping the steps its provision state shows are done. A step only starts
+  once one of its slots is free, so one device can fuse its vboot key or lock
+  AVB while another exchanges keys with the ATFA. AtftManager.Provision only
+  holds the ATFA for the key exchange itself, so with more than one
+  provisioning slot the next device asks for its CA request while the
+  previous one stores its key. atft runs auto provisioning through a
+  pipeline if the 'PIPELINE_PROVISION' config is set.
+
+  Attributes:
+    finished_count: The number of devices that finished all the steps.
+    failed_count: The number of devices that stopped at a failed step.
+  """
+  # The steps a pipeline can run. These are the names used in PROVISION_STEPS.
+  STEPS = ['FuseVbootKey', 'FusePermAttr', 'LockAvb', 'UnlockAvb',
+           'ProvisionProduct', 'ProvisionSom']
+  # The number of devices that may be in one step at the same time.
+  DEFAULT_STAGE_LIMIT = 4
+
+  def __init__(self, atft_manager, provision_steps, reboot_timeout,
+               device_list_lock=None, success_callback=None,
+               failure_callback=None, clock=time.time):
+    """Initialize a pipeline.
+
+    Args:
+      atft_manager: The AtftManager for the devices.
+      provision_steps: The list of steps each device runs, see STEPS.
+      reboot_timeout: How long to wait for a device to come back after the
+        reboot that follows FuseVbootKey.
+      device_list_lock: The lock held while the target device list changes,
+        which is also held while listing devices.
+      success_callback: Called with the target after it finished all steps.
+      failure_callback: Called with the target, the step and the exception
+        when a step fails.
+      clock: The function returning the current time in seconds.
+    """
+    self._atft_manager = atft_manager
+    self._provision_steps = provision_steps
+    self._reboot_timeout = reboot_timeout
+    if not device_list_lock:
+      device_list_lock = threading.Lock()
+    self._device_list_lock = device_list_lock
+    self._success_callback = success_callback
+    self._failure_callback = failure_callback
+    self._clock = clock
+    self._stage_slots = {}
+    for step in self.STEPS:
+      limit = atft_manager.PIPELINE_STAGE_LIMITS.get(
+          step, self.DEFAULT_STAGE_LIMIT)
+      self._stage_slots[step] = threading.BoundedSemaphore(max(limit, 1))
+    # Protects the fields below.
+    self._lock = threading.Lock()
+    self._threads = {}
+    self._stopped = False
+    self._start_time = None
+    self._last_finish_time = None
+    self._stage_counts = dict((step, 0) for step in self.STEPS)
+    self.finished_count = 0
+    self.failed_count = 0
+
+  def Submit(self, target):
+    """Start running the provision steps for a target device.
+
+    Args:
+      target: The target device (DeviceInfo).
+    Returns:
+      False if the device is already in the pipeline or the pipeline is
+      stopped, otherwise True.
+    """
+    serial = target.serial_number
+    with self._lock:
+      if self._stopped or serial in self._threads:
+        return False
+      if self._start_time is None:
+        self._start_time = self._clock()
+      target.provision_status = ProvisionStatus.WAITING
+      thread = threading.Thread(target=self._RunDevice, args=(serial,))
+      thread.daemon = True
+      self._threads[serial] = thread
+    thread.start()
+    return True
+
+  def IsRunning(self, serial):
+    with self._lock:
+      return serial in self._threads
+
+  def Stop(self):
+    """Stop starting new steps. Steps that already started still finish."""
+    with self._lock:
+      self._stopped = True
+
+  def Join(self):
+    """Wait for all the submitted devices to stop."""
+    while True:
+      with self._lock:
+        threads = list(self._threads.values())
+      if not threads:
+        return
+      for thread in threads:
+        thread.join()
+
+  def GetDevicesPerHour(self):
+    """Get the number of devices finishing all steps per hour so far."""
+    with self._lock:
+      return self._PerHour(self.finished_count)
+
+  def GetStageDevicesPerHour(self):
+    """Get the number of devices finishing each step per hour so far.
+
+    Returns:
+      A map from the step name to the devices per hour.
+    """
+    with self._lock:
+      return dict((step, self._PerHour(count))
+                  for step, count in self._stage_counts.items())
+
+  def _PerHour(self, count):
+    if not count or self._start_time is None:
+      return 0.0
+    elapsed = self._last_finish_time - self._start_time
+    if elapsed <= 0:
+      return 0.0
+    return count * 3600.0 / elapsed
+
+  def _RunDevice(self, serial):
+    """Run the provision steps for one device.
+
+    The target is looked up again before each step since the DeviceInfo is
+    replaced when the device reboots.
+
+    Args:
+      serial: The serial number for the target device.
+    """
+    failed = False
+    target = None
+    try:
+      for step in self._provision_steps:
+        with self._lock:
+          if self._stopped:
+            return
+        target = self._atft_manager.GetTargetDevice(serial)
+        if not target or ProvisionStatus.isFailed(target.provision_status):
+          failed = True
+          return
+        if not ProvisionPipeline._IsStepNeeded(target.provision_state, step):
+          continue
+        try:
+          with self._stage_slots[step]:
+            with target.operation_lock:
+              target.operation = step
+              try:
+                target = self._RunStep(target, step)
+              finally:
+                target.operation = None
+        except (DeviceNotFoundException, FastbootFailure,
+                ProductNotSpecifiedException) as e:
+          failed = True
+          if self._failure_callback:
+            self._failure_callback(target, step, e)
+          return
+        with self._lock:
+          self._stage_counts[step] += 1
+          self._last_finish_time = self._clock()
+      with self._lock:
+        self.finished_count += 1
+        self._last_finish_time = self._clock()
+      if self._success_callback:
+        self._success_callback(target)
+    finally:
+      with self._lock:
+        if failed:
+          self.failed_count += 1
+        del self._threads[serial]
+
+  @staticmethod
+  def _IsStepNeeded(provision_state, step):
+    if step == 'FuseVbootKey':
+      return not provision_state.bootloader_locked
+    elif step == 'FusePermAttr':
+      return not provision_state.avb_perm_attr_set
+    elif step == 'LockAvb':
+      return not provision_state.avb_locked
+    elif step == 'UnlockAvb':
+      return provision_state.avb_locked
+    elif step == 'ProvisionProduct':
+      return not provision_state.product_provisioned
+    elif step == 'ProvisionSom':
+      return not provision_state.som_provisioned
+    return False
+
+  def _RunStep(self, target, step):
+    """Run one provision step on a target device.
+
+    Args:
+      target: The target device (DeviceInfo).
+      step: The step name.
+    Returns:
+      The target device, which is a new DeviceInfo if the step rebooted it.
+    Raises:
+      DeviceNotFoundException: When the ATFA is not available.
+      FastbootFailure: When fastboot command fails.
+      ProductNotSpecifiedException: When product is not specified.
+    """
+    if step == 'FuseVbootKey':
+      self._atft_manager.FuseVbootKey(target)
+      return self._RebootAndWait(target)
+    elif step == 'FusePermAttr':
+      self._atft_manager.FusePermAttr(target)
+    elif step == 'LockAvb':
+      self._atft_manager.LockAvb(target)
+    elif step == 'UnlockAvb':
+      self._atft_manager.UnlockAvb(target)
+    elif step == 'ProvisionProduct':
+      self._atft_manager.Provision(target, False)
+    elif step == 'ProvisionSom':
+      self._atft_manager.Provision(target, True)
+    return target
+
+  def _RebootAndWait(self, target):
+    """Reboot the target after fusing the vboot key and wait for it.
+
+    The device comes back when the device list is refreshed, or the reboot
+    times out.
+
+    Args:
+      target: The target device (DeviceInfo).
+    Returns:
+      The new DeviceInfo for the target.
+    Raises:
+      FastbootFailure: When fastboot command fails, the reboot times out or
+        the bootloader is not locked after the reboot.
+    """
+    serial = target.serial_number
+    rebooted = threading.Event()
+    result = {'success': False}
+
+    def SuccessCallback():
+      result['success'] = True
+      rebooted.set()
+
+    with self._device_list_lock:
+      self._atft_manager.Reboot(
+          target, self._reboot_timeout, SuccessCallback, rebooted.set)
+    rebooted.wait()
+
+    new_target = self._atft_manager.GetTargetDevice(serial)
+    if not result['success'] or not new_target:
+      raise FastbootFailure('Reboot Failed! Timeout!')
+    if not new_target.provision_state.bootloader_locked:
+      new_target.provision_status = ProvisionStatus.FUSEVBOOT_FAILED
+      raise FastbootFailure('Status not updated.')
+    return new_target
@@ -14,12 +14,14 @@
 
 """Unit test for atft manager."""
 import base64
+import threading
 import unittest
 
 import atftman
 
 from atftman import EncryptionAlgorithm
 from atftman import ProductInfo
+from atftman import ProvisionPipeline
 from atftman import ProvisionState
 from atftman import ProvisionStatus
 from atftman import SomInfo
@@ -579,6 +581,38 @@ class AtftManTest(unittest.TestCase):
     # we should have no temporary file at the end
     self.assertTrue(not files)
 
+  def testTransferContentInMemory(self):
+    atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
+                                       self.mock_serial_mapper, self.configs)
+    src_controller = MagicMock()
+    src_controller.UploadContent.return_value = bytearray(b'content')
+    dst_controller = MagicMock()
+    src = atftman.DeviceInfo(src_controller, self.TEST_SERIAL)
+    dst = atftman.DeviceInfo(dst_controller, self.TEST_SERIAL2)
+    atft_manager.TransferContent(src, dst)
+    dst_controller.DownloadContent.assert_called_once_with(
+        bytearray(b'content'))
+    src_controller.Upload.assert_not_called()
+    dst_controller.Download.assert_not_called()
+
+  def testTransferContentWithoutContentTransfer(self):
+    atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
+                                       self.mock_serial_mapper, self.configs)
+    src_controller = MagicMock()
+    # The destination controller only transfers through files.
+    dst_controller = MagicMock(spec=['Download'])
+    src = atftman.DeviceInfo(src_controller, self.TEST_SERIAL)
+    dst = atftman.DeviceInfo(dst_controller, self.TEST_SERIAL2)
+    self.assertTrue(src.SupportsContentTransfer())
+    self.assertFalse(dst.SupportsContentTransfer())
+    atft_manager.TransferContent(src, dst)
+    # A single temporary file is shared by the upload and the download.
+    src_controller.UploadContent.assert_not_called()
+    src_controller.Upload.assert_called_once()
+    tmp_path = src_controller.Upload.call_args[0][0]
+    dst_controller.Download.assert_called_once_with(tmp_path)
+    self.assertFalse(os.path.exists(tmp_path))
+
   # Test AtftManager._ChooseAlgorithm
   def testChooseAlgorithm(self):
     atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
@@ -865,6 +899,101 @@ class AtftManTest(unittest.TestCase):
     self.assertEqual(ProvisionStatus.FUSEVBOOT_SUCCESS,
                      mock_device.provision_status)
 
+  def CreateCachedTarget(self):
+    self.status_map = {}
+    self.status_map['at-vboot-state'] = (
+        '(bootloader) bootloader-locked: 1\n'
+        '(bootloader) avb-perm-attr-set: 1\n'
+        '(bootloader) avb-locked: 0\n')
+    self.status_map['at-attest-uuid'] = ''
+    self.status_map['at-attest-dh'] = '1:p256'
+    controller = MagicMock()
+    controller.GetVar.side_effect = self.MockGetVar
+    target = atftman.DeviceInfo(
+        controller, self.TEST_SERIAL, provision_state=ProvisionState())
+    return target, controller
+
+  def testCheckProvisionStatusCached(self):
+    atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
+                                       self.mock_serial_mapper, self.configs)
+    atft_manager._ProbeSomKey = MagicMock()
+    atft_manager._ProbeSomKey.return_value = False
+    target, controller = self.CreateCachedTarget()
+    atft_manager.CheckProvisionStatus(target)
+    atft_manager.CheckProvisionStatus(target)
+    self.assertEqual(
+        [call('at-vboot-state'), call('at-attest-uuid')],
+        controller.GetVar.call_args_list)
+    atft_manager._ProbeSomKey.assert_called_once_with(target)
+    self.assertEqual(
+        ProvisionStatus.FUSEATTR_SUCCESS, target.provision_status)
+
+  def testLockAvbInvalidatesVbootState(self):
+    atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
+                                       self.mock_serial_mapper, self.configs)
+    atft_manager._ProbeSomKey = MagicMock()
+    atft_manager._ProbeSomKey.return_value = False
+    target, controller = self.CreateCachedTarget()
+    atft_manager.CheckProvisionStatus(target)
+    controller.GetVar.reset_mock()
+    self.status_map['at-vboot-state'] = (
+        '(bootloader) bootloader-locked: 1\n'
+        '(bootloader) avb-perm-attr-set: 1\n'
+        '(bootloader) avb-locked: 1\n')
+    atft_manager.LockAvb(target)
+    # Only the state changed by the operation is queried again.
+    controller.GetVar.assert_called_once_with('at-vboot-state')
+    atft_manager._ProbeSomKey.assert_called_once_with(target)
+    self.assertEqual(
+        ProvisionStatus.LOCKAVB_SUCCESS, target.provision_status)
+
+  def testRebootInvalidatesState(self):
+    atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
+                                       self.mock_serial_mapper, self.configs)
+    atft_manager._ProbeSomKey = MagicMock()
+    atft_manager._ProbeSomKey.return_value = False
+    target, controller = self.CreateCachedTarget()
+    atft_manager._GetAlgorithmList(target)
+    atft_manager._GetAlgorithmList(target)
+    atft_manager.CheckProvisionStatus(target)
+    target.Reboot()
+    self.assertEqual({}, target.state_cache)
+    atft_manager.CheckProvisionStatus(target)
+    self.assertEqual(
+        [call('at-attest-dh'), call('at-vboot-state'), call('at-attest-uuid'),
+         call('at-vboot-state'), call('at-attest-uuid')],
+        controller.GetVar.call_args_list)
+    self.assertEqual(2, atft_manager._ProbeSomKey.call_count)
+
+  def testCheckProvisionStatusFailedProbeNotCached(self):
+    atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
+                                       self.mock_serial_mapper, self.configs)
+    atft_manager._ProbeSomKey = MagicMock()
+    atft_manager._ProbeSomKey.side_effect = [
+        FastbootFailure(''), True]
+    target, controller = self.CreateCachedTarget()
+    controller.GetVar.side_effect = [
+        self.status_map['at-vboot-state'],
+        FastbootFailure(''),
+        self.TEST_UUID]
+    atft_manager.CheckProvisionStatus(target)
+    self.assertNotIn(atftman.DeviceInfo.STATE_ATTEST_UUID, target.state_cache)
+    self.assertNotIn(atftman.DeviceInfo.STATE_SOM_KEY, target.state_cache)
+    self.assertFalse(target.provision_state.product_provisioned)
+    self.assertFalse(target.provision_state.som_provisioned)
+    # The failed probes are retried and their results cached this time.
+    atft_manager.CheckProvisionStatus(target)
+    self.assertEqual(
+        [call('at-vboot-state'), call('at-attest-uuid'),
+         call('at-attest-uuid')],
+        controller.GetVar.call_args_list)
+    self.assertEqual(2, atft_manager._ProbeSomKey.call_count)
+    self.assertEqual(
+        self.TEST_UUID, target.state_cache[atftman.DeviceInfo.STATE_ATTEST_UUID])
+    self.assertTrue(target.state_cache[atftman.DeviceInfo.STATE_SOM_KEY])
+    self.assertTrue(target.provision_state.product_provisioned)
+    self.assertTrue(target.provision_state.som_provisioned)
+
   def testCheckProvisionStatusFormat(self):
     atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
                                        self.mock_serial_mapper, self.configs)
@@ -1888,6 +2017,451 @@ class AtftManTest(unittest.TestCase):
     with self.assertRaises(ProductAttributesFileFormatError):
       atft_manager.ProcessAttributesFile(test_content)
 
+  # Test AtftManager.ProvisionBatch
+  class FakeBatchDevice(object):
+    """A device that keeps what was downloaded and uploads staged content."""
+
+    def __init__(self, serial_number):
+      self.serial_number = serial_number
+      self.downloaded = []
+      self.staged = bytearray()
+      self.oem_commands = []
+      self.oem_failures = {}
+      self.provision_status = ProvisionStatus.IDLE
+      self.provision_state = ProvisionState()
+
+    def Download(self, file_path):
+      with open(file_path, 'rb') as f:
+        self.downloaded.append(bytearray(f.read()))
+
+    def Upload(self, file_path):
+      with open(file_path, 'wb') as f:
+        f.write(self.staged)
+
+    def Oem(self, oem_command, err_to_out=False):
+      self.oem_commands.append(oem_command)
+      if oem_command in self.oem_failures:
+        raise self.oem_failures[oem_command]
+      if oem_command == 'at-get-ca-request':
+        self.staged = bytearray(b'request-' + self.serial_number.encode())
+
+    def InvalidateState(self, *states):
+      pass
+
+    def __str__(self):
+      return self.serial_number
+
+  def CreateBatchAtfa(self, atft_manager, serials):
+    atfa = self.FakeBatchDevice(self.ATFA_TEST_SERIAL)
+    atfa.GetVar = MagicMock()
+    atfa.GetVar.return_value = '4'
+    atfa_oem = atfa.Oem
+
+    def MockAtfaOem(oem_command, err_to_out=False):
+      atfa_oem(oem_command, err_to_out)
+      if oem_command.startswith('start-provisioning-batch'):
+        atfa.staged = atftman._PackBatch(
+            [bytearray(b'start-' + serial.encode()) for serial in serials])
+      elif oem_command == 'finish-provisioning-batch':
+        requests, _ = atftman._UnpackBatch(
+            atfa.downloaded[-1], len(serials))
+        responses = [
+            request.replace(b'request', b'response') for request in requests]
+        atfa.staged = atftman._PackBatch(responses) + bytearray(
+            b'\x07\x00\x00\x00')
+
+    atfa.Oem = MockAtfaOem
+    atft_manager._atfa_dev_manager.SetATFADevice(atfa)
+    return atfa
+
+  def testProvisionBatch(self):
+    atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
+                                       self.mock_serial_mapper, self.configs)
+    serials = [self.TEST_SERIAL, self.TEST_SERIAL2, self.TEST_SERIAL3]
+    atfa = self.CreateBatchAtfa(atft_manager, serials)
+    targets = [self.FakeBatchDevice(serial) for serial in serials]
+    atft_manager._GetAlgorithmList = MagicMock()
+    atft_manager._GetAlgorithmList.return_value = [
+        EncryptionAlgorithm.ALGORITHM_CURVE25519
+    ]
+    atft_manager.Provision = MagicMock()
+    atft_manager.CheckProvisionStatus = MagicMock()
+    atft_manager.CheckProvisionStatus.side_effect = self.MockSetProvisionSuccess
+
+    atft_manager.ProvisionBatch(targets, False)
+
+    atft_manager.Provision.assert_not_called()
+    self.assertEqual(
+        ['start-provisioning-batch ' +
+         str(EncryptionAlgorithm.ALGORITHM_CURVE25519) + ' 3',
+         'finish-provisioning-batch'], atfa.oem_commands)
+    for serial, target in zip(serials, targets):
+      self.assertEqual(
+          [bytearray(b'start-' + serial.encode()),
+           bytearray(b'response-' + serial.encode())], target.downloaded)
+      self.assertEqual(
+          ['at-get-ca-request', 'at-set-ca-response'], target.oem_commands)
+      self.assertEqual(
+          ProvisionStatus.PROVISION_SUCCESS, target.provision_status)
+    self.assertEqual(7, atft_manager.GetCachedATFAKeysLeft())
+
+  def testProvisionBatchTargetFailure(self):
+    atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
+                                       self.mock_serial_mapper, self.configs)
+    serials = [self.TEST_SERIAL, self.TEST_SERIAL2]
+    atfa = self.CreateBatchAtfa(atft_manager, serials)
+    targets = [self.FakeBatchDevice(serial) for serial in serials]
+    targets[0].oem_failures['at-get-ca-request'] = FastbootFailure('fail')
+    atft_manager._GetAlgorithmList = MagicMock()
+    atft_manager._GetAlgorithmList.return_value = [
+        EncryptionAlgorithm.ALGORITHM_P256
+    ]
+    atft_manager.CheckProvisionStatus = MagicMock()
+    atft_manager.CheckProvisionStatus.side_effect = self.MockSetProvisionSuccess
+
+    with self.assertRaises(FastbootFailure):
+      atft_manager.ProvisionBatch(targets, False)
+
+    # The failed target sends an empty request and gets nothing back.
+    requests, _ = atftman._UnpackBatch(atfa.downloaded[-1], 2)
+    self.assertEqual(
+        [bytearray(), bytearray(b'request-' + self.TEST_SERIAL2.encode())],
+        requests)
+    self.assertEqual(1, len(targets[0].downloaded))
+    self.assertEqual(
+        ProvisionStatus.PROVISION_FAILED, targets[0].provision_status)
+    self.assertEqual(
+        ProvisionStatus.PROVISION_SUCCESS, targets[1].provision_status)
+
+  def testProvisionBatchNoAlgorithm(self):
+    atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
+                                       self.mock_serial_mapper, self.configs)
+    serials = [self.TEST_SERIAL, self.TEST_SERIAL2, self.TEST_SERIAL3]
+    self.CreateBatchAtfa(atft_manager, serials[1:])
+    targets = [self.FakeBatchDevice(serial) for serial in serials]
+
+    def MockGetAlgorithmList(target):
+      if target is targets[0]:
+        return []
+      return [EncryptionAlgorithm.ALGORITHM_P256]
+
+    atft_manager._GetAlgorithmList = MagicMock()
+    atft_manager._GetAlgorithmList.side_effect = MockGetAlgorithmList
+    atft_manager.CheckProvisionStatus = MagicMock()
+    atft_manager.CheckProvisionStatus.side_effect = self.MockSetProvisionSuccess
+
+    with self.assertRaises(FastbootFailure) as e:
+      atft_manager.ProvisionBatch(targets, False)
+
+    self.assertIn('No available algorithm for ' + self.TEST_SERIAL,
+                  e.exception.msg)
+    self.assertEqual(
+        ProvisionStatus.PROVISION_FAILED, targets[0].provision_status)
+    self.assertEqual(
+        ProvisionStatus.PROVISION_SUCCESS, targets[1].provision_status)
+    self.assertEqual(
+        ProvisionStatus.PROVISION_SUCCESS, targets[2].provision_status)
+
+  def testProvisionBatchNotSupportedNoAlgorithm(self):
+    atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
+                                       self.mock_serial_mapper, self.configs)
+    mock_atfa = MagicMock()
+    mock_atfa.GetVar.side_effect = FastbootFailure('unknown variable')
+    atft_manager._atfa_dev_manager.SetATFADevice(mock_atfa)
+    targets = [MagicMock(), MagicMock()]
+    targets[0].serial_number = self.TEST_SERIAL
+    atft_manager.Provision = MagicMock()
+    atft_manager.Provision.side_effect = [
+        NoAlgorithmAvailableException(), None]
+
+    with self.assertRaises(FastbootFailure) as e:
+      atft_manager.ProvisionBatch(targets, False)
+
+    self.assertEqual(
+        'No available algorithm for ' + self.TEST_SERIAL, e.exception.msg)
+    atft_manager.Provision.assert_has_calls(
+        [call(targets[0], False), call(targets[1], False)])
+    self.assertEqual(
+        ProvisionStatus.PROVISION_FAILED, targets[0].provision_status)
+
+  def testProvisionBatchNotSupported(self):
+    atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
+                                       self.mock_serial_mapper, self.configs)
+    mock_atfa = MagicMock()
+    mock_atfa.GetVar.side_effect = FastbootFailure('unknown variable')
+    atft_manager._atfa_dev_manager.SetATFADevice(mock_atfa)
+    targets = [MagicMock(), MagicMock()]
+    atft_manager.Provision = MagicMock()
+
+    atft_manager.ProvisionBatch(targets, True)
+
+    atft_manager.Provision.assert_has_calls(
+        [call(targets[0], True), call(targets[1], True)])
+    mock_atfa.GetVar.assert_called_once_with('batch-provisioning')
+    mock_atfa.Oem.assert_not_called()
+
+  def testFinishProvisioningBatchInvalidFormat(self):
+    atfa = self.FakeBatchDevice(self.ATFA_TEST_SERIAL)
+    atfa_manager = atftman.AtfaDeviceManager(atfa)
+    # The reply is missing the number of keys left.
+    atfa.staged = atftman._PackBatch([bytearray(b'response')])
+    with self.assertRaises(FastbootFailure):
+      atfa_manager.FinishProvisioningBatch([bytearray(b'request')])
+    # The reply has fewer responses than requests.
+    atfa.staged = atftman._PackBatch([bytearray(b'response')]) + bytearray(4)
+    with self.assertRaises(FastbootFailure):
+      atfa_manager.FinishProvisioningBatch(
+          [bytearray(b'request'), bytearray(b'request')])
+
+  # Test AtftManager.StartHotplugWatcher
+  @patch('threading.Timer')
+  def testHotplugWatcher(self, mock_timer):
+    atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
+                                       self.mock_serial_mapper, self.configs)
+    mock_callback = MagicMock()
+    self.mock_serial_instance.start_hotplug_watcher.return_value = True
+
+    self.assertTrue(atft_manager.StartHotplugWatcher(mock_callback))
+    watcher_callback = (
+        self.mock_serial_instance.start_hotplug_watcher.call_args[0][0])
+
+    # An added device is listed now and again once it settles.
+    watcher_callback(self.TEST_SERIAL, self.TEST_LOCATION, True)
+    mock_callback.assert_called_once()
+    mock_timer.assert_called_once_with(
+        atft_manager.DEVICE_SETTLE_TIME, atft_manager._HandleHotplugTimer)
+    mock_timer.return_value.start.assert_called_once()
+    atft_manager._HandleHotplugTimer()
+    self.assertEqual(2, mock_callback.call_count)
+    mock_callback.reset_mock()
+
+    # A removed device is only listed now.
+    mock_timer.reset_mock()
+    watcher_callback(self.TEST_SERIAL, self.TEST_LOCATION, False)
+    mock_callback.assert_called_once()
+    mock_timer.assert_not_called()
+
+    # The serial mapper keeps the map up to date while the watcher runs.
+    atft_manager._RefreshSerialMap()
+    self.mock_serial_instance.refresh_serial_map.assert_not_called()
+
+    # Stopping the watcher cancels a pending call.
+    watcher_callback(self.TEST_SERIAL, self.TEST_LOCATION, True)
+    self.assertEqual(2, mock_callback.call_count)
+    atft_manager.StopHotplugWatcher()
+    self.mock_serial_instance.stop_hotplug_watcher.assert_called_once()
+    mock_timer.return_value.cancel.assert_called_once()
+    watcher_callback(self.TEST_SERIAL, self.TEST_LOCATION, True)
+    self.assertEqual(2, mock_callback.call_count)
+    atft_manager._RefreshSerialMap()
+    self.mock_serial_instance.refresh_serial_map.assert_called_once()
+
+  def testHotplugWatcherNotAvailable(self):
+    atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
+                                       self.mock_serial_mapper, self.configs)
+    self.mock_serial_instance.start_hotplug_watcher.return_value = False
+
+    self.assertFalse(atft_manager.StartHotplugWatcher(MagicMock()))
+    atft_manager._RefreshSerialMap()
+    self.mock_serial_instance.refresh_serial_map.assert_called_once()
+    atft_manager.StopHotplugWatcher()
+    self.mock_serial_instance.stop_hotplug_watcher.assert_not_called()
+
+  @patch('threading.Timer')
+  def testHotplugWatcherListPending(self, mock_timer):
+    atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
+                                       self.mock_serial_mapper, self.configs)
+    mock_callback = MagicMock()
+    self.mock_serial_instance.start_hotplug_watcher.return_value = True
+    atft_manager.StartHotplugWatcher(mock_callback)
+    atft_manager._fastboot_device_controller = MagicMock()
+    atft_manager._fastboot_device_controller.ListDevices.return_value = [
+        self.TEST_SERIAL]
+
+    # The device is pending after the first listing, so list again soon.
+    atft_manager.ListDevices()
+    self.assertEqual([self.TEST_SERIAL], atft_manager.pending_serials)
+    mock_timer.assert_called_once_with(
+        atft_manager.DEVICE_SETTLE_TIME, atft_manager._HandleHotplugTimer)
+
+    # Listing again while the call is pending does not start another timer.
+    atft_manager._fastboot_device_controller.ListDevices.return_value = [
+        self.TEST_SERIAL2]
+    atft_manager.ListDevices()
+    self.assertEqual([self.TEST_SERIAL2], atft_manager.pending_serials)
+    mock_timer.assert_called_once()
+
+    # Once it fires, the next listing with a pending device schedules the
+    # next call.
+    atft_manager._HandleHotplugTimer()
+    mock_callback.assert_called_once()
+    atft_manager._fastboot_device_controller.ListDevices.return_value = [
+        self.TEST_SERIAL]
+    atft_manager.ListDevices()
+    self.assertEqual([self.TEST_SERIAL], atft_manager.pending_serials)
+    self.assertEqual(2, mock_timer.call_count)
+
+  # Test ProvisionPipeline
+  def CreatePipelineManager(self, serials):
+    atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
+                                       self.mock_serial_mapper, self.configs)
+    for serial in serials:
+      atft_manager.target_devs.append(atftman.DeviceInfo(
+          MagicMock(), serial, self.TEST_LOCATION,
+          provision_state=ProvisionState()))
+    return atft_manager
+
+  def MockSetProvisioned(self, target, is_som_key):
+    target.provision_state = ProvisionState()
+    target.provision_state.avb_locked = True
+    target.provision_state.product_provisioned = True
+    target.provision_status = ProvisionStatus.PROVISION_SUCCESS
+
+  def testProvisionPipeline(self):
+    atft_manager = self.CreatePipelineManager(
+        [self.TEST_SERIAL, self.TEST_SERIAL2])
+    atft_manager.LockAvb = MagicMock()
+    atft_manager.Provision = MagicMock()
+    atft_manager.Provision.side_effect = self.MockSetProvisioned
+    mock_success = MagicMock()
+    mock_failure = MagicMock()
+    # The pipeline starts at 100s and every step finishes at 1900s.
+    clock = MagicMock()
+    clock.side_effect = [100] + [1900] * 6
+    pipeline = ProvisionPipeline(
+        atft_manager, ['LockAvb', 'ProvisionProduct'], 1,
+        success_callback=mock_success, failure_callback=mock_failure,
+        clock=clock)
+
+    self.assertEqual(0, pipeline.GetDevicesPerHour())
+    for device in atft_manager.target_devs:
+      self.assertTrue(pipeline.Submit(device))
+    pipeline.Join()
+
+    self.assertEqual(2, atft_manager.LockAvb.call_count)
+    atft_manager.Provision.assert_has_calls(
+        [call(atft_manager.target_devs[0], False),
+         call(atft_manager.target_devs[1], False)], any_order=True)
+    self.assertEqual(2, mock_success.call_count)
+    mock_failure.assert_not_called()
+    self.assertEqual(2, pipeline.finished_count)
+    self.assertEqual(0, pipeline.failed_count)
+    self.assertEqual(4.0, pipeline.GetDevicesPerHour())
+    stage_rates = pipeline.GetStageDevicesPerHour()
+    self.assertEqual(4.0, stage_rates['LockAvb'])
+    self.assertEqual(4.0, stage_rates['ProvisionProduct'])
+    self.assertEqual(0, stage_rates['FusePermAttr'])
+
+  def testProvisionPipelineSkipFinishedSteps(self):
+    atft_manager = self.CreatePipelineManager([self.TEST_SERIAL])
+    target = atft_manager.target_devs[0]
+    target.provision_state.avb_locked = True
+    atft_manager.LockAvb = MagicMock()
+    atft_manager.Provision = MagicMock()
+    atft_manager.Provision.side_effect = self.MockSetProvisioned
+    pipeline = ProvisionPipeline(
+        atft_manager, ['LockAvb', 'ProvisionProduct'], 1)
+
+    self.assertTrue(pipeline.Submit(target))
+    pipeline.Join()
+
+    atft_manager.LockAvb.assert_not_called()
+    atft_manager.Provision.assert_called_once_with(target, False)
+    self.assertEqual(1, pipeline.finished_count)
+
+  def testProvisionPipelineFailure(self):
+    atft_manager = self.CreatePipelineManager([self.TEST_SERIAL])
+    target = atft_manager.target_devs[0]
+    error = FastbootFailure('')
+    atft_manager.LockAvb = MagicMock()
+    atft_manager.LockAvb.side_effect = error
+    atft_manager.Provision = MagicMock()
+    mock_success = MagicMock()
+    mock_failure = MagicMock()
+    pipeline = ProvisionPipeline(
+        atft_manager, ['LockAvb', 'ProvisionProduct'], 1,
+        success_callback=mock_success, failure_callback=mock_failure)
+
+    self.assertTrue(pipeline.Submit(target))
+    pipeline.Join()
+
+    atft_manager.Provision.assert_not_called()
+    mock_success.assert_not_called()
+    mock_failure.assert_called_once_with(target, 'LockAvb', error)
+    self.assertEqual(0, pipeline.finished_count)
+    self.assertEqual(1, pipeline.failed_count)
+    self.assertFalse(pipeline.IsRunning(self.TEST_SERIAL))
+
+  def testProvisionPipelineOverlapsSteps(self):
+    # The second device locks AVB while the first is inside Provision.
+    atft_manager = self.CreatePipelineManager(
+        [self.TEST_SERIAL, self.TEST_SERIAL2])
+    first, second = atft_manager.target_devs
+    first.provision_state.avb_locked = True
+    in_provision = threading.Event()
+    second_locked = threading.Event()
+
+    def MockProvision(target, is_som_key):
+      in_provision.set()
+      self.assertTrue(second_locked.wait(5))
+      self.MockSetProvisioned(target, is_som_key)
+
+    def MockLockAvb(target):
+      self.assertTrue(in_provision.wait(5))
+      target.provision_state.avb_locked = True
+      second_locked.set()
+
+    atft_manager.Provision = MagicMock()
+    atft_manager.Provision.side_effect = MockProvision
+    atft_manager.LockAvb = MagicMock()
+    atft_manager.LockAvb.side_effect = MockLockAvb
+    atft_manager.PIPELINE_STAGE_LIMITS = {'ProvisionProduct': 1}
+    pipeline = ProvisionPipeline(
+        atft_manager, ['LockAvb', 'ProvisionProduct'], 1)
+
+    self.assertTrue(pipeline.Submit(first))
+    self.assertTrue(pipeline.Submit(second))
+    self.assertFalse(pipeline.Submit(second))
+    pipeline.Join()
+
+    self.assertEqual(2, pipeline.finished_count)
+    self.assertEqual(2, atft_manager.Provision.call_count)
+
+  def testProvisionPipelineStageLimit(self):
+    configs = dict(self.configs)
+    configs['PIPELINE_STAGE_LIMITS'] = {'LockAvb': '2'}
+    atft_manager = atftman.AtftManager(self.FastbootDeviceTemplate,
+                                       self.mock_serial_mapper, configs)
+    self.assertEqual({'LockAvb': 2}, atft_manager.PIPELINE_STAGE_LIMITS)
+    serials = [self.TEST_SERIAL, self.TEST_SERIAL2, self.TEST_SERIAL3]
+    for serial in serials:
+      atft_manager.target_devs.append(atftman.DeviceInfo(
+          MagicMock(), serial, self.TEST_LOCATION,
+          provision_state=ProvisionState()))
+    lock = threading.Lock()
+    running = {'now': 0, 'max': 0}
+    release = threading.Event()
+
+    def MockLockAvb(target):
+      with lock:
+        running['now'] += 1
+        running['max'] = max(running['max'], running['now'])
+        if running['max'] == 2:
+          release.set()
+      self.assertTrue(release.wait(5))
+      with lock:
+        running['now'] -= 1
+
+    atft_manager.LockAvb = MagicMock()
+    atft_manager.LockAvb.side_effect = MockLockAvb
+    pipeline = ProvisionPipeline(atft_manager, ['LockAvb'], 1)
+    for device in atft_manager.target_devs:
+      self.assertTrue(pipeline.Submit(device))
+    pipeline.Join()
+
+    self.assertEqual(2, running['max'])
+    self.assertEqual(3, pipeline.finished_count)
+
   # Test _AddNewAtfa
   def testAddNewAtfa(self):
     mock_fastboot = MagicMock()
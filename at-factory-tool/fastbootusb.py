@@ -0,0 +1,749 @@
+# Copyright 2018 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Fastboot Interface Implementation over libusb.
+
+Instead of starting a fastboot process for every command, this module talks
+the fastboot protocol to the device over libusb-1.0 through ctypes. One USB
+handle is kept open per device and reused for all the commands, and staged
+content is transferred from and to memory.
+"""
+# pylint: disable=invalid-name
+import ctypes
+import ctypes.util
+import os
+import sys
+import threading
+
+import fastboot_exceptions
+
+# The fastboot USB interface.
+FASTBOOT_CLASS = 0xFF
+FASTBOOT_SUBCLASS = 0x42
+FASTBOOT_PROTOCOL = 0x03
+
+LIBUSB_ENDPOINT_IN = 0x80
+LIBUSB_TRANSFER_TYPE_MASK = 0x03
+LIBUSB_TRANSFER_TYPE_BULK = 0x02
+LIBUSB_ERROR_TIMEOUT = -7
+
+# The response to a command is at most 256 bytes. Reads are a whole number of
+# high speed bulk packets.
+RESPONSE_BUFFER_SIZE = 512
+# The largest single bulk transfer for staged content.
+MAX_TRANSFER_SIZE = 1024 * 1024
+# Commands like at-get-ca-request may take a while on the device.
+USB_TIMEOUT_MS = 60000
+
+
+def _GetCurrentPath():
+  if getattr(sys, 'frozen', False):
+    # we are running in a bundle
+    path = sys._MEIPASS  # pylint: disable=protected-access
+  else:
+    # we are running in a normal Python environment
+    path = os.path.dirname(os.path.abspath(__file__))
+  return path
+
+
+def _ToStr(data):
+  if sys.version_info[0] < 3:
+    return str(data)
+  return bytes(data).decode('utf-8', 'replace')
+
+
+class libusb_device_descriptor(ctypes.Structure):
+  _fields_ = [
+      ('bLength', ctypes.c_uint8),
+      ('bDescriptorType', ctypes.c_uint8),
+      ('bcdUSB', ctypes.c_uint16),
+      ('bDeviceClass', ctypes.c_uint8),
+      ('bDeviceSubClass', ctypes.c_uint8),
+      ('bDeviceProtocol', ctypes.c_uint8),
+      ('bMaxPacketSize0', ctypes.c_uint8),
+      ('idVendor', ctypes.c_uint16),
+      ('idProduct', ctypes.c_uint16),
+      ('bcdDevice', ctypes.c_uint16),
+      ('iManufacturer', ctypes.c_uint8),
+      ('iProduct', ctypes.c_uint8),
+      ('iSerialNumber', ctypes.c_uint8),
+      ('bNumConfigurations', ctypes.c_uint8),
+  ]
+
+
+class libusb_endpoint_descriptor(ctypes.Structure):
+  _fields_ = [
+      ('bLength', ctypes.c_uint8),
+      ('bDescriptorType', ctypes.c_uint8),
+      ('bEndpointAddress', ctypes.c_uint8),
+      ('bmAttributes', ctypes.c_uint8),
+      ('wMaxPacketSize', ctypes.c_uint16),
+      ('bInterval', ctypes.c_uint8),
+      ('bRefresh', ctypes.c_uint8),
+      ('bSynchAddress', ctypes.c_uint8),
+      ('extra', ctypes.POINTER(ctypes.c_ubyte)),
+      ('extra_length', ctypes.c_int),
+  ]
+
+
+class libusb_interface_descriptor(ctypes.Structure):
+  _fields_ = [
+      ('bLength', ctypes.c_uint8),
+      ('bDescriptorType', ctypes.c_uint8),
+      ('bInterfaceNumber', ctypes.c_uint8),
+      ('bAlternateSetting', ctypes.c_uint8),
+      ('bNumEndpoints', ctypes.c_uint8),
+      ('bInterfaceClass', ctypes.c_uint8),
+      ('bInterfaceSubClass', ctypes.c_uint8),
+      ('bInterfaceProtocol', ctypes.c_uint8),
+      ('iInterface', ctypes.c_uint8),
+      ('endpoint', ctypes.POINTER(libusb_endpoint_descriptor)),
+      ('extra', ctypes.POINTER(ctypes.c_ubyte)),
+      ('extra_length', ctypes.c_int),
+  ]
+
+
+class libusb_interface(ctypes.Structure):
+  _fields_ = [
+      ('altsetting', ctypes.POINTER(libusb_interface_descriptor)),
+      ('num_altsetting', ctypes.c_int),
+  ]
+
+
+class libusb_config_descriptor(ctypes.Structure):
+  _fields_ = [
+      ('bLength', ctypes.c_uint8),
+      ('bDescriptorType', ctypes.c_uint8),
+      ('wTotalLength', ctypes.c_uint16),
+      ('bNumInterfaces', ctypes.c_uint8),
+      ('bConfigurationValue', ctypes.c_uint8),
+      ('iConfiguration', ctypes.c_uint8),
+      ('bmAttributes', ctypes.c_uint8),
+      ('MaxPower', ctypes.c_uint8),
+      ('interface', ctypes.POINTER(libusb_interface)),
+      ('extra', ctypes.POINTER(ctypes.c_ubyte)),
+      ('extra_length', ctypes.c_int),
+  ]
+
+
+def _LoadLibUsb():
+  """Load libusb-1.0 and declare the functions used here.
+
+  Returns:
+    The library, or None if it is not available.
+  """
+  if sys.platform.startswith('win'):
+    loader = ctypes.WinDLL
+    names = [os.path.join(_GetCurrentPath(), 'libusb-1.0.dll'),
+             'libusb-1.0.dll']
+  else:
+    loader = ctypes.CDLL
+    names = [os.path.join(_GetCurrentPath(), 'libusb-1.0.so'),
+             ctypes.util.find_library('usb-1.0'), 'libusb-1.0.so.0']
+  libusb = None
+  for name in names:
+    if not name:
+      continue
+    try:
+      libusb = loader(name)
+      break
+    except OSError:
+      continue
+  if not libusb:
+    return None
+
+  c_void_pp = ctypes.POINTER(ctypes.c_void_p)
+  libusb.libusb_init.argtypes = [c_void_pp]
+  libusb.libusb_get_device_list.argtypes = [
+      ctypes.c_void_p, ctypes.POINTER(c_void_pp)]
+  libusb.libusb_get_device_list.restype = ctypes.c_ssize_t
+  libusb.libusb_free_device_list.argtypes = [c_void_pp, ctypes.c_int]
+  libusb.libusb_free_device_list.restype = None
+  libusb.libusb_get_bus_number.argtypes = [ctypes.c_void_p]
+  libusb.libusb_get_bus_number.restype = ctypes.c_uint8
+  libusb.libusb_get_device_address.argtypes = [ctypes.c_void_p]
+  libusb.libusb_get_device_address.restype = ctypes.c_uint8
+  libusb.libusb_get_device_descriptor.argtypes = [
+      ctypes.c_void_p, ctypes.POINTER(libusb_device_descriptor)]
+  libusb.libusb_get_active_config_descriptor.argtypes = [
+      ctypes.c_void_p,
+      ctypes.POINTER(ctypes.POINTER(libusb_config_descriptor))]
+  libusb.libusb_free_config_descriptor.argtypes = [
+      ctypes.POINTER(libusb_config_descriptor)]
+  libusb.libusb_free_config_descriptor.restype = None
+  libusb.libusb_open.argtypes = [ctypes.c_void_p, c_void_pp]
+  libusb.libusb_close.argtypes = [ctypes.c_void_p]
+  libusb.libusb_close.restype = None
+  libusb.libusb_get_string_descriptor_ascii.argtypes = [
+      ctypes.c_void_p, ctypes.c_uint8, ctypes.POINTER(ctypes.c_ubyte),
+      ctypes.c_int]
+  libusb.libusb_claim_interface.argtypes = [ctypes.c_void_p, ctypes.c_int]
+  libusb.libusb_release_interface.argtypes = [ctypes.c_void_p, ctypes.c_int]
+  libusb.libusb_bulk_transfer.argtypes = [
+      ctypes.c_void_p, ctypes.c_ubyte, ctypes.POINTER(ctypes.c_ubyte),
+      ctypes.c_int, ctypes.POINTER(ctypes.c_int), ctypes.c_uint]
+  if hasattr(libusb, 'libusb_set_auto_detach_kernel_driver'):
+    libusb.libusb_set_auto_detach_kernel_driver.argtypes = [
+        ctypes.c_void_p, ctypes.c_int]
+
+  if libusb.libusb_init(None) != 0:
+    return None
+  return libusb
+
+
+class UsbTransport(object):
+  """The bulk endpoints of a claimed fastboot interface."""
+
+  def __init__(self, libusb, handle, interface_number, endpoint_in,
+               endpoint_out):
+    self._libusb = libusb
+    self._handle = handle
+    self._interface_number = interface_number
+    self._endpoint_in = endpoint_in
+    self._endpoint_out = endpoint_out
+
+  def Write(self, data):
+    """Write data to the device.
+
+    Args:
+      data: A bytearray, which is sent without copying, or bytes.
+    Raises:
+      FastbootFailure: When the transfer fails.
+    """
+    if not isinstance(data, bytearray):
+      data = bytearray(data)
+    offset = 0
+    while offset < len(data):
+      size = min(len(data) - offset, MAX_TRANSFER_SIZE)
+      chunk = (ctypes.c_ubyte * size).from_buffer(data, offset)
+      offset += self._Transfer(self._endpoint_out, chunk, size)
+
+  def ReadInto(self, buf, offset, size):
+    """Read up to size bytes from the device into buf at offset.
+
+    Args:
+      buf: The bytearray to read into.
+      offset: Where in buf to start.
+      size: The maximum number of bytes to read.
+    Returns:
+      The number of bytes read.
+    Raises:
+      FastbootFailure: When the transfer fails.
+    """
+    chunk = (ctypes.c_ubyte * size).from_buffer(buf, offset)
+    return self._Transfer(self._endpoint_in, chunk, size)
+
+  def _Transfer(self, endpoint, chunk, size):
+    transferred = ctypes.c_int(0)
+    result = self._libusb.libusb_bulk_transfer(
+        self._handle, endpoint, chunk, size, ctypes.byref(transferred),
+        USB_TIMEOUT_MS)
+    if result == LIBUSB_ERROR_TIMEOUT and transferred.value:
+      return transferred.value
+    if result != 0:
+      raise fastboot_exceptions.FastbootFailure(
+          'USB transfer failed: ' + str(result))
+    return transferred.value
+
+  def Close(self):
+    if self._handle:
+      self._libusb.libusb_release_interface(
+          self._handle, self._interface_number)
+      self._libusb.libusb_close(self._handle)
+      self._handle = None
+
+
+class FastbootConnection(object):
+  """The fastboot protocol over a transport.
+
+  Attributes:
+    lock: Held while a command is running, so there is only one command per
+      device at a time.
+  """
+
+  def __init__(self, transport):
+    self._transport = transport
+    self.lock = threading.Lock()
+
+  def Command(self, command):
+    """Run a command and wait for its final response.
+
+    Args:
+      command: The command string.
+    Returns:
+      The list of INFO messages and the OKAY message.
+    Raises:
+      FastbootFailure: When the device fails the command.
+    """
+    self._transport.Write(bytearray(command.encode('utf-8')))
+    info, kind, message = self._ReadResponse()
+    if kind != 'OKAY':
+      raise fastboot_exceptions.FastbootFailure(
+          'Unexpected response ' + kind + ' to ' + command)
+    return info, message
+
+  def Download(self, data):
+    """Stage data on the device.
+
+    Args:
+      data: The content, a bytearray is sent without copying.
+    Returns:
+      The list of INFO messages.
+    Raises:
+      FastbootFailure: When the device fails the command.
+    """
+    self._transport.Write(
+        bytearray(('download:%08x' % len(data)).encode('utf-8')))
+    info, kind, message = self._ReadResponse()
+    if kind != 'DATA' or int(message, 16) != len(data):
+      raise fastboot_exceptions.FastbootFailure(
+          'Unexpected response ' + kind + ' to download')
+    self._transport.Write(data)
+    more_info, kind, message = self._ReadResponse()
+    if kind != 'OKAY':
+      raise fastboot_exceptions.FastbootFailure(
+          'Unexpected response ' + kind + ' to download')
+    return info + more_info
+
+  def Upload(self):
+    """Read the content staged on the device.
+
+    Returns:
+      The content as a bytearray.
+    Raises:
+      FastbootFailure: When the device fails the command.
+    """
+    self._transport.Write(bytearray(b'upload'))
+    _, kind, message = self._ReadResponse()
+    if kind != 'DATA':
+      raise fastboot_exceptions.FastbootFailure(
+          'Unexpected response ' + kind + ' to upload')
+    size = int(message, 16)
+    data = bytearray(size)
+    offset = 0
+    while offset < size:
+      read = self._transport.ReadInto(
+          data, offset, min(size - offset, MAX_TRANSFER_SIZE))
+      if not read:
+        raise fastboot_exceptions.FastbootFailure('Upload is truncated')
+      offset += read
+    _, kind, message = self._ReadResponse()
+    if kind != 'OKAY':
+      raise fastboot_exceptions.FastbootFailure(
+          'Unexpected response ' + kind + ' to upload')
+    return data
+
+  def _ReadResponse(self):
+    """Read responses until one that is not INFO or TEXT.
+
+    Returns:
+      The list of INFO messages, the final response type and its message.
+    Raises:
+      FastbootFailure: When the response is FAIL. The message contains the
+        INFO messages and the failure like the fastboot tool prints them.
+    """
+    info = []
+    buf = bytearray(RESPONSE_BUFFER_SIZE)
+    while True:
+      size = self._transport.ReadInto(buf, 0, RESPONSE_BUFFER_SIZE)
+      response = _ToStr(buf[:size])
+      kind = response[:4]
+      message = response[4:]
+      if kind in ('INFO', 'TEXT'):
+        info.append(message)
+        continue
+      if kind == 'FAIL':
+        raise fastboot_exceptions.FastbootFailure(
+            FastbootConnection.FormatInfo(info) +
+            "FAILED (remote: '" + message + "')\n")
+      return info, kind, message
+
+  @staticmethod
+  def FormatInfo(info):
+    return ''.join('(bootloader) ' + message + '\n' for message in info)
+
+  def Close(self):
+    self._transport.Close()
+
+
+class UsbConnectionPool(object):
+  """Keeps one FastbootConnection open per fastboot USB device."""
+
+  def __init__(self, libusb):
+    self._libusb = libusb
+    self._lock = threading.Lock()
+    # Serial number -> FastbootConnection.
+    self._connections = {}
+    # (bus number, device address) -> serial number, for opened devices.
+    self._serials = {}
+
+  def ListSerials(self):
+    """Find the fastboot devices and open the new ones.
+
+    Devices already open are recognized by their bus number and address, so
+    they are not opened again to read their serial number.
+
+    Returns:
+      The list of serial numbers.
+    """
+    libusb = self._libusb
+    device_list = ctypes.POINTER(ctypes.c_void_p)()
+    count = libusb.libusb_get_device_list(None, ctypes.byref(device_list))
+    if count < 0:
+      raise fastboot_exceptions.FastbootFailure(
+          'Failed to list USB devices: ' + str(count))
+    with self._lock:
+      try:
+        present = {}
+        for i in range(count):
+          device = device_list[i]
+          key = (libusb.libusb_get_bus_number(device),
+                 libusb.libusb_get_device_address(device))
+          serial = self._serials.get(key)
+          if serial is None:
+            serial = self._Open(device)
+          if serial is not None:
+            present[key] = serial
+      finally:
+        libusb.libusb_free_device_list(device_list, 1)
+      for key in list(self._serials):
+        if key not in present:
+          self._CloseLocked(self._serials[key])
+      return sorted(present.values())
+
+  def Get(self, serial):
+    """Get the connection for a device, opening it if needed.
+
+    Raises:
+      FastbootFailure: When the device is not found.
+    """
+    with self._lock:
+      connection = self._connections.get(serial)
+    if connection:
+      return connection
+    self.ListSerials()
+    with self._lock:
+      connection = self._connections.get(serial)
+    if not connection:
+      raise fastboot_exceptions.FastbootFailure(
+          'Fastboot device not found: ' + serial)
+    return connection
+
+  def Close(self, serial):
+    """Close the connection for a device, for example after a reboot."""
+    with self._lock:
+      self._CloseLocked(serial)
+
+  def _CloseLocked(self, serial):
+    connection = self._connections.pop(serial, None)
+    if connection:
+      connection.Close()
+    for key in [key for key in self._serials if self._serials[key] == serial]:
+      del self._serials[key]
+
+  def _Open(self, device):
+    """Open a device if it has a fastboot interface.
+
+    Returns:
+      The serial number for the device, or None if it is not a fastboot
+      device or cannot be opened.
+    """
+    libusb = self._libusb
+    interface = self._FindFastbootInterface(device)
+    if not interface:
+      return None
+    interface_number, endpoint_in, endpoint_out = interface
+    descriptor = libusb_device_descriptor()
+    if libusb.libusb_get_device_descriptor(
+        device, ctypes.byref(descriptor)) != 0:
+      return None
+    handle = ctypes.c_void_p()
+    if libusb.libusb_open(device, ctypes.byref(handle)) != 0:
+      return None
+    serial_buffer = (ctypes.c_ubyte * 256)()
+    size = libusb.libusb_get_string_descriptor_ascii(
+        handle, descriptor.iSerialNumber, serial_buffer, 256)
+    if size <= 0:
+      libusb.libusb_close(handle)
+      return None
+    serial = _ToStr(bytearray(serial_buffer[:size]))
+    if hasattr(libusb, 'libusb_set_auto_detach_kernel_driver'):
+      libusb.libusb_set_auto_detach_kernel_driver(handle, 1)
+    if libusb.libusb_claim_interface(handle, interface_number) != 0:
+      libusb.libusb_close(handle)
+      return None
+    transport = UsbTransport(
+        libusb, handle, interface_number, endpoint_in, endpoint_out)
+    self._connections[serial] = FastbootConnection(transport)
+    self._serials[(libusb.libusb_get_bus_number(device),
+                   libusb.libusb_get_device_address(device))] = serial
+    return serial
+
+  def _FindFastbootInterface(self, device):
+    """Find the fastboot interface of a device.
+
+    Returns:
+      The interface number and the bulk in and out endpoint addresses, or
+      None if the device has no fastboot interface.
+    """
+    libusb = self._libusb
+    config = ctypes.POINTER(libusb_config_descriptor)()
+    if libusb.libusb_get_active_config_descriptor(
+        device, ctypes.byref(config)) != 0:
+      return None
+    try:
+      for i in range(config.contents.bNumInterfaces):
+        interface = config.contents.interface[i]
+        for j in range(interface.num_altsetting):
+          setting = interface.altsetting[j]
+          if (setting.bInterfaceClass != FASTBOOT_CLASS or
+              setting.bInterfaceSubClass != FASTBOOT_SUBCLASS or
+              setting.bInterfaceProtocol != FASTBOOT_PROTOCOL):
+            continue
+          endpoint_in = None
+          endpoint_out = None
+          for k in range(setting.bNumEndpoints):
+            endpoint = setting.endpoint[k]
+            if ((endpoint.bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) !=
+                LIBUSB_TRANSFER_TYPE_BULK):
+              continue
+            if endpoint.bEndpointAddress & LIBUSB_ENDPOINT_IN:
+              endpoint_in = endpoint.bEndpointAddress
+            else:
+              endpoint_out = endpoint.bEndpointAddress
+          if endpoint_in is not None and endpoint_out is not None:
+            return setting.bInterfaceNumber, endpoint_in, endpoint_out
+    finally:
+      libusb.libusb_free_config_descriptor(config)
+    return None
+
+
+_pool = None
+_pool_lock = threading.Lock()
+
+
+def _GetPool():
+  """Get the connection pool shared by all the devices.
+
+  Raises:
+    FastbootFailure: When libusb is not available.
+  """
+  global _pool
+  with _pool_lock:
+    if not _pool:
+      libusb = _LoadLibUsb()
+      if not libusb:
+        raise fastboot_exceptions.FastbootFailure('libusb is not available')
+      _pool = UsbConnectionPool(libusb)
+    return _pool
+
+
+def IsAvailable():
+  """Whether libusb can be loaded, so FastbootDevice can be used."""
+  try:
+    _GetPool()
+    return True
+  except fastboot_exceptions.FastbootFailure:
+    return False
+
+
+class FastbootDevice(object):
+  """An abstracted fastboot device object.
+
+  All the FastbootDevice objects for a serial number share one connection,
+  which stays open until the device reboots or goes away.
+
+  Attributes:
+    serial_number: The serial number of the fastboot device.
+  """
+
+  if sys.platform.startswith('win'):
+    HOST_OS = 'Windows'
+  else:
+    HOST_OS = 'Linux'
+
+  @staticmethod
+  def ListDevices():
+    """List all fastboot devices.
+
+    Returns:
+      A list of serial numbers for all the fastboot devices.
+    """
+    return _GetPool().ListSerials()
+
+  def __init__(self, serial_number):
+    """Initiate the fastboot device object.
+
+    Args:
+      serial_number: The serial number of the fastboot device.
+    """
+    self.serial_number = serial_number
+
+  def _Run(self, operation):
+    """Run an operation on the connection for this device.
+
+    If the transfer fails, the connection is closed so the next command opens
+    the device again.
+
+    Args:
+      operation: Called with the FastbootConnection.
+    Returns:
+      What the operation returns.
+    Raises:
+      FastbootFailure: If failure happens during the command.
+    """
+    pool = _GetPool()
+    connection = pool.Get(self.serial_number)
+    with connection.lock:
+      try:
+        return operation(connection)
+      except fastboot_exceptions.FastbootFailure as e:
+        if e.msg.startswith('USB transfer failed'):
+          pool.Close(self.serial_number)
+        raise e
+
+  def Reboot(self):
+    """Reboot the device into fastboot mode.
+
+    Returns:
+      The command output.
+    """
+    info, _ = self._Run(
+        lambda connection: connection.Command('reboot-bootloader'))
+    # The device comes back as a new USB device.
+    _GetPool().Close(self.serial_number)
+    return FastbootConnection.FormatInfo(info)
+
+  def Oem(self, oem_command, err_to_out=False):
+    """"Run an OEM command.
+
+    Args:
+      oem_command: The OEM command to run.
+      err_to_out: Unused, the messages are always in the result.
+    Returns:
+      The result message for the OEM command.
+    Raises:
+      FastbootFailure: If failure happens during the command.
+    """
+    info, _ = self._Run(
+        lambda connection: connection.Command('oem ' + oem_command))
+    return FastbootConnection.FormatInfo(info)
+
+  def Flash(self, partition, file_path):
+    """Flash a file to a partition.
+
+    Args:
+      file_path: The partition file to be flashed.
+      partition: The partition to be flashed.
+    Returns:
+      The output for the fastboot command required.
+    Raises:
+      FastbootFailure: If failure happens during the command.
+    """
+    with open(file_path, 'rb') as partition_file:
+      data = bytearray(partition_file.read())
+
+    def FlashOperation(connection):
+      info = connection.Download(data)
+      more_info, _ = connection.Command('flash:' + partition)
+      return info + more_info
+
+    return FastbootConnection.FormatInfo(self._Run(FlashOperation))
+
+  def UploadContent(self):
+    """Get the content staged on the fastboot device.
+
+    Returns:
+      The content as a bytearray.
+    Raises:
+      FastbootFailure: If failure happens during the command.
+    """
+    return self._Run(lambda connection: connection.Upload())
+
+  def DownloadContent(self, content):
+    """Stage content on the fastboot device.
+
+    Args:
+      content: The content, a bytearray is sent without copying.
+    Returns:
+      The output for the fastboot command required.
+    Raises:
+      FastbootFailure: If failure happens during the command.
+    """
+    return FastbootConnection.FormatInfo(
+        self._Run(lambda connection: connection.Download(content)))
+
+  def Upload(self, file_path):
+    """Pulls a file from the fastboot device to the local file system.
+
+    Args:
+      file_path: The file path of the file system
+        that the remote file would be pulled to.
+    Returns:
+      The output for the fastboot command required.
+    Raises:
+      FastbootFailure: If failure happens during the command.
+    """
+    content = self.UploadContent()
+    with open(file_path, 'wb') as content_file:
+      content_file.write(content)
+    return ''
+
+  def Download(self, file_path):
+    """Push a file from the file system to the fastboot device.
+
+    Args:
+      file_path: The file path of the file on the local file system
+        that would be pushed to fastboot device.
+    Returns:
+      The output for the fastboot command required.
+    Raises:
+      FastbootFailure: If failure happens during the command.
+    """
+    with open(file_path, 'rb') as content_file:
+      content = bytearray(content_file.read())
+    return self.DownloadContent(content)
+
+  def GetVar(self, var):
+    """Get a variable from the device.
+
+    Args:
+      var: The name of the variable.
+    Returns:
+      The value for the variable. For at-vboot-state, the state lines the
+      device sends followed by the value, as the fastboot tool prints them.
+    Raises:
+      FastbootFailure: If failure happens during the command.
+    """
+    info, value = self._Run(
+        lambda connection: connection.Command('getvar:' + var))
+    if var == 'at-vboot-state':
+      # For the result of vboot-state, it does not follow the standard.
+      return FastbootConnection.FormatInfo(info) + var + ': ' + value + '\n'
+    return value
+
+  @staticmethod
+  def GetHostOs():
+    return FastbootDevice.HOST_OS
+
+  def Disconnect(self):
+    """Disconnect from the fastboot device.
+
+    The connection is shared with the other objects for this device, so it
+    stays open until the device reboots or is unplugged.
+    """
+    pass
+
+  def __del__(self):
+    self.Disconnect()
@@ -0,0 +1,144 @@
+# Copyright 2018 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Unit test for fastboot interface over libusb."""
+import unittest
+
+import fastboot_exceptions
+import fastbootusb
+from mock import MagicMock
+from mock import patch
+
+
+class FakeTransport(object):
+  """A transport that replies with scripted responses."""
+
+  def __init__(self, responses):
+    self.responses = [bytearray(response) for response in responses]
+    self.written = []
+
+  def Write(self, data):
+    self.written.append(bytearray(data))
+
+  def ReadInto(self, buf, offset, size):
+    response = self.responses.pop(0)
+    size = min(size, len(response))
+    buf[offset:offset + size] = response[:size]
+    if size < len(response):
+      self.responses.insert(0, response[size:])
+    return size
+
+  def Close(self):
+    pass
+
+
+class FastbootUsbTest(unittest.TestCase):
+  TEST_SERIAL = 'TEST_SERIAL'
+  TEST_MESSAGE = 'TEST MESSAGE'
+
+  def CreateDevice(self, responses):
+    transport = FakeTransport(responses)
+    connection = fastbootusb.FastbootConnection(transport)
+    pool = MagicMock()
+    pool.Get.return_value = connection
+    patcher = patch('fastbootusb._GetPool')
+    mock_get_pool = patcher.start()
+    self.addCleanup(patcher.stop)
+    mock_get_pool.return_value = pool
+    return fastbootusb.FastbootDevice(self.TEST_SERIAL), transport, pool
+
+  # Test FastbootDevice.ListDevices
+  @patch('fastbootusb._GetPool')
+  def testListDevices(self, mock_get_pool):
+    mock_get_pool.return_value.ListSerials.return_value = [self.TEST_SERIAL]
+    self.assertEqual(
+        [self.TEST_SERIAL], fastbootusb.FastbootDevice.ListDevices())
+
+  # Test FastbootDevice.Oem
+  def testOem(self):
+    device, transport, _ = self.CreateDevice(
+        [b'INFOline1', b'INFOline2', b'OKAY'])
+    out = device.Oem('TEST COMMAND', False)
+    self.assertEqual([bytearray(b'oem TEST COMMAND')], transport.written)
+    self.assertEqual('(bootloader) line1\n(bootloader) line2\n', out)
+
+  def testOemFailure(self):
+    device, _, pool = self.CreateDevice(
+        [b'INFOline1', b'FAIL' + self.TEST_MESSAGE.encode()])
+    with self.assertRaises(fastboot_exceptions.FastbootFailure) as e:
+      device.Oem('TEST COMMAND', False)
+    self.assertEqual(
+        "(bootloader) line1\nFAILED (remote: '" + self.TEST_MESSAGE + "')\n",
+        str(e.exception))
+    # The device failed the command, the connection is still good.
+    pool.Close.assert_not_called()
+
+  def testOemTransferFailure(self):
+    device, transport, pool = self.CreateDevice([])
+    transport.Write = MagicMock()
+    transport.Write.side_effect = fastboot_exceptions.FastbootFailure(
+        'USB transfer failed: -4')
+    with self.assertRaises(fastboot_exceptions.FastbootFailure):
+      device.Oem('TEST COMMAND', False)
+    pool.Close.assert_called_once_with(self.TEST_SERIAL)
+
+  # Test FastbootDevice.GetVar
+  def testGetVar(self):
+    device, transport, _ = self.CreateDevice([b'OKAYvalue'])
+    self.assertEqual('value', device.GetVar('VAR1'))
+    self.assertEqual([bytearray(b'getvar:VAR1')], transport.written)
+
+  def testGetVarVbootState(self):
+    device, _, _ = self.CreateDevice(
+        [b'INFObootloader-locked: 1', b'INFOavb-locked: 0', b'OKAY'])
+    self.assertEqual(
+        '(bootloader) bootloader-locked: 1\n(bootloader) avb-locked: 0\n'
+        'at-vboot-state: \n', device.GetVar('at-vboot-state'))
+
+  # Test FastbootDevice.DownloadContent
+  def testDownloadContent(self):
+    device, transport, _ = self.CreateDevice([b'DATA00000004', b'OKAY'])
+    content = bytearray(b'\x01\x02\x03\x04')
+    device.DownloadContent(content)
+    self.assertEqual(
+        [bytearray(b'download:00000004'), content], transport.written)
+
+  def testDownloadContentWrongSize(self):
+    device, _, _ = self.CreateDevice([b'DATA00000002'])
+    with self.assertRaises(fastboot_exceptions.FastbootFailure):
+      device.DownloadContent(bytearray(4))
+
+  # Test FastbootDevice.UploadContent
+  def testUploadContent(self):
+    device, transport, _ = self.CreateDevice(
+        [b'DATA00000006', b'abc', b'def', b'OKAY'])
+    self.assertEqual(bytearray(b'abcdef'), device.UploadContent())
+    self.assertEqual([bytearray(b'upload')], transport.written)
+
+  def testUploadContentFailure(self):
+    device, _, _ = self.CreateDevice([b'FAIL' + self.TEST_MESSAGE.encode()])
+    with self.assertRaises(fastboot_exceptions.FastbootFailure):
+      device.UploadContent()
+
+  # Test FastbootDevice.Reboot
+  def testReboot(self):
+    device, transport, pool = self.CreateDevice([b'OKAY'])
+    device.Reboot()
+    self.assertEqual([bytearray(b'reboot-bootloader')], transport.written)
+    # The device comes back as a new USB device.
+    pool.Close.assert_called_once_with(self.TEST_SERIAL)
+
+
+if __name__ == '__main__':
+  unittest.main()
@@ -14,6 +14,13 @@
 
 """This module provides the serial number to USB location map on Linux."""
 import os
+import socket
+import threading
+
+# The netlink protocol and multicast group for kernel uevents.
+NETLINK_KOBJECT_UEVENT = 15
+UEVENT_KERNEL_GROUP = 1
+UEVENT_BUFFER_SIZE = 16384
 
 
 class SerialMapper(object):
@@ -23,10 +30,12 @@ class SerialMapper(object):
   USB devices. Use the serial file's content to create the map.
   """
 
+  SYS_PATH = '/sys'
   USB_DEVICES_PATH = '/sys/bus/usb/devices/'
 
   def __init__(self):
     self.serial_map = {}
+    self._watcher_socket = None
 
   def refresh_serial_map(self):
     """Refresh the serial_number -> USB location map.
@@ -64,3 +73,98 @@ class SerialMapper(object):
     if serial_lower in self.serial_map:
       return self.serial_map[serial_lower]
     return None
+
+  def start_hotplug_watcher(self, callback):
+    """Start watching the kernel uevents for USB devices.
+
+    The serial map is kept up to date from the uevents, so it does not need
+    to be refreshed while the watcher runs.
+
+    Args:
+      callback: Called as callback(serial, location, added) from the watcher
+        thread when a USB device with a serial number is added or removed.
+    Returns:
+      Whether the watcher is running. It does not run if netlink is not
+      available.
+    """
+    if self._watcher_socket:
+      return True
+    try:
+      watcher_socket = socket.socket(
+          socket.AF_NETLINK, socket.SOCK_DGRAM, NETLINK_KOBJECT_UEVENT)
+      watcher_socket.bind((0, UEVENT_KERNEL_GROUP))
+    except (AttributeError, socket.error):
+      return False
+    # Wake up now and then to see whether the watcher is stopped.
+    watcher_socket.settimeout(1.0)
+    self._watcher_socket = watcher_socket
+    self.refresh_serial_map()
+    thread = threading.Thread(
+        target=self._watch_uevents, args=(watcher_socket, callback))
+    thread.daemon = True
+    thread.start()
+    return True
+
+  def stop_hotplug_watcher(self):
+    """Stop the watcher started by start_hotplug_watcher."""
+    watcher_socket = self._watcher_socket
+    self._watcher_socket = None
+    if watcher_socket:
+      watcher_socket.close()
+
+  def _watch_uevents(self, watcher_socket, callback):
+    while self._watcher_socket is watcher_socket:
+      try:
+        data = watcher_socket.recv(UEVENT_BUFFER_SIZE)
+      except socket.timeout:
+        continue
+      except socket.error:
+        return
+      event = self.handle_uevent(data)
+      if event:
+        callback(*event)
+
+  def handle_uevent(self, data):
+    """Update the serial map from one kernel uevent.
+
+    A uevent is a 'action@devpath' line followed by KEY=value lines, all
+    separated by NUL characters.
+
+    Args:
+      data: The uevent message.
+    Returns:
+      A (serial, location, added) tuple if a USB device with a serial number
+      was added or removed, otherwise None.
+    """
+    fields = {}
+    for line in data.decode('utf-8', 'replace').split(u'\0'):
+      key, separator, value = line.partition(u'=')
+      if separator:
+        fields[key] = value
+    if (fields.get('SUBSYSTEM') != 'usb' or
+        fields.get('DEVTYPE') != 'usb_device' or 'DEVPATH' not in fields):
+      return None
+    location = str(os.path.basename(fields['DEVPATH']))
+    action = fields.get('ACTION')
+    serial_map = dict(self.serial_map)
+    if action == 'add':
+      serial_path = self.SYS_PATH + fields['DEVPATH'] + '/serial'
+      try:
+        with open(serial_path) as f:
+          serial = f.readline().rstrip('\n').lower()
+      except IOError:
+        return None
+      serial_map[serial] = location
+      added = True
+    elif action == 'remove':
+      serials = [serial for serial in serial_map
+                 if serial_map[serial] == location]
+      if not serials:
+        return None
+      serial = serials[0]
+      del serial_map[serial]
+      added = False
+    else:
+      return None
+    self.serial_map = serial_map
+    return (serial, location, added)
@@ -21,8 +21,17 @@ support calling C type functions.
 import ctypes
 from ctypes.wintypes import BYTE
 from ctypes.wintypes import DWORD
+from ctypes.wintypes import HANDLE
+from ctypes.wintypes import HWND
+from ctypes.wintypes import LPARAM
+from ctypes.wintypes import LPCWSTR
+from ctypes.wintypes import LPVOID
+from ctypes.wintypes import MSG
+from ctypes.wintypes import UINT
 from ctypes.wintypes import ULONG
 from ctypes.wintypes import WORD
+from ctypes.wintypes import WPARAM
+import threading
 
 NULL = None
 DIGCF_ALLCLASSES = 0x4
@@ -33,6 +42,16 @@ SPDRP_LOCATION_INFORMATION = 0xD
 INVALID_HANDLE_VALUE = -1
 ERROR_NO_MORE_ITEMS = 0x103
 BUFFER_SIZE = 1024
+WM_CLOSE = 0x0010
+WM_DESTROY = 0x0002
+WM_DEVICECHANGE = 0x0219
+DBT_DEVICEARRIVAL = 0x8000
+DBT_DEVICEREMOVECOMPLETE = 0x8004
+DBT_DEVTYP_DEVICEINTERFACE = 5
+DEVICE_NOTIFY_WINDOW_HANDLE = 0
+HWND_MESSAGE = HWND(-3)
+LRESULT = LPARAM
+WNDPROC = ctypes.WINFUNCTYPE(LRESULT, HWND, UINT, WPARAM, LPARAM)
 
 
 class GUID(ctypes.Structure):
@@ -53,6 +72,44 @@ class SP_DEVINFO_DATA(ctypes.Structure):
   ]
 
 
+GUID_DEVINTERFACE_USB_DEVICE = GUID(
+    0xA5DCBF10, 0x6530, 0x11D2,
+    (BYTE*8)(0x90, 0x1F, 0x00, 0xC0, 0x4F, 0xB9, 0x51, 0xED))
+
+
+class DEV_BROADCAST_HDR(ctypes.Structure):
+  _fields_ = [
+      ('dbch_size', DWORD),
+      ('dbch_devicetype', DWORD),
+      ('dbch_reserved', DWORD),
+  ]
+
+
+class DEV_BROADCAST_DEVICEINTERFACE(ctypes.Structure):
+  _fields_ = [
+      ('dbcc_size', DWORD),
+      ('dbcc_devicetype', DWORD),
+      ('dbcc_reserved', DWORD),
+      ('dbcc_classguid', GUID),
+      ('dbcc_name', ctypes.c_wchar*1),
+  ]
+
+
+class WNDCLASS(ctypes.Structure):
+  _fields_ = [
+      ('style', UINT),
+      ('lpfnWndProc', WNDPROC),
+      ('cbClsExtra', ctypes.c_int),
+      ('cbWndExtra', ctypes.c_int),
+      ('hInstance', HANDLE),
+      ('hIcon', HANDLE),
+      ('hCursor', HANDLE),
+      ('hbrBackground', HANDLE),
+      ('lpszMenuName', LPCWSTR),
+      ('lpszClassName', LPCWSTR),
+  ]
+
+
 class SerialMapper(object):
   """Maps serial number to its USB physical location.
 
@@ -64,6 +121,8 @@ class SerialMapper(object):
   def __init__(self):
     self.setupapi = ctypes.WinDLL('setupapi')
     self.serial_map = {}
+    self._watcher_hwnd = None
+    self._watcher_thread = None
 
   def refresh_serial_map(self):
     """Refresh the serial_number -> USB location map.
@@ -151,3 +210,125 @@ class SerialMapper(object):
       return self.serial_map[serial_lower]
     return None
 
+  def start_hotplug_watcher(self, callback):
+    """Start watching the USB device arrival and removal notifications.
+
+    The notifications go to a message-only window on the watcher thread. The
+    serial map is refreshed on each notification, so it does not need to be
+    refreshed while the watcher runs.
+
+    Args:
+      callback: Called as callback(serial, location, added) from the watcher
+        thread when a USB device is added or removed.
+    Returns:
+      Whether the watcher is running.
+    """
+    if self._watcher_thread:
+      return True
+    self.refresh_serial_map()
+    started = threading.Event()
+    thread = threading.Thread(
+        target=self._watch_device_changes, args=(callback, started))
+    thread.daemon = True
+    thread.start()
+    started.wait()
+    if not self._watcher_hwnd:
+      return False
+    self._watcher_thread = thread
+    return True
+
+  def stop_hotplug_watcher(self):
+    """Stop the watcher started by start_hotplug_watcher."""
+    thread = self._watcher_thread
+    if not thread:
+      return
+    ctypes.windll.user32.PostMessageW(self._watcher_hwnd, WM_CLOSE, 0, 0)
+    thread.join()
+    self._watcher_thread = None
+
+  def _watch_device_changes(self, callback, started):
+    """Run the message loop for the device change notifications.
+
+    Args:
+      callback: The callback passed to start_hotplug_watcher.
+      started: Set once the window is created, or failed to be created.
+    """
+    user32 = ctypes.windll.user32
+    kernel32 = ctypes.windll.kernel32
+    user32.DefWindowProcW.argtypes = [HWND, UINT, WPARAM, LPARAM]
+    user32.DefWindowProcW.restype = LRESULT
+    user32.CreateWindowExW.restype = HWND
+    user32.RegisterDeviceNotificationW.argtypes = [HANDLE, LPVOID, DWORD]
+    user32.RegisterDeviceNotificationW.restype = HANDLE
+    kernel32.GetModuleHandleW.restype = HANDLE
+
+    def WndProc(hwnd, message, wparam, lparam):
+      if (message == WM_DEVICECHANGE and lparam and
+          wparam in (DBT_DEVICEARRIVAL, DBT_DEVICEREMOVECOMPLETE)):
+        header = ctypes.cast(lparam, ctypes.POINTER(DEV_BROADCAST_HDR))
+        if header.contents.dbch_devicetype == DBT_DEVTYP_DEVICEINTERFACE:
+          name = ctypes.wstring_at(
+              lparam + DEV_BROADCAST_DEVICEINTERFACE.dbcc_name.offset)
+          self._handle_device_change(
+              name, wparam == DBT_DEVICEARRIVAL, callback)
+        return 1
+      if message == WM_DESTROY:
+        user32.PostQuitMessage(0)
+        return 0
+      return user32.DefWindowProcW(hwnd, message, wparam, lparam)
+
+    # Keep a reference so the callback is not garbage collected.
+    self._wndproc = WNDPROC(WndProc)
+    window_class = WNDCLASS()
+    window_class.lpfnWndProc = self._wndproc
+    window_class.hInstance = kernel32.GetModuleHandleW(None)
+    window_class.lpszClassName = u'AtftSerialMapper'
+    user32.RegisterClassW(ctypes.byref(window_class))
+    hwnd = user32.CreateWindowExW(
+        0, window_class.lpszClassName, None, 0, 0, 0, 0, 0, HWND_MESSAGE,
+        None, window_class.hInstance, None)
+    notification = None
+    if hwnd:
+      notification_filter = DEV_BROADCAST_DEVICEINTERFACE()
+      notification_filter.dbcc_size = ctypes.sizeof(notification_filter)
+      notification_filter.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE
+      notification_filter.dbcc_classguid = GUID_DEVINTERFACE_USB_DEVICE
+      notification = user32.RegisterDeviceNotificationW(
+          hwnd, ctypes.byref(notification_filter), DEVICE_NOTIFY_WINDOW_HANDLE)
+      if not notification:
+        user32.DestroyWindow(hwnd)
+        hwnd = None
+    self._watcher_hwnd = hwnd
+    started.set()
+
+    if hwnd:
+      message = MSG()
+      while user32.GetMessageW(ctypes.byref(message), None, 0, 0) > 0:
+        user32.TranslateMessage(ctypes.byref(message))
+        user32.DispatchMessageW(ctypes.byref(message))
+      user32.UnregisterDeviceNotification(notification)
+      self._watcher_hwnd = None
+    user32.UnregisterClassW(window_class.lpszClassName,
+                            window_class.hInstance)
+
+  def _handle_device_change(self, device_name, added, callback):
+    """Handle one device arrival or removal.
+
+    Args:
+      device_name: The device interface name, in the format of
+        \\\\?\\USB#[VID_PID]#[SERIAL]#{[GUID]}.
+      added: Whether the device arrived (or was removed).
+      callback: The callback passed to start_hotplug_watcher.
+    """
+    name_parts = device_name.split('#')
+    if len(name_parts) < 3:
+      return
+    serial = str(name_parts[2]).lower()
+    if added:
+      self.refresh_serial_map()
+      location = self.get_location(serial)
+    else:
+      serial_map = dict(self.serial_map)
+      location = serial_map.pop(serial, None)
+      self.serial_map = serial_map
+    callback(serial, location, added)
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef ATAP_BENCHMARK_UTIL_H_
+#define ATAP_BENCHMARK_UTIL_H_
+
+#include <string>
+
+#include <benchmark/benchmark.h>
+#include <libatap/libatap.h>
+
+namespace atap {
+
+// These are in atap_sysdeps_posix_benchmark.cpp, which counts every
+// atap_malloc() call and every byte passed to atap_memcpy() since the last
+// reset.
+void benchmark_counters_reset();
+uint64_t benchmark_allocs();
+uint64_t benchmark_bytes_copied();
+
+// Resets the counters. Call right before the timed loop.
+inline void start_counting() {
+  benchmark_counters_reset();
+}
+
+// Reports the libatap allocations and copies since start_counting() as
+// allocs/op and bytes_copied/op of |state|.
+inline void report_counters(benchmark::State& state) {
+  state.counters["allocs/op"] = benchmark::Counter(
+      benchmark_allocs(), benchmark::Counter::kAvgIterations);
+  state.counters["bytes_copied/op"] = benchmark::Counter(
+      benchmark_bytes_copied(), benchmark::Counter::kAvgIterations);
+}
+
+const char kCaP256PrivateKey[] = "test/data/ca_p256_private.bin";
+const char kCaX25519PrivateKey[] = "test/data/ca_x25519_private.bin";
+const char kIssueP256OperationStartPath[] =
+    "test/data/issue_p256_operation_start.bin";
+const char kIssueX25519OperationStartPath[] =
+    "test/data/issue_x25519_operation_start.bin";
+const char kIssueX25519InnerCaResponsePath[] =
+    "test/data/issue_x25519_inner_ca_response.bin";
+const char kAuthSig[] = "test/data/auth_sig.bin";
+const char kAuthCert[] = "test/data/auth_cert.bin";
+
+}  // namespace atap
+
+#endif /* ATAP_BENCHMARK_UTIL_H_ */
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// CA side benchmarks: AtapCaServer::ProcessBatch() over a batch of CA
+// Requests, on a growing number of threads.
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <base/files/file_util.h>
+#include <benchmark/benchmark.h>
+#include <libatap/libatap.h>
+
+#include "atap_benchmark_util.h"
+#include "ops/atap_ops_provider.h"
+#include "server/atap_ca_server.h"
+#include "test/fake_atap_ops.h"
+
+namespace atap {
+
+namespace {
+
+constexpr size_t kBatchSize = 64;
+constexpr uint32_t kCertLen = 600;
+constexpr uint32_t kKeyLen = 1200;
+
+// Issues one synthetic certificate and key of the usual sizes per key type.
+class BenchmarkIssuer : public AtapCaIssuer {
+ public:
+  BenchmarkIssuer() : cert_(kCertLen, 0x30), key_(kKeyLen, 0x42) {}
+
+  AtapResult Issue(const AtapCaIssueRequest& request,
+                   AtapCaIssueResponse* response) override {
+    memset(response->hex_uuid, 'a', ATAP_HEX_UUID_LEN);
+    for (uint32_t i = 0; i < response->key_count; ++i) {
+      AtapAttestationKey* key = &response->keys[i];
+      key->cert_chain.entry_count = 1;
+      key->cert_chain.entries[0].data = cert_.data();
+      key->cert_chain.entries[0].data_length = cert_.size();
+      key->key.data = key_.data();
+      key->key.data_length = key_.size();
+    }
+    return ATAP_RESULT_OK;
+  }
+
+ private:
+  std::vector<uint8_t> cert_;
+  std::vector<uint8_t> key_;
+};
+
+// Builds kBatchSize issue CA Requests on |curve| from distinct devices.
+class CaRequestBatch {
+ public:
+  bool Init(AtapCurveType curve) {
+    std::string operation_start;
+    const char* operation_start_path = (curve == ATAP_CURVE_TYPE_X25519)
+                                           ? kIssueX25519OperationStartPath
+                                           : kIssueP256OperationStartPath;
+    const char* private_key_path = (curve == ATAP_CURVE_TYPE_X25519)
+                                       ? kCaX25519PrivateKey
+                                       : kCaP256PrivateKey;
+    if (!base::ReadFileToString(base::FilePath(operation_start_path),
+                                &operation_start) ||
+        !base::ReadFileToString(base::FilePath(private_key_path),
+                                &private_key_)) {
+      return false;
+    }
+    FakeAtapOps fake_ops;
+    AtapOpsProvider ops(&fake_ops);
+    requests_.resize(kBatchSize);
+    responses_.resize(kBatchSize);
+    items_.resize(kBatchSize);
+    for (size_t i = 0; i < kBatchSize; ++i) {
+      uint8_t* ca_request = nullptr;
+      uint32_t ca_request_size = 0;
+      AtapSession* session = atap_session_create();
+      atap_session_set_optional_ops(session, AtapOpsProvider::optional_ops());
+      AtapResult ret = atap_get_ca_request_ex(session,
+                                              ops.atap_ops(),
+                                              (uint8_t*)&operation_start[0],
+                                              operation_start.size(),
+                                              &ca_request,
+                                              &ca_request_size);
+      atap_session_destroy(session);
+      if (ret != ATAP_RESULT_OK) {
+        return false;
+      }
+      requests_[i].assign(ca_request, ca_request + ca_request_size);
+      atap_free(ca_request);
+      responses_[i].resize(AtapCaServer::kCaResponseLenMax);
+
+      AtapCaBatchItem* item = &items_[i];
+      memset(item, 0, sizeof(*item));
+      item->curve = curve;
+      item->operation = ATAP_OPERATION_ISSUE;
+      item->ca_private_key = (const uint8_t*)private_key_.data();
+      item->ca_private_key_size = private_key_.size();
+      item->ca_request = requests_[i].data();
+      item->ca_request_size = requests_[i].size();
+      item->ca_response = responses_[i].data();
+      item->ca_response_capacity = responses_[i].size();
+    }
+    return true;
+  }
+
+  AtapCaBatchItem* items() { return items_.data(); }
+
+ private:
+  std::string private_key_;
+  std::vector<std::vector<uint8_t>> requests_;
+  std::vector<std::vector<uint8_t>> responses_;
+  std::vector<AtapCaBatchItem> items_;
+};
+
+}  // namespace
+
+// Decrypts, issues and encrypts kBatchSize CA Requests per iteration.
+void BM_CaServerBatch(benchmark::State& state) {
+  CaRequestBatch batch;
+  if (!batch.Init((AtapCurveType)state.range(1))) {
+    state.SkipWithError("could not build CA requests");
+    return;
+  }
+  BenchmarkIssuer issuer;
+  AtapCaServer server(&issuer, state.range(0));
+  for (auto _ : state) {
+    server.ProcessBatch(batch.items(), kBatchSize);
+    if (batch.items()[0].result != ATAP_RESULT_OK) {
+      state.SkipWithError("ProcessBatch failed");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kBatchSize);
+}
+BENCHMARK(BM_CaServerBatch)
+    ->ArgNames({"threads", "curve"})
+    ->ArgsProduct({{1, 2, 4, 8}, {ATAP_CURVE_TYPE_P256, ATAP_CURVE_TYPE_X25519}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace atap
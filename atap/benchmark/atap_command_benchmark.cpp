@@ -0,0 +1,417 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Handshake benchmarks: atap_get_ca_request_ex() and
+// atap_set_ca_response_ex() for every operation on both curves, with and
+// without a session arena.
+
+#include <string>
+#include <vector>
+
+#include <base/files/file_util.h>
+#include <benchmark/benchmark.h>
+#include <libatap/libatap.h>
+
+#include "atap_benchmark_util.h"
+#include "ops/atap_ops_provider.h"
+#include "test/fake_atap_ops.h"
+
+namespace atap {
+
+namespace {
+
+// Sizes of the synthetic certificates and keys in a CA Response.
+constexpr uint32_t kCertLen = 600;
+constexpr uint32_t kCertsPerChain = 3;
+constexpr uint32_t kKeyLen = 1200;
+
+// Answers every op a handshake needs, so each operation can run to the end.
+class BenchmarkAtapOps : public FakeAtapOps {
+ public:
+  // Certify reads the keys to be certified. edDSA is left out, as on most
+  // devices.
+  AtapResult read_attestation_public_key(AtapKeyType key_type,
+                                         uint8_t pubkey[ATAP_KEY_LEN_MAX],
+                                         uint32_t* pubkey_len) override {
+    if (key_type == ATAP_KEY_TYPE_edDSA) {
+      return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
+    }
+    // DER sizes of an RSA-2048 and a P-256 SubjectPublicKeyInfo.
+    *pubkey_len = key_type == ATAP_KEY_TYPE_RSA ? 294 : 91;
+    atap_memset(pubkey, 0x55, *pubkey_len);
+    return ATAP_RESULT_OK;
+  }
+
+  // The encrypted issue operations use an all-zero SoC global key, like the
+  // partner-tools test keysets.
+  AtapResult read_soc_global_key(
+      uint8_t global_key[ATAP_AES_128_KEY_LEN]) override {
+    atap_memset(global_key, 0, ATAP_AES_128_KEY_LEN);
+    return ATAP_RESULT_OK;
+  }
+};
+
+const char* operation_name(AtapOperation operation) {
+  switch (operation) {
+    case ATAP_OPERATION_CERTIFY:
+      return "certify";
+    case ATAP_OPERATION_ISSUE:
+      return "issue";
+    case ATAP_OPERATION_ISSUE_ENCRYPTED:
+      return "issue_encrypted";
+    case ATAP_OPERATION_ISSUE_SOM_KEY:
+      return "issue_som";
+    case ATAP_OPERATION_ISSUE_ENCRYPTED_SOM_KEY:
+      return "issue_encrypted_som";
+    default:
+      return "none";
+  }
+}
+
+void append_cert_chain(std::string* buf) {
+  uint8_t len[sizeof(uint32_t)];
+  append_uint32_to_buf(
+      len, kCertsPerChain * (sizeof(uint32_t) + kCertLen));
+  buf->append((const char*)len, sizeof(len));
+  for (uint32_t i = 0; i < kCertsPerChain; ++i) {
+    append_uint32_to_buf(len, kCertLen);
+    buf->append((const char*)len, sizeof(len));
+    buf->append(kCertLen, '\x30');
+  }
+}
+
+void append_key(std::string* buf, uint32_t key_len) {
+  uint8_t len[sizeof(uint32_t)];
+  append_uint32_to_buf(len, key_len);
+  buf->append((const char*)len, sizeof(len));
+  buf->append(key_len, '\x42');
+}
+
+// Builds an Inner CA Response with every key present. Certify responses
+// carry cert chains only.
+std::string build_inner_ca_response(AtapOperation operation) {
+  bool som = is_som_operation(operation);
+  uint32_t fields = som ? ATAP_INNER_CA_RESPONSE_FIELDS_SOM
+                        : ATAP_INNER_CA_RESPONSE_FIELDS_PRODUCT;
+  std::string body;
+  if (!som) {
+    body.append(ATAP_HEX_UUID_LEN, 'a');
+  }
+  for (uint32_t i = 0; i < fields / 2; ++i) {
+    append_cert_chain(&body);
+    append_key(&body, operation == ATAP_OPERATION_CERTIFY ? 0 : kKeyLen);
+  }
+  std::string inner(ATAP_HEADER_LEN, 0);
+  append_header_to_buf((uint8_t*)&inner[0], body.size());
+  return inner + body;
+}
+
+// Returns |plaintext| encrypted with |key| as an Encrypted Message: header,
+// IV, ciphertext length, ciphertext and tag.
+std::string encrypt_message(AtapOps* ops,
+                            const std::string& plaintext,
+                            const uint8_t key[ATAP_AES_128_KEY_LEN]) {
+  std::string message(ATAP_ENCRYPTED_MESSAGE_OVERHEAD + plaintext.size(), 0);
+  uint8_t* buf = (uint8_t*)&message[0];
+  uint8_t* iv = append_header_to_buf(buf, message.size() - ATAP_HEADER_LEN);
+  ops->get_random_bytes(ops, iv, ATAP_GCM_IV_LEN);
+  uint8_t* ciphertext =
+      append_uint32_to_buf(iv + ATAP_GCM_IV_LEN, plaintext.size());
+  if (ops->aes_gcm_128_encrypt(ops,
+                               (const uint8_t*)plaintext.data(),
+                               plaintext.size(),
+                               iv,
+                               key,
+                               ciphertext,
+                               ciphertext + plaintext.size()) !=
+      ATAP_RESULT_OK) {
+    return std::string();
+  }
+  return message;
+}
+
+// One device talking to the test CA. The device ECDH key is the CA test
+// key, so the session key is the same every time.
+class Handshake {
+ public:
+  Handshake(AtapCurveType curve, AtapOperation operation, bool arena)
+      : curve_(curve), operation_(operation) {
+    session_ = atap_session_create();
+    atap_session_set_optional_ops(session_, AtapOpsProvider::optional_ops());
+    if (arena) {
+      arena_.resize(ATAP_ARENA_SIZE / sizeof(uint64_t));
+      atap_session_set_arena(
+          session_, arena_.data(), arena_.size() * sizeof(uint64_t));
+    }
+  }
+
+  ~Handshake() {
+    if (auth_) {
+      fake_ops_.set_auth(ATAP_KEY_TYPE_NONE, nullptr, 0, nullptr, 0);
+    }
+    atap_session_destroy(session_);
+  }
+
+  // Loads the fixtures for the curve and operation. Returns false if they
+  // are missing.
+  bool Init() {
+    std::string key;
+    if (!base::ReadFileToString(
+            base::FilePath(curve_ == ATAP_CURVE_TYPE_P256
+                               ? kCaP256PrivateKey
+                               : kCaX25519PrivateKey),
+            &key) ||
+        !base::ReadFileToString(
+            base::FilePath(curve_ == ATAP_CURVE_TYPE_P256
+                               ? kIssueP256OperationStartPath
+                               : kIssueX25519OperationStartPath),
+            &operation_start_) ||
+        operation_start_.size() != ATAP_OPERATION_START_LEN) {
+      return false;
+    }
+    fake_ops_.SetEcdhKeyForTesting(key.data(), key.size());
+    operation_start_[ATAP_HEADER_LEN + 1] = operation_;
+    return true;
+  }
+
+  // Authenticates CA Requests with the test RSA auth key.
+  bool SetAuth() {
+    std::string sig, cert;
+    if (!base::ReadFileToString(base::FilePath(kAuthSig), &sig) ||
+        !base::ReadFileToString(base::FilePath(kAuthCert), &cert)) {
+      return false;
+    }
+    fake_ops_.set_auth(ATAP_KEY_TYPE_RSA,
+                       (uint8_t*)&sig[0],
+                       sig.size(),
+                       (uint8_t*)&cert[0],
+                       cert.size());
+    auth_ = true;
+    return true;
+  }
+
+  AtapResult GetCaRequest() {
+    uint8_t* ca_request = nullptr;
+    uint32_t ca_request_size = 0;
+    AtapResult ret = atap_get_ca_request_ex(session_,
+                                            atap_ops(),
+                                            (uint8_t*)&operation_start_[0],
+                                            operation_start_.size(),
+                                            &ca_request,
+                                            &ca_request_size);
+    if (ret == ATAP_RESULT_OK) {
+      atap_memcpy(device_pubkey_, ca_request + ATAP_HEADER_LEN,
+                  ATAP_ECDH_KEY_LEN);
+      atap_free(ca_request);
+    }
+    return ret;
+  }
+
+  // Builds the CA Response for the last CA Request.
+  bool BuildCaResponse() {
+    uint8_t ca_pubkey[ATAP_ECDH_KEY_LEN];
+    uint8_t shared_secret[ATAP_ECDH_SHARED_SECRET_LEN];
+    uint8_t session_key[ATAP_AES_128_KEY_LEN];
+    uint8_t global_key[ATAP_AES_128_KEY_LEN];
+    std::string inner;
+
+    if (fake_ops_.ecdh_shared_secret_compute(
+            curve_, device_pubkey_, ca_pubkey, shared_secret) !=
+            ATAP_RESULT_OK ||
+        derive_session_key(atap_ops(),
+                           device_pubkey_,
+                           ca_pubkey,
+                           shared_secret,
+                           "KEY",
+                           session_key,
+                           ATAP_AES_128_KEY_LEN) != ATAP_RESULT_OK) {
+      return false;
+    }
+    if (operation_ == ATAP_OPERATION_ISSUE ||
+        operation_ == ATAP_OPERATION_ISSUE_ENCRYPTED) {
+      if (!base::ReadFileToString(
+              base::FilePath(kIssueX25519InnerCaResponsePath), &inner)) {
+        return false;
+      }
+    } else {
+      inner = build_inner_ca_response(operation_);
+    }
+    if (operation_ == ATAP_OPERATION_ISSUE_ENCRYPTED ||
+        operation_ == ATAP_OPERATION_ISSUE_ENCRYPTED_SOM_KEY) {
+      fake_ops_.read_soc_global_key(global_key);
+      inner = encrypt_message(atap_ops(), inner, global_key);
+    }
+    ca_response_ = encrypt_message(atap_ops(), inner, session_key);
+    return !inner.empty() && !ca_response_.empty();
+  }
+
+  AtapResult SetCaResponse() {
+    return atap_set_ca_response_ex(session_,
+                                   atap_ops(),
+                                   (const uint8_t*)ca_response_.data(),
+                                   ca_response_.size());
+  }
+
+  void SetLabel(benchmark::State& state) const {
+    std::string label = operation_name(operation_);
+    label += curve_ == ATAP_CURVE_TYPE_P256 ? "/p256" : "/x25519";
+    if (auth_) {
+      label += "/auth";
+    }
+    state.SetLabel(label);
+  }
+
+  AtapOps* atap_ops() {
+    return ops_.atap_ops();
+  }
+
+ private:
+  AtapCurveType curve_;
+  AtapOperation operation_;
+  bool auth_ = false;
+  BenchmarkAtapOps fake_ops_;
+  AtapOpsProvider ops_{&fake_ops_};
+  AtapSession* session_;
+  std::vector<uint64_t> arena_;
+  std::string operation_start_;
+  std::string ca_response_;
+  uint8_t device_pubkey_[ATAP_ECDH_KEY_LEN];
+};
+
+// Args are {operation, curve, arena}.
+void HandshakeArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"op", "curve", "arena"});
+  for (int operation = ATAP_OPERATION_CERTIFY;
+       operation <= ATAP_OPERATION_ISSUE_ENCRYPTED_SOM_KEY;
+       ++operation) {
+    for (int curve : {ATAP_CURVE_TYPE_P256, ATAP_CURVE_TYPE_X25519}) {
+      for (int arena : {0, 1}) {
+        b->Args({operation, curve, arena});
+      }
+    }
+  }
+}
+
+void BM_GetCaRequest(benchmark::State& state) {
+  Handshake handshake((AtapCurveType)state.range(1),
+                      (AtapOperation)state.range(0),
+                      state.range(2));
+  if (!handshake.Init()) {
+    state.SkipWithError("missing test data");
+    return;
+  }
+  start_counting();
+  for (auto _ : state) {
+    if (handshake.GetCaRequest() != ATAP_RESULT_OK) {
+      state.SkipWithError("atap_get_ca_request_ex failed");
+      break;
+    }
+  }
+  report_counters(state);
+  handshake.SetLabel(state);
+}
+BENCHMARK(BM_GetCaRequest)->Apply(HandshakeArgs)->Unit(benchmark::kMicrosecond);
+
+// Issue with an authentication key adds the cert chain and a signature to
+// the request.
+void BM_GetCaRequestAuth(benchmark::State& state) {
+  Handshake handshake(
+      (AtapCurveType)state.range(0), ATAP_OPERATION_ISSUE, false);
+  if (!handshake.Init() || !handshake.SetAuth()) {
+    state.SkipWithError("missing test data");
+    return;
+  }
+  start_counting();
+  for (auto _ : state) {
+    if (handshake.GetCaRequest() != ATAP_RESULT_OK) {
+      state.SkipWithError("atap_get_ca_request_ex failed");
+      break;
+    }
+  }
+  report_counters(state);
+  handshake.SetLabel(state);
+}
+BENCHMARK(BM_GetCaRequestAuth)
+    ->ArgName("curve")
+    ->Arg(ATAP_CURVE_TYPE_P256)
+    ->Arg(ATAP_CURVE_TYPE_X25519)
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_SetCaResponse(benchmark::State& state) {
+  Handshake handshake((AtapCurveType)state.range(1),
+                      (AtapOperation)state.range(0),
+                      state.range(2));
+  if (!handshake.Init()) {
+    state.SkipWithError("missing test data");
+    return;
+  }
+  if (handshake.GetCaRequest() != ATAP_RESULT_OK ||
+      !handshake.BuildCaResponse()) {
+    state.SkipWithError("handshake setup failed");
+    return;
+  }
+  start_counting();
+  for (auto _ : state) {
+    if (handshake.SetCaResponse() != ATAP_RESULT_OK) {
+      state.SkipWithError("atap_set_ca_response_ex failed");
+      break;
+    }
+  }
+  report_counters(state);
+  handshake.SetLabel(state);
+}
+BENCHMARK(BM_SetCaResponse)->Apply(HandshakeArgs)->Unit(benchmark::kMicrosecond);
+
+// A whole device handshake: CA Request, then the CA Response for it. The
+// CA side, building the response, is not timed.
+void BM_Handshake(benchmark::State& state) {
+  Handshake handshake((AtapCurveType)state.range(1),
+                      (AtapOperation)state.range(0),
+                      state.range(2));
+  if (!handshake.Init()) {
+    state.SkipWithError("missing test data");
+    return;
+  }
+  // The device key is fixed, so one CA Response fits every request.
+  if (handshake.GetCaRequest() != ATAP_RESULT_OK ||
+      !handshake.BuildCaResponse()) {
+    state.SkipWithError("handshake setup failed");
+    return;
+  }
+  start_counting();
+  for (auto _ : state) {
+    if (handshake.GetCaRequest() != ATAP_RESULT_OK ||
+        handshake.SetCaResponse() != ATAP_RESULT_OK) {
+      state.SkipWithError("handshake failed");
+      break;
+    }
+  }
+  report_counters(state);
+  handshake.SetLabel(state);
+}
+BENCHMARK(BM_Handshake)->Apply(HandshakeArgs)->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+
+}  // namespace atap
@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Benchmarks for each crypto op, called through the AtapOps table as
+// libatap calls them.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <base/files/file_util.h>
+#include <benchmark/benchmark.h>
+#include <libatap/libatap.h>
+
+#include "atap_benchmark_util.h"
+#include "ops/atap_ops_provider.h"
+#include "test/fake_atap_ops.h"
+
+namespace atap {
+
+namespace {
+
+// From a small Inner CA Request to the largest CA Response.
+void MessageSizes(benchmark::internal::Benchmark* b) {
+  b->ArgName("bytes");
+  for (int len : {64, 1024, 8192, 65536}) {
+    b->Arg(len);
+  }
+}
+
+class CryptoOps {
+ public:
+  AtapOps* ops() {
+    return provider_.atap_ops();
+  }
+
+  FakeAtapOps* delegate() {
+    return &fake_ops_;
+  }
+
+ private:
+  FakeAtapOps fake_ops_;
+  AtapOpsProvider provider_{&fake_ops_};
+};
+
+const uint8_t kKey[ATAP_AES_128_KEY_LEN] = {1, 2, 3, 4, 5, 6, 7, 8,
+                                            9, 10, 11, 12, 13, 14, 15, 16};
+const uint8_t kIv[ATAP_GCM_IV_LEN] = {0};
+
+void BM_GetRandomBytes(benchmark::State& state) {
+  CryptoOps crypto;
+  AtapOps* ops = crypto.ops();
+  std::vector<uint8_t> buf(state.range(0));
+  start_counting();
+  for (auto _ : state) {
+    ops->get_random_bytes(ops, buf.data(), buf.size());
+    benchmark::DoNotOptimize(buf.data());
+  }
+  state.SetBytesProcessed(state.iterations() * buf.size());
+  report_counters(state);
+}
+BENCHMARK(BM_GetRandomBytes)->ArgName("bytes")->Arg(ATAP_GCM_IV_LEN)->Arg(64);
+
+// Generates an ephemeral keypair and computes the shared secret with the
+// CA public key, as atap_get_ca_request() does.
+void BM_EcdhSharedSecretCompute(benchmark::State& state) {
+  AtapCurveType curve = (AtapCurveType)state.range(0);
+  CryptoOps crypto;
+  AtapOps* ops = crypto.ops();
+  std::string operation_start;
+  if (!base::ReadFileToString(
+          base::FilePath(curve == ATAP_CURVE_TYPE_P256
+                             ? kIssueP256OperationStartPath
+                             : kIssueX25519OperationStartPath),
+          &operation_start) ||
+      operation_start.size() != ATAP_OPERATION_START_LEN) {
+    state.SkipWithError("missing test data");
+    return;
+  }
+  const uint8_t* ca_pubkey =
+      (const uint8_t*)&operation_start[ATAP_HEADER_LEN + 2];
+  uint8_t pubkey[ATAP_ECDH_KEY_LEN];
+  uint8_t shared_secret[ATAP_ECDH_SHARED_SECRET_LEN];
+  start_counting();
+  for (auto _ : state) {
+    if (ops->ecdh_shared_secret_compute(
+            ops, curve, ca_pubkey, pubkey, shared_secret) != ATAP_RESULT_OK) {
+      state.SkipWithError("ecdh_shared_secret_compute failed");
+      break;
+    }
+  }
+  report_counters(state);
+  state.SetLabel(curve == ATAP_CURVE_TYPE_P256 ? "p256" : "x25519");
+}
+BENCHMARK(BM_EcdhSharedSecretCompute)
+    ->ArgName("curve")
+    ->Arg(ATAP_CURVE_TYPE_P256)
+    ->Arg(ATAP_CURVE_TYPE_X25519)
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_AesGcmEncrypt(benchmark::State& state) {
+  CryptoOps crypto;
+  AtapOps* ops = crypto.ops();
+  std::vector<uint8_t> plaintext(state.range(0), 0x11);
+  std::vector<uint8_t> ciphertext(plaintext.size());
+  uint8_t tag[ATAP_GCM_TAG_LEN];
+  start_counting();
+  for (auto _ : state) {
+    if (ops->aes_gcm_128_encrypt(ops,
+                                 plaintext.data(),
+                                 plaintext.size(),
+                                 kIv,
+                                 kKey,
+                                 ciphertext.data(),
+                                 tag) != ATAP_RESULT_OK) {
+      state.SkipWithError("aes_gcm_128_encrypt failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * plaintext.size());
+  report_counters(state);
+}
+BENCHMARK(BM_AesGcmEncrypt)->Apply(MessageSizes);
+
+void BM_AesGcmDecrypt(benchmark::State& state) {
+  CryptoOps crypto;
+  AtapOps* ops = crypto.ops();
+  std::vector<uint8_t> plaintext(state.range(0), 0x11);
+  std::vector<uint8_t> ciphertext(plaintext.size());
+  uint8_t tag[ATAP_GCM_TAG_LEN];
+  if (ops->aes_gcm_128_encrypt(ops,
+                               plaintext.data(),
+                               plaintext.size(),
+                               kIv,
+                               kKey,
+                               ciphertext.data(),
+                               tag) != ATAP_RESULT_OK) {
+    state.SkipWithError("aes_gcm_128_encrypt failed");
+    return;
+  }
+  start_counting();
+  for (auto _ : state) {
+    if (ops->aes_gcm_128_decrypt(ops,
+                                 ciphertext.data(),
+                                 ciphertext.size(),
+                                 kIv,
+                                 kKey,
+                                 tag,
+                                 plaintext.data()) != ATAP_RESULT_OK) {
+      state.SkipWithError("aes_gcm_128_decrypt failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * plaintext.size());
+  report_counters(state);
+}
+BENCHMARK(BM_AesGcmDecrypt)->Apply(MessageSizes);
+
+// Encrypts and decrypts back in place, so the buffer stays valid.
+void BM_AesGcmInPlace(benchmark::State& state) {
+  CryptoOps crypto;
+  AtapOps* ops = crypto.ops();
+  const AtapOptionalOps* optional_ops = AtapOpsProvider::optional_ops();
+  std::vector<uint8_t> buf(state.range(0), 0x11);
+  uint8_t tag[ATAP_GCM_TAG_LEN];
+  start_counting();
+  for (auto _ : state) {
+    if (optional_ops->aes_gcm_128_encrypt_in_place(
+            ops, buf.data(), buf.size(), kIv, kKey, tag) != ATAP_RESULT_OK ||
+        optional_ops->aes_gcm_128_decrypt_in_place(
+            ops, buf.data(), buf.size(), kIv, kKey, tag) != ATAP_RESULT_OK) {
+      state.SkipWithError("in place AES-GCM failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(2 * state.iterations() * buf.size());
+  report_counters(state);
+}
+BENCHMARK(BM_AesGcmInPlace)->Apply(MessageSizes);
+
+// Decrypts in 1 KiB pieces, as atap_ca_response_update() receives them.
+void BM_AesGcmDecryptStream(benchmark::State& state) {
+  const uint32_t kChunk = 1024;
+  CryptoOps crypto;
+  AtapOps* ops = crypto.ops();
+  const AtapOptionalOps* optional_ops = AtapOpsProvider::optional_ops();
+  std::vector<uint8_t> plaintext(state.range(0), 0x11);
+  std::vector<uint8_t> ciphertext(plaintext.size());
+  uint8_t tag[ATAP_GCM_TAG_LEN];
+  if (ops->aes_gcm_128_encrypt(ops,
+                               plaintext.data(),
+                               plaintext.size(),
+                               kIv,
+                               kKey,
+                               ciphertext.data(),
+                               tag) != ATAP_RESULT_OK) {
+    state.SkipWithError("aes_gcm_128_encrypt failed");
+    return;
+  }
+  start_counting();
+  for (auto _ : state) {
+    void* ctx = nullptr;
+    AtapResult ret =
+        optional_ops->aes_gcm_128_decrypt_begin(ops, kIv, kKey, &ctx);
+    for (uint32_t i = 0; ret == ATAP_RESULT_OK && i < ciphertext.size();
+         i += kChunk) {
+      uint32_t len =
+          std::min(kChunk, (uint32_t)ciphertext.size() - i);
+      ret = optional_ops->aes_gcm_128_decrypt_update(
+          ops, ctx, &ciphertext[i], len, &plaintext[i]);
+    }
+    if (ctx != nullptr) {
+      AtapResult finish = optional_ops->aes_gcm_128_decrypt_finish(
+          ops, ctx, ret == ATAP_RESULT_OK ? tag : nullptr);
+      if (ret == ATAP_RESULT_OK) {
+        ret = finish;
+      }
+    }
+    if (ret != ATAP_RESULT_OK) {
+      state.SkipWithError("streaming AES-GCM decrypt failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * plaintext.size());
+  report_counters(state);
+}
+BENCHMARK(BM_AesGcmDecryptStream)->Apply(MessageSizes);
+
+void BM_Sha256(benchmark::State& state) {
+  CryptoOps crypto;
+  AtapOps* ops = crypto.ops();
+  std::vector<uint8_t> input(state.range(0), 0x11);
+  uint8_t hash[ATAP_SHA256_DIGEST_LEN];
+  start_counting();
+  for (auto _ : state) {
+    if (ops->sha256(ops, input.data(), input.size(), hash) !=
+        ATAP_RESULT_OK) {
+      state.SkipWithError("sha256 failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+  report_counters(state);
+}
+BENCHMARK(BM_Sha256)->ArgName("bytes")->Arg(ATAP_PRODUCT_ID_LEN)->Arg(1024);
+
+// The session key derivation of a handshake: the salt is both public keys.
+void BM_HkdfSha256(benchmark::State& state) {
+  CryptoOps crypto;
+  AtapOps* ops = crypto.ops();
+  uint8_t salt[2 * ATAP_ECDH_KEY_LEN] = {0};
+  uint8_t ikm[ATAP_ECDH_SHARED_SECRET_LEN] = {0};
+  uint8_t okm[ATAP_AES_128_KEY_LEN];
+  start_counting();
+  for (auto _ : state) {
+    if (ops->hkdf_sha256(ops,
+                         salt,
+                         sizeof(salt),
+                         ikm,
+                         sizeof(ikm),
+                         (const uint8_t*)"KEY",
+                         3,
+                         okm,
+                         sizeof(okm)) != ATAP_RESULT_OK) {
+      state.SkipWithError("hkdf_sha256 failed");
+      break;
+    }
+  }
+  report_counters(state);
+}
+BENCHMARK(BM_HkdfSha256);
+
+// The session key and nonce derivations of |jobs|/2 handshakes, as the CA
+// server runs them, batched or through the default loop.
+void BM_HkdfSha256Batch(benchmark::State& state) {
+  CryptoOps crypto;
+  FakeAtapOps* delegate = crypto.delegate();
+  const size_t count = state.range(0);
+  const bool batched = state.range(1);
+  std::vector<uint8_t> salts(count / 2 * 2 * ATAP_ECDH_KEY_LEN, 0x01);
+  uint8_t ikm[ATAP_ECDH_SHARED_SECRET_LEN] = {0};
+  std::vector<uint8_t> okm(count * ATAP_AES_128_KEY_LEN);
+  std::vector<AtapHkdfSha256Job> jobs(count);
+  for (size_t i = 0; i < count; ++i) {
+    salts[i / 2 * 2 * ATAP_ECDH_KEY_LEN] = i / 2;
+    jobs[i].salt = &salts[i / 2 * 2 * ATAP_ECDH_KEY_LEN];
+    jobs[i].salt_len = 2 * ATAP_ECDH_KEY_LEN;
+    jobs[i].ikm = ikm;
+    jobs[i].ikm_len = sizeof(ikm);
+    jobs[i].info = (const uint8_t*)((i % 2) ? "SIGN" : "KEY");
+    jobs[i].info_len = (i % 2) ? 4 : 3;
+    jobs[i].okm = &okm[i * ATAP_AES_128_KEY_LEN];
+    jobs[i].okm_len = ATAP_AES_128_KEY_LEN;
+  }
+  for (auto _ : state) {
+    AtapResult ret =
+        batched ? delegate->hkdf_sha256_batch(jobs.data(), count)
+                : delegate->AtapOpsDelegate::hkdf_sha256_batch(jobs.data(),
+                                                               count);
+    if (ret != ATAP_RESULT_OK) {
+      state.SkipWithError("HKDF batch failed");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_HkdfSha256Batch)
+    ->ArgNames({"jobs", "batched"})
+    ->ArgsProduct({{2, 64}, {0, 1}});
+
+// derive_session_key() in atap_util.c, which builds the salt and calls
+// hkdf_sha256.
+void BM_DeriveSessionKey(benchmark::State& state) {
+  CryptoOps crypto;
+  AtapOps* ops = crypto.ops();
+  uint8_t device_pubkey[ATAP_ECDH_KEY_LEN] = {1};
+  uint8_t ca_pubkey[ATAP_ECDH_KEY_LEN] = {2};
+  uint8_t shared_secret[ATAP_ECDH_SHARED_SECRET_LEN] = {3};
+  uint8_t session_key[ATAP_AES_128_KEY_LEN];
+  start_counting();
+  for (auto _ : state) {
+    if (derive_session_key(ops,
+                           device_pubkey,
+                           ca_pubkey,
+                           shared_secret,
+                           "KEY",
+                           session_key,
+                           ATAP_AES_128_KEY_LEN) != ATAP_RESULT_OK) {
+      state.SkipWithError("derive_session_key failed");
+      break;
+    }
+  }
+  report_counters(state);
+}
+BENCHMARK(BM_DeriveSessionKey);
+
+}  // namespace
+
+}  // namespace atap
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+
+#include <libatap/libatap.h>
+
+#include "atap_benchmark_util.h"
+
+// Same as atap_sysdeps_posix_testing.cpp, but instead of tracking every
+// block for leak checks, which would dominate the timings, this only
+// counts allocations and copied bytes.
+
+static std::atomic<uint64_t> alloc_count{0};
+static std::atomic<uint64_t> bytes_copied{0};
+
+void* atap_memcpy(void* dest, const void* src, size_t n) {
+  bytes_copied.fetch_add(n, std::memory_order_relaxed);
+  return memcpy(dest, src, n);
+}
+
+void* atap_memset(void* dest, const int c, size_t n) {
+  return memset(dest, c, n);
+}
+
+void atap_abort(void) {
+  abort();
+}
+
+void atap_print(const char* message) {
+  fprintf(stderr, "%s", message);
+}
+
+void atap_printv(const char* message, ...) {
+  va_list ap;
+  const char* m;
+
+  va_start(ap, message);
+  for (m = message; m != NULL; m = va_arg(ap, const char*)) {
+    fprintf(stderr, "%s", m);
+  }
+  va_end(ap);
+}
+
+size_t atap_strlen(const char* str) {
+  return strlen(str);
+}
+
+uint64_t atap_get_monotonic_time_ns(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void* atap_malloc(size_t size) {
+  void* ptr = malloc(size);
+  atap_assert(ptr != nullptr);
+  alloc_count.fetch_add(1, std::memory_order_relaxed);
+  return ptr;
+}
+
+void atap_free(void* ptr) {
+  free(ptr);
+}
+
+namespace atap {
+
+void benchmark_counters_reset() {
+  alloc_count = 0;
+  bytes_copied = 0;
+}
+
+uint64_t benchmark_allocs() {
+  return alloc_count;
+}
+
+uint64_t benchmark_bytes_copied() {
+  return bytes_copied;
+}
+
+}  // namespace atap
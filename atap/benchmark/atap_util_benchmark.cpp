@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Benchmarks for the serialization, parsing and validation in atap_util.c.
+
+#include <string>
+#include <vector>
+
+#include <base/files/file_util.h>
+#include <benchmark/benchmark.h>
+#include <libatap/libatap.h>
+
+#include "atap_benchmark_util.h"
+
+namespace atap {
+
+namespace {
+
+// A cert chain the size of a typical attestation chain.
+constexpr uint32_t kCertLen = 600;
+constexpr uint32_t kCertsPerChain = 3;
+
+class TestCertChain {
+ public:
+  TestCertChain() : certs_(kCertsPerChain, std::string(kCertLen, '\x30')) {
+    atap_memset(&chain_, 0, sizeof(chain_));
+    chain_.entry_count = kCertsPerChain;
+    for (uint32_t i = 0; i < kCertsPerChain; ++i) {
+      chain_.entries[i].data = (uint8_t*)&certs_[i][0];
+      chain_.entries[i].data_length = kCertLen;
+    }
+    serialized_.resize(cert_chain_serialized_size(&chain_));
+    append_cert_chain_to_buf((uint8_t*)&serialized_[0], &chain_);
+  }
+
+  const AtapCertChain* chain() const {
+    return &chain_;
+  }
+
+  std::string* serialized() {
+    return &serialized_;
+  }
+
+ private:
+  std::vector<std::string> certs_;
+  AtapCertChain chain_;
+  std::string serialized_;
+};
+
+void BM_SerializeCertChain(benchmark::State& state) {
+  TestCertChain chain;
+  std::vector<uint8_t> buf(cert_chain_serialized_size(chain.chain()));
+  start_counting();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        append_cert_chain_to_buf(buf.data(), chain.chain()));
+  }
+  state.SetBytesProcessed(state.iterations() * buf.size());
+  report_counters(state);
+}
+BENCHMARK(BM_SerializeCertChain);
+
+// Parses a cert chain into copies of its entries.
+void BM_CopyCertChainFromBuf(benchmark::State& state) {
+  TestCertChain chain;
+  start_counting();
+  for (auto _ : state) {
+    AtapCertChain parsed;
+    uint8_t* buf_ptr = (uint8_t*)&(*chain.serialized())[0];
+    if (!copy_cert_chain_from_buf(&buf_ptr, &parsed)) {
+      state.SkipWithError("copy_cert_chain_from_buf failed");
+      break;
+    }
+    free_cert_chain(parsed);
+  }
+  state.SetBytesProcessed(state.iterations() * chain.serialized()->size());
+  report_counters(state);
+}
+BENCHMARK(BM_CopyCertChainFromBuf);
+
+// Parses a cert chain into views of the buffer, as set_ca_response does.
+void BM_ViewCertChainFromBuf(benchmark::State& state) {
+  TestCertChain chain;
+  std::string* serialized = chain.serialized();
+  const uint8_t* buf_end = (const uint8_t*)serialized->data() + serialized->size();
+  start_counting();
+  for (auto _ : state) {
+    AtapCertChain parsed;
+    uint8_t* buf_ptr = (uint8_t*)&(*serialized)[0];
+    if (!view_cert_chain_from_buf(&buf_ptr, buf_end, &parsed)) {
+      state.SkipWithError("view_cert_chain_from_buf failed");
+      break;
+    }
+    benchmark::DoNotOptimize(parsed);
+  }
+  state.SetBytesProcessed(state.iterations() * serialized->size());
+  report_counters(state);
+}
+BENCHMARK(BM_ViewCertChainFromBuf);
+
+// An authenticated certify request: auth cert chain, signature and all
+// three public keys.
+void BM_SerializeInnerCaRequestProduct(benchmark::State& state) {
+  TestCertChain chain;
+  std::string signature(256, '\x01');
+  std::string rsa_pubkey(294, '\x02');
+  std::string ecdsa_pubkey(91, '\x03');
+  std::string eddsa_pubkey(44, '\x04');
+  AtapInnerCaRequestProduct request;
+  atap_memset(&request, 0, sizeof(request));
+  request.auth_key_cert_chain = *chain.chain();
+  request.signature.data = (uint8_t*)&signature[0];
+  request.signature.data_length = signature.size();
+  request.RSA_pubkey.data = (uint8_t*)&rsa_pubkey[0];
+  request.RSA_pubkey.data_length = rsa_pubkey.size();
+  request.ECDSA_pubkey.data = (uint8_t*)&ecdsa_pubkey[0];
+  request.ECDSA_pubkey.data_length = ecdsa_pubkey.size();
+  request.edDSA_pubkey.data = (uint8_t*)&eddsa_pubkey[0];
+  request.edDSA_pubkey.data_length = eddsa_pubkey.size();
+  std::vector<uint8_t> buf(inner_ca_request_product_serialized_size(&request));
+  start_counting();
+  for (auto _ : state) {
+    uint32_t size = inner_ca_request_product_serialized_size(&request);
+    benchmark::DoNotOptimize(
+        append_inner_ca_request_product_to_buf(buf.data(), &request));
+    benchmark::DoNotOptimize(size);
+  }
+  state.SetBytesProcessed(state.iterations() * buf.size());
+  report_counters(state);
+}
+BENCHMARK(BM_SerializeInnerCaRequestProduct);
+
+void BM_SerializeCaRequest(benchmark::State& state) {
+  std::string encrypted(state.range(0), '\x05');
+  AtapCaRequest request;
+  atap_memset(&request, 0, sizeof(request));
+  request.encrypted_inner_ca_request.data = (uint8_t*)&encrypted[0];
+  request.encrypted_inner_ca_request.data_length = encrypted.size();
+  std::vector<uint8_t> buf(ca_request_serialized_size(&request));
+  start_counting();
+  for (auto _ : state) {
+    uint32_t size = ca_request_serialized_size(&request);
+    benchmark::DoNotOptimize(append_ca_request_to_buf(buf.data(), &request));
+    benchmark::DoNotOptimize(size);
+  }
+  state.SetBytesProcessed(state.iterations() * buf.size());
+  report_counters(state);
+}
+BENCHMARK(BM_SerializeCaRequest)
+    ->ArgName("inner_bytes")
+    ->Arg(ATAP_HEADER_LEN + ATAP_SHA256_DIGEST_LEN)
+    ->Arg(4096);
+
+void BM_ValidateInnerCaResponse(benchmark::State& state) {
+  std::string inner;
+  if (!base::ReadFileToString(base::FilePath(kIssueX25519InnerCaResponsePath),
+                              &inner)) {
+    state.SkipWithError("missing test data");
+    return;
+  }
+  start_counting();
+  for (auto _ : state) {
+    if (!validate_inner_ca_response((const uint8_t*)inner.data(),
+                                    inner.size(),
+                                    ATAP_OPERATION_ISSUE)) {
+      state.SkipWithError("validate_inner_ca_response failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * inner.size());
+  report_counters(state);
+}
+BENCHMARK(BM_ValidateInnerCaResponse);
+
+void BM_ParseInnerCaResponse(benchmark::State& state) {
+  std::string inner;
+  AtapInnerCaResponse response;
+  if (!base::ReadFileToString(base::FilePath(kIssueX25519InnerCaResponsePath),
+                              &inner)) {
+    state.SkipWithError("missing test data");
+    return;
+  }
+  start_counting();
+  for (auto _ : state) {
+    if (!parse_inner_ca_response((const uint8_t*)inner.data(),
+                                 inner.size(),
+                                 ATAP_OPERATION_ISSUE,
+                                 &response)) {
+      state.SkipWithError("parse_inner_ca_response failed");
+      break;
+    }
+    benchmark::DoNotOptimize(response);
+  }
+  state.SetBytesProcessed(state.iterations() * inner.size());
+  report_counters(state);
+}
+BENCHMARK(BM_ParseInnerCaResponse);
+
+void BM_ValidateEncryptedMessage(benchmark::State& state) {
+  std::string message(ATAP_ENCRYPTED_MESSAGE_OVERHEAD + 4096, 0);
+  uint8_t* buf = (uint8_t*)&message[0];
+  append_uint32_to_buf(
+      append_header_to_buf(buf, message.size() - ATAP_HEADER_LEN) +
+          ATAP_GCM_IV_LEN,
+      4096);
+  start_counting();
+  for (auto _ : state) {
+    if (!validate_encrypted_message(buf, message.size())) {
+      state.SkipWithError("validate_encrypted_message failed");
+      break;
+    }
+  }
+  report_counters(state);
+}
+BENCHMARK(BM_ValidateEncryptedMessage);
+
+}  // namespace
+
+}  // namespace atap
+
+BENCHMARK_MAIN();
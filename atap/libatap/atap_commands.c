@@ -18,94 +18,67 @@
 #include "atap_util.h"
 #include "libatap.h"
 
-static uint8_t session_shared_secret[ATAP_ECDH_SHARED_SECRET_LEN];
-static uint8_t session_key[ATAP_AES_128_KEY_LEN];
-static AtapOperation operation;
+/* Session used by the legacy, non-reentrant entry points. */
+static AtapSession default_session;
 
-static AtapResult auth_key_signature_generate(
-    AtapOps* ops,
-    uint8_t device_pubkey[ATAP_ECDH_KEY_LEN],
-    uint8_t ca_pubkey[ATAP_ECDH_KEY_LEN],
-    uint8_t** signature,
-    uint32_t* signature_len) {
+/* Generates the authentication key signature over the nonce derived from
+ * the session, into a signature buffer from the session arena.
+ */
+static AtapResult auth_key_signature_generate(AtapSession* session,
+                                              AtapOps* ops) {
   AtapResult ret = 0;
-  uint8_t nonce[ATAP_NONCE_LEN];
-  *signature = (uint8_t*)atap_malloc(ATAP_SIGNATURE_LEN_MAX);
-  if (*signature == NULL) {
+  AtapCaRequestState* state = &session->ca_request_state;
+  AtapBlob* signature = &state->product.signature;
+
+  signature->data =
+      (uint8_t*)atap_arena_alloc(&session->arena, ATAP_SIGNATURE_LEN_MAX);
+  if (signature->data == NULL) {
     return ATAP_RESULT_ERROR_OOM;
   }
   /* deriving nonce uses same HKDF as deriving session key */
   ret = derive_session_key(ops,
-                           device_pubkey,
-                           ca_pubkey,
-                           session_shared_secret,
+                           state->ca_request.device_pubkey,
+                           state->ca_pubkey,
+                           session->shared_secret,
                            "SIGN",
-                           nonce,
+                           state->nonce,
                            ATAP_NONCE_LEN);
   if (ret != ATAP_RESULT_OK) {
     return ret;
   }
-  return ops->auth_key_sign(
-      ops, nonce, ATAP_NONCE_LEN, *signature, signature_len);
+  return ops->auth_key_sign(ops,
+                            state->nonce,
+                            ATAP_NONCE_LEN,
+                            signature->data,
+                            &signature->data_length);
 }
 
-static AtapResult read_available_public_keys(
-    AtapOps* ops, AtapInnerCaRequestProduct* product_ca_request) {
-  AtapResult ret = 0;
-
-  product_ca_request->RSA_pubkey.data = (uint8_t*)atap_malloc(ATAP_KEY_LEN_MAX);
-  product_ca_request->RSA_pubkey.data_length = ATAP_KEY_LEN_MAX;
-  product_ca_request->ECDSA_pubkey.data = (uint8_t*)atap_malloc(ATAP_KEY_LEN_MAX);
-  product_ca_request->ECDSA_pubkey.data_length = ATAP_KEY_LEN_MAX;
-  product_ca_request->edDSA_pubkey.data = (uint8_t*)atap_malloc(ATAP_KEY_LEN_MAX);
-  product_ca_request->edDSA_pubkey.data_length = ATAP_KEY_LEN_MAX;
-
-  if (product_ca_request->RSA_pubkey.data == NULL ||
-      product_ca_request->ECDSA_pubkey.data == NULL ||
-      product_ca_request->edDSA_pubkey.data == NULL) {
+#if ATAP_ENABLE_OPERATION_CERTIFY
+/* Reads the attestation public key of |key_type| into |pubkey|, a new
+ * buffer from the session arena.
+ */
+static AtapResult read_attestation_public_key(AtapSession* session,
+                                              AtapOps* ops,
+                                              AtapKeyType key_type,
+                                              AtapBlob* pubkey) {
+  pubkey->data = (uint8_t*)atap_arena_alloc(&session->arena, ATAP_KEY_LEN_MAX);
+  pubkey->data_length = ATAP_KEY_LEN_MAX;
+  if (pubkey->data == NULL) {
     return ATAP_RESULT_ERROR_OOM;
   }
-  ret = ops->read_attestation_public_key(
-      ops,
-      ATAP_KEY_TYPE_RSA,
-      product_ca_request->RSA_pubkey.data,
-      &product_ca_request->RSA_pubkey.data_length);
-  if (ret != ATAP_RESULT_OK) {
-    return ret;
-  }
-  ret = ops->read_attestation_public_key(
-      ops,
-      ATAP_KEY_TYPE_ECDSA,
-      product_ca_request->ECDSA_pubkey.data,
-      &product_ca_request->ECDSA_pubkey.data_length);
-  if (ret != ATAP_RESULT_OK) {
-    return ret;
-  }
-  ret = ops->read_attestation_public_key(
-      ops,
-      ATAP_KEY_TYPE_edDSA,
-      product_ca_request->edDSA_pubkey.data,
-      &product_ca_request->edDSA_pubkey.data_length);
-  /* edDSA support is not required in the initial version */
-  if (ret == ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION) {
-    atap_free(product_ca_request->edDSA_pubkey.data);
-    product_ca_request->edDSA_pubkey.data = NULL;
-    product_ca_request->edDSA_pubkey.data_length = 0;
-    ret = ATAP_RESULT_OK;
-  }
-  return ret;
+  return ops->read_attestation_public_key(
+      ops, key_type, pubkey->data, &pubkey->data_length);
 }
+#endif
 
-static AtapResult initialize_session(
-    AtapOps* ops,
-    const uint8_t* operation_start,
-    uint32_t operation_start_size,
-    AtapKeyType* auth_key_type,
-    uint8_t ca_pubkey[ATAP_ECDH_KEY_LEN],
-    AtapCaRequest* ca_request) {
+/* Checks |operation_start| and keeps the operation, curve and CA public
+ * key it holds.
+ */
+static AtapResult parse_operation_start(AtapSession* session,
+                                        const uint8_t* operation_start,
+                                        uint32_t operation_start_size) {
+  AtapCaRequestState* state = &session->ca_request_state;
   uint32_t message_length = 0;
-  AtapCurveType curve_type = 0;
-  AtapResult ret = 0;
   uint8_t* buf_ptr = (uint8_t*)operation_start + 4;
 
   if (operation_start_size != ATAP_OPERATION_START_LEN) {
@@ -119,73 +92,43 @@ static AtapResult initialize_session(
   if (message_length != ATAP_ECDH_KEY_LEN + 2) {
     return ATAP_RESULT_ERROR_INVALID_INPUT;
   }
-  curve_type = operation_start[ATAP_HEADER_LEN];
-  operation = operation_start[ATAP_HEADER_LEN + 1];
-  if (!validate_operation(operation)) {
+  state->curve = operation_start[ATAP_HEADER_LEN];
+  session->operation = operation_start[ATAP_HEADER_LEN + 1];
+  if (!validate_operation(session->operation)) {
     return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
   }
-  if (!validate_curve(curve_type)) {
+  if (!validate_curve(state->curve)) {
     return ATAP_RESULT_ERROR_UNSUPPORTED_ALGORITHM;
   }
 
-  atap_memcpy(ca_pubkey, &operation_start[10], ATAP_ECDH_KEY_LEN);
+  atap_memcpy(state->ca_pubkey, &operation_start[10], ATAP_ECDH_KEY_LEN);
+  return ATAP_RESULT_OK;
+}
 
-  ret = ops->get_auth_key_type(ops, auth_key_type);
-  if (ret != ATAP_RESULT_OK) {
-    return ret;
-  }
+static AtapResult compute_session_key(AtapSession* session, AtapOps* ops) {
+  AtapResult ret = 0;
+  AtapCaRequestState* state = &session->ca_request_state;
 
   ret = ops->ecdh_shared_secret_compute(ops,
-                                        curve_type,
-                                        ca_pubkey,
-                                        ca_request->device_pubkey,
-                                        session_shared_secret);
+                                        state->curve,
+                                        state->ca_pubkey,
+                                        state->ca_request.device_pubkey,
+                                        session->shared_secret);
   if (ret != ATAP_RESULT_OK) {
     return ret;
   }
 
   return derive_session_key(ops,
-                            ca_request->device_pubkey,
-                            ca_pubkey,
-                            session_shared_secret,
+                            state->ca_request.device_pubkey,
+                            state->ca_pubkey,
+                            session->shared_secret,
                             "KEY",
-                            session_key,
+                            session->session_key,
                             ATAP_AES_128_KEY_LEN);
 }
 
-static AtapResult compute_auth_signature(
-    AtapOps* ops,
-    uint8_t ca_pubkey[ATAP_ECDH_KEY_LEN],
-    uint8_t device_pubkey[ATAP_ECDH_KEY_LEN],
-    AtapInnerCaRequestProduct* product_ca_request) {
-  AtapResult ret = 0;
-  /* read auth key cert chain */
-  ret = ops->read_auth_key_cert_chain(ops,
-                                      &product_ca_request->auth_key_cert_chain);
-  if (ret != ATAP_RESULT_OK) {
-    return ret;
-  }
-  /* generate auth key signature */
-  return auth_key_signature_generate(
-      ops, device_pubkey, ca_pubkey, &product_ca_request->signature.data,
-      &product_ca_request->signature.data_length);
-}
-
-static AtapResult read_product_id_hash(
-    AtapOps* ops, AtapInnerCaRequestProduct* product_ca_request) {
-  AtapResult ret = 0;
-  uint8_t product_id[ATAP_PRODUCT_ID_LEN];
-
-  ret = ops->read_product_id(ops, product_id);
-  if (ret != ATAP_RESULT_OK) {
-    return ret;
-  }
-  return ops->sha256(
-      ops, product_id, ATAP_PRODUCT_ID_LEN,
-      product_ca_request->product_id_hash);
-}
-
 static AtapResult encrypt_inner_ca_request(
+    AtapSession* session,
     AtapOps* ops,
     const AtapInnerCaRequestProduct* product_ca_request,
     const AtapInnerCaRequestSom* som_ca_request,
@@ -193,21 +136,21 @@ static AtapResult encrypt_inner_ca_request(
   AtapResult ret = 0;
   uint32_t inner_ca_request_len = 0;
   uint8_t* inner_ca_request_buf = NULL;
-  bool som = is_som_operation(operation);
+  bool som = is_som_operation(session->operation);
   if (som) {
     inner_ca_request_len = inner_ca_request_som_serialized_size();
   } else {
     inner_ca_request_len = inner_ca_request_product_serialized_size(
         product_ca_request);
   }
-  inner_ca_request_buf = (uint8_t*)atap_malloc(inner_ca_request_len);
   ca_request->encrypted_inner_ca_request.data =
-      (uint8_t*)atap_malloc(inner_ca_request_len);
+      (uint8_t*)atap_arena_alloc(&session->arena, inner_ca_request_len);
   ca_request->encrypted_inner_ca_request.data_length = inner_ca_request_len;
-  if (inner_ca_request_buf == NULL ||
-      ca_request->encrypted_inner_ca_request.data == NULL) {
+  if (ca_request->encrypted_inner_ca_request.data == NULL) {
     return ATAP_RESULT_ERROR_OOM;
   }
+  /* Serialize straight into the output buffer and encrypt it in place. */
+  inner_ca_request_buf = ca_request->encrypted_inner_ca_request.data;
   if (som) {
     append_inner_ca_request_som_to_buf(inner_ca_request_buf, som_ca_request);
   } else {
@@ -218,32 +161,66 @@ static AtapResult encrypt_inner_ca_request(
   /* generate IV */
   ret = ops->get_random_bytes(ops, ca_request->iv, ATAP_GCM_IV_LEN);
   if (ret != ATAP_RESULT_OK) {
-    goto out;
+    return ret;
   }
 
   /* encrypt inner CA request with shared key */
+  if (atap_has_optional_op(session, aes_gcm_128_encrypt_in_place)) {
+    ret = session->optional_ops->aes_gcm_128_encrypt_in_place(
+        ops,
+        inner_ca_request_buf,
+        inner_ca_request_len,
+        ca_request->iv,
+        session->session_key,
+        ca_request->tag);
+    if (ret != ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION) {
+      return ret;
+    }
+  }
+  inner_ca_request_buf =
+      (uint8_t*)atap_arena_alloc(&session->arena, inner_ca_request_len);
+  if (inner_ca_request_buf == NULL) {
+    return ATAP_RESULT_ERROR_OOM;
+  }
+  atap_memcpy(inner_ca_request_buf,
+              ca_request->encrypted_inner_ca_request.data,
+              inner_ca_request_len);
   ret = ops->aes_gcm_128_encrypt(ops,
                                  inner_ca_request_buf,
                                  inner_ca_request_len,
                                  ca_request->iv,
-                                 session_key,
+                                 session->session_key,
                                  ca_request->encrypted_inner_ca_request.data,
                                  ca_request->tag);
-out:
-  atap_free(inner_ca_request_buf);
+  atap_memset(inner_ca_request_buf, 0, inner_ca_request_len);
+  atap_arena_free(&session->arena, inner_ca_request_buf);
   return ret;
 }
 
-static AtapResult decrypt_encrypted_message(AtapOps* ops,
-                                            const uint8_t* buf,
+/* Decrypts the encrypted message in |buf| with |key|. On success,
+ * |*plaintext| points to |*plaintext_len| bytes of plaintext. If
+ * |in_place| is true and the ops support it, the ciphertext in |buf| is
+ * overwritten and |*plaintext| points into |buf|. Otherwise a new buffer
+ * is allocated from the arena of |session| for |*plaintext| and
+ * |*allocated| is set to true; the caller must then free it with
+ * atap_arena_free().
+ */
+static AtapResult decrypt_encrypted_message(AtapSession* session,
+                                            AtapOps* ops,
+                                            uint8_t* buf,
                                             uint32_t buf_size,
-                                            uint8_t* key,
+                                            const uint8_t* key,
+                                            bool in_place,
                                             uint8_t** plaintext,
-                                            uint32_t* plaintext_len) {
-  const uint8_t *iv = NULL, *tag = NULL, *ciphertext = NULL;
+                                            uint32_t* plaintext_len,
+                                            bool* allocated) {
+  const uint8_t *iv = NULL, *tag = NULL;
+  uint8_t* ciphertext = NULL;
   uint32_t encrypted_len = 0;
-  uint8_t* buf_ptr = (uint8_t*)buf + ATAP_HEADER_LEN;
+  uint8_t* buf_ptr = buf + ATAP_HEADER_LEN;
+  AtapResult ret = ATAP_RESULT_OK;
 
+  *allocated = false;
   if (!validate_encrypted_message(buf, buf_size)) {
     return ATAP_RESULT_ERROR_INVALID_INPUT;
   }
@@ -254,122 +231,154 @@ static AtapResult decrypt_encrypted_message(AtapOps* ops,
   ciphertext = buf_ptr;
   buf_ptr += encrypted_len;
   tag = buf_ptr;
+  *plaintext_len = encrypted_len;
 
-  *plaintext = (uint8_t*)atap_malloc(encrypted_len);
+  if (in_place &&
+      atap_has_optional_op(session, aes_gcm_128_decrypt_in_place)) {
+    ret = session->optional_ops->aes_gcm_128_decrypt_in_place(
+        ops, ciphertext, encrypted_len, iv, key, tag);
+    if (ret != ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION) {
+      *plaintext = ciphertext;
+      return ret;
+    }
+  }
+
+  *plaintext = (uint8_t*)atap_arena_alloc(&session->arena, encrypted_len);
   if (*plaintext == NULL) {
     return ATAP_RESULT_ERROR_OOM;
   }
-  *plaintext_len = encrypted_len;
-
+  *allocated = true;
   return ops->aes_gcm_128_decrypt(
-      ops, ciphertext, *plaintext_len, iv, session_key, tag, *plaintext);
+      ops, ciphertext, encrypted_len, iv, key, tag, *plaintext);
 }
 
-static AtapResult write_attestation_data(AtapOps* ops,
-                                         uint8_t** buf_ptr,
-                                         AtapKeyType key_type) {
-  AtapBlob key;
-  AtapCertChain cert_chain;
-  AtapResult ret = ATAP_RESULT_OK;
-
-  atap_memset(&key, 0, sizeof(key));
-  atap_memset(&cert_chain, 0, sizeof(cert_chain));
-
-  if (!copy_cert_chain_from_buf(buf_ptr, &cert_chain)) {
-    ret = ATAP_RESULT_ERROR_OOM;
-    goto out;
-  }
-  if (!copy_blob_from_buf(buf_ptr, &key)) {
-    ret = ATAP_RESULT_ERROR_OOM;
-    goto out;
-  }
-  if (key.data_length == 0 && cert_chain.entry_count) {
-    ret = ops->write_attestation_key(ops, key_type, NULL, &cert_chain);
-  } else if (key.data_length && cert_chain.entry_count) {
-    ret = ops->write_attestation_key(ops, key_type, &key, &cert_chain);
-  } else if (key.data_length && cert_chain.entry_count == 0) {
-    /* We never issue a key without a certificate chain */
-    ret = ATAP_RESULT_ERROR_INVALID_INPUT;
-  } else if (key_type != ATAP_KEY_TYPE_edDSA &&
-             key_type != ATAP_KEY_TYPE_SPECIAL &&
-             key_type != ATAP_KEY_TYPE_EPID &&
-             key_type != ATAP_KEY_TYPE_edDSA_SOM &&
-             key_type != ATAP_KEY_TYPE_EPID_SOM) {
-    /* edDSA, EPID, and special purpose key are optional in version 1*/
-    ret = ATAP_RESULT_ERROR_INVALID_INPUT;
+/* atap_set_ca_response() has no resume step, so an op that returns
+ * ATAP_RESULT_PENDING there cannot be waited for. Reports it as
+ * unsupported instead of passing the pending result up as a failure.
+ */
+static AtapResult reject_pending(AtapResult ret, const char* op_name) {
+  if (ret == ATAP_RESULT_PENDING) {
+    atap_errorv(op_name,
+                " returned ATAP_RESULT_PENDING, which is not supported by "
+                "atap_set_ca_response()",
+                NULL);
+    return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
   }
-
-out:
-  free_blob(key);
-  free_cert_chain(cert_chain);
   return ret;
 }
 
-static AtapResult write_inner_ca_response(AtapOps* ops,
-                                          uint8_t* inner_ca_resp_ptr,
-                                          uint32_t inner_ca_resp_len) {
-  AtapResult ret = 0;
-  uint8_t** buf_ptr = &inner_ca_resp_ptr;
-  bool som = is_som_operation(operation);
+static AtapResult write_attestation_keys(AtapSession* session,
+                                         AtapOps* ops,
+                                         const AtapAttestationKey* keys,
+                                         uint32_t key_count) {
+  AtapResult ret = ATAP_RESULT_OK;
+  uint32_t i = 0;
 
-  if (!validate_inner_ca_response(
-          inner_ca_resp_ptr, inner_ca_resp_len, operation)) {
-    return ATAP_RESULT_ERROR_INVALID_INPUT;
-  }
-  if (som) {
-    /* SoM key operation doesn't have hex UUID field. */
-    *buf_ptr += ATAP_HEADER_LEN;
-  } else {
-    ret = ops->write_hex_uuid(ops, &inner_ca_resp_ptr[ATAP_HEADER_LEN]);
-    *buf_ptr += (ATAP_HEADER_LEN + ATAP_HEX_UUID_LEN);
-    if (ret != ATAP_RESULT_OK) {
-      return ret;
+  if (atap_has_optional_op(session, write_attestation_keys)) {
+    ret = session->optional_ops->write_attestation_keys(ops, keys, key_count);
+    if (ret != ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION) {
+      /* Checked here so that a pending batch does not fall back. */
+      return reject_pending(ret, "write_attestation_keys");
     }
   }
-  if (som) {
-    ret = write_attestation_data(ops, buf_ptr, ATAP_KEY_TYPE_RSA_SOM);
-    if (ret != ATAP_RESULT_OK) {
-      return ret;
-    }
-    ret = write_attestation_data(ops, buf_ptr, ATAP_KEY_TYPE_ECDSA_SOM);
-    if (ret != ATAP_RESULT_OK) {
-      return ret;
-    }
-    ret = write_attestation_data(ops, buf_ptr, ATAP_KEY_TYPE_edDSA_SOM);
+  for (i = 0; i < key_count; ++i) {
+    ret = ops->write_attestation_key(
+        ops,
+        keys[i].key_type,
+        keys[i].key.data_length ? &keys[i].key : NULL,
+        &keys[i].cert_chain);
+    ret = reject_pending(ret, "write_attestation_key");
     /* Device may not support edDSA */
-    if (ret != ATAP_RESULT_OK && ret != ATAP_RESULT_ERROR_UNSUPPORTED_ALGORITHM) {
-      return ret;
+    if (ret == ATAP_RESULT_ERROR_UNSUPPORTED_ALGORITHM &&
+        (keys[i].key_type == ATAP_KEY_TYPE_edDSA ||
+         keys[i].key_type == ATAP_KEY_TYPE_edDSA_SOM)) {
+      continue;
     }
-    ret = write_attestation_data(ops, buf_ptr, ATAP_KEY_TYPE_EPID_SOM);
     if (ret != ATAP_RESULT_OK) {
       return ret;
     }
-  } else {
-    ret = write_attestation_data(ops, buf_ptr, ATAP_KEY_TYPE_RSA);
-    if (ret != ATAP_RESULT_OK) {
-      return ret;
-    }
-    ret = write_attestation_data(ops, buf_ptr, ATAP_KEY_TYPE_ECDSA);
-    if (ret != ATAP_RESULT_OK) {
-      return ret;
-    }
-    ret = write_attestation_data(ops, buf_ptr, ATAP_KEY_TYPE_edDSA);
-    /* Device may not support edDSA */
-    if (ret != ATAP_RESULT_OK && ret != ATAP_RESULT_ERROR_UNSUPPORTED_ALGORITHM) {
-      return ret;
-    }
-    ret = write_attestation_data(ops, buf_ptr, ATAP_KEY_TYPE_EPID);
-    if (ret != ATAP_RESULT_OK) {
-      return ret;
-    }
-    /* Device may not support Special Cast key */
-    ret = write_attestation_data(ops, buf_ptr, ATAP_KEY_TYPE_SPECIAL);
+  }
+  return ATAP_RESULT_OK;
+}
+
+static AtapResult write_inner_ca_response(AtapSession* session,
+                                          AtapOps* ops,
+                                          uint8_t* inner_ca_resp_ptr,
+                                          uint32_t inner_ca_resp_len) {
+  AtapResult ret = 0;
+  AtapInnerCaResponse response;
+
+  /* Parse every key first, so nothing is written for a malformed response.
+   */
+  if (!parse_inner_ca_response(inner_ca_resp_ptr,
+                               inner_ca_resp_len,
+                               session->operation,
+                               &response)) {
+    return ATAP_RESULT_ERROR_INVALID_INPUT;
+  }
+  if (response.hex_uuid != NULL) {
+    ret = reject_pending(ops->write_hex_uuid(ops, response.hex_uuid),
+                         "write_hex_uuid");
     if (ret != ATAP_RESULT_OK) {
       return ret;
     }
   }
+  return write_attestation_keys(
+      session, ops, response.keys, response.key_count);
+}
 
-  return ATAP_RESULT_OK;
+static AtapResult traced_write_inner_ca_response(AtapSession* session,
+                                                 AtapOps* ops,
+                                                 uint8_t* inner_ca_resp_ptr,
+                                                 uint32_t inner_ca_resp_len) {
+  AtapResult ret = 0;
+
+  atap_trace(session,
+             ops,
+             ATAP_TRACE_PHASE_WRITE_INNER_CA_RESPONSE,
+             ATAP_TRACE_EVENT_BEGIN);
+  ret = write_inner_ca_response(
+      session, ops, inner_ca_resp_ptr, inner_ca_resp_len);
+  atap_trace(session,
+             ops,
+             ATAP_TRACE_PHASE_WRITE_INNER_CA_RESPONSE,
+             ATAP_TRACE_EVENT_END);
+  return ret;
+}
+
+AtapSession* atap_session_create(void) {
+  AtapSession* session = (AtapSession*)atap_malloc(sizeof(AtapSession));
+  if (session != NULL) {
+    atap_memset(session, 0, sizeof(AtapSession));
+  }
+  return session;
+}
+
+void atap_session_set_arena(AtapSession* session, void* buf, size_t size) {
+  atap_arena_init(&session->arena, buf, size);
+}
+
+void atap_set_arena(void* buf, size_t size) {
+  atap_session_set_arena(&default_session, buf, size);
+}
+
+void atap_session_set_optional_ops(AtapSession* session,
+                                   const AtapOptionalOps* optional_ops) {
+  session->optional_ops = optional_ops;
+}
+
+void atap_set_optional_ops(const AtapOptionalOps* optional_ops) {
+  atap_session_set_optional_ops(&default_session, optional_ops);
+}
+
+void atap_session_destroy(AtapSession* session) {
+  if (session == NULL) {
+    return;
+  }
+  atap_ca_response_abort(session);
+  atap_get_ca_request_abort(session);
+  atap_memset(session, 0, sizeof(AtapSession));
+  atap_free(session);
 }
 
 AtapResult atap_get_ca_request(AtapOps* ops,
@@ -377,125 +386,584 @@ AtapResult atap_get_ca_request(AtapOps* ops,
                                uint32_t operation_start_size,
                                uint8_t** ca_request_p,
                                uint32_t* ca_request_size_p) {
-  AtapResult ret = 0;
-  AtapKeyType auth_key_type = 0;
-  AtapCaRequest ca_request;
-  AtapInnerCaRequestProduct inner_ca_request_product;
-  AtapInnerCaRequestSom inner_ca_request_som;
-  atap_memset(&ca_request, 0, sizeof(AtapCaRequest));
-  atap_memset(&inner_ca_request_product, 0, sizeof(AtapInnerCaRequestProduct));
-  atap_memset(&inner_ca_request_som, 0, sizeof(AtapInnerCaRequestSom));
-
-  uint8_t ca_pubkey[ATAP_ECDH_KEY_LEN];
-
-  ret = initialize_session(ops,
-                           operation_start,
-                           operation_start_size,
-                           &auth_key_type,
-                           ca_pubkey,
-                           &ca_request);
-  bool som = is_som_operation(operation);
-  if (ret != ATAP_RESULT_OK) {
-    goto err;
+  return atap_get_ca_request_ex(&default_session,
+                                ops,
+                                operation_start,
+                                operation_start_size,
+                                ca_request_p,
+                                ca_request_size_p);
+}
+
+/* Starts the op of the current CA Request step. The result, which may be
+ * ATAP_RESULT_PENDING, is handled by finish_ca_request_step().
+ */
+static AtapResult start_ca_request_step(AtapSession* session, AtapOps* ops) {
+  AtapCaRequestState* state = &session->ca_request_state;
+  AtapInnerCaRequestProduct* product = &state->product;
+
+  switch (state->step) {
+    case ATAP_CA_REQUEST_STEP_GET_AUTH_KEY_TYPE:
+      return ops->get_auth_key_type(ops, &state->auth_key_type);
+    case ATAP_CA_REQUEST_STEP_COMPUTE_SESSION_KEY:
+      return compute_session_key(session, ops);
+    case ATAP_CA_REQUEST_STEP_READ_AUTH_KEY_CERT_CHAIN:
+      atap_trace(session,
+                 ops,
+                 ATAP_TRACE_PHASE_COMPUTE_AUTH_SIGNATURE,
+                 ATAP_TRACE_EVENT_BEGIN);
+      return ops->read_auth_key_cert_chain(ops,
+                                           &product->auth_key_cert_chain);
+    case ATAP_CA_REQUEST_STEP_AUTH_KEY_SIGN:
+      return auth_key_signature_generate(session, ops);
+#if ATAP_ENABLE_OPERATION_CERTIFY
+    case ATAP_CA_REQUEST_STEP_READ_RSA_PUBKEY:
+      atap_trace(session,
+                 ops,
+                 ATAP_TRACE_PHASE_READ_AVAILABLE_PUBLIC_KEYS,
+                 ATAP_TRACE_EVENT_BEGIN);
+      return read_attestation_public_key(
+          session, ops, ATAP_KEY_TYPE_RSA, &product->RSA_pubkey);
+    case ATAP_CA_REQUEST_STEP_READ_ECDSA_PUBKEY:
+      return read_attestation_public_key(
+          session, ops, ATAP_KEY_TYPE_ECDSA, &product->ECDSA_pubkey);
+    case ATAP_CA_REQUEST_STEP_READ_edDSA_PUBKEY:
+      return read_attestation_public_key(
+          session, ops, ATAP_KEY_TYPE_edDSA, &product->edDSA_pubkey);
+#endif
+    case ATAP_CA_REQUEST_STEP_READ_PRODUCT_ID:
+      return ops->read_product_id(ops, state->product_id);
+    case ATAP_CA_REQUEST_STEP_ENCRYPT_INNER_CA_REQUEST:
+      atap_trace(session,
+                 ops,
+                 ATAP_TRACE_PHASE_ENCRYPT_INNER_CA_REQUEST,
+                 ATAP_TRACE_EVENT_BEGIN);
+      return encrypt_inner_ca_request(
+          session, ops, product, &state->som, &state->ca_request);
+    default:
+      return ATAP_RESULT_ERROR_INVALID_INPUT;
   }
-  if (!som) {
-    if (auth_key_type != ATAP_KEY_TYPE_NONE) {
-      ret = compute_auth_signature(
-          ops, ca_pubkey, ca_request.device_pubkey, &inner_ca_request_product);
+}
+
+/* Handles the result |ret| of the op of the current CA Request step and,
+ * on success, moves to the next step.
+ */
+static AtapResult finish_ca_request_step(AtapSession* session,
+                                         AtapOps* ops,
+                                         AtapResult ret) {
+  AtapCaRequestState* state = &session->ca_request_state;
+  AtapInnerCaRequestProduct* product = &state->product;
+  AtapCaRequestStep next = ATAP_CA_REQUEST_STEP_DONE;
+  bool som = is_som_operation(session->operation);
+  bool certify = is_certify_operation(session->operation);
+
+  switch (state->step) {
+    case ATAP_CA_REQUEST_STEP_GET_AUTH_KEY_TYPE:
       if (ret != ATAP_RESULT_OK) {
-        goto err;
+        atap_trace(session,
+                   ops,
+                   ATAP_TRACE_PHASE_INITIALIZE_SESSION,
+                   ATAP_TRACE_EVENT_END);
       }
-    }
-
-    if (operation == ATAP_OPERATION_CERTIFY) {
-      ret = read_available_public_keys(ops, &inner_ca_request_product);
+      next = ATAP_CA_REQUEST_STEP_COMPUTE_SESSION_KEY;
+      break;
+    case ATAP_CA_REQUEST_STEP_COMPUTE_SESSION_KEY:
+      atap_trace(session,
+                 ops,
+                 ATAP_TRACE_PHASE_INITIALIZE_SESSION,
+                 ATAP_TRACE_EVENT_END);
+      if (som) {
+        // TODO: Set SOM ID hash (b/78599492)
+        next = ATAP_CA_REQUEST_STEP_ENCRYPT_INNER_CA_REQUEST;
+      } else if (state->auth_key_type != ATAP_KEY_TYPE_NONE) {
+        next = ATAP_CA_REQUEST_STEP_READ_AUTH_KEY_CERT_CHAIN;
+      } else if (certify) {
+        next = ATAP_CA_REQUEST_STEP_READ_RSA_PUBKEY;
+      } else {
+        next = ATAP_CA_REQUEST_STEP_READ_PRODUCT_ID;
+      }
+      break;
+    case ATAP_CA_REQUEST_STEP_READ_AUTH_KEY_CERT_CHAIN:
       if (ret != ATAP_RESULT_OK) {
-        goto err;
+        atap_trace(session,
+                   ops,
+                   ATAP_TRACE_PHASE_COMPUTE_AUTH_SIGNATURE,
+                   ATAP_TRACE_EVENT_END);
+      }
+      next = ATAP_CA_REQUEST_STEP_AUTH_KEY_SIGN;
+      break;
+    case ATAP_CA_REQUEST_STEP_AUTH_KEY_SIGN:
+      atap_trace(session,
+                 ops,
+                 ATAP_TRACE_PHASE_COMPUTE_AUTH_SIGNATURE,
+                 ATAP_TRACE_EVENT_END);
+      next = certify ? ATAP_CA_REQUEST_STEP_READ_RSA_PUBKEY
+                     : ATAP_CA_REQUEST_STEP_READ_PRODUCT_ID;
+      break;
+#if ATAP_ENABLE_OPERATION_CERTIFY
+    case ATAP_CA_REQUEST_STEP_READ_RSA_PUBKEY:
+    case ATAP_CA_REQUEST_STEP_READ_ECDSA_PUBKEY:
+      if (ret != ATAP_RESULT_OK) {
+        atap_trace(session,
+                   ops,
+                   ATAP_TRACE_PHASE_READ_AVAILABLE_PUBLIC_KEYS,
+                   ATAP_TRACE_EVENT_END);
+      }
+      next = state->step + 1;
+      break;
+    case ATAP_CA_REQUEST_STEP_READ_edDSA_PUBKEY:
+      /* edDSA support is not required in the initial version */
+      if (ret == ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION) {
+        atap_arena_free(&session->arena, product->edDSA_pubkey.data);
+        product->edDSA_pubkey.data = NULL;
+        product->edDSA_pubkey.data_length = 0;
+        ret = ATAP_RESULT_OK;
+      }
+      atap_trace(session,
+                 ops,
+                 ATAP_TRACE_PHASE_READ_AVAILABLE_PUBLIC_KEYS,
+                 ATAP_TRACE_EVENT_END);
+      next = ATAP_CA_REQUEST_STEP_READ_PRODUCT_ID;
+      break;
+#endif
+    case ATAP_CA_REQUEST_STEP_READ_PRODUCT_ID:
+      if (ret == ATAP_RESULT_OK) {
+        ret = ops->sha256(ops,
+                          state->product_id,
+                          ATAP_PRODUCT_ID_LEN,
+                          product->product_id_hash);
       }
+      next = ATAP_CA_REQUEST_STEP_ENCRYPT_INNER_CA_REQUEST;
+      break;
+    case ATAP_CA_REQUEST_STEP_ENCRYPT_INNER_CA_REQUEST:
+      atap_trace(session,
+                 ops,
+                 ATAP_TRACE_PHASE_ENCRYPT_INNER_CA_REQUEST,
+                 ATAP_TRACE_EVENT_END);
+      next = ATAP_CA_REQUEST_STEP_DONE;
+      break;
+    default:
+      return ATAP_RESULT_ERROR_INVALID_INPUT;
+  }
+  if (ret == ATAP_RESULT_OK) {
+    state->step = next;
+  }
+  return ret;
+}
+
+/* Clears the secrets and frees the buffers of the CA Request in progress,
+ * if any.
+ */
+static void ca_request_release(AtapSession* session, bool clear_secrets) {
+  AtapCaRequestState* state = &session->ca_request_state;
+
+  if (state->step == ATAP_CA_REQUEST_STEP_NONE) {
+    return;
+  }
+  if (clear_secrets) {
+    atap_memset(session->shared_secret, 0, ATAP_ECDH_SHARED_SECRET_LEN);
+    atap_memset(session->session_key, 0, ATAP_AES_128_KEY_LEN);
+  }
+  arena_free_inner_ca_request_product(&session->arena, &state->product);
+  arena_free_ca_request(&session->arena, &state->ca_request);
+  atap_arena_release(&session->arena, state->arena_mark);
+  atap_memset(state, 0, sizeof(AtapCaRequestState));
+}
+
+/* Finishes the current step with |ret| and runs the following steps until
+ * the CA Request is built, an op is pending, or a step fails.
+ */
+static AtapResult run_ca_request(AtapSession* session,
+                                 AtapOps* ops,
+                                 AtapResult ret,
+                                 uint8_t** ca_request_p,
+                                 uint32_t* ca_request_size_p) {
+  AtapCaRequestState* state = &session->ca_request_state;
+
+  *ca_request_p = NULL;
+  *ca_request_size_p = 0;
+  for (;;) {
+    if (ret == ATAP_RESULT_PENDING) {
+      state->waiting = true;
+      return ret;
     }
-    ret = read_product_id_hash(ops, &inner_ca_request_product);
+    ret = finish_ca_request_step(session, ops, ret);
     if (ret != ATAP_RESULT_OK) {
       goto err;
     }
-  } else{
-    // TODO: Set SOM ID hash (b/78599492)
+    if (state->step == ATAP_CA_REQUEST_STEP_DONE) {
+      break;
+    }
+    ret = start_ca_request_step(session, ops);
   }
 
-  ret = encrypt_inner_ca_request(
-      ops, &inner_ca_request_product, &inner_ca_request_som, &ca_request);
-  if (ret != ATAP_RESULT_OK) {
-    goto err;
-  }
-  *ca_request_size_p = ca_request_serialized_size(&ca_request);
+  *ca_request_size_p = ca_request_serialized_size(&state->ca_request);
   *ca_request_p = (uint8_t*)atap_malloc(*ca_request_size_p);
   if (*ca_request_p == NULL) {
     *ca_request_size_p = 0;
     ret = ATAP_RESULT_ERROR_OOM;
     goto err;
   }
-  append_ca_request_to_buf(*ca_request_p, &ca_request);
-  goto out;
+  append_ca_request_to_buf(*ca_request_p, &state->ca_request);
+  ca_request_release(session, false);
+  return ret;
 
 err:
-  /* clear global secrets */
-  atap_memset(session_shared_secret, 0, ATAP_ECDH_SHARED_SECRET_LEN);
-  atap_memset(session_key, 0, ATAP_AES_128_KEY_LEN);
-  *ca_request_p = NULL;
-  *ca_request_size_p = 0;
-out:
-  free_inner_ca_request_product(&inner_ca_request_product);
-  free_ca_request(&ca_request);
+  ca_request_release(session, true);
   return ret;
 }
 
-AtapResult atap_set_ca_response(AtapOps* ops,
-                                const uint8_t* ca_response,
-                                uint32_t ca_response_size) {
+AtapResult atap_get_ca_request_begin(AtapSession* session,
+                                     AtapOps* ops,
+                                     const uint8_t* operation_start,
+                                     uint32_t operation_start_size,
+                                     uint8_t** ca_request_p,
+                                     uint32_t* ca_request_size_p) {
+  AtapResult ret = 0;
+  AtapCaRequestState* state = &session->ca_request_state;
+
+  atap_get_ca_request_abort(session);
+  state->arena_mark = atap_arena_mark(&session->arena);
+  state->step = ATAP_CA_REQUEST_STEP_GET_AUTH_KEY_TYPE;
+
+  atap_trace(session,
+             ops,
+             ATAP_TRACE_PHASE_INITIALIZE_SESSION,
+             ATAP_TRACE_EVENT_BEGIN);
+  ret = parse_operation_start(session, operation_start, operation_start_size);
+  if (ret == ATAP_RESULT_OK) {
+    ret = start_ca_request_step(session, ops);
+  }
+  return run_ca_request(session, ops, ret, ca_request_p, ca_request_size_p);
+}
+
+AtapResult atap_get_ca_request_resume(AtapSession* session,
+                                      AtapOps* ops,
+                                      AtapResult op_result,
+                                      uint8_t** ca_request_p,
+                                      uint32_t* ca_request_size_p) {
+  AtapCaRequestState* state = &session->ca_request_state;
+
+  if (!state->waiting || op_result == ATAP_RESULT_PENDING) {
+    *ca_request_p = NULL;
+    *ca_request_size_p = 0;
+    return ATAP_RESULT_ERROR_INVALID_INPUT;
+  }
+  state->waiting = false;
+  return run_ca_request(
+      session, ops, op_result, ca_request_p, ca_request_size_p);
+}
+
+void atap_get_ca_request_abort(AtapSession* session) {
+  ca_request_release(session, true);
+}
+
+AtapResult atap_get_ca_request_ex(AtapSession* session,
+                                  AtapOps* ops,
+                                  const uint8_t* operation_start,
+                                  uint32_t operation_start_size,
+                                  uint8_t** ca_request_p,
+                                  uint32_t* ca_request_size_p) {
+  return atap_get_ca_request_begin(session,
+                                   ops,
+                                   operation_start,
+                                   operation_start_size,
+                                   ca_request_p,
+                                   ca_request_size_p);
+}
+
+/* Stores the |inner_ca_resp_len| bytes of decrypted Inner CA Response at
+ * |inner_ca_resp|, first removing the SoC global key layer for encrypted
+ * issue operations. That layer is decrypted in place if |in_place| is
+ * true.
+ */
+static AtapResult store_inner_ca_response(AtapSession* session,
+                                          AtapOps* ops,
+                                          uint8_t* inner_ca_resp,
+                                          uint32_t inner_ca_resp_len,
+                                          bool in_place) {
   AtapResult ret = 0;
-  uint8_t* inner_ca_resp = NULL;
   uint8_t* inner_inner_ca_resp = NULL;
-  uint8_t* inner_ca_resp_ptr = NULL;
-  uint32_t inner_ca_resp_len = 0;
   uint32_t inner_inner_ca_resp_len = 0;
+  bool inner_inner_ca_resp_allocated = false;
   uint8_t soc_global_key[ATAP_AES_128_KEY_LEN];
 
-  ret = decrypt_encrypted_message(ops,
-                                  ca_response,
-                                  ca_response_size,
-                                  session_key,
-                                  &inner_ca_resp,
-                                  &inner_ca_resp_len);
-  if (ret != ATAP_RESULT_OK) {
-    goto out;
-  }
-  inner_ca_resp_ptr = inner_ca_resp;
-  if (operation == ATAP_OPERATION_ISSUE_ENCRYPTED ||
-      operation == ATAP_OPERATION_ISSUE_ENCRYPTED_SOM_KEY) {
+  if (is_encrypted_operation(session->operation)) {
     /* Decrypt Encrypted Inner CA Response (encrypted) with SoC global key */
-    ret = ops->read_soc_global_key(ops, soc_global_key);
+    ret = reject_pending(ops->read_soc_global_key(ops, soc_global_key),
+                         "read_soc_global_key");
     if (ret != ATAP_RESULT_OK) {
-      goto out;
+      return ret;
     }
-    ret = decrypt_encrypted_message(ops,
+    atap_trace(session,
+               ops,
+               ATAP_TRACE_PHASE_DECRYPT_ENCRYPTED_MESSAGE,
+               ATAP_TRACE_EVENT_BEGIN);
+    ret = decrypt_encrypted_message(session,
+                                    ops,
                                     inner_ca_resp,
                                     inner_ca_resp_len,
                                     soc_global_key,
+                                    in_place,
                                     &inner_inner_ca_resp,
-                                    &inner_inner_ca_resp_len);
+                                    &inner_inner_ca_resp_len,
+                                    &inner_inner_ca_resp_allocated);
+    atap_trace(session,
+               ops,
+               ATAP_TRACE_PHASE_DECRYPT_ENCRYPTED_MESSAGE,
+               ATAP_TRACE_EVENT_END);
+    atap_memset(soc_global_key, 0, ATAP_AES_128_KEY_LEN);
+    if (ret == ATAP_RESULT_OK) {
+      ret = traced_write_inner_ca_response(
+          session, ops, inner_inner_ca_resp, inner_inner_ca_resp_len);
+    }
+    if (inner_inner_ca_resp_allocated) {
+      atap_memset(inner_inner_ca_resp, 0, inner_inner_ca_resp_len);
+      atap_arena_free(&session->arena, inner_inner_ca_resp);
+    }
+    return ret;
+  }
+  return traced_write_inner_ca_response(
+      session, ops, inner_ca_resp, inner_ca_resp_len);
+}
+
+/* Decrypts and stores the CA Response in |ca_response|. If |in_place| is
+ * false, |ca_response| is not modified.
+ */
+static AtapResult set_ca_response(AtapSession* session,
+                                  AtapOps* ops,
+                                  uint8_t* ca_response,
+                                  uint32_t ca_response_size,
+                                  bool in_place) {
+  AtapResult ret = 0;
+  uint8_t* inner_ca_resp = NULL;
+  uint32_t inner_ca_resp_len = 0;
+  bool inner_ca_resp_allocated = false;
+  size_t arena_mark = atap_arena_mark(&session->arena);
+
+  atap_trace(session,
+             ops,
+             ATAP_TRACE_PHASE_DECRYPT_ENCRYPTED_MESSAGE,
+             ATAP_TRACE_EVENT_BEGIN);
+  ret = decrypt_encrypted_message(session,
+                                  ops,
+                                  ca_response,
+                                  ca_response_size,
+                                  session->session_key,
+                                  in_place,
+                                  &inner_ca_resp,
+                                  &inner_ca_resp_len,
+                                  &inner_ca_resp_allocated);
+  atap_trace(session,
+             ops,
+             ATAP_TRACE_PHASE_DECRYPT_ENCRYPTED_MESSAGE,
+             ATAP_TRACE_EVENT_END);
+  if (ret == ATAP_RESULT_OK) {
+    /* The outer plaintext is always writable, so the inner layer is
+     * decrypted in place when possible.
+     */
+    ret = store_inner_ca_response(session,
+                                  ops,
+                                  inner_ca_resp,
+                                  inner_ca_resp_len,
+                                  in_place || inner_ca_resp_allocated);
+  }
+  if (inner_ca_resp_allocated) {
+    atap_memset(inner_ca_resp, 0, inner_ca_resp_len);
+    atap_arena_free(&session->arena, inner_ca_resp);
+  }
+  atap_arena_release(&session->arena, arena_mark);
+  return ret;
+}
+
+AtapResult atap_set_ca_response(AtapOps* ops,
+                                const uint8_t* ca_response,
+                                uint32_t ca_response_size) {
+  return atap_set_ca_response_ex(
+      &default_session, ops, ca_response, ca_response_size);
+}
+
+AtapResult atap_set_ca_response_ex(AtapSession* session,
+                                   AtapOps* ops,
+                                   const uint8_t* ca_response,
+                                   uint32_t ca_response_size) {
+  return set_ca_response(
+      session, ops, (uint8_t*)ca_response, ca_response_size, false);
+}
+
+AtapResult atap_set_ca_response_in_place(AtapOps* ops,
+                                         uint8_t* ca_response,
+                                         uint32_t ca_response_size) {
+  return atap_set_ca_response_in_place_ex(
+      &default_session, ops, ca_response, ca_response_size);
+}
+
+AtapResult atap_set_ca_response_in_place_ex(AtapSession* session,
+                                            AtapOps* ops,
+                                            uint8_t* ca_response,
+                                            uint32_t ca_response_size) {
+  return set_ca_response(session, ops, ca_response, ca_response_size, true);
+}
+
+void atap_ca_response_abort(AtapSession* session) {
+  AtapCaResponseStream* stream = &session->ca_response_stream;
+
+  if (stream->gcm_ctx != NULL) {
+    stream->optional_ops->aes_gcm_128_decrypt_finish(
+        stream->ops, stream->gcm_ctx, NULL);
+  }
+  if (stream->buf != NULL) {
+    atap_memset(stream->buf, 0, stream->size);
+    atap_arena_free(&session->arena, stream->buf);
+    atap_arena_release(&session->arena, stream->arena_mark);
+  }
+  atap_memset(stream, 0, sizeof(AtapCaResponseStream));
+}
+
+AtapResult atap_ca_response_begin(AtapSession* session, AtapOps* ops) {
+  atap_ca_response_abort(session);
+  session->ca_response_stream.ops = ops;
+  return ATAP_RESULT_OK;
+}
+
+/* Called once the header, IV and ciphertext length have been received.
+ * Allocates the buffer for the whole CA Response and starts streaming
+ * decryption if the ops support it.
+ */
+static AtapResult ca_response_stream_start(AtapSession* session) {
+  AtapCaResponseStream* stream = &session->ca_response_stream;
+  AtapOps* ops = stream->ops;
+  uint8_t* header_ptr = &stream->prefix[4];
+  uint8_t* buf_ptr = &stream->prefix[ATAP_HEADER_LEN + ATAP_GCM_IV_LEN];
+  uint32_t message_len = 0;
+  uint32_t encrypted_len = 0;
+  AtapResult ret = ATAP_RESULT_OK;
+
+  if (stream->prefix[0] != ATAP_PROTOCOL_VERSION &&
+      stream->prefix[0] != ATAP_PROTOCOL_VERSION_1) {
+    return ATAP_RESULT_ERROR_INVALID_INPUT;
+  }
+  copy_uint32_from_buf(&header_ptr, &message_len);
+  copy_uint32_from_buf(&buf_ptr, &encrypted_len);
+  /* The largest CA Response wraps an Inner CA Response in two layers. */
+  if (encrypted_len >
+          ATAP_INNER_CA_RESPONSE_LEN_MAX + ATAP_ENCRYPTED_MESSAGE_OVERHEAD ||
+      message_len != ATAP_CA_RESPONSE_PREFIX_LEN - ATAP_HEADER_LEN +
+                         encrypted_len + ATAP_GCM_TAG_LEN) {
+    return ATAP_RESULT_ERROR_INVALID_INPUT;
+  }
+  stream->size = ATAP_HEADER_LEN + message_len;
+  stream->arena_mark = atap_arena_mark(&session->arena);
+  stream->buf = (uint8_t*)atap_arena_alloc(&session->arena, stream->size);
+  if (stream->buf == NULL) {
+    return ATAP_RESULT_ERROR_OOM;
+  }
+  atap_memcpy(stream->buf, stream->prefix, ATAP_CA_RESPONSE_PREFIX_LEN);
+
+  if (atap_has_optional_op(session, aes_gcm_128_decrypt_begin) &&
+      atap_has_optional_op(session, aes_gcm_128_decrypt_update) &&
+      atap_has_optional_op(session, aes_gcm_128_decrypt_finish)) {
+    /* |gcm_ctx| stays with these ops if the session's are replaced. */
+    stream->optional_ops = session->optional_ops;
+    ret = stream->optional_ops->aes_gcm_128_decrypt_begin(
+        ops,
+        &stream->prefix[ATAP_HEADER_LEN],
+        session->session_key,
+        &stream->gcm_ctx);
+    if (ret == ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION) {
+      stream->gcm_ctx = NULL;
+      ret = ATAP_RESULT_OK;
+    }
+  }
+  return ret;
+}
+
+AtapResult atap_ca_response_update(AtapSession* session,
+                                   const uint8_t* data,
+                                   uint32_t data_size) {
+  AtapCaResponseStream* stream = &session->ca_response_stream;
+  uint32_t ciphertext_end = 0;
+  uint32_t start = 0;
+  uint32_t len = 0;
+  AtapResult ret = ATAP_RESULT_OK;
+
+  if (stream->ops == NULL) {
+    return ATAP_RESULT_ERROR_INVALID_INPUT;
+  }
+  if (stream->buf == NULL) {
+    len = ATAP_CA_RESPONSE_PREFIX_LEN - stream->received;
+    if (len > data_size) {
+      len = data_size;
+    }
+    atap_memcpy(&stream->prefix[stream->received], data, len);
+    stream->received += len;
+    data += len;
+    data_size -= len;
+    if (stream->received < ATAP_CA_RESPONSE_PREFIX_LEN) {
+      return ATAP_RESULT_OK;
+    }
+    ret = ca_response_stream_start(session);
     if (ret != ATAP_RESULT_OK) {
-      goto out;
+      goto fail;
+    }
+  }
+  if (data_size > stream->size - stream->received) {
+    ret = ATAP_RESULT_ERROR_INVALID_INPUT;
+    goto fail;
+  }
+  start = stream->received;
+  atap_memcpy(&stream->buf[start], data, data_size);
+  stream->received += data_size;
+
+  /* Decrypt whatever part of this chunk is ciphertext. */
+  ciphertext_end = stream->size - ATAP_GCM_TAG_LEN;
+  if (stream->gcm_ctx != NULL && start < ciphertext_end) {
+    len = (stream->received < ciphertext_end ? stream->received
+                                             : ciphertext_end) -
+          start;
+    if (len) {
+      ret = stream->optional_ops->aes_gcm_128_decrypt_update(
+          stream->ops,
+          stream->gcm_ctx,
+          &stream->buf[start],
+          len,
+          &stream->buf[start]);
+      if (ret != ATAP_RESULT_OK) {
+        goto fail;
+      }
     }
-    inner_ca_resp_ptr = inner_inner_ca_resp;
-    inner_ca_resp_len = inner_inner_ca_resp_len;
   }
-  ret = write_inner_ca_response(ops, inner_ca_resp_ptr, inner_ca_resp_len);
+  return ATAP_RESULT_OK;
 
-out:
-  if (inner_ca_resp) {
-    atap_free(inner_ca_resp);
+fail:
+  atap_ca_response_abort(session);
+  return ret;
+}
+
+AtapResult atap_ca_response_finish(AtapSession* session) {
+  AtapCaResponseStream* stream = &session->ca_response_stream;
+  AtapOps* ops = stream->ops;
+  void* gcm_ctx = stream->gcm_ctx;
+  AtapResult ret = ATAP_RESULT_OK;
+
+  if (ops == NULL || stream->buf == NULL || stream->received != stream->size) {
+    atap_ca_response_abort(session);
+    return ATAP_RESULT_ERROR_INVALID_INPUT;
   }
-  if (inner_inner_ca_resp) {
-    atap_free(inner_inner_ca_resp);
+  if (gcm_ctx != NULL) {
+    stream->gcm_ctx = NULL;
+    ret = stream->optional_ops->aes_gcm_128_decrypt_finish(
+        ops, gcm_ctx, &stream->buf[stream->size - ATAP_GCM_TAG_LEN]);
+    if (ret == ATAP_RESULT_OK) {
+      ret = store_inner_ca_response(
+          session,
+          ops,
+          &stream->buf[ATAP_CA_RESPONSE_PREFIX_LEN],
+          stream->size - ATAP_CA_RESPONSE_PREFIX_LEN - ATAP_GCM_TAG_LEN,
+          true);
+    }
+  } else {
+    ret = set_ca_response(session, ops, stream->buf, stream->size, true);
   }
+  atap_ca_response_abort(session);
   return ret;
 }
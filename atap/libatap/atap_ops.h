@@ -26,6 +26,25 @@ extern "C" {
 
 /* High-level operations/functions/methods that are platform
  * dependent.
+ *
+ * Ops backed by a TEE or secure storage may block for a long time. When
+ * called from atap_get_ca_request_begin() or atap_get_ca_request_resume(),
+ * read_product_id, get_auth_key_type, read_auth_key_cert_chain,
+ * read_attestation_public_key and auth_key_sign may instead start the work
+ * and return ATAP_RESULT_PENDING. The op then finishes on its own,
+ * writing its outputs to the buffers it was given, which stay valid until
+ * its result is passed to atap_get_ca_request_resume(). Everywhere else,
+ * ATAP_RESULT_PENDING is treated as an error. Pending ops are only
+ * supported while building the CA Request: atap_set_ca_response() has no
+ * resume step, so read_soc_global_key, write_hex_uuid,
+ * write_attestation_key and write_attestation_keys must finish
+ * synchronously. If one returns ATAP_RESULT_PENDING there,
+ * atap_set_ca_response() fails with
+ * ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION.
+ *
+ * Every member must be set. New optional ops are added to AtapOptionalOps
+ * rather than here, so that tables filled in field by field keep working
+ * unchanged.
  */
 struct AtapOps {
   /* This pointer can be used by the application/TEE and is typically
@@ -58,7 +77,7 @@ struct AtapOps {
   /* Writes the |key_type| attestation |key| and |cert_chain|. The data
    * MUST be stored in a location that cannot be read or written to by
    * Android. For certify operations, |key| will be NULL. On success,
-   * returns ATAP_RESULT_OK.
+   * returns ATAP_RESULT_OK. Must not return ATAP_RESULT_PENDING.
    */
   AtapResult (*write_attestation_key)(AtapOps* ops,
                                       AtapKeyType key_type,
@@ -80,7 +99,8 @@ struct AtapOps {
   /* Reads the SoC global key. If an SoC global key is not supported,
    * ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION is returned and nothing is
    * written to |global_key|. On success, returns ATAP_RESULT_OK and writes
-   * ATAP_AES_128_KEY_LEN bytes to |global_key|.
+   * ATAP_AES_128_KEY_LEN bytes to |global_key|. Must not return
+   * ATAP_RESULT_PENDING.
    */
   AtapResult (*read_soc_global_key)(AtapOps* ops,
                                     uint8_t global_key[ATAP_AES_128_KEY_LEN]);
@@ -88,6 +108,7 @@ struct AtapOps {
   /* Writes the hex encoded UUID that appears in the subjectName of the
    * Product Key Certificate to storage. The UUID will be read by
    * invoking a fastboot command. On success, returns ATAP_RESULT_OK.
+   * Must not return ATAP_RESULT_PENDING.
    */
   AtapResult (*write_hex_uuid)(AtapOps* ops,
                                const uint8_t uuid[ATAP_HEX_UUID_LEN]);
@@ -170,6 +191,95 @@ struct AtapOps {
                             uint32_t okm_len);
 };
 
+/* Optional ops, added after AtapOps. libatap only calls them for a
+ * session they were registered on with atap_session_set_optional_ops() or
+ * atap_set_optional_ops(). Each op is passed the AtapOps of the call it
+ * belongs to.
+ *
+ * |struct_size| must be set to sizeof(AtapOptionalOps). libatap treats
+ * every member that does not fit below |struct_size| as NULL, so a table
+ * built against an older version of this header stays valid as new ops
+ * are appended. Any member may be NULL.
+ */
+struct AtapOptionalOps {
+  uint32_t struct_size;
+
+  /* Same as aes_gcm_128_encrypt(), but encrypts |len| bytes of |buf| in
+   * place. May be NULL, or return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION,
+   * in which case libatap uses aes_gcm_128_encrypt() with a separate
+   * output buffer.
+   */
+  AtapResult (*aes_gcm_128_encrypt_in_place)(
+      AtapOps* ops,
+      uint8_t* buf,
+      uint32_t len,
+      const uint8_t iv[ATAP_GCM_IV_LEN],
+      const uint8_t key[ATAP_AES_128_KEY_LEN],
+      uint8_t tag[ATAP_GCM_TAG_LEN]);
+
+  /* Same as aes_gcm_128_decrypt(), but decrypts |len| bytes of |buf| in
+   * place. The contents of |buf| are unspecified on failure. May be NULL,
+   * or return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION, in which case
+   * libatap uses aes_gcm_128_decrypt() with a separate output buffer.
+   */
+  AtapResult (*aes_gcm_128_decrypt_in_place)(
+      AtapOps* ops,
+      uint8_t* buf,
+      uint32_t len,
+      const uint8_t iv[ATAP_GCM_IV_LEN],
+      const uint8_t key[ATAP_AES_128_KEY_LEN],
+      const uint8_t tag[ATAP_GCM_TAG_LEN]);
+
+  /* Streaming AES-128-GCM decryption, used by
+   * atap_ca_response_update(). aes_gcm_128_decrypt_begin() sets up |*ctx|
+   * to decrypt with |key| and |iv|. aes_gcm_128_decrypt_update() decrypts
+   * the next |len| bytes of |ciphertext| to |plaintext|, which may equal
+   * |ciphertext|. aes_gcm_128_decrypt_finish() checks |tag| against all of
+   * the ciphertext and releases |ctx|; if |tag| is NULL, |ctx| is released
+   * without checking. finish must be called exactly once for every
+   * successful begin, and plaintext must not be used until it returns
+   * ATAP_RESULT_OK. They are only used if all three are set, and begin
+   * may return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION; otherwise libatap
+   * buffers the ciphertext and decrypts it when the CA Response is
+   * complete.
+   */
+  AtapResult (*aes_gcm_128_decrypt_begin)(
+      AtapOps* ops,
+      const uint8_t iv[ATAP_GCM_IV_LEN],
+      const uint8_t key[ATAP_AES_128_KEY_LEN],
+      void** ctx);
+  AtapResult (*aes_gcm_128_decrypt_update)(AtapOps* ops,
+                                           void* ctx,
+                                           const uint8_t* ciphertext,
+                                           uint32_t len,
+                                           uint8_t* plaintext);
+  AtapResult (*aes_gcm_128_decrypt_finish)(
+      AtapOps* ops, void* ctx, const uint8_t tag[ATAP_GCM_TAG_LEN]);
+
+  /* Writes all |key_count| attestation keys and cert chains of a CA
+   * Response at once, so they can be committed to storage in a single
+   * transaction. The same storage rules as write_attestation_key
+   * apply. A key of type ATAP_KEY_TYPE_edDSA or ATAP_KEY_TYPE_edDSA_SOM
+   * may be skipped if the device does not support edDSA. May be NULL, or
+   * return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION without writing
+   * anything, in which case libatap calls write_attestation_key once per
+   * key.
+   */
+  AtapResult (*write_attestation_keys)(AtapOps* ops,
+                                       const AtapAttestationKey* keys,
+                                       uint32_t key_count);
+
+  /* Called at the begin and end of each phase of atap_get_ca_request()
+   * and atap_set_ca_response() with atap_get_monotonic_time_ns() as
+   * |timestamp_ns|. Only called if libatap is built with
+   * ATAP_ENABLE_TRACE. May be NULL.
+   */
+  void (*trace)(AtapOps* ops,
+                AtapTracePhase phase,
+                AtapTraceEvent event,
+                uint64_t timestamp_ns);
+};
+
 #ifdef __cplusplus
 }
 #endif
@@ -39,6 +39,14 @@ extern "C" {
 #define ATAP_ATTR_NO_RETURN __attribute__((noreturn))
 #define ATAP_ATTR_SENTINEL __attribute__((__sentinel__))
 
+/* Alignment in bytes of pointers returned by atap_malloc(). Buffers handed
+ * out by an AtapArena are aligned the same way. Change this if a word is
+ * wider on your platform.
+ */
+#ifndef ATAP_ALIGNMENT_SIZE
+#define ATAP_ALIGNMENT_SIZE 8
+#endif
+
 /* Copy |n| bytes from |src| to |dest|. */
 void* atap_memcpy(void* dest, const void* src, size_t n);
 
@@ -75,6 +83,11 @@ void atap_free(void* ptr);
 /* Returns the length of |str|, excluding the terminating NUL-byte. */
 size_t atap_strlen(const char* str) ATAP_ATTR_WARN_UNUSED_RESULT;
 
+/* Returns the time in nanoseconds of a clock that never goes backwards.
+ * Only needed if libatap is built with ATAP_ENABLE_TRACE.
+ */
+uint64_t atap_get_monotonic_time_ns(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "atap_sysdeps.h"
 
@@ -60,3 +61,10 @@ void* atap_malloc(size_t size) {
 void atap_free(void* ptr) {
   free(ptr);
 }
+
+uint64_t atap_get_monotonic_time_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -25,6 +25,8 @@ extern "C" {
 
 struct AtapOps;
 typedef struct AtapOps AtapOps;
+struct AtapOptionalOps;
+typedef struct AtapOptionalOps AtapOptionalOps;
 
 /* Return codes used for all operations.
  *
@@ -45,6 +47,13 @@ typedef struct AtapOps AtapOps;
  * not support the requested operation.
  *
  * ATAP_RESULT_ERROR_CRYPTO is returned if a crypto operation failed.
+ *
+ * ATAP_RESULT_PENDING is returned by an op that has started but not
+ * finished, and by atap_get_ca_request_begin() and
+ * atap_get_ca_request_resume() while they wait for such an op. Only the
+ * CA Request ops listed in atap_ops.h may return it. Storing the CA
+ * Response is synchronous: read_soc_global_key, write_hex_uuid and the
+ * attestation key writes must not return it.
  */
 typedef enum {
   ATAP_RESULT_OK,
@@ -55,6 +64,7 @@ typedef enum {
   ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION,
   ATAP_RESULT_ERROR_CRYPTO,
   ATAP_RESULT_ERROR_STORAGE,
+  ATAP_RESULT_PENDING,
 } AtapResult;
 
 typedef enum {
@@ -86,6 +96,74 @@ typedef enum {
   ATAP_OPERATION_ISSUE_ENCRYPTED_SOM_KEY = 5
 } AtapOperation;
 
+/* Operations and curves compiled into libatap. Each is enabled unless the
+ * platform sets it to 0, e.g. a bootloader that only needs encrypted
+ * product keys over X25519 builds with every other ATAP_ENABLE_OPERATION_*
+ * and ATAP_ENABLE_CURVE_P256 set to 0. The code for disabled operations is
+ * compiled out, and atap_get_ca_request() rejects them with
+ * ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION or
+ * ATAP_RESULT_ERROR_UNSUPPORTED_ALGORITHM.
+ */
+#ifndef ATAP_ENABLE_OPERATION_CERTIFY
+#define ATAP_ENABLE_OPERATION_CERTIFY 1
+#endif
+#ifndef ATAP_ENABLE_OPERATION_ISSUE
+#define ATAP_ENABLE_OPERATION_ISSUE 1
+#endif
+#ifndef ATAP_ENABLE_OPERATION_ISSUE_ENCRYPTED
+#define ATAP_ENABLE_OPERATION_ISSUE_ENCRYPTED 1
+#endif
+#ifndef ATAP_ENABLE_OPERATION_ISSUE_SOM_KEY
+#define ATAP_ENABLE_OPERATION_ISSUE_SOM_KEY 1
+#endif
+#ifndef ATAP_ENABLE_OPERATION_ISSUE_ENCRYPTED_SOM_KEY
+#define ATAP_ENABLE_OPERATION_ISSUE_ENCRYPTED_SOM_KEY 1
+#endif
+#ifndef ATAP_ENABLE_CURVE_P256
+#define ATAP_ENABLE_CURVE_P256 1
+#endif
+#ifndef ATAP_ENABLE_CURVE_X25519
+#define ATAP_ENABLE_CURVE_X25519 1
+#endif
+
+#define ATAP_ENABLE_PRODUCT_OPERATIONS                                 \
+  (ATAP_ENABLE_OPERATION_CERTIFY || ATAP_ENABLE_OPERATION_ISSUE ||     \
+   ATAP_ENABLE_OPERATION_ISSUE_ENCRYPTED)
+#define ATAP_ENABLE_SOM_OPERATIONS          \
+  (ATAP_ENABLE_OPERATION_ISSUE_SOM_KEY ||   \
+   ATAP_ENABLE_OPERATION_ISSUE_ENCRYPTED_SOM_KEY)
+#define ATAP_ENABLE_ENCRYPTED_OPERATIONS        \
+  (ATAP_ENABLE_OPERATION_ISSUE_ENCRYPTED ||     \
+   ATAP_ENABLE_OPERATION_ISSUE_ENCRYPTED_SOM_KEY)
+#define ATAP_ENABLE_UNENCRYPTED_OPERATIONS                             \
+  (ATAP_ENABLE_OPERATION_CERTIFY || ATAP_ENABLE_OPERATION_ISSUE ||     \
+   ATAP_ENABLE_OPERATION_ISSUE_SOM_KEY)
+
+#if !ATAP_ENABLE_PRODUCT_OPERATIONS && !ATAP_ENABLE_SOM_OPERATIONS
+#error "libatap needs at least one ATAP_ENABLE_OPERATION_*"
+#endif
+#if !ATAP_ENABLE_CURVE_P256 && !ATAP_ENABLE_CURVE_X25519
+#error "libatap needs at least one ATAP_ENABLE_CURVE_*"
+#endif
+
+/* Phases of atap_get_ca_request() and atap_set_ca_response() reported to
+ * the optional AtapOps trace op. ATAP_TRACE_PHASE_COUNT is not a phase.
+ */
+typedef enum {
+  ATAP_TRACE_PHASE_INITIALIZE_SESSION,
+  ATAP_TRACE_PHASE_COMPUTE_AUTH_SIGNATURE,
+  ATAP_TRACE_PHASE_READ_AVAILABLE_PUBLIC_KEYS,
+  ATAP_TRACE_PHASE_ENCRYPT_INNER_CA_REQUEST,
+  ATAP_TRACE_PHASE_DECRYPT_ENCRYPTED_MESSAGE,
+  ATAP_TRACE_PHASE_WRITE_INNER_CA_RESPONSE,
+  ATAP_TRACE_PHASE_COUNT
+} AtapTracePhase;
+
+typedef enum {
+  ATAP_TRACE_EVENT_BEGIN,
+  ATAP_TRACE_EVENT_END
+} AtapTraceEvent;
+
 /* Version 2 adds SoM key support */
 #define ATAP_PROTOCOL_VERSION 2
 #define ATAP_PROTOCOL_VERSION_1 1
@@ -108,6 +186,31 @@ typedef enum {
 #define ATAP_HEX_UUID_LEN 32
 #define ATAP_INNER_CA_RESPONSE_FIELDS_PRODUCT 10
 #define ATAP_INNER_CA_RESPONSE_FIELDS_SOM 8
+#define ATAP_ATTESTATION_KEYS_MAX (ATAP_INNER_CA_RESPONSE_FIELDS_PRODUCT / 2)
+#define ATAP_ENCRYPTED_MESSAGE_OVERHEAD \
+  (ATAP_HEADER_LEN + ATAP_GCM_IV_LEN + sizeof(uint32_t) + ATAP_GCM_TAG_LEN)
+#define ATAP_INNER_CA_REQUEST_LEN_MAX                                   \
+  (ATAP_HEADER_LEN + sizeof(uint32_t) + ATAP_CERT_CHAIN_LEN_MAX +       \
+   sizeof(uint32_t) + ATAP_SIGNATURE_LEN_MAX + ATAP_SHA256_DIGEST_LEN + \
+   3 * (sizeof(uint32_t) + ATAP_KEY_LEN_MAX))
+#define ATAP_INNER_CA_RESPONSE_LEN_MAX                         \
+  (ATAP_HEADER_LEN + ATAP_HEX_UUID_LEN +                       \
+   (ATAP_INNER_CA_RESPONSE_FIELDS_PRODUCT / 2) *               \
+       (2 * sizeof(uint32_t) + ATAP_CERT_CHAIN_LEN_MAX +       \
+        ATAP_CERT_CHAIN_ENTRIES_MAX * sizeof(uint32_t) + ATAP_KEY_LEN_MAX))
+
+/* Size of an AtapArena that fits every temporary buffer of one
+ * atap_get_ca_request_ex() or atap_set_ca_response_ex() call, including
+ * the fallbacks used when the ops cannot encrypt or decrypt in place. A
+ * smaller arena may be used; allocations that do not fit fall back to
+ * atap_malloc(). Platforms may override this.
+ */
+#ifndef ATAP_ARENA_SIZE
+#define ATAP_ARENA_SIZE                                          \
+  (2 * (ATAP_INNER_CA_RESPONSE_LEN_MAX +                         \
+        2 * ATAP_ENCRYPTED_MESSAGE_OVERHEAD) +                   \
+   ATAP_CERT_CHAIN_LEN_MAX + ATAP_KEY_LEN_MAX + 64 * ATAP_ALIGNMENT_SIZE)
+#endif
 
 typedef struct {
   uint8_t* data;
@@ -119,6 +222,34 @@ typedef struct {
   uint32_t entry_count;
 } AtapCertChain;
 
+/* One attestation key and its certificate chain, as passed to the
+ * write_attestation_keys op. |key| is empty for certify operations.
+ */
+typedef struct {
+  AtapKeyType key_type;
+  AtapBlob key;
+  AtapCertChain cert_chain;
+} AtapAttestationKey;
+
+/* A bounds-checked reader over serialized data. See atap_cursor_init() in
+ * atap_util.h. The fields are private to libatap.
+ */
+typedef struct {
+  const uint8_t* ptr;
+  const uint8_t* end;
+  bool ok;
+} AtapCursor;
+
+/* An Inner CA Response parsed by parse_inner_ca_response(). |hex_uuid| and
+ * the keys point into the parsed buffer. |hex_uuid| is NULL for SoM key
+ * operations, and |keys| only holds the keys that were issued.
+ */
+typedef struct {
+  const uint8_t* hex_uuid;
+  AtapAttestationKey keys[ATAP_ATTESTATION_KEYS_MAX];
+  uint32_t key_count;
+} AtapInnerCaResponse;
+
 typedef struct {
   uint8_t header[ATAP_HEADER_LEN];
   AtapCertChain auth_key_cert_chain;
@@ -149,6 +280,90 @@ typedef struct {
   uint8_t tag[ATAP_GCM_TAG_LEN];
 } AtapEncryptedMessage;
 
+/* A bump allocator over caller-provided memory. See atap_arena_init()
+ * in atap_util.h. The fields are private to libatap.
+ */
+typedef struct {
+  uint8_t* buf;
+  size_t size;
+  size_t used;
+} AtapArena;
+
+/* Bytes of a CA Response before the ciphertext: header, IV and length. */
+#define ATAP_CA_RESPONSE_PREFIX_LEN \
+  (ATAP_HEADER_LEN + ATAP_GCM_IV_LEN + sizeof(uint32_t))
+
+/* State of a CA Response received with atap_ca_response_update(). The
+ * fields are private to libatap.
+ */
+typedef struct {
+  AtapOps* ops;
+  uint8_t prefix[ATAP_CA_RESPONSE_PREFIX_LEN];
+  /* Holds the whole CA Response once its size is known. When the ops
+   * support streaming decryption, ciphertext is replaced by plaintext as
+   * it arrives.
+   */
+  uint8_t* buf;
+  uint32_t size;
+  uint32_t received;
+  size_t arena_mark;
+  /* The optional ops that started streaming decryption of |gcm_ctx|. */
+  const AtapOptionalOps* optional_ops;
+  void* gcm_ctx;
+} AtapCaResponseStream;
+
+/* Steps of atap_get_ca_request_begin(). Each step with an op that may
+ * return ATAP_RESULT_PENDING is a step of its own.
+ */
+typedef enum {
+  ATAP_CA_REQUEST_STEP_NONE = 0,
+  ATAP_CA_REQUEST_STEP_GET_AUTH_KEY_TYPE,
+  ATAP_CA_REQUEST_STEP_COMPUTE_SESSION_KEY,
+  ATAP_CA_REQUEST_STEP_READ_AUTH_KEY_CERT_CHAIN,
+  ATAP_CA_REQUEST_STEP_AUTH_KEY_SIGN,
+  ATAP_CA_REQUEST_STEP_READ_RSA_PUBKEY,
+  ATAP_CA_REQUEST_STEP_READ_ECDSA_PUBKEY,
+  ATAP_CA_REQUEST_STEP_READ_edDSA_PUBKEY,
+  ATAP_CA_REQUEST_STEP_READ_PRODUCT_ID,
+  ATAP_CA_REQUEST_STEP_ENCRYPT_INNER_CA_REQUEST,
+  ATAP_CA_REQUEST_STEP_DONE,
+} AtapCaRequestStep;
+
+/* State of a CA Request between atap_get_ca_request_begin() and its last
+ * atap_get_ca_request_resume(). Every buffer handed to an op lives here
+ * or in the session arena, so it stays valid while the op is pending. The
+ * fields are private to libatap.
+ */
+typedef struct {
+  AtapCaRequestStep step;
+  bool waiting;
+  size_t arena_mark;
+  AtapCurveType curve;
+  AtapKeyType auth_key_type;
+  uint8_t ca_pubkey[ATAP_ECDH_KEY_LEN];
+  uint8_t nonce[ATAP_NONCE_LEN];
+  uint8_t product_id[ATAP_PRODUCT_ID_LEN];
+  AtapCaRequest ca_request;
+  AtapInnerCaRequestProduct product;
+  AtapInnerCaRequestSom som;
+} AtapCaRequestState;
+
+/* Per-handshake state shared between atap_get_ca_request_ex() and
+ * atap_set_ca_response_ex(). A session holds the ECDH shared secret and
+ * the derived session key for exactly one device, so independent
+ * sessions may be driven concurrently from different threads. The
+ * fields are private to libatap.
+ */
+typedef struct AtapSession {
+  uint8_t shared_secret[ATAP_ECDH_SHARED_SECRET_LEN];
+  uint8_t session_key[ATAP_AES_128_KEY_LEN];
+  AtapOperation operation;
+  AtapArena arena;
+  AtapCaResponseStream ca_response_stream;
+  AtapCaRequestState ca_request_state;
+  const AtapOptionalOps* optional_ops;
+} AtapSession;
+
 #ifdef __cplusplus
 }
 #endif
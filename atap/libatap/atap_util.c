@@ -18,12 +18,6 @@
 
 #include "atap_ops.h"
 
-bool is_som_operation(AtapOperation operation) {
-  return (
-      operation == ATAP_OPERATION_ISSUE_SOM_KEY ||
-      operation == ATAP_OPERATION_ISSUE_ENCRYPTED_SOM_KEY);
-}
-
 const char* atap_basename(const char* str) {
   int64_t n = 0;
   size_t len = atap_strlen(str);
@@ -38,6 +32,52 @@ const char* atap_basename(const char* str) {
   return str;
 }
 
+void atap_arena_init(AtapArena* arena, void* buf, size_t size) {
+  atap_assert_aligned(buf);
+  arena->buf = (uint8_t*)buf;
+  arena->size = size;
+  arena->used = 0;
+}
+
+void* atap_arena_alloc(AtapArena* arena, size_t size) {
+  size_t aligned_size = 0;
+  void* ptr = NULL;
+
+  if (arena == NULL || arena->buf == NULL) {
+    return atap_malloc(size);
+  }
+  aligned_size = (size + ATAP_ALIGNMENT_SIZE - 1) & ~(ATAP_ALIGNMENT_SIZE - 1);
+  if (aligned_size < size || aligned_size > arena->size - arena->used) {
+    return atap_malloc(size);
+  }
+  ptr = arena->buf + arena->used;
+  arena->used += aligned_size;
+  return ptr;
+}
+
+void atap_arena_free(AtapArena* arena, void* ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  if (arena != NULL && arena->buf != NULL && (uint8_t*)ptr >= arena->buf &&
+      (uint8_t*)ptr < arena->buf + arena->size) {
+    return;
+  }
+  atap_free(ptr);
+}
+
+size_t atap_arena_mark(const AtapArena* arena) {
+  return arena == NULL ? 0 : arena->used;
+}
+
+void atap_arena_release(AtapArena* arena, size_t mark) {
+  if (arena == NULL || arena->buf == NULL || mark >= arena->used) {
+    return;
+  }
+  atap_memset(arena->buf + mark, 0, arena->used - mark);
+  arena->used = mark;
+}
+
 uint8_t* append_to_buf(uint8_t* buf, const void* data, uint32_t data_size) {
   atap_memcpy(buf, data, data_size);
   return buf + data_size;
@@ -123,13 +163,23 @@ void copy_uint32_from_buf(uint8_t** buf_ptr, uint32_t* x) {
 }
 
 bool copy_blob_from_buf(uint8_t** buf_ptr, AtapBlob* blob) {
+  return arena_copy_blob_from_buf(NULL, buf_ptr, blob);
+}
+
+bool copy_cert_chain_from_buf(uint8_t** buf_ptr, AtapCertChain* cert_chain) {
+  return arena_copy_cert_chain_from_buf(NULL, buf_ptr, cert_chain);
+}
+
+bool arena_copy_blob_from_buf(AtapArena* arena,
+                              uint8_t** buf_ptr,
+                              AtapBlob* blob) {
   atap_memset(blob, 0, sizeof(AtapBlob));
   copy_uint32_from_buf(buf_ptr, &blob->data_length);
   if (blob->data_length > ATAP_BLOB_LEN_MAX) {
     return false;
   }
   if (blob->data_length) {
-    blob->data = (uint8_t*)atap_malloc(blob->data_length);
+    blob->data = (uint8_t*)atap_arena_alloc(arena, blob->data_length);
     if (blob->data == NULL) {
       return false;
     }
@@ -138,7 +188,9 @@ bool copy_blob_from_buf(uint8_t** buf_ptr, AtapBlob* blob) {
   return true;
 }
 
-bool copy_cert_chain_from_buf(uint8_t** buf_ptr, AtapCertChain* cert_chain) {
+bool arena_copy_cert_chain_from_buf(AtapArena* arena,
+                                    uint8_t** buf_ptr,
+                                    AtapCertChain* cert_chain) {
   uint32_t cert_chain_size = 0;
   int32_t bytes_remaining = 0;
   size_t i = 0;
@@ -157,7 +209,7 @@ bool copy_cert_chain_from_buf(uint8_t** buf_ptr, AtapCertChain* cert_chain) {
   }
   bytes_remaining = cert_chain_size;
   for (i = 0; i < ATAP_CERT_CHAIN_ENTRIES_MAX; ++i) {
-    if (!copy_blob_from_buf(buf_ptr, &cert_chain->entries[i])) {
+    if (!arena_copy_blob_from_buf(arena, buf_ptr, &cert_chain->entries[i])) {
       retval = false;
       break;
     }
@@ -169,11 +221,127 @@ bool copy_cert_chain_from_buf(uint8_t** buf_ptr, AtapCertChain* cert_chain) {
     }
   }
   if (retval == false) {
-    free_cert_chain(*cert_chain);
+    arena_free_cert_chain(arena, *cert_chain);
   }
   return retval;
 }
 
+void atap_cursor_init(AtapCursor* cursor, const uint8_t* buf, size_t size) {
+  cursor->ptr = buf;
+  cursor->end = buf + size;
+  cursor->ok = true;
+}
+
+const uint8_t* atap_cursor_take(AtapCursor* cursor, uint32_t size) {
+  const uint8_t* ptr = cursor->ptr;
+
+  if (!cursor->ok || (size_t)(cursor->end - cursor->ptr) < size) {
+    cursor->ok = false;
+    return NULL;
+  }
+  cursor->ptr += size;
+  return ptr;
+}
+
+uint32_t atap_cursor_read_uint32(AtapCursor* cursor) {
+  uint32_t x = 0;
+  const uint8_t* ptr = atap_cursor_take(cursor, sizeof(uint32_t));
+
+  if (ptr != NULL) {
+    atap_memcpy(&x, ptr, sizeof(uint32_t));
+  }
+  return x;
+}
+
+bool atap_cursor_read_blob(AtapCursor* cursor,
+                           uint32_t max_len,
+                           AtapBlob* blob) {
+  uint32_t data_length = atap_cursor_read_uint32(cursor);
+  const uint8_t* data = NULL;
+
+  blob->data = NULL;
+  blob->data_length = 0;
+  if (data_length > max_len) {
+    cursor->ok = false;
+    return false;
+  }
+  data = atap_cursor_take(cursor, data_length);
+  if (!cursor->ok) {
+    return false;
+  }
+  if (data_length) {
+    blob->data = (uint8_t*)data;
+    blob->data_length = data_length;
+  }
+  return true;
+}
+
+bool atap_cursor_read_cert_chain(AtapCursor* cursor,
+                                 uint32_t max_entry_len,
+                                 AtapCertChain* cert_chain) {
+  uint32_t cert_chain_size = atap_cursor_read_uint32(cursor);
+  const uint8_t* entries = NULL;
+  AtapCursor entry_cursor;
+
+  atap_memset(cert_chain, 0, sizeof(AtapCertChain));
+  if (cert_chain_size > ATAP_CERT_CHAIN_LEN_MAX) {
+    cursor->ok = false;
+    return false;
+  }
+  entries = atap_cursor_take(cursor, cert_chain_size);
+  if (entries == NULL) {
+    return false;
+  }
+  /* Every entry takes at least 4 bytes, so this is linear in the size. */
+  atap_cursor_init(&entry_cursor, entries, cert_chain_size);
+  while (entry_cursor.ptr != entry_cursor.end) {
+    if (cert_chain->entry_count == ATAP_CERT_CHAIN_ENTRIES_MAX ||
+        !atap_cursor_read_blob(&entry_cursor,
+                               max_entry_len,
+                               &cert_chain->entries[cert_chain->entry_count])) {
+      atap_memset(cert_chain, 0, sizeof(AtapCertChain));
+      cursor->ok = false;
+      return false;
+    }
+    ++cert_chain->entry_count;
+  }
+  return true;
+}
+
+bool view_blob_from_buf(uint8_t** buf_ptr,
+                        const uint8_t* buf_end,
+                        AtapBlob* blob) {
+  AtapCursor cursor;
+
+  if (buf_end < *buf_ptr) {
+    atap_memset(blob, 0, sizeof(AtapBlob));
+    return false;
+  }
+  atap_cursor_init(&cursor, *buf_ptr, buf_end - *buf_ptr);
+  if (!atap_cursor_read_blob(&cursor, ATAP_BLOB_LEN_MAX, blob)) {
+    return false;
+  }
+  *buf_ptr = (uint8_t*)cursor.ptr;
+  return true;
+}
+
+bool view_cert_chain_from_buf(uint8_t** buf_ptr,
+                              const uint8_t* buf_end,
+                              AtapCertChain* cert_chain) {
+  AtapCursor cursor;
+
+  if (buf_end < *buf_ptr) {
+    atap_memset(cert_chain, 0, sizeof(AtapCertChain));
+    return false;
+  }
+  atap_cursor_init(&cursor, *buf_ptr, buf_end - *buf_ptr);
+  if (!atap_cursor_read_cert_chain(&cursor, ATAP_CERT_LEN_MAX, cert_chain)) {
+    return false;
+  }
+  *buf_ptr = (uint8_t*)cursor.ptr;
+  return true;
+}
+
 uint32_t blob_serialized_size(const AtapBlob* blob) {
   return sizeof(uint32_t) + blob->data_length;
 }
@@ -215,55 +383,91 @@ uint32_t inner_ca_request_som_serialized_size() {
 }
 
 void free_blob(AtapBlob blob) {
+  arena_free_blob(NULL, blob);
+}
+
+void free_cert_chain(AtapCertChain cert_chain) {
+  arena_free_cert_chain(NULL, cert_chain);
+}
+
+void free_ca_request(AtapCaRequest* ca_request) {
+  arena_free_ca_request(NULL, ca_request);
+}
+
+void free_inner_ca_request_product(
+    AtapInnerCaRequestProduct* product_ca_request) {
+  arena_free_inner_ca_request_product(NULL, product_ca_request);
+}
+
+void arena_free_blob(AtapArena* arena, AtapBlob blob) {
   if (blob.data) {
-    atap_free(blob.data);
+    atap_arena_free(arena, blob.data);
   }
   blob.data_length = 0;
 }
 
-void free_cert_chain(AtapCertChain cert_chain) {
+void arena_free_cert_chain(AtapArena* arena, AtapCertChain cert_chain) {
   unsigned int i = 0;
 
   for (i = 0; i < cert_chain.entry_count; ++i) {
     if (cert_chain.entries[i].data) {
-      atap_free(cert_chain.entries[i].data);
+      atap_arena_free(arena, cert_chain.entries[i].data);
     }
     cert_chain.entries[i].data_length = 0;
   }
   atap_memset(&cert_chain, 0, sizeof(AtapCertChain));
 }
 
-void free_ca_request(AtapCaRequest* ca_request) {
-  free_blob(ca_request->encrypted_inner_ca_request);
+void arena_free_ca_request(AtapArena* arena, AtapCaRequest* ca_request) {
+  arena_free_blob(arena, ca_request->encrypted_inner_ca_request);
   atap_memset(ca_request, 0, sizeof(AtapCaRequest));
 }
 
-void free_inner_ca_request_product(
-    AtapInnerCaRequestProduct* product_ca_request) {
-  free_cert_chain(product_ca_request->auth_key_cert_chain);
-  free_blob(product_ca_request->signature);
-  free_blob(product_ca_request->RSA_pubkey);
-  free_blob(product_ca_request->ECDSA_pubkey);
-  free_blob(product_ca_request->edDSA_pubkey);
+void arena_free_inner_ca_request_product(
+    AtapArena* arena, AtapInnerCaRequestProduct* product_ca_request) {
+  arena_free_cert_chain(arena, product_ca_request->auth_key_cert_chain);
+  arena_free_blob(arena, product_ca_request->signature);
+  arena_free_blob(arena, product_ca_request->RSA_pubkey);
+  arena_free_blob(arena, product_ca_request->ECDSA_pubkey);
+  arena_free_blob(arena, product_ca_request->edDSA_pubkey);
   atap_memset(product_ca_request, 0, sizeof(AtapInnerCaRequestProduct));
 }
 
 bool validate_operation(AtapOperation operation) {
-  if (operation != ATAP_OPERATION_CERTIFY &&
-      operation != ATAP_OPERATION_ISSUE &&
-      operation != ATAP_OPERATION_ISSUE_ENCRYPTED &&
-      operation != ATAP_OPERATION_ISSUE_SOM_KEY &&
-      operation != ATAP_OPERATION_ISSUE_ENCRYPTED_SOM_KEY) {
-    return false;
+  switch (operation) {
+#if ATAP_ENABLE_OPERATION_CERTIFY
+    case ATAP_OPERATION_CERTIFY:
+#endif
+#if ATAP_ENABLE_OPERATION_ISSUE
+    case ATAP_OPERATION_ISSUE:
+#endif
+#if ATAP_ENABLE_OPERATION_ISSUE_ENCRYPTED
+    case ATAP_OPERATION_ISSUE_ENCRYPTED:
+#endif
+#if ATAP_ENABLE_OPERATION_ISSUE_SOM_KEY
+    case ATAP_OPERATION_ISSUE_SOM_KEY:
+#endif
+#if ATAP_ENABLE_OPERATION_ISSUE_ENCRYPTED_SOM_KEY
+    case ATAP_OPERATION_ISSUE_ENCRYPTED_SOM_KEY:
+#endif
+      return true;
+    default:
+      return false;
   }
-  return true;
 }
 
 bool validate_curve(AtapCurveType curve) {
-  if (curve != ATAP_CURVE_TYPE_P256 && curve != ATAP_CURVE_TYPE_X25519) {
-    return false;
+  switch (curve) {
+#if ATAP_ENABLE_CURVE_P256
+    case ATAP_CURVE_TYPE_P256:
+#endif
+#if ATAP_ENABLE_CURVE_X25519
+    case ATAP_CURVE_TYPE_X25519:
+#endif
+      return true;
+    default:
+      return false;
   }
-  return true;
 }
 
 bool validate_encrypted_message(const uint8_t* buf, uint32_t buf_size) {
@@ -294,80 +498,96 @@ bool validate_encrypted_message(const uint8_t* buf, uint32_t buf_size) {
 bool validate_inner_ca_response(const uint8_t* buf,
                                 uint32_t buf_size,
                                 AtapOperation operation) {
-  uint32_t cert_chain_len = 0, len = 0;
-  size_t i = 0;
-  int tmp = 0;
-  uint8_t* buf_ptr = (uint8_t*)buf;
-  uint32_t inner_ca_response_fields = 0;
-  uint32_t min_size = 0;
-  bool som = is_som_operation(operation);
+  AtapInnerCaResponse response;
 
-  if (!som) {
-    min_size += ATAP_HEX_UUID_LEN;
-    inner_ca_response_fields = ATAP_INNER_CA_RESPONSE_FIELDS_PRODUCT;
-  } else {
-    inner_ca_response_fields = ATAP_INNER_CA_RESPONSE_FIELDS_SOM;
+  return parse_inner_ca_response(buf, buf_size, operation, &response);
+}
+
+/* Key types in the order they appear in an Inner CA Response. */
+static const AtapKeyType product_key_types[] = {ATAP_KEY_TYPE_RSA,
+                                                ATAP_KEY_TYPE_ECDSA,
+                                                ATAP_KEY_TYPE_edDSA,
+                                                ATAP_KEY_TYPE_EPID,
+                                                ATAP_KEY_TYPE_SPECIAL};
+static const AtapKeyType som_key_types[] = {ATAP_KEY_TYPE_RSA_SOM,
+                                            ATAP_KEY_TYPE_ECDSA_SOM,
+                                            ATAP_KEY_TYPE_edDSA_SOM,
+                                            ATAP_KEY_TYPE_EPID_SOM};
+
+const AtapKeyType* inner_ca_response_key_types(AtapOperation operation,
+                                               uint32_t* count) {
+  if (is_som_operation(operation)) {
+    *count = sizeof(som_key_types) / sizeof(som_key_types[0]);
+    return som_key_types;
   }
+  *count = sizeof(product_key_types) / sizeof(product_key_types[0]);
+  return product_key_types;
+}
 
-  min_size += ATAP_HEADER_LEN + inner_ca_response_fields * sizeof(uint32_t);
+/* edDSA, EPID, and special purpose key are optional in version 1 */
+static bool is_optional_key_type(AtapKeyType key_type) {
+  return key_type == ATAP_KEY_TYPE_edDSA || key_type == ATAP_KEY_TYPE_SPECIAL ||
+         key_type == ATAP_KEY_TYPE_EPID || key_type == ATAP_KEY_TYPE_edDSA_SOM ||
+         key_type == ATAP_KEY_TYPE_EPID_SOM;
+}
 
-  if (buf_size < min_size) {
+bool parse_inner_ca_response(const uint8_t* buf,
+                             uint32_t buf_size,
+                             AtapOperation operation,
+                             AtapInnerCaResponse* response) {
+  AtapCursor cursor;
+  const uint8_t* header = NULL;
+  uint32_t message_len = 0;
+  bool som = is_som_operation(operation);
+  uint32_t key_type_count = 0;
+  const AtapKeyType* key_types =
+      inner_ca_response_key_types(operation, &key_type_count);
+  AtapAttestationKey* key = NULL;
+  uint32_t i = 0;
+
+  response->hex_uuid = NULL;
+  response->key_count = 0;
+  atap_cursor_init(&cursor, buf, buf_size);
+  header = atap_cursor_take(&cursor, 4);
+  message_len = atap_cursor_read_uint32(&cursor);
+  if (!atap_cursor_ok(&cursor) || message_len != buf_size - ATAP_HEADER_LEN) {
     return false;
   }
-  if (buf[0] != ATAP_PROTOCOL_VERSION &&
-      buf[0] != ATAP_PROTOCOL_VERSION_1) {
+  if (header[0] != ATAP_PROTOCOL_VERSION &&
+      header[0] != ATAP_PROTOCOL_VERSION_1) {
     return false;
   }
-  if (buf[0] == ATAP_PROTOCOL_VERSION_1 && som) {
+  if (header[0] == ATAP_PROTOCOL_VERSION_1 && som) {
     /* Legacy version protocol doesn't support som key operation. */
     return false;
   }
-  buf_ptr += 4;
-  copy_uint32_from_buf(&buf_ptr, &len);
-  if (len != buf_size - ATAP_HEADER_LEN) {
-    return false;
+  if (!som) {
+    response->hex_uuid = atap_cursor_take(&cursor, ATAP_HEX_UUID_LEN);
   }
 
-  if (!som) {
-    buf_ptr += ATAP_HEX_UUID_LEN;
-  }
-  for (i = 0; i < inner_ca_response_fields; ++i) {
-    /* Odd indices are private keys */
-    if (i % 2) {
-      copy_uint32_from_buf(&buf_ptr, &len);
-      /* Product keys (non special purpose) are omitted on certify operation. */
-      if (operation == ATAP_OPERATION_CERTIFY &&
-          i != inner_ca_response_fields - 1 && len != 0) {
-        return false;
-      }
-      if (len > ATAP_KEY_LEN_MAX) {
-        return false;
-      }
-      buf_ptr += len;
-    } else {
-      copy_uint32_from_buf(&buf_ptr, &cert_chain_len);
-      if (cert_chain_len > ATAP_CERT_CHAIN_LEN_MAX) {
-        return false;
-      }
-      tmp = cert_chain_len;
-      while (tmp) {
-        copy_uint32_from_buf(&buf_ptr, &len);
-        if (len > ATAP_CERT_LEN_MAX) {
-          return false;
-        }
-        buf_ptr += len;
-        tmp -= (sizeof(uint32_t) + len);
-        /* Length value list was not constructed correctly. */
-        if (tmp < 0) {
-          return false;
-        }
-      }
+  for (i = 0; i < key_type_count; ++i) {
+    key = &response->keys[response->key_count];
+    key->key_type = key_types[i];
+    if (!atap_cursor_read_cert_chain(
+            &cursor, ATAP_CERT_LEN_MAX, &key->cert_chain) ||
+        !atap_cursor_read_blob(&cursor, ATAP_KEY_LEN_MAX, &key->key)) {
+      return false;
+    }
+    /* Product keys (non special purpose) are omitted on certify operation. */
+    if (is_certify_operation(operation) && i != key_type_count - 1 &&
+        key->key.data_length != 0) {
+      return false;
+    }
+    if (key->cert_chain.entry_count) {
+      ++response->key_count;
+    } else if (key->key.data_length) {
+      /* We never issue a key without a certificate chain */
+      return false;
+    } else if (!is_optional_key_type(key_types[i])) {
+      return false;
     }
   }
-  if (buf_ptr != buf + buf_size) {
-    return false;
-  }
-  return true;
+  return atap_cursor_done(&cursor);
 }
 
 AtapResult derive_session_key(
@@ -91,6 +91,35 @@ extern "C" {
 #define atap_debugv(message, ...)
 #endif
 
+/* Whether the optional op |member| is registered on |session|: an
+ * AtapOptionalOps is registered, its struct_size covers |member|, and
+ * |member| is not NULL. Only then may (session)->optional_ops->member be
+ * called.
+ */
+#define atap_has_optional_op(session, member)                \
+  ((session)->optional_ops != NULL &&                        \
+   (session)->optional_ops->struct_size >=                   \
+       offsetof(AtapOptionalOps, member) +                   \
+           sizeof((session)->optional_ops->member) &&        \
+   (session)->optional_ops->member != NULL)
+
+#ifdef ATAP_ENABLE_TRACE
+/* Reports |event| of |phase| of a call with |ops| to the optional trace
+ * op registered on |session|.
+ *
+ * This has no effect unless ATAP_ENABLE_TRACE is defined.
+ */
+#define atap_trace(session, ops, phase, event)                    \
+  do {                                                            \
+    if (atap_has_optional_op(session, trace)) {                   \
+      (session)->optional_ops->trace(                             \
+          (ops), (phase), (event), atap_get_monotonic_time_ns()); \
+    }                                                             \
+  } while (0)
+#else
+#define atap_trace(session, ops, phase, event)
+#endif
+
 /* Prints out a message. This is typically used if a runtime-error
  * occurs.
  */
@@ -136,8 +165,42 @@ extern "C" {
     atap_abort();                         \
   } while (0)
 
-/* Return whether current operation is a SoM key operation. */
-bool is_som_operation(AtapOperation operation);
+/* Return whether current operation is a SoM key operation. These
+ * operation predicates are constant when the build enables only one kind
+ * of operation, so the code for the other kind is compiled out.
+ */
+static inline bool is_som_operation(AtapOperation operation) {
+  if (!ATAP_ENABLE_SOM_OPERATIONS) {
+    return false;
+  }
+  if (!ATAP_ENABLE_PRODUCT_OPERATIONS) {
+    return true;
+  }
+  return (
+      operation == ATAP_OPERATION_ISSUE_SOM_KEY ||
+      operation == ATAP_OPERATION_ISSUE_ENCRYPTED_SOM_KEY);
+}
+
+/* Return whether current operation is the certify operation. */
+static inline bool is_certify_operation(AtapOperation operation) {
+  return ATAP_ENABLE_OPERATION_CERTIFY &&
+         operation == ATAP_OPERATION_CERTIFY;
+}
+
+/* Return whether the Inner CA Response of the current operation is
+ * encrypted with the SoC global key.
+ */
+static inline bool is_encrypted_operation(AtapOperation operation) {
+  if (!ATAP_ENABLE_ENCRYPTED_OPERATIONS) {
+    return false;
+  }
+  if (!ATAP_ENABLE_UNENCRYPTED_OPERATIONS) {
+    return true;
+  }
+  return (
+      operation == ATAP_OPERATION_ISSUE_ENCRYPTED ||
+      operation == ATAP_OPERATION_ISSUE_ENCRYPTED_SOM_KEY);
+}
 
 /* Returns the basename of |str|. This is defined as the last path
  * component, assuming the normal POSIX separator '/'. If there are no
@@ -145,6 +208,86 @@ bool is_som_operation(AtapOperation operation);
  */
 const char* atap_basename(const char* str);
 
+/* Initializes |arena| to hand out memory from the |size| bytes at |buf|.
+ * The arena does not own |buf|, which must stay valid while the arena is
+ * in use. |buf| must be aligned to ATAP_ALIGNMENT_SIZE.
+ */
+void atap_arena_init(AtapArena* arena, void* buf, size_t size);
+
+/* Allocates |size| bytes from |arena|. Falls back to atap_malloc() if
+ * |arena| is NULL, was never initialized, or does not have enough room.
+ * The memory is not initialized. Returns NULL if no memory is available.
+ */
+void* atap_arena_alloc(AtapArena* arena,
+                       size_t size) ATAP_ATTR_WARN_UNUSED_RESULT;
+
+/* Frees |ptr| returned by atap_arena_alloc(). Memory inside |arena| is
+ * only reclaimed by atap_arena_release(); other pointers are passed to
+ * atap_free().
+ */
+void atap_arena_free(AtapArena* arena, void* ptr);
+
+/* Returns a mark that can later be passed to atap_arena_release(). */
+size_t atap_arena_mark(const AtapArena* arena);
+
+/* Zeroizes and releases everything allocated from |arena| since |mark|
+ * was taken. Passing 0 releases the whole arena.
+ */
+void atap_arena_release(AtapArena* arena, size_t mark);
+
+/* Starts reading the |size| bytes at |buf| with |cursor|. Every read
+ * checks that the data is within bounds; once a read fails, the cursor
+ * stays failed, so a parser can check atap_cursor_ok() after a sequence
+ * of reads. Nothing is copied: views returned by a cursor point into
+ * |buf|, which must outlive them.
+ */
+void atap_cursor_init(AtapCursor* cursor, const uint8_t* buf, size_t size);
+
+/* Returns true if no read from |cursor| has failed. */
+static inline bool atap_cursor_ok(const AtapCursor* cursor) {
+  return cursor->ok;
+}
+
+/* Returns true if |cursor| has not failed and read every byte. */
+static inline bool atap_cursor_done(const AtapCursor* cursor) {
+  return cursor->ok && cursor->ptr == cursor->end;
+}
+
+/* Returns a pointer to the next |size| bytes and advances past them, or
+ * NULL if fewer bytes are left.
+ */
+const uint8_t* atap_cursor_take(AtapCursor* cursor, uint32_t size);
+
+/* Reads a uint32_t. Returns 0 on failure. */
+uint32_t atap_cursor_read_uint32(AtapCursor* cursor);
+
+/* Reads a blob of at most |max_len| bytes into |blob|, or a cert chain of
+ * at most ATAP_CERT_CHAIN_ENTRIES_MAX entries of at most |max_entry_len|
+ * bytes each into |cert_chain|. Returns false on failure.
+ */
+bool atap_cursor_read_blob(AtapCursor* cursor,
+                           uint32_t max_len,
+                           AtapBlob* blob);
+bool atap_cursor_read_cert_chain(AtapCursor* cursor,
+                                 uint32_t max_entry_len,
+                                 AtapCertChain* cert_chain);
+
+/* These parse serialized data at |*buf_ptr| without copying it: on
+ * success the output structure points into the buffer, which must outlive
+ * it, and must not be freed. |*buf_ptr| is advanced past the parsed data.
+ * Returns false if the serialized format is invalid or would read at or
+ * past |buf_end|. Unlike copy_cert_chain_from_buf(), which accepts entries
+ * up to ATAP_BLOB_LEN_MAX, view_cert_chain_from_buf() rejects any entry
+ * longer than ATAP_CERT_LEN_MAX, like parse_inner_ca_response().
+ */
+bool view_blob_from_buf(uint8_t** buf_ptr,
+                        const uint8_t* buf_end,
+                        AtapBlob* blob) ATAP_ATTR_WARN_UNUSED_RESULT;
+bool view_cert_chain_from_buf(uint8_t** buf_ptr,
+                              const uint8_t* buf_end,
+                              AtapCertChain* cert_chain)
+    ATAP_ATTR_WARN_UNUSED_RESULT;
+
 /* These write serialized structures to |buf|, and return
  * |buf| + [number of bytes written].
  */
@@ -170,6 +313,16 @@ void copy_uint32_from_buf(uint8_t** buf_ptr, uint32_t* x);
 bool copy_blob_from_buf(uint8_t** buf_ptr, AtapBlob* blob);
 bool copy_cert_chain_from_buf(uint8_t** buf_ptr, AtapCertChain* cert_chain);
 
+/* Same as above, but blob data is allocated with atap_arena_alloc() from
+ * |arena|, which may be NULL.
+ */
+bool arena_copy_blob_from_buf(AtapArena* arena,
+                              uint8_t** buf_ptr,
+                              AtapBlob* blob);
+bool arena_copy_cert_chain_from_buf(AtapArena* arena,
+                                    uint8_t** buf_ptr,
+                                    AtapCertChain* cert_chain);
+
 /* Returns the serialized size of structures. For AtapCaRequest and
  * AtapInnerCaRequestProduct, this includes the header. AtapInnerCaRequestSom
  * is constant size, thus no need to calculate size for that.
@@ -188,6 +341,13 @@ void free_inner_ca_request_product(
     AtapInnerCaRequestProduct* product_ca_request);
 void free_ca_request(AtapCaRequest* ca_request);
 
+/* Same as above, but blob data is freed with atap_arena_free(). */
+void arena_free_blob(AtapArena* arena, AtapBlob blob);
+void arena_free_cert_chain(AtapArena* arena, AtapCertChain cert_chain);
+void arena_free_inner_ca_request_product(
+    AtapArena* arena, AtapInnerCaRequestProduct* product_ca_request);
+void arena_free_ca_request(AtapArena* arena, AtapCaRequest* ca_request);
+
 /* These return true if the inputs are valid. For complicated message
  * structures, each expected field is parsed and validated.
  */
@@ -198,6 +358,21 @@ bool validate_inner_ca_response(const uint8_t* buf,
                                 uint32_t buf_size,
                                 AtapOperation operation);
 
+/* Validates the Inner CA Response in |buf| for |operation| and parses it
+ * into |response| in the same pass. Returns false if it is invalid.
+ */
+bool parse_inner_ca_response(const uint8_t* buf,
+                             uint32_t buf_size,
+                             AtapOperation operation,
+                             AtapInnerCaResponse* response)
+    ATAP_ATTR_WARN_UNUSED_RESULT;
+
+/* Returns the key types of an Inner CA Response for |operation|, in the
+ * order they appear, and sets |*count| to their number.
+ */
+const AtapKeyType* inner_ca_response_key_types(AtapOperation operation,
+                                               uint32_t* count);
+
 /* Derives the session key to |okm| using HKDF-SHA256 as the KDF. The input
  * keying material (IKM) is |shared_secret|. The salt is the concatenation
  * |ca_pubkey| + |device_pubkey|. |info| is "KEY" (without trailing NUL
@@ -30,12 +30,61 @@ extern "C" {
 #include "atap_types.h"
 #include "atap_util.h"
 
+/*
+ * Allocates a new, empty provisioning session with atap_malloc(). Returns
+ * NULL if no memory is available. The session must be released with
+ * atap_session_destroy().
+ */
+AtapSession* atap_session_create(void) ATAP_ATTR_WARN_UNUSED_RESULT;
+
+/*
+ * Makes |session| allocate the temporary buffers of each call from the
+ * |size| bytes at |buf| instead of the heap. The memory is zeroized and
+ * handed back at the end of every atap_get_ca_request_ex() and
+ * atap_set_ca_response_ex() call, so it can be reused for the lifetime of
+ * the session. A |size| of ATAP_ARENA_SIZE is always enough; anything
+ * that does not fit is allocated with atap_malloc(). |buf| must be aligned
+ * to ATAP_ALIGNMENT_SIZE, must outlive the session, and must not be shared
+ * with another session. Passing a NULL |buf| goes back to the heap.
+ */
+void atap_session_set_arena(AtapSession* session, void* buf, size_t size);
+
+/*
+ * Same as atap_session_set_arena(), for the default session used by
+ * atap_get_ca_request() and atap_set_ca_response().
+ */
+void atap_set_arena(void* buf, size_t size);
+
+/*
+ * Registers the optional ops that libatap may call for |session|. Until
+ * this is called, only the ops in AtapOps are used. The table is not
+ * copied and must outlive the session; NULL unregisters it.
+ */
+void atap_session_set_optional_ops(AtapSession* session,
+                                   const AtapOptionalOps* optional_ops);
+
+/*
+ * Same as atap_session_set_optional_ops(), for the default session used by
+ * atap_get_ca_request() and atap_set_ca_response().
+ */
+void atap_set_optional_ops(const AtapOptionalOps* optional_ops);
+
+/*
+ * Clears all secrets held by |session| and frees it. |session| may be
+ * NULL.
+ */
+void atap_session_destroy(AtapSession* session);
+
 /*
  * Parses |operation_start_size| bytes from |operation_start| and
  * constructs a request for the Android Things CA. Number of bytes
  * allocated for the CA Request message is written to
  * |*ca_request_size_p|, and caller takes ownership of |*ca_request_p|,
  * and must free with atap_free(). On success, returns ATAP_RESULT_OK.
+ *
+ * The session state is kept in a single library-wide default session, so
+ * this function is not reentrant. Use atap_get_ca_request_ex() to run
+ * several provisioning handshakes at once.
  */
 AtapResult atap_get_ca_request(AtapOps* ops,
                                const uint8_t* operation_start,
@@ -47,11 +96,136 @@ AtapResult atap_get_ca_request(AtapOps* ops,
  * |ca_response| contains |ca_response_size| bytes of the CA Response
  * message, which holds the encrypted product certificate chains and
  * (optionally) keys. On success, returns ATAP_RESULT_OK.
+ *
+ * Runs synchronously. The ops it calls must not return
+ * ATAP_RESULT_PENDING (see atap_ops.h); if one does, returns
+ * ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION.
+ *
+ * Uses the same default session as atap_get_ca_request().
  */
 AtapResult atap_set_ca_response(AtapOps* ops,
                                 const uint8_t* ca_response,
                                 uint32_t ca_response_size);
 
+/*
+ * Same as atap_set_ca_response(), but decrypts |ca_response| in place, so
+ * the CA Response is decrypted without copying it to a separate buffer.
+ * The contents of |ca_response| are overwritten with plaintext key
+ * material and are unspecified on return; the caller should clear them.
+ */
+AtapResult atap_set_ca_response_in_place(AtapOps* ops,
+                                         uint8_t* ca_response,
+                                         uint32_t ca_response_size);
+
+/*
+ * Same as atap_get_ca_request(), but keeps the ECDH shared secret, session
+ * key and operation in |session| instead of the default session.
+ * Different sessions may be used concurrently, provided |ops| is safe to
+ * call from several threads at once.
+ */
+AtapResult atap_get_ca_request_ex(AtapSession* session,
+                                  AtapOps* ops,
+                                  const uint8_t* operation_start,
+                                  uint32_t operation_start_size,
+                                  uint8_t** ca_request_p,
+                                  uint32_t* ca_request_size_p);
+
+/*
+ * Same as atap_get_ca_request_ex(), for ops that may return
+ * ATAP_RESULT_PENDING (see atap_ops.h). Returns ATAP_RESULT_PENDING when
+ * an op has started but not finished; the state of the CA Request is then
+ * kept in |session|, and the caller passes the result of that op to
+ * atap_get_ca_request_resume() once it is known. That way one thread can
+ * drive many sessions while their storage and TEE operations are in
+ * flight. Any other result is final, as from atap_get_ca_request_ex().
+ * Beginning a new CA Request aborts any unfinished one.
+ */
+AtapResult atap_get_ca_request_begin(AtapSession* session,
+                                     AtapOps* ops,
+                                     const uint8_t* operation_start,
+                                     uint32_t operation_start_size,
+                                     uint8_t** ca_request_p,
+                                     uint32_t* ca_request_size_p);
+
+/*
+ * Continues the CA Request of |session| with |op_result|, the result of
+ * the op that was pending. Returns ATAP_RESULT_PENDING again if a later op
+ * is pending, or the final result with the CA Request as for
+ * atap_get_ca_request_ex(). Returns ATAP_RESULT_ERROR_INVALID_INPUT if no
+ * op of |session| was pending.
+ */
+AtapResult atap_get_ca_request_resume(AtapSession* session,
+                                      AtapOps* ops,
+                                      AtapResult op_result,
+                                      uint8_t** ca_request_p,
+                                      uint32_t* ca_request_size_p);
+
+/*
+ * Discards an unfinished CA Request and clears its secrets. The pending
+ * op, if any, must have finished or been cancelled, since its buffers are
+ * freed. Does nothing if no CA Request is in progress. Called by
+ * atap_session_destroy().
+ */
+void atap_get_ca_request_abort(AtapSession* session);
+
+/*
+ * Same as atap_set_ca_response(), but uses the state established in
+ * |session| by a prior call to atap_get_ca_request_ex().
+ */
+AtapResult atap_set_ca_response_ex(AtapSession* session,
+                                   AtapOps* ops,
+                                   const uint8_t* ca_response,
+                                   uint32_t ca_response_size);
+
+/*
+ * Same as atap_set_ca_response_in_place(), but uses the state established
+ * in |session| by a prior call to atap_get_ca_request_ex().
+ */
+AtapResult atap_set_ca_response_in_place_ex(AtapSession* session,
+                                            AtapOps* ops,
+                                            uint8_t* ca_response,
+                                            uint32_t ca_response_size);
+
+/*
+ * Starts receiving a CA Response for |session| in pieces, for transports
+ * that deliver it in chunks. Feed every byte of the CA Response, in order,
+ * to atap_ca_response_update(), then call atap_ca_response_finish(), which
+ * stores the keys like atap_set_ca_response_ex(). If the optional ops
+ * support streaming AES-GCM, each chunk is decrypted as it arrives.
+ * Nothing is written to storage before finish has checked the GCM tag.
+ * Starting a new CA Response aborts any unfinished one.
+ *
+ * Since no key may be stored before the tag is checked, the whole CA
+ * Response is still buffered in the session arena until finish: streaming
+ * saves the caller's copy and the separate decryption buffer, but peak
+ * memory grows with the size of the CA Response and is not bounded per
+ * cert chain entry.
+ */
+AtapResult atap_ca_response_begin(AtapSession* session, AtapOps* ops);
+
+/*
+ * Feeds the next |data_size| bytes of the CA Response. Returns
+ * ATAP_RESULT_ERROR_INVALID_INPUT if the data is malformed or runs past
+ * the size given in the CA Response header. On failure the CA Response is
+ * aborted.
+ */
+AtapResult atap_ca_response_update(AtapSession* session,
+                                   const uint8_t* data,
+                                   uint32_t data_size);
+
+/*
+ * Authenticates and stores the CA Response fed to |session| so far, then
+ * clears its buffers. Returns ATAP_RESULT_ERROR_INVALID_INPUT if the CA
+ * Response is incomplete.
+ */
+AtapResult atap_ca_response_finish(AtapSession* session);
+
+/*
+ * Discards an unfinished CA Response. Does nothing if none is in progress.
+ * Called by atap_session_destroy().
+ */
+void atap_ca_response_abort(AtapSession* session);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "async_ca_request.h"
+
+#include <utility>
+
+namespace atap {
+
+AsyncCaRequest::AsyncCaRequest(AtapSession* session,
+                               AtapOps* ops,
+                               DoneCallback done)
+    : session_(session), ops_(ops), done_(std::move(done)) {}
+
+AsyncCaRequest::~AsyncCaRequest() {
+  if (pending_) {
+    atap_get_ca_request_abort(session_);
+  }
+}
+
+void AsyncCaRequest::Start(const uint8_t* operation_start,
+                           uint32_t operation_start_size) {
+  uint8_t* ca_request = nullptr;
+  uint32_t ca_request_size = 0;
+  AtapResult ret = atap_get_ca_request_begin(session_,
+                                             ops_,
+                                             operation_start,
+                                             operation_start_size,
+                                             &ca_request,
+                                             &ca_request_size);
+  Handle(ret, ca_request, ca_request_size);
+}
+
+void AsyncCaRequest::Complete(AtapResult op_result) {
+  uint8_t* ca_request = nullptr;
+  uint32_t ca_request_size = 0;
+  AtapResult ret = atap_get_ca_request_resume(
+      session_, ops_, op_result, &ca_request, &ca_request_size);
+  Handle(ret, ca_request, ca_request_size);
+}
+
+void AsyncCaRequest::Handle(AtapResult ret,
+                            uint8_t* ca_request,
+                            uint32_t ca_request_size) {
+  pending_ = (ret == ATAP_RESULT_PENDING);
+  if (pending_) {
+    return;
+  }
+  done_(ret, ca_request, ca_request_size);
+  if (ca_request != nullptr) {
+    atap_free(ca_request);
+  }
+}
+
+}  // namespace atap
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef ASYNC_CA_REQUEST_H_
+#define ASYNC_CA_REQUEST_H_
+
+#include <functional>
+
+#include <libatap/libatap.h>
+
+namespace atap {
+
+// Drives the resumable CA Request of one session, for a delegate whose
+// storage and TEE ops complete asynchronously. Such an op starts its work,
+// returns ATAP_RESULT_PENDING, and once the work is done its owner calls
+// Complete() with the result. Every call must come from the thread driving
+// the request, so one event loop thread can run many devices at once.
+class AsyncCaRequest {
+ public:
+  // Receives the final result and, on success, the CA Request, which is
+  // only valid during the call.
+  using DoneCallback = std::function<void(
+      AtapResult result, const uint8_t* ca_request, uint32_t ca_request_size)>;
+
+  // Does not take ownership of |session| or |ops|, which must outlive this.
+  AsyncCaRequest(AtapSession* session, AtapOps* ops, DoneCallback done);
+  AsyncCaRequest(const AsyncCaRequest&) = delete;
+  AsyncCaRequest& operator=(const AsyncCaRequest&) = delete;
+  // Aborts the CA Request if an op is still pending.
+  ~AsyncCaRequest();
+
+  // Starts building the CA Request for |operation_start|. |done| runs
+  // before this returns if no op goes pending.
+  void Start(const uint8_t* operation_start, uint32_t operation_start_size);
+
+  // Continues with |op_result|, the result of the pending op. Must not be
+  // called from inside the op itself.
+  void Complete(AtapResult op_result);
+
+  bool pending() const {
+    return pending_;
+  }
+
+ private:
+  void Handle(AtapResult ret, uint8_t* ca_request, uint32_t ca_request_size);
+
+  AtapSession* session_;
+  AtapOps* ops_;
+  DoneCallback done_;
+  bool pending_{false};
+};
+
+}  // namespace atap
+
+#endif /* ASYNC_CA_REQUEST_H_ */
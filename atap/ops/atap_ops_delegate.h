@@ -29,6 +29,41 @@
 
 namespace atap {
 
+// One encryption of aes_gcm_128_encrypt_batch(). The fields are the
+// arguments of aes_gcm_128_encrypt(), and |ciphertext| may equal
+// |plaintext|. |result| receives the result of the job.
+struct AtapAesGcmEncryptJob {
+  const uint8_t* plaintext;
+  uint32_t len;
+  const uint8_t* iv;
+  const uint8_t* key;
+  uint8_t* ciphertext;
+  uint8_t* tag;
+  AtapResult result;
+};
+
+// One hash of sha256_batch(), with the arguments of sha256().
+struct AtapSha256Job {
+  const uint8_t* plaintext;
+  uint32_t plaintext_len;
+  uint8_t* hash;
+  AtapResult result;
+};
+
+// One key derivation of hkdf_sha256_batch(), with the arguments of
+// hkdf_sha256().
+struct AtapHkdfSha256Job {
+  const uint8_t* salt;
+  uint32_t salt_len;
+  const uint8_t* ikm;
+  uint32_t ikm_len;
+  const uint8_t* info;
+  uint32_t info_len;
+  uint8_t* okm;
+  int32_t okm_len;
+  AtapResult result;
+};
+
 // A delegate interface for ops callbacks.
 //
 // Implement this interface and use with AtapOpsProvider. The delegate will
@@ -48,6 +83,12 @@ class AtapOpsDelegate {
                                            const AtapBlob* key,
                                            const AtapCertChain* cert_chain) = 0;
 
+  // Optional. See write_attestation_keys in atap_ops.h.
+  virtual AtapResult write_attestation_keys(const AtapAttestationKey* keys,
+                                            uint32_t key_count) {
+    return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
+  }
+
   virtual AtapResult read_attestation_public_key(
       AtapKeyType key_type,
       uint8_t pubkey[ATAP_KEY_LEN_MAX],
@@ -87,6 +128,48 @@ class AtapOpsDelegate {
       const uint8_t tag[ATAP_GCM_TAG_LEN],
       uint8_t* plaintext) = 0;
 
+  // In-place variants of the AES-GCM ops. These are optional; the default
+  // implementations return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION, and
+  // libatap then falls back to the ops above with separate buffers.
+  virtual AtapResult aes_gcm_128_encrypt_in_place(
+      uint8_t* buf,
+      uint32_t len,
+      const uint8_t iv[ATAP_GCM_IV_LEN],
+      const uint8_t key[ATAP_AES_128_KEY_LEN],
+      uint8_t tag[ATAP_GCM_TAG_LEN]) {
+    return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
+  }
+
+  virtual AtapResult aes_gcm_128_decrypt_in_place(
+      uint8_t* buf,
+      uint32_t len,
+      const uint8_t iv[ATAP_GCM_IV_LEN],
+      const uint8_t key[ATAP_AES_128_KEY_LEN],
+      const uint8_t tag[ATAP_GCM_TAG_LEN]) {
+    return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
+  }
+
+  // Optional streaming decryption. See aes_gcm_128_decrypt_begin() in
+  // atap_ops.h; finish is only called after a successful begin.
+  virtual AtapResult aes_gcm_128_decrypt_begin(
+      const uint8_t iv[ATAP_GCM_IV_LEN],
+      const uint8_t key[ATAP_AES_128_KEY_LEN],
+      void** ctx) {
+    return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
+  }
+
+  virtual AtapResult aes_gcm_128_decrypt_update(void* ctx,
+                                                const uint8_t* ciphertext,
+                                                uint32_t len,
+                                                uint8_t* plaintext) {
+    return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
+  }
+
+  virtual AtapResult aes_gcm_128_decrypt_finish(
+      void* ctx, const uint8_t tag[ATAP_GCM_TAG_LEN]) {
+    return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
+  }
+
   virtual AtapResult sha256(const uint8_t* plaintext,
                             uint32_t plaintext_len,
                             uint8_t hash[ATAP_SHA256_DIGEST_LEN]) = 0;
@@ -99,6 +182,67 @@ class AtapOpsDelegate {
                                  uint32_t info_len,
                                  uint8_t* okm,
                                  int32_t okm_len) = 0;
+
+  // Optional batch variants of aes_gcm_128_encrypt(), sha256() and
+  // hkdf_sha256() for callers handling many sessions at once, such as a CA.
+  // Every job is run and gets its own result; the return value is
+  // ATAP_RESULT_OK if all of them succeeded, or else the first failure. The
+  // default implementations run the single-buffer ops in turn.
+  virtual AtapResult aes_gcm_128_encrypt_batch(AtapAesGcmEncryptJob* jobs,
+                                               size_t count) {
+    AtapResult ret = ATAP_RESULT_OK;
+    for (size_t i = 0; i < count; ++i) {
+      AtapAesGcmEncryptJob* job = &jobs[i];
+      job->result = aes_gcm_128_encrypt(job->plaintext,
+                                        job->len,
+                                        job->iv,
+                                        job->key,
+                                        job->ciphertext,
+                                        job->tag);
+      if (ret == ATAP_RESULT_OK) {
+        ret = job->result;
+      }
+    }
+    return ret;
+  }
+
+  virtual AtapResult sha256_batch(AtapSha256Job* jobs, size_t count) {
+    AtapResult ret = ATAP_RESULT_OK;
+    for (size_t i = 0; i < count; ++i) {
+      AtapSha256Job* job = &jobs[i];
+      job->result = sha256(job->plaintext, job->plaintext_len, job->hash);
+      if (ret == ATAP_RESULT_OK) {
+        ret = job->result;
+      }
+    }
+    return ret;
+  }
+
+  virtual AtapResult hkdf_sha256_batch(AtapHkdfSha256Job* jobs,
+                                       size_t count) {
+    AtapResult ret = ATAP_RESULT_OK;
+    for (size_t i = 0; i < count; ++i) {
+      AtapHkdfSha256Job* job = &jobs[i];
+      job->result = hkdf_sha256(job->salt,
+                                job->salt_len,
+                                job->ikm,
+                                job->ikm_len,
+                                job->info,
+                                job->info_len,
+                                job->okm,
+                                job->okm_len);
+      if (ret == ATAP_RESULT_OK) {
+        ret = job->result;
+      }
+    }
+    return ret;
+  }
+
+  // Optional. Receives the libatap phase begin and end events; see trace in
+  // atap_ops.h. The default implementation ignores them.
+  virtual void trace(AtapTracePhase phase,
+                     AtapTraceEvent event,
+                     uint64_t timestamp_ns) {}
 };
 
 }  // namespace atap
@@ -57,6 +57,14 @@ AtapResult forward_write_attestation_key(AtapOps* ops,
       ->write_attestation_key(key_type, key, cert_chain);
 }
 
+AtapResult forward_write_attestation_keys(AtapOps* ops,
+                                          const AtapAttestationKey* keys,
+                                          uint32_t key_count) {
+  return AtapOpsProvider::GetInstanceFromAtapOps(ops)
+      ->delegate()
+      ->write_attestation_keys(keys, key_count);
+}
+
 AtapResult forward_read_attestation_public_key(AtapOps* ops,
                                                AtapKeyType key_type,
                                                uint8_t pubkey[ATAP_KEY_LEN_MAX],
@@ -134,6 +142,57 @@ AtapResult forward_aes_gcm_128_decrypt(AtapOps* ops,
       ->aes_gcm_128_decrypt(ciphertext, len, iv, key, tag, plaintext);
 }
 
+AtapResult forward_aes_gcm_128_encrypt_in_place(
+    AtapOps* ops,
+    uint8_t* buf,
+    uint32_t len,
+    const uint8_t iv[ATAP_GCM_IV_LEN],
+    const uint8_t key[ATAP_AES_128_KEY_LEN],
+    uint8_t tag[ATAP_GCM_TAG_LEN]) {
+  return AtapOpsProvider::GetInstanceFromAtapOps(ops)
+      ->delegate()
+      ->aes_gcm_128_encrypt_in_place(buf, len, iv, key, tag);
+}
+
+AtapResult forward_aes_gcm_128_decrypt_in_place(
+    AtapOps* ops,
+    uint8_t* buf,
+    uint32_t len,
+    const uint8_t iv[ATAP_GCM_IV_LEN],
+    const uint8_t key[ATAP_AES_128_KEY_LEN],
+    const uint8_t tag[ATAP_GCM_TAG_LEN]) {
+  return AtapOpsProvider::GetInstanceFromAtapOps(ops)
+      ->delegate()
+      ->aes_gcm_128_decrypt_in_place(buf, len, iv, key, tag);
+}
+
+AtapResult forward_aes_gcm_128_decrypt_begin(
+    AtapOps* ops,
+    const uint8_t iv[ATAP_GCM_IV_LEN],
+    const uint8_t key[ATAP_AES_128_KEY_LEN],
+    void** ctx) {
+  return AtapOpsProvider::GetInstanceFromAtapOps(ops)
+      ->delegate()
+      ->aes_gcm_128_decrypt_begin(iv, key, ctx);
+}
+
+AtapResult forward_aes_gcm_128_decrypt_update(AtapOps* ops,
+                                              void* ctx,
+                                              const uint8_t* ciphertext,
+                                              uint32_t len,
+                                              uint8_t* plaintext) {
+  return AtapOpsProvider::GetInstanceFromAtapOps(ops)
+      ->delegate()
+      ->aes_gcm_128_decrypt_update(ctx, ciphertext, len, plaintext);
+}
+
+AtapResult forward_aes_gcm_128_decrypt_finish(
+    AtapOps* ops, void* ctx, const uint8_t tag[ATAP_GCM_TAG_LEN]) {
+  return AtapOpsProvider::GetInstanceFromAtapOps(ops)
+      ->delegate()
+      ->aes_gcm_128_decrypt_finish(ctx, tag);
+}
+
 AtapResult forward_sha256(AtapOps* ops,
                           const uint8_t* plaintext,
                           uint32_t plaintext_len,
@@ -155,6 +214,30 @@ AtapResult forward_hkdf_sha256(AtapOps* ops,
       salt, salt_len, ikm, ikm_len, info, info_len, okm, okm_len);
 }
 
+void forward_trace(AtapOps* ops,
+                   AtapTracePhase phase,
+                   AtapTraceEvent event,
+                   uint64_t timestamp_ns) {
+  AtapOpsProvider::GetInstanceFromAtapOps(ops)->delegate()->trace(
+      phase, event, timestamp_ns);
+}
+
+AtapOptionalOps make_optional_ops() {
+  AtapOptionalOps optional_ops;
+  atap_memset(&optional_ops, 0, sizeof(optional_ops));
+  optional_ops.struct_size = sizeof(optional_ops);
+  optional_ops.aes_gcm_128_encrypt_in_place =
+      forward_aes_gcm_128_encrypt_in_place;
+  optional_ops.aes_gcm_128_decrypt_in_place =
+      forward_aes_gcm_128_decrypt_in_place;
+  optional_ops.aes_gcm_128_decrypt_begin = forward_aes_gcm_128_decrypt_begin;
+  optional_ops.aes_gcm_128_decrypt_update = forward_aes_gcm_128_decrypt_update;
+  optional_ops.aes_gcm_128_decrypt_finish = forward_aes_gcm_128_decrypt_finish;
+  optional_ops.write_attestation_keys = forward_write_attestation_keys;
+  optional_ops.trace = forward_trace;
+  return optional_ops;
+}
+
 }  // namespace
 
 namespace atap {
@@ -170,7 +253,13 @@ AtapOpsProvider::AtapOpsProvider(AtapOpsDelegate* delegate)
 
 AtapOpsProvider::~AtapOpsProvider() {}
 
+const AtapOptionalOps* AtapOpsProvider::optional_ops() {
+  static const AtapOptionalOps kOptionalOps = make_optional_ops();
+  return &kOptionalOps;
+}
+
 void AtapOpsProvider::setup_ops() {
+  atap_memset(&atap_ops_, 0, sizeof(atap_ops_));
   atap_ops_.user_data = this;
   atap_ops_.read_product_id = forward_read_product_id;
   atap_ops_.get_auth_key_type = forward_get_auth_key_type;
@@ -29,10 +29,15 @@
 
 namespace atap {
 
-// An implementation of ops callbacks that forwards to a given delegate. All
-// instances of this class must be created on the same thread. A delegate must
-// be provided either in the constructor or set_delegate() before using the
-// AtapOps returned by atap_ops().
+// An implementation of ops callbacks that forwards to a given delegate. A
+// delegate must be provided either in the constructor or set_delegate() before
+// using the AtapOps returned by atap_ops().
+//
+// Each instance owns its own AtapOps table and has no state shared with other
+// instances, so distinct providers may be used concurrently from different
+// threads. A single instance (and its delegate) must only be used by one
+// thread at a time; see ShardedAtapOpsProvider for handing out one provider
+// per worker thread.
 class AtapOpsProvider {
  public:
   AtapOpsProvider();
@@ -48,6 +53,11 @@ class AtapOpsProvider {
     return &atap_ops_;
   }
 
+  // The optional ops of all providers, to be registered on each session
+  // with atap_session_set_optional_ops(). They forward to the delegate of
+  // the provider whose atap_ops() the libatap call was made with.
+  static const AtapOptionalOps* optional_ops();
+
   AtapOpsDelegate* delegate() {
     return delegate_;
   }
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ecdh_key_pool.h"
+
+#include <openssl/curve25519.h>
+#include <openssl/mem.h>
+#include <openssl/obj_mac.h>
+
+namespace atap {
+
+namespace {
+
+/* How long the refill thread waits before retrying a failed key generation. */
+constexpr std::chrono::milliseconds kRetryBackoff(100);
+
+}  // namespace
+
+EcdhKeyPool::EcdhKeyPool(AtapCurveType curve, size_t depth)
+    : curve_(curve), depth_(depth) {
+  atap_assert(curve == ATAP_CURVE_TYPE_X25519 ||
+              curve == ATAP_CURVE_TYPE_P256);
+  refill_thread_ = std::thread(&EcdhKeyPool::RefillLoop, this);
+}
+
+EcdhKeyPool::~EcdhKeyPool() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    stopping_ = true;
+  }
+  refill_needed_.notify_all();
+  full_.notify_all();
+  refill_thread_.join();
+  for (Entry& entry : entries_) {
+    ClearEntry(&entry);
+  }
+}
+
+bool EcdhKeyPool::TakeX25519Keypair(uint8_t public_key[32],
+                                    uint8_t private_key[32]) {
+  if (curve_ != ATAP_CURVE_TYPE_X25519) {
+    return false;
+  }
+  std::unique_lock<std::mutex> lock(lock_);
+  if (entries_.empty()) {
+    ++misses_;
+    lock.unlock();
+    refill_needed_.notify_one();
+    return false;
+  }
+  Entry& entry = entries_.front();
+  atap_memcpy(public_key, entry.x25519_public_key, 32);
+  atap_memcpy(private_key, entry.x25519_private_key, 32);
+  ClearEntry(&entry);
+  entries_.pop_front();
+  ++hits_;
+  lock.unlock();
+  refill_needed_.notify_one();
+  return true;
+}
+
+EC_KEY* EcdhKeyPool::TakeP256Key() {
+  if (curve_ != ATAP_CURVE_TYPE_P256) {
+    return nullptr;
+  }
+  std::unique_lock<std::mutex> lock(lock_);
+  if (entries_.empty()) {
+    ++misses_;
+    lock.unlock();
+    refill_needed_.notify_one();
+    return nullptr;
+  }
+  EC_KEY* key = entries_.front().p256_key;
+  entries_.pop_front();
+  ++hits_;
+  lock.unlock();
+  refill_needed_.notify_one();
+  return key;
+}
+
+bool EcdhKeyPool::WaitUntilFull() {
+  std::unique_lock<std::mutex> lock(lock_);
+  full_.wait(lock, [this] {
+    return stopping_ || generation_failed_ || entries_.size() >= depth_;
+  });
+  return entries_.size() >= depth_;
+}
+
+bool EcdhKeyPool::GenerateEntry(Entry* entry) {
+  atap_memset(entry, 0, sizeof(Entry));
+  if (curve_ == ATAP_CURVE_TYPE_X25519) {
+    X25519_keypair(entry->x25519_public_key, entry->x25519_private_key);
+    return true;
+  }
+  entry->p256_key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+  if (!entry->p256_key) {
+    atap_error("Error allocating EC key");
+    return false;
+  }
+  if (1 != EC_KEY_generate_key(entry->p256_key)) {
+    atap_error("EC_KEY_generate_key failed");
+    EC_KEY_free(entry->p256_key);
+    entry->p256_key = nullptr;
+    return false;
+  }
+  return true;
+}
+
+void EcdhKeyPool::ClearEntry(Entry* entry) {
+  OPENSSL_cleanse(entry->x25519_private_key, sizeof(entry->x25519_private_key));
+  if (entry->p256_key) {
+    /* EC_KEY_free() zeroizes the private scalar. */
+    EC_KEY_free(entry->p256_key);
+    entry->p256_key = nullptr;
+  }
+}
+
+void EcdhKeyPool::RefillLoop() {
+  std::unique_lock<std::mutex> lock(lock_);
+  while (!stopping_) {
+    if (entries_.size() >= depth_) {
+      full_.notify_all();
+      refill_needed_.wait(
+          lock, [this] { return stopping_ || entries_.size() < depth_; });
+      continue;
+    }
+    /* Generate outside the lock so that Take*() never waits on keygen. */
+    lock.unlock();
+    Entry entry;
+    bool generated = GenerateEntry(&entry);
+    lock.lock();
+    if (!generated) {
+      /* Leave the pool short and retry later; callers fall back to
+       * generating inline in the meantime. */
+      generation_failed_ = true;
+      full_.notify_all();
+      refill_needed_.wait_for(lock, kRetryBackoff, [this] { return stopping_; });
+      continue;
+    }
+    generation_failed_ = false;
+    if (stopping_) {
+      ClearEntry(&entry);
+      break;
+    }
+    entries_.push_back(entry);
+    OPENSSL_cleanse(&entry, sizeof(entry));
+  }
+}
+
+}  // namespace atap
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef ECDH_KEY_POOL_H_
+#define ECDH_KEY_POOL_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <libatap/libatap.h>
+#include <openssl/ec.h>
+
+namespace atap {
+
+// A pool of pre-generated ephemeral ECDH keypairs for one curve. A background
+// thread keeps up to |depth| keypairs ready, so that the key generation does
+// not sit on the critical path of atap_get_ca_request(). Pooled private keys
+// are zeroized when they are handed out and when the pool is destroyed.
+//
+// A pool may be shared by several OpensslOps instances on different threads.
+class EcdhKeyPool {
+ public:
+  // Starts refilling |depth| keypairs for |curve|, which must be
+  // ATAP_CURVE_TYPE_X25519 or ATAP_CURVE_TYPE_P256.
+  EcdhKeyPool(AtapCurveType curve, size_t depth);
+  virtual ~EcdhKeyPool();
+
+  AtapCurveType curve() const {
+    return curve_;
+  }
+
+  size_t depth() const {
+    return depth_;
+  }
+
+  // Moves a pooled X25519 keypair to |public_key| and |private_key|. Returns
+  // false if the pool is empty or does not hold X25519 keys.
+  bool TakeX25519Keypair(uint8_t public_key[32], uint8_t private_key[32]);
+
+  // Returns a pooled P-256 key, which the caller must free with EC_KEY_free().
+  // Returns nullptr if the pool is empty or does not hold P-256 keys.
+  EC_KEY* TakeP256Key();
+
+  // Blocks until the pool holds |depth| keypairs and returns true. Returns
+  // false without waiting further if the last key generation failed, or if
+  // the pool is being destroyed.
+  bool WaitUntilFull();
+
+  // Number of Take*() calls that were served from the pool, and that found
+  // it empty.
+  uint64_t hits() const {
+    return hits_;
+  }
+  uint64_t misses() const {
+    return misses_;
+  }
+
+ private:
+  struct Entry {
+    uint8_t x25519_public_key[32];
+    uint8_t x25519_private_key[32];
+    EC_KEY* p256_key;
+  };
+
+  // Generates one keypair for |curve_|. Returns false on failure.
+  bool GenerateEntry(Entry* entry);
+  static void ClearEntry(Entry* entry);
+  void RefillLoop();
+
+  const AtapCurveType curve_;
+  const size_t depth_;
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+
+  std::mutex lock_;
+  // Signalled when a keypair is taken or missed, or on shutdown.
+  std::condition_variable refill_needed_;
+  // Signalled by the refill thread when the pool is full, or when a key
+  // generation fails.
+  std::condition_variable full_;
+  std::deque<Entry> entries_;
+  // Whether the last key generation failed. The refill thread retries after
+  // a backoff and clears it on the next success.
+  bool generation_failed_{false};
+  bool stopping_{false};
+  std::thread refill_thread_;
+};
+
+}  // namespace atap
+
+#endif /* ECDH_KEY_POOL_H_ */
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FORWARDING_ATAP_OPS_DELEGATE_H_
+#define FORWARDING_ATAP_OPS_DELEGATE_H_
+
+#include "atap_ops_delegate.h"
+
+namespace atap {
+
+// A delegate that forwards every call to another delegate. Subclass it to
+// observe or adjust some of the calls of an existing delegate, such as
+// OpensslOps or device-specific ops, without patching it.
+class ForwardingAtapOpsDelegate : public AtapOpsDelegate {
+ public:
+  // Does not take ownership of |delegate|, which must outlive this object.
+  explicit ForwardingAtapOpsDelegate(AtapOpsDelegate* delegate)
+      : delegate_(delegate) {}
+  ~ForwardingAtapOpsDelegate() override {}
+
+  AtapOpsDelegate* delegate() {
+    return delegate_;
+  }
+
+  AtapResult read_product_id(uint8_t product_id[ATAP_PRODUCT_ID_LEN]) override {
+    return delegate_->read_product_id(product_id);
+  }
+
+  AtapResult get_auth_key_type(AtapKeyType* key_type) override {
+    return delegate_->get_auth_key_type(key_type);
+  }
+
+  AtapResult read_auth_key_cert_chain(AtapCertChain* cert_chain) override {
+    return delegate_->read_auth_key_cert_chain(cert_chain);
+  }
+
+  AtapResult write_attestation_key(AtapKeyType key_type,
+                                   const AtapBlob* key,
+                                   const AtapCertChain* cert_chain) override {
+    return delegate_->write_attestation_key(key_type, key, cert_chain);
+  }
+
+  AtapResult write_attestation_keys(const AtapAttestationKey* keys,
+                                    uint32_t key_count) override {
+    return delegate_->write_attestation_keys(keys, key_count);
+  }
+
+  AtapResult read_attestation_public_key(AtapKeyType key_type,
+                                         uint8_t pubkey[ATAP_KEY_LEN_MAX],
+                                         uint32_t* pubkey_len) override {
+    return delegate_->read_attestation_public_key(key_type, pubkey, pubkey_len);
+  }
+
+  AtapResult read_soc_global_key(
+      uint8_t global_key[ATAP_AES_128_KEY_LEN]) override {
+    return delegate_->read_soc_global_key(global_key);
+  }
+
+  AtapResult write_hex_uuid(const uint8_t uuid[ATAP_HEX_UUID_LEN]) override {
+    return delegate_->write_hex_uuid(uuid);
+  }
+
+  AtapResult get_random_bytes(uint8_t* buf, uint32_t buf_size) override {
+    return delegate_->get_random_bytes(buf, buf_size);
+  }
+
+  AtapResult auth_key_sign(const uint8_t* nonce,
+                           uint32_t nonce_len,
+                           uint8_t sig[ATAP_SIGNATURE_LEN_MAX],
+                           uint32_t* sig_len) override {
+    return delegate_->auth_key_sign(nonce, nonce_len, sig, sig_len);
+  }
+
+  AtapResult ecdh_shared_secret_compute(
+      AtapCurveType curve,
+      const uint8_t other_public_key[ATAP_ECDH_KEY_LEN],
+      uint8_t public_key[ATAP_ECDH_KEY_LEN],
+      uint8_t shared_secret[ATAP_ECDH_KEY_LEN]) override {
+    return delegate_->ecdh_shared_secret_compute(
+        curve, other_public_key, public_key, shared_secret);
+  }
+
+  AtapResult aes_gcm_128_encrypt(const uint8_t* plaintext,
+                                 uint32_t len,
+                                 const uint8_t iv[ATAP_GCM_IV_LEN],
+                                 const uint8_t key[ATAP_AES_128_KEY_LEN],
+                                 uint8_t* ciphertext,
+                                 uint8_t tag[ATAP_GCM_TAG_LEN]) override {
+    return delegate_->aes_gcm_128_encrypt(
+        plaintext, len, iv, key, ciphertext, tag);
+  }
+
+  AtapResult aes_gcm_128_decrypt(const uint8_t* ciphertext,
+                                 uint32_t len,
+                                 const uint8_t iv[ATAP_GCM_IV_LEN],
+                                 const uint8_t key[ATAP_AES_128_KEY_LEN],
+                                 const uint8_t tag[ATAP_GCM_TAG_LEN],
+                                 uint8_t* plaintext) override {
+    return delegate_->aes_gcm_128_decrypt(
+        ciphertext, len, iv, key, tag, plaintext);
+  }
+
+  AtapResult aes_gcm_128_encrypt_in_place(
+      uint8_t* buf,
+      uint32_t len,
+      const uint8_t iv[ATAP_GCM_IV_LEN],
+      const uint8_t key[ATAP_AES_128_KEY_LEN],
+      uint8_t tag[ATAP_GCM_TAG_LEN]) override {
+    return delegate_->aes_gcm_128_encrypt_in_place(buf, len, iv, key, tag);
+  }
+
+  AtapResult aes_gcm_128_decrypt_in_place(
+      uint8_t* buf,
+      uint32_t len,
+      const uint8_t iv[ATAP_GCM_IV_LEN],
+      const uint8_t key[ATAP_AES_128_KEY_LEN],
+      const uint8_t tag[ATAP_GCM_TAG_LEN]) override {
+    return delegate_->aes_gcm_128_decrypt_in_place(buf, len, iv, key, tag);
+  }
+
+  AtapResult aes_gcm_128_decrypt_begin(const uint8_t iv[ATAP_GCM_IV_LEN],
+                                       const uint8_t key[ATAP_AES_128_KEY_LEN],
+                                       void** ctx) override {
+    return delegate_->aes_gcm_128_decrypt_begin(iv, key, ctx);
+  }
+
+  AtapResult aes_gcm_128_decrypt_update(void* ctx,
+                                        const uint8_t* ciphertext,
+                                        uint32_t len,
+                                        uint8_t* plaintext) override {
+    return delegate_->aes_gcm_128_decrypt_update(
+        ctx, ciphertext, len, plaintext);
+  }
+
+  AtapResult aes_gcm_128_decrypt_finish(
+      void* ctx, const uint8_t tag[ATAP_GCM_TAG_LEN]) override {
+    return delegate_->aes_gcm_128_decrypt_finish(ctx, tag);
+  }
+
+  AtapResult sha256(const uint8_t* plaintext,
+                    uint32_t plaintext_len,
+                    uint8_t hash[ATAP_SHA256_DIGEST_LEN]) override {
+    return delegate_->sha256(plaintext, plaintext_len, hash);
+  }
+
+  AtapResult hkdf_sha256(const uint8_t* salt,
+                         uint32_t salt_len,
+                         const uint8_t* ikm,
+                         uint32_t ikm_len,
+                         const uint8_t* info,
+                         uint32_t info_len,
+                         uint8_t* okm,
+                         int32_t okm_len) override {
+    return delegate_->hkdf_sha256(
+        salt, salt_len, ikm, ikm_len, info, info_len, okm, okm_len);
+  }
+
+  AtapResult aes_gcm_128_encrypt_batch(AtapAesGcmEncryptJob* jobs,
+                                       size_t count) override {
+    return delegate_->aes_gcm_128_encrypt_batch(jobs, count);
+  }
+
+  AtapResult sha256_batch(AtapSha256Job* jobs, size_t count) override {
+    return delegate_->sha256_batch(jobs, count);
+  }
+
+  AtapResult hkdf_sha256_batch(AtapHkdfSha256Job* jobs,
+                               size_t count) override {
+    return delegate_->hkdf_sha256_batch(jobs, count);
+  }
+
+  void trace(AtapTracePhase phase,
+             AtapTraceEvent event,
+             uint64_t timestamp_ns) override {
+    delegate_->trace(phase, event, timestamp_ns);
+  }
+
+ private:
+  AtapOpsDelegate* delegate_;
+};
+
+}  // namespace atap
+
+#endif /* FORWARDING_ATAP_OPS_DELEGATE_H_ */
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "latency_histogram.h"
+
+#include <math.h>
+
+namespace atap {
+
+constexpr size_t LatencyHistogram::kBucketCount;
+
+uint64_t LatencyHistogram::BucketLimitNs(size_t index) {
+  if (index + 1 >= kBucketCount) {
+    return UINT64_MAX;
+  }
+  return (uint64_t{1000}) << index;
+}
+
+void LatencyHistogram::Record(uint64_t duration_ns) {
+  size_t bucket = 0;
+
+  while (duration_ns >= BucketLimitNs(bucket)) {
+    ++bucket;
+  }
+  if (count == 0 || duration_ns < min_ns) {
+    min_ns = duration_ns;
+  }
+  if (duration_ns > max_ns) {
+    max_ns = duration_ns;
+  }
+  ++count;
+  total_ns += duration_ns;
+  ++buckets[bucket];
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+  if (other.count == 0) {
+    return;
+  }
+  if (count == 0 || other.min_ns < min_ns) {
+    min_ns = other.min_ns;
+  }
+  if (other.max_ns > max_ns) {
+    max_ns = other.max_ns;
+  }
+  count += other.count;
+  total_ns += other.total_ns;
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    buckets[i] += other.buckets[i];
+  }
+}
+
+uint64_t LatencyHistogram::PercentileNs(double percentile) const {
+  uint64_t seen = 0;
+  // Nearest rank, counted from 0.
+  uint64_t rank = static_cast<uint64_t>(ceil(count * percentile / 100.0));
+
+  if (count == 0) {
+    return 0;
+  }
+  rank = rank == 0 ? 0 : rank - 1;
+  if (rank >= count) {
+    rank = count - 1;
+  }
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    seen += buckets[i];
+    if (seen > rank) {
+      return BucketLimitNs(i) < max_ns ? BucketLimitNs(i) : max_ns;
+    }
+  }
+  return max_ns;
+}
+
+}  // namespace atap
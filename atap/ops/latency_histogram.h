@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LATENCY_HISTOGRAM_H_
+#define LATENCY_HISTOGRAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace atap {
+
+// Latency histogram with power of two buckets. Bucket 0 counts durations
+// shorter than 1us, bucket i counts durations in [2^(i-1), 2^i) us, and the
+// last bucket also counts every longer duration.
+struct LatencyHistogram {
+  static constexpr size_t kBucketCount = 24;
+
+  // Returns the upper bound in nanoseconds of bucket |index|.
+  static uint64_t BucketLimitNs(size_t index);
+
+  // Adds one duration of |duration_ns|.
+  void Record(uint64_t duration_ns);
+
+  // Adds all durations recorded in |other|.
+  void Merge(const LatencyHistogram& other);
+
+  // Returns the upper bound in nanoseconds of the bucket holding the
+  // |percentile|th percentile, or 0 if nothing was recorded.
+  uint64_t PercentileNs(double percentile) const;
+
+  uint64_t count = 0;
+  uint64_t total_ns = 0;
+  uint64_t min_ns = 0;
+  uint64_t max_ns = 0;
+  uint64_t buckets[kBucketCount] = {};
+};
+
+}  // namespace atap
+
+#endif /* LATENCY_HISTOGRAM_H_ */
@@ -0,0 +1,532 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "metrics_atap_ops_delegate.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+namespace atap {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+uint64_t CertChainBytes(const AtapCertChain* cert_chain) {
+  uint64_t bytes = 0;
+  for (uint32_t i = 0; i < cert_chain->entry_count; ++i) {
+    bytes += cert_chain->entries[i].data_length;
+  }
+  return bytes;
+}
+
+// Appends a counter of every called method in |snapshot| to |out|.
+void AppendCounter(const std::vector<AtapOpMetrics>& snapshot,
+                   const std::string& name,
+                   const char* help,
+                   uint64_t AtapOpMetrics::*field,
+                   std::string* out) {
+  char line[256];
+
+  *out += "# HELP " + name + " " + help + "\n";
+  *out += "# TYPE " + name + " counter\n";
+  for (const AtapOpMetrics& m : snapshot) {
+    if (m.calls == 0) {
+      continue;
+    }
+    snprintf(line,
+             sizeof(line),
+             "%s{method=\"%s\"} %" PRIu64 "\n",
+             name.c_str(),
+             m.method,
+             m.*field);
+    *out += line;
+  }
+}
+
+}  // namespace
+
+MetricsAtapOpsDelegate::MetricsAtapOpsDelegate(AtapOpsDelegate* delegate)
+    : ForwardingAtapOpsDelegate(delegate) {
+  for (int i = 0; i < kMethodCount; ++i) {
+    metrics_[i].method = MethodName(static_cast<Method>(i));
+  }
+}
+
+MetricsAtapOpsDelegate::~MetricsAtapOpsDelegate() {}
+
+AtapResult MetricsAtapOpsDelegate::Record(Method method,
+                                          Clock::time_point start,
+                                          uint64_t bytes,
+                                          AtapResult ret) {
+  uint64_t duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             Clock::now() - start)
+                             .count();
+  std::lock_guard<std::mutex> lock(mutex_);
+  AtapOpMetrics* m = &metrics_[method];
+
+  ++m->calls;
+  if (ret == ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION) {
+    ++m->unsupported;
+  } else if (ret != ATAP_RESULT_OK) {
+    ++m->errors;
+  }
+  m->bytes += bytes;
+  m->latency.Record(duration_ns);
+  return ret;
+}
+
+AtapResult MetricsAtapOpsDelegate::read_product_id(
+    uint8_t product_id[ATAP_PRODUCT_ID_LEN]) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret = ForwardingAtapOpsDelegate::read_product_id(product_id);
+  return Record(kReadProductId,
+                start,
+                ret == ATAP_RESULT_OK ? ATAP_PRODUCT_ID_LEN : 0,
+                ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::get_auth_key_type(AtapKeyType* key_type) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret = ForwardingAtapOpsDelegate::get_auth_key_type(key_type);
+  return Record(kGetAuthKeyType, start, 0, ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::read_auth_key_cert_chain(
+    AtapCertChain* cert_chain) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret =
+      ForwardingAtapOpsDelegate::read_auth_key_cert_chain(cert_chain);
+  return Record(kReadAuthKeyCertChain,
+                start,
+                ret == ATAP_RESULT_OK ? CertChainBytes(cert_chain) : 0,
+                ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::write_attestation_key(
+    AtapKeyType key_type,
+    const AtapBlob* key,
+    const AtapCertChain* cert_chain) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret = ForwardingAtapOpsDelegate::write_attestation_key(
+      key_type, key, cert_chain);
+  return Record(kWriteAttestationKey,
+                start,
+                (key ? key->data_length : 0) + CertChainBytes(cert_chain),
+                ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::write_attestation_keys(
+    const AtapAttestationKey* keys, uint32_t key_count) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret =
+      ForwardingAtapOpsDelegate::write_attestation_keys(keys, key_count);
+  uint64_t bytes = 0;
+  for (uint32_t i = 0; i < key_count; ++i) {
+    bytes += keys[i].key.data_length + CertChainBytes(&keys[i].cert_chain);
+  }
+  return Record(kWriteAttestationKeys, start, bytes, ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::read_attestation_public_key(
+    AtapKeyType key_type,
+    uint8_t pubkey[ATAP_KEY_LEN_MAX],
+    uint32_t* pubkey_len) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret = ForwardingAtapOpsDelegate::read_attestation_public_key(
+      key_type, pubkey, pubkey_len);
+  return Record(kReadAttestationPublicKey,
+                start,
+                ret == ATAP_RESULT_OK ? *pubkey_len : 0,
+                ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::read_soc_global_key(
+    uint8_t global_key[ATAP_AES_128_KEY_LEN]) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret = ForwardingAtapOpsDelegate::read_soc_global_key(global_key);
+  return Record(kReadSocGlobalKey,
+                start,
+                ret == ATAP_RESULT_OK ? ATAP_AES_128_KEY_LEN : 0,
+                ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::write_hex_uuid(
+    const uint8_t uuid[ATAP_HEX_UUID_LEN]) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret = ForwardingAtapOpsDelegate::write_hex_uuid(uuid);
+  return Record(kWriteHexUuid, start, ATAP_HEX_UUID_LEN, ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::get_random_bytes(uint8_t* buf,
+                                                    uint32_t buf_size) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret = ForwardingAtapOpsDelegate::get_random_bytes(buf, buf_size);
+  return Record(
+      kGetRandomBytes, start, ret == ATAP_RESULT_OK ? buf_size : 0, ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::auth_key_sign(
+    const uint8_t* nonce,
+    uint32_t nonce_len,
+    uint8_t sig[ATAP_SIGNATURE_LEN_MAX],
+    uint32_t* sig_len) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret =
+      ForwardingAtapOpsDelegate::auth_key_sign(nonce, nonce_len, sig, sig_len);
+  return Record(kAuthKeySign,
+                start,
+                nonce_len + (ret == ATAP_RESULT_OK ? *sig_len : 0),
+                ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::ecdh_shared_secret_compute(
+    AtapCurveType curve,
+    const uint8_t other_public_key[ATAP_ECDH_KEY_LEN],
+    uint8_t public_key[ATAP_ECDH_KEY_LEN],
+    uint8_t shared_secret[ATAP_ECDH_KEY_LEN]) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret = ForwardingAtapOpsDelegate::ecdh_shared_secret_compute(
+      curve, other_public_key, public_key, shared_secret);
+  return Record(kEcdhSharedSecretCompute, start, ATAP_ECDH_KEY_LEN, ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::aes_gcm_128_encrypt(
+    const uint8_t* plaintext,
+    uint32_t len,
+    const uint8_t iv[ATAP_GCM_IV_LEN],
+    const uint8_t key[ATAP_AES_128_KEY_LEN],
+    uint8_t* ciphertext,
+    uint8_t tag[ATAP_GCM_TAG_LEN]) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret = ForwardingAtapOpsDelegate::aes_gcm_128_encrypt(
+      plaintext, len, iv, key, ciphertext, tag);
+  return Record(kAesGcm128Encrypt, start, len, ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::aes_gcm_128_decrypt(
+    const uint8_t* ciphertext,
+    uint32_t len,
+    const uint8_t iv[ATAP_GCM_IV_LEN],
+    const uint8_t key[ATAP_AES_128_KEY_LEN],
+    const uint8_t tag[ATAP_GCM_TAG_LEN],
+    uint8_t* plaintext) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret = ForwardingAtapOpsDelegate::aes_gcm_128_decrypt(
+      ciphertext, len, iv, key, tag, plaintext);
+  return Record(kAesGcm128Decrypt, start, len, ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::aes_gcm_128_encrypt_in_place(
+    uint8_t* buf,
+    uint32_t len,
+    const uint8_t iv[ATAP_GCM_IV_LEN],
+    const uint8_t key[ATAP_AES_128_KEY_LEN],
+    uint8_t tag[ATAP_GCM_TAG_LEN]) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret = ForwardingAtapOpsDelegate::aes_gcm_128_encrypt_in_place(
+      buf, len, iv, key, tag);
+  return Record(kAesGcm128EncryptInPlace, start, len, ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::aes_gcm_128_decrypt_in_place(
+    uint8_t* buf,
+    uint32_t len,
+    const uint8_t iv[ATAP_GCM_IV_LEN],
+    const uint8_t key[ATAP_AES_128_KEY_LEN],
+    const uint8_t tag[ATAP_GCM_TAG_LEN]) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret = ForwardingAtapOpsDelegate::aes_gcm_128_decrypt_in_place(
+      buf, len, iv, key, tag);
+  return Record(kAesGcm128DecryptInPlace, start, len, ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::aes_gcm_128_decrypt_begin(
+    const uint8_t iv[ATAP_GCM_IV_LEN],
+    const uint8_t key[ATAP_AES_128_KEY_LEN],
+    void** ctx) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret =
+      ForwardingAtapOpsDelegate::aes_gcm_128_decrypt_begin(iv, key, ctx);
+  return Record(kAesGcm128DecryptBegin, start, 0, ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::aes_gcm_128_decrypt_update(
+    void* ctx, const uint8_t* ciphertext, uint32_t len, uint8_t* plaintext) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret = ForwardingAtapOpsDelegate::aes_gcm_128_decrypt_update(
+      ctx, ciphertext, len, plaintext);
+  return Record(kAesGcm128DecryptUpdate, start, len, ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::aes_gcm_128_decrypt_finish(
+    void* ctx, const uint8_t tag[ATAP_GCM_TAG_LEN]) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret =
+      ForwardingAtapOpsDelegate::aes_gcm_128_decrypt_finish(ctx, tag);
+  return Record(kAesGcm128DecryptFinish, start, 0, ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::sha256(
+    const uint8_t* plaintext,
+    uint32_t plaintext_len,
+    uint8_t hash[ATAP_SHA256_DIGEST_LEN]) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret =
+      ForwardingAtapOpsDelegate::sha256(plaintext, plaintext_len, hash);
+  return Record(kSha256, start, plaintext_len, ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::hkdf_sha256(const uint8_t* salt,
+                                               uint32_t salt_len,
+                                               const uint8_t* ikm,
+                                               uint32_t ikm_len,
+                                               const uint8_t* info,
+                                               uint32_t info_len,
+                                               uint8_t* okm,
+                                               int32_t okm_len) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret = ForwardingAtapOpsDelegate::hkdf_sha256(
+      salt, salt_len, ikm, ikm_len, info, info_len, okm, okm_len);
+  return Record(kHkdfSha256,
+                start,
+                salt_len + ikm_len + info_len +
+                    (okm_len > 0 ? static_cast<uint64_t>(okm_len) : 0),
+                ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::aes_gcm_128_encrypt_batch(
+    AtapAesGcmEncryptJob* jobs, size_t count) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret =
+      ForwardingAtapOpsDelegate::aes_gcm_128_encrypt_batch(jobs, count);
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < count; ++i) {
+    bytes += jobs[i].len;
+  }
+  return Record(kAesGcm128EncryptBatch, start, bytes, ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::sha256_batch(AtapSha256Job* jobs,
+                                                size_t count) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret = ForwardingAtapOpsDelegate::sha256_batch(jobs, count);
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < count; ++i) {
+    bytes += jobs[i].plaintext_len;
+  }
+  return Record(kSha256Batch, start, bytes, ret);
+}
+
+AtapResult MetricsAtapOpsDelegate::hkdf_sha256_batch(AtapHkdfSha256Job* jobs,
+                                                     size_t count) {
+  Clock::time_point start = Clock::now();
+  AtapResult ret = ForwardingAtapOpsDelegate::hkdf_sha256_batch(jobs, count);
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < count; ++i) {
+    bytes += jobs[i].salt_len + jobs[i].ikm_len + jobs[i].info_len +
+             (jobs[i].okm_len > 0 ? static_cast<uint64_t>(jobs[i].okm_len)
+                                  : 0);
+  }
+  return Record(kHkdfSha256Batch, start, bytes, ret);
+}
+
+AtapOpMetrics MetricsAtapOpsDelegate::metrics(Method method) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  atap_assert(method >= 0 && method < kMethodCount);
+  return metrics_[method];
+}
+
+std::vector<AtapOpMetrics> MetricsAtapOpsDelegate::Snapshot() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return std::vector<AtapOpMetrics>(metrics_, metrics_ + kMethodCount);
+}
+
+void MetricsAtapOpsDelegate::Reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (int i = 0; i < kMethodCount; ++i) {
+    metrics_[i] = AtapOpMetrics();
+    metrics_[i].method = MethodName(static_cast<Method>(i));
+  }
+}
+
+void MetricsAtapOpsDelegate::MergeSnapshot(
+    const std::vector<AtapOpMetrics>& other,
+    std::vector<AtapOpMetrics>* snapshot) {
+  atap_assert(other.size() == snapshot->size());
+  for (size_t i = 0; i < other.size(); ++i) {
+    AtapOpMetrics* m = &(*snapshot)[i];
+    m->calls += other[i].calls;
+    m->errors += other[i].errors;
+    m->unsupported += other[i].unsupported;
+    m->bytes += other[i].bytes;
+    m->latency.Merge(other[i].latency);
+  }
+}
+
+std::string MetricsAtapOpsDelegate::ToString(
+    const std::vector<AtapOpMetrics>& snapshot) {
+  std::string out;
+  char line[256];
+
+  for (const AtapOpMetrics& m : snapshot) {
+    if (m.calls == 0) {
+      continue;
+    }
+    snprintf(line,
+             sizeof(line),
+             "%s calls=%" PRIu64 " errors=%" PRIu64 " unsupported=%" PRIu64
+             " bytes=%" PRIu64 " p50_us=%" PRIu64 " p99_us=%" PRIu64
+             " max_us=%" PRIu64 "\n",
+             m.method,
+             m.calls,
+             m.errors,
+             m.unsupported,
+             m.bytes,
+             m.latency.PercentileNs(50) / 1000,
+             m.latency.PercentileNs(99) / 1000,
+             m.latency.max_ns / 1000);
+    out += line;
+  }
+  return out;
+}
+
+std::string MetricsAtapOpsDelegate::ToPrometheusText(
+    const std::vector<AtapOpMetrics>& snapshot, const std::string& prefix) {
+  std::string out;
+  std::string latency = prefix + "_latency_seconds";
+  char line[256];
+
+  AppendCounter(snapshot,
+                prefix + "_calls_total",
+                "AtapOps calls.",
+                &AtapOpMetrics::calls,
+                &out);
+  AppendCounter(snapshot,
+                prefix + "_errors_total",
+                "AtapOps calls that failed.",
+                &AtapOpMetrics::errors,
+                &out);
+  AppendCounter(snapshot,
+                prefix + "_unsupported_total",
+                "AtapOps calls that returned UNSUPPORTED_OPERATION.",
+                &AtapOpMetrics::unsupported,
+                &out);
+  AppendCounter(snapshot,
+                prefix + "_bytes_total",
+                "Bytes passed to or returned by AtapOps calls.",
+                &AtapOpMetrics::bytes,
+                &out);
+
+  out += "# HELP " + latency + " AtapOps call latency.\n";
+  out += "# TYPE " + latency + " histogram\n";
+  for (const AtapOpMetrics& m : snapshot) {
+    uint64_t cumulative = 0;
+    if (m.calls == 0) {
+      continue;
+    }
+    for (size_t i = 0; i + 1 < LatencyHistogram::kBucketCount; ++i) {
+      cumulative += m.latency.buckets[i];
+      snprintf(line,
+               sizeof(line),
+               "%s_bucket{method=\"%s\",le=\"%g\"} %" PRIu64 "\n",
+               latency.c_str(),
+               m.method,
+               LatencyHistogram::BucketLimitNs(i) / 1e9,
+               cumulative);
+      out += line;
+    }
+    snprintf(line,
+             sizeof(line),
+             "%s_bucket{method=\"%s\",le=\"+Inf\"} %" PRIu64
+             "\n%s_sum{method=\"%s\"} %.9f\n%s_count{method=\"%s\"} %" PRIu64
+             "\n",
+             latency.c_str(),
+             m.method,
+             m.latency.count,
+             latency.c_str(),
+             m.method,
+             m.latency.total_ns / 1e9,
+             latency.c_str(),
+             m.method,
+             m.latency.count);
+    out += line;
+  }
+  return out;
+}
+
+const char* MetricsAtapOpsDelegate::MethodName(Method method) {
+  switch (method) {
+    case kReadProductId:
+      return "read_product_id";
+    case kGetAuthKeyType:
+      return "get_auth_key_type";
+    case kReadAuthKeyCertChain:
+      return "read_auth_key_cert_chain";
+    case kWriteAttestationKey:
+      return "write_attestation_key";
+    case kWriteAttestationKeys:
+      return "write_attestation_keys";
+    case kReadAttestationPublicKey:
+      return "read_attestation_public_key";
+    case kReadSocGlobalKey:
+      return "read_soc_global_key";
+    case kWriteHexUuid:
+      return "write_hex_uuid";
+    case kGetRandomBytes:
+      return "get_random_bytes";
+    case kAuthKeySign:
+      return "auth_key_sign";
+    case kEcdhSharedSecretCompute:
+      return "ecdh_shared_secret_compute";
+    case kAesGcm128Encrypt:
+      return "aes_gcm_128_encrypt";
+    case kAesGcm128Decrypt:
+      return "aes_gcm_128_decrypt";
+    case kAesGcm128EncryptInPlace:
+      return "aes_gcm_128_encrypt_in_place";
+    case kAesGcm128DecryptInPlace:
+      return "aes_gcm_128_decrypt_in_place";
+    case kAesGcm128DecryptBegin:
+      return "aes_gcm_128_decrypt_begin";
+    case kAesGcm128DecryptUpdate:
+      return "aes_gcm_128_decrypt_update";
+    case kAesGcm128DecryptFinish:
+      return "aes_gcm_128_decrypt_finish";
+    case kSha256:
+      return "sha256";
+    case kHkdfSha256:
+      return "hkdf_sha256";
+    case kAesGcm128EncryptBatch:
+      return "aes_gcm_128_encrypt_batch";
+    case kSha256Batch:
+      return "sha256_batch";
+    case kHkdfSha256Batch:
+      return "hkdf_sha256_batch";
+    default:
+      return "unknown";
+  }
+}
+
+}  // namespace atap
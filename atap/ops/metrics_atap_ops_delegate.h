@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef METRICS_ATAP_OPS_DELEGATE_H_
+#define METRICS_ATAP_OPS_DELEGATE_H_
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "forwarding_atap_ops_delegate.h"
+#include "latency_histogram.h"
+
+namespace atap {
+
+// Counters of one AtapOpsDelegate method.
+struct AtapOpMetrics {
+  const char* method = nullptr;
+  uint64_t calls = 0;
+  // Calls that returned neither ATAP_RESULT_OK nor
+  // ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION.
+  uint64_t errors = 0;
+  // Calls that returned ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION. This is
+  // expected for optional ops the wrapped delegate does not implement.
+  uint64_t unsupported = 0;
+  // Message bytes passed in or, on success, returned: plaintext or
+  // ciphertext for AES-GCM, hash and HKDF input, keys, cert chains, public
+  // keys, signatures and random bytes.
+  uint64_t bytes = 0;
+  LatencyHistogram latency;
+};
+
+// Forwards all ops to another delegate, such as OpensslOps or device ops,
+// and counts calls, bytes, errors and latency of every method. trace() is
+// forwarded but not counted.
+//
+// Like any delegate, an instance must only be driven by one AtapOps at a
+// time, but the metrics may be read from any thread. To aggregate the
+// shards of a ShardedAtapOpsProvider, wrap each shard's delegate and merge
+// their snapshots.
+class MetricsAtapOpsDelegate : public ForwardingAtapOpsDelegate {
+ public:
+  enum Method {
+    kReadProductId,
+    kGetAuthKeyType,
+    kReadAuthKeyCertChain,
+    kWriteAttestationKey,
+    kWriteAttestationKeys,
+    kReadAttestationPublicKey,
+    kReadSocGlobalKey,
+    kWriteHexUuid,
+    kGetRandomBytes,
+    kAuthKeySign,
+    kEcdhSharedSecretCompute,
+    kAesGcm128Encrypt,
+    kAesGcm128Decrypt,
+    kAesGcm128EncryptInPlace,
+    kAesGcm128DecryptInPlace,
+    kAesGcm128DecryptBegin,
+    kAesGcm128DecryptUpdate,
+    kAesGcm128DecryptFinish,
+    kSha256,
+    kHkdfSha256,
+    kAesGcm128EncryptBatch,
+    kSha256Batch,
+    kHkdfSha256Batch,
+    kMethodCount
+  };
+
+  // Does not take ownership of |delegate|, which must outlive this object.
+  explicit MetricsAtapOpsDelegate(AtapOpsDelegate* delegate);
+  ~MetricsAtapOpsDelegate() override;
+
+  AtapResult read_product_id(uint8_t product_id[ATAP_PRODUCT_ID_LEN]) override;
+
+  AtapResult get_auth_key_type(AtapKeyType* key_type) override;
+
+  AtapResult read_auth_key_cert_chain(AtapCertChain* cert_chain) override;
+
+  AtapResult write_attestation_key(AtapKeyType key_type,
+                                   const AtapBlob* key,
+                                   const AtapCertChain* cert_chain) override;
+
+  AtapResult write_attestation_keys(const AtapAttestationKey* keys,
+                                    uint32_t key_count) override;
+
+  AtapResult read_attestation_public_key(AtapKeyType key_type,
+                                         uint8_t pubkey[ATAP_KEY_LEN_MAX],
+                                         uint32_t* pubkey_len) override;
+
+  AtapResult read_soc_global_key(
+      uint8_t global_key[ATAP_AES_128_KEY_LEN]) override;
+
+  AtapResult write_hex_uuid(const uint8_t uuid[ATAP_HEX_UUID_LEN]) override;
+
+  AtapResult get_random_bytes(uint8_t* buf, uint32_t buf_size) override;
+
+  AtapResult auth_key_sign(const uint8_t* nonce,
+                           uint32_t nonce_len,
+                           uint8_t sig[ATAP_SIGNATURE_LEN_MAX],
+                           uint32_t* sig_len) override;
+
+  AtapResult ecdh_shared_secret_compute(
+      AtapCurveType curve,
+      const uint8_t other_public_key[ATAP_ECDH_KEY_LEN],
+      uint8_t public_key[ATAP_ECDH_KEY_LEN],
+      uint8_t shared_secret[ATAP_ECDH_KEY_LEN]) override;
+
+  AtapResult aes_gcm_128_encrypt(const uint8_t* plaintext,
+                                 uint32_t len,
+                                 const uint8_t iv[ATAP_GCM_IV_LEN],
+                                 const uint8_t key[ATAP_AES_128_KEY_LEN],
+                                 uint8_t* ciphertext,
+                                 uint8_t tag[ATAP_GCM_TAG_LEN]) override;
+
+  AtapResult aes_gcm_128_decrypt(const uint8_t* ciphertext,
+                                 uint32_t len,
+                                 const uint8_t iv[ATAP_GCM_IV_LEN],
+                                 const uint8_t key[ATAP_AES_128_KEY_LEN],
+                                 const uint8_t tag[ATAP_GCM_TAG_LEN],
+                                 uint8_t* plaintext) override;
+
+  AtapResult aes_gcm_128_encrypt_in_place(
+      uint8_t* buf,
+      uint32_t len,
+      const uint8_t iv[ATAP_GCM_IV_LEN],
+      const uint8_t key[ATAP_AES_128_KEY_LEN],
+      uint8_t tag[ATAP_GCM_TAG_LEN]) override;
+
+  AtapResult aes_gcm_128_decrypt_in_place(
+      uint8_t* buf,
+      uint32_t len,
+      const uint8_t iv[ATAP_GCM_IV_LEN],
+      const uint8_t key[ATAP_AES_128_KEY_LEN],
+      const uint8_t tag[ATAP_GCM_TAG_LEN]) override;
+
+  AtapResult aes_gcm_128_decrypt_begin(const uint8_t iv[ATAP_GCM_IV_LEN],
+                                       const uint8_t key[ATAP_AES_128_KEY_LEN],
+                                       void** ctx) override;
+
+  AtapResult aes_gcm_128_decrypt_update(void* ctx,
+                                        const uint8_t* ciphertext,
+                                        uint32_t len,
+                                        uint8_t* plaintext) override;
+
+  AtapResult aes_gcm_128_decrypt_finish(
+      void* ctx, const uint8_t tag[ATAP_GCM_TAG_LEN]) override;
+
+  AtapResult sha256(const uint8_t* plaintext,
+                    uint32_t plaintext_len,
+                    uint8_t hash[ATAP_SHA256_DIGEST_LEN]) override;
+
+  AtapResult hkdf_sha256(const uint8_t* salt,
+                         uint32_t salt_len,
+                         const uint8_t* ikm,
+                         uint32_t ikm_len,
+                         const uint8_t* info,
+                         uint32_t info_len,
+                         uint8_t* okm,
+                         int32_t okm_len) override;
+
+  // A batch counts as one call, with the bytes of all its jobs.
+  AtapResult aes_gcm_128_encrypt_batch(AtapAesGcmEncryptJob* jobs,
+                                       size_t count) override;
+
+  AtapResult sha256_batch(AtapSha256Job* jobs, size_t count) override;
+
+  AtapResult hkdf_sha256_batch(AtapHkdfSha256Job* jobs,
+                               size_t count) override;
+
+  // Returns a copy of the metrics of |method|.
+  AtapOpMetrics metrics(Method method) const;
+
+  // Returns a copy of the metrics of every method, indexed by Method.
+  std::vector<AtapOpMetrics> Snapshot() const;
+
+  // Clears all metrics.
+  void Reset();
+
+  // Adds the counters of |other| to |*snapshot|, both as returned by
+  // Snapshot().
+  static void MergeSnapshot(const std::vector<AtapOpMetrics>& other,
+                            std::vector<AtapOpMetrics>* snapshot);
+
+  // Returns one line per called method of |snapshot| with its counters and
+  // p50, p99 and maximum latency in microseconds.
+  static std::string ToString(const std::vector<AtapOpMetrics>& snapshot);
+
+  // Returns |snapshot| in the Prometheus text exposition format, as
+  // counters <prefix>_calls_total, <prefix>_errors_total,
+  // <prefix>_unsupported_total and <prefix>_bytes_total and histogram
+  // <prefix>_latency_seconds, labelled with the method name. Methods that
+  // were never called are left out.
+  static std::string ToPrometheusText(
+      const std::vector<AtapOpMetrics>& snapshot, const std::string& prefix);
+
+  // Returns the name of |method|, the name of the AtapOps field.
+  static const char* MethodName(Method method);
+
+ private:
+  // Counts a call of |method| that started at |start| and returns |ret|.
+  AtapResult Record(Method method,
+                    std::chrono::steady_clock::time_point start,
+                    uint64_t bytes,
+                    AtapResult ret);
+
+  mutable std::mutex mutex_;
+  AtapOpMetrics metrics_[kMethodCount];
+};
+
+}  // namespace atap
+
+#endif /* METRICS_ATAP_OPS_DELEGATE_H_ */
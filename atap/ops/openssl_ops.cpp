@@ -26,11 +26,13 @@
 
 #include <libatap/libatap.h>
 #include <openssl/aead.h>
+#include <openssl/cipher.h>
 #include <openssl/curve25519.h>
 #include <openssl/digest.h>
 #include <openssl/ec.h>
 #include <openssl/ecdh.h>
 #include <openssl/hkdf.h>
+#include <openssl/mem.h>
 #include <openssl/obj_mac.h>
 #include <openssl/rand.h>
 #include <openssl/sha.h>
@@ -38,7 +40,72 @@
 namespace atap {
 
 OpensslOps::OpensslOps() {}
-OpensslOps::~OpensslOps() {}
+
+OpensslOps::~OpensslOps() {
+  ClearAeadKeyCache();
+  if (p256_other_point_) EC_POINT_free(p256_other_point_);
+  if (p256_group_) EC_GROUP_free(p256_group_);
+}
+
+void OpensslOps::ClearAeadKeyCache() {
+  for (size_t i = 0; i < kAeadKeyCacheSize; ++i) {
+    AeadKeyCacheEntry* entry = &aead_key_cache_[i];
+    if (entry->valid) {
+      EVP_AEAD_CTX_cleanup(&entry->ctx);
+    }
+    OPENSSL_cleanse(entry, sizeof(AeadKeyCacheEntry));
+  }
+  aead_key_cache_next_ = 0;
+}
+
+const EVP_AEAD_CTX* OpensslOps::get_aead_ctx(
+    const uint8_t key[ATAP_AES_128_KEY_LEN]) {
+  for (size_t i = 0; i < kAeadKeyCacheSize; ++i) {
+    AeadKeyCacheEntry* entry = &aead_key_cache_[i];
+    if (entry->valid &&
+        CRYPTO_memcmp(entry->key, key, ATAP_AES_128_KEY_LEN) == 0) {
+      return &entry->ctx;
+    }
+  }
+  AeadKeyCacheEntry* entry = &aead_key_cache_[aead_key_cache_next_];
+  aead_key_cache_next_ = (aead_key_cache_next_ + 1) % kAeadKeyCacheSize;
+  if (entry->valid) {
+    EVP_AEAD_CTX_cleanup(&entry->ctx);
+    OPENSSL_cleanse(entry, sizeof(AeadKeyCacheEntry));
+  }
+  if (!EVP_AEAD_CTX_init(&entry->ctx,
+                         EVP_aead_aes_128_gcm(),
+                         key,
+                         ATAP_AES_128_KEY_LEN,
+                         ATAP_GCM_TAG_LEN,
+                         NULL)) {
+    atap_error("Error initializing EVP_AEAD_CTX");
+    return nullptr;
+  }
+  atap_memcpy(entry->key, key, ATAP_AES_128_KEY_LEN);
+  entry->valid = true;
+  return &entry->ctx;
+}
+
+AtapResult OpensslOps::init_p256_context() {
+  if (p256_other_point_) {
+    return ATAP_RESULT_OK;
+  }
+  if (!p256_group_) {
+    /* The built-in P-256 group carries precomputed generator tables. */
+    p256_group_ = EC_GROUP_new_by_curve_name(NID_X9_62_prime256v1);
+    if (!p256_group_) {
+      atap_error("Error allocating P-256 group");
+      return ATAP_RESULT_ERROR_OOM;
+    }
+  }
+  p256_other_point_ = EC_POINT_new(p256_group_);
+  if (!p256_other_point_) {
+    atap_error("Error allocating EC point");
+    return ATAP_RESULT_ERROR_OOM;
+  }
+  return ATAP_RESULT_OK;
+}
 
 AtapResult OpensslOps::get_random_bytes(uint8_t* buf, uint32_t buf_size) {
   if (RAND_bytes(buf, buf_size) != 1) {
@@ -53,28 +120,68 @@ AtapResult OpensslOps::ecdh_shared_secret_compute(
     const uint8_t other_public_key[ATAP_ECDH_KEY_LEN],
     uint8_t public_key[ATAP_ECDH_KEY_LEN],
     uint8_t shared_secret[ATAP_ECDH_SHARED_SECRET_LEN]) {
+  bool use_test_key = curve == ATAP_CURVE_TYPE_X25519 ? test_key_size_ == 32
+                                                      : test_key_size_ > 0;
+  return ecdh_compute(curve,
+                      use_test_key ? test_key_ : nullptr,
+                      use_test_key ? test_key_size_ : 0,
+                      other_public_key,
+                      public_key,
+                      shared_secret);
+}
+
+AtapResult OpensslOps::ecdh_shared_secret_compute_with_key(
+    AtapCurveType curve,
+    const void* private_key,
+    size_t private_key_size,
+    const uint8_t other_public_key[ATAP_ECDH_KEY_LEN],
+    uint8_t public_key[ATAP_ECDH_KEY_LEN],
+    uint8_t shared_secret[ATAP_ECDH_SHARED_SECRET_LEN]) {
+  if (private_key == nullptr || private_key_size == 0 ||
+      (curve == ATAP_CURVE_TYPE_X25519 && private_key_size != 32)) {
+    return ATAP_RESULT_ERROR_INVALID_INPUT;
+  }
+  return ecdh_compute(curve,
+                      static_cast<const uint8_t*>(private_key),
+                      private_key_size,
+                      other_public_key,
+                      public_key,
+                      shared_secret);
+}
+
+AtapResult OpensslOps::ecdh_compute(
+    AtapCurveType curve,
+    const uint8_t* private_key,
+    size_t private_key_size,
+    const uint8_t other_public_key[ATAP_ECDH_KEY_LEN],
+    uint8_t public_key[ATAP_ECDH_KEY_LEN],
+    uint8_t shared_secret[ATAP_ECDH_SHARED_SECRET_LEN]) {
   AtapResult result = ATAP_RESULT_OK;
-  EC_GROUP* group = NULL;
-  EC_POINT* other_point = NULL;
   EC_KEY* pkey = NULL;
   if (curve == ATAP_CURVE_TYPE_X25519) {
     uint8_t x25519_priv_key[32];
     uint8_t x25519_pub_key[32];
-    if (test_key_size_ == 32) {
-      atap_memcpy(x25519_priv_key, test_key_, 32);
+    if (private_key) {
+      atap_memcpy(x25519_priv_key, private_key, 32);
       X25519_public_from_private(x25519_pub_key, x25519_priv_key);
-    } else {
+    } else if (!ecdh_key_pool_ ||
+               !ecdh_key_pool_->TakeX25519Keypair(x25519_pub_key,
+                                                  x25519_priv_key)) {
       // Generate an ephemeral key pair.
       X25519_keypair(x25519_pub_key, x25519_priv_key);
     }
     atap_memset(public_key, 0, ATAP_ECDH_KEY_LEN);
     atap_memcpy(public_key, x25519_pub_key, 32);
     X25519(shared_secret, x25519_priv_key, other_public_key);
+    OPENSSL_cleanse(x25519_priv_key, sizeof(x25519_priv_key));
   } else if (curve == ATAP_CURVE_TYPE_P256) {
-    group = EC_GROUP_new_by_curve_name(NID_X9_62_prime256v1);
-    other_point = EC_POINT_new(group);
+    result = init_p256_context();
+    if (result != ATAP_RESULT_OK) {
+      goto out;
+    }
+    const EC_GROUP* group = p256_group_;
     if (!EC_POINT_oct2point(group,
-                            other_point,
+                            p256_other_point_,
                             other_public_key,
                             ATAP_ECDH_KEY_LEN,
                             NULL)) {
@@ -83,26 +190,40 @@ AtapResult OpensslOps::ecdh_shared_secret_compute(
       goto out;
     }
 
-    if (test_key_size_ > 0) {
-      const uint8_t* buf_ptr = test_key_;
-      pkey = d2i_ECPrivateKey(nullptr, &buf_ptr, test_key_size_);
-      EC_KEY_set_group(pkey, group);
-    } else {
-      pkey = EC_KEY_new();
+    if (private_key) {
+      const uint8_t* buf_ptr = private_key;
+      pkey = d2i_ECPrivateKey(nullptr, &buf_ptr, private_key_size);
       if (!pkey) {
-        atap_error("Error allocating EC key");
-        result = ATAP_RESULT_ERROR_OOM;
+        atap_error("Deserializing private_key failed");
+        result = ATAP_RESULT_ERROR_INVALID_INPUT;
         goto out;
       }
-      if (1 != EC_KEY_set_group(pkey, group)) {
-        atap_error("EC_KEY_set_group failed");
-        result = ATAP_RESULT_ERROR_CRYPTO;
-        goto out;
+      EC_KEY_set_group(pkey, group);
+    } else {
+      if (ecdh_key_pool_) {
+        pkey = ecdh_key_pool_->TakeP256Key();
       }
-      if (1 != EC_KEY_generate_key(pkey)) {
-        atap_error("EC_KEY_generate_key failed");
-        result = ATAP_RESULT_ERROR_CRYPTO;
-        goto out;
+      if (!pkey) {
+        /* The key object is not reused, so that the ephemeral private key
+         * is wiped by EC_KEY_free() as soon as the shared secret is
+         * computed.
+         */
+        pkey = EC_KEY_new();
+        if (!pkey) {
+          atap_error("Error allocating EC key");
+          result = ATAP_RESULT_ERROR_OOM;
+          goto out;
+        }
+        if (1 != EC_KEY_set_group(pkey, group)) {
+          atap_error("EC_KEY_set_group failed");
+          result = ATAP_RESULT_ERROR_CRYPTO;
+          goto out;
+        }
+        if (1 != EC_KEY_generate_key(pkey)) {
+          atap_error("EC_KEY_generate_key failed");
+          result = ATAP_RESULT_ERROR_CRYPTO;
+          goto out;
+        }
       }
     }
     const EC_POINT* public_point = EC_KEY_get0_public_key(pkey);
@@ -119,7 +240,7 @@ AtapResult OpensslOps::ecdh_shared_secret_compute(
 
     if (-1 == ECDH_compute_key(shared_secret,
                                ATAP_ECDH_SHARED_SECRET_LEN,
-                               other_point,
+                               p256_other_point_,
                                pkey,
                                NULL)) {
       atap_error("Error computing shared secret");
@@ -133,8 +254,6 @@ AtapResult OpensslOps::ecdh_shared_secret_compute(
   }
 
 out:
-  if (group) EC_GROUP_free(group);
-  if (other_point) EC_POINT_free(other_point);
   if (pkey) EC_KEY_free(pkey);
   return result;
 }
@@ -147,38 +266,31 @@ AtapResult OpensslOps::aes_gcm_128_encrypt(
     uint8_t* ciphertext,
     uint8_t tag[ATAP_GCM_TAG_LEN]) {
   AtapResult ret = ATAP_RESULT_OK;
-  EVP_AEAD_CTX ctx;
-  if (!EVP_AEAD_CTX_init(&ctx,
-                         EVP_aead_aes_128_gcm(),
-                         key,
-                         ATAP_AES_128_KEY_LEN,
-                         ATAP_GCM_TAG_LEN,
-                         NULL)) {
-    atap_error("Error initializing EVP_AEAD_CTX");
+  const EVP_AEAD_CTX* ctx = get_aead_ctx(key);
+  size_t tag_len = 0;
+  if (!ctx) {
     return ATAP_RESULT_ERROR_CRYPTO;
   }
-  uint8_t* out_buf = (uint8_t*)atap_malloc(len + ATAP_GCM_TAG_LEN);
-  size_t out_len = len + ATAP_GCM_TAG_LEN;
-  if (!EVP_AEAD_CTX_seal(&ctx,
-                         out_buf,
-                         &out_len,
-                         len + ATAP_GCM_TAG_LEN,
-                         iv,
-                         ATAP_GCM_IV_LEN,
-                         plaintext,
-                         len,
-                         NULL,
-                         0)) {
+  /* seal_scatter writes the tag separately, so no joined output buffer is
+   * needed. |ciphertext| may equal |plaintext|.
+   */
+  if (!EVP_AEAD_CTX_seal_scatter(ctx,
+                                 ciphertext,
+                                 tag,
+                                 &tag_len,
+                                 ATAP_GCM_TAG_LEN,
+                                 iv,
+                                 ATAP_GCM_IV_LEN,
+                                 plaintext,
+                                 len,
+                                 NULL,
+                                 0,
+                                 NULL,
+                                 0) ||
+      tag_len != ATAP_GCM_TAG_LEN) {
     atap_error("Error encrypting");
     ret = ATAP_RESULT_ERROR_CRYPTO;
-    goto out;
   }
-  atap_memcpy(ciphertext, out_buf, len);
-  atap_memcpy(tag, out_buf + len, ATAP_GCM_TAG_LEN);
-
-out:
-  atap_free(out_buf);
-  EVP_AEAD_CTX_cleanup(&ctx);
   return ret;
 }
 
@@ -190,37 +302,102 @@ AtapResult OpensslOps::aes_gcm_128_decrypt(
     const uint8_t tag[ATAP_GCM_TAG_LEN],
     uint8_t* plaintext) {
   AtapResult ret = ATAP_RESULT_OK;
-  EVP_AEAD_CTX ctx;
-  if (!EVP_AEAD_CTX_init(&ctx,
-                         EVP_aead_aes_128_gcm(),
-                         key,
-                         ATAP_AES_128_KEY_LEN,
-                         ATAP_GCM_TAG_LEN,
-                         NULL)) {
-    atap_error("Error initializing EVP_AEAD_CTX");
+  const EVP_AEAD_CTX* ctx = get_aead_ctx(key);
+  if (!ctx) {
+    return ATAP_RESULT_ERROR_CRYPTO;
+  }
+  /* open_gather takes the detached tag, so the ciphertext is not copied.
+   * |plaintext| may equal |ciphertext|.
+   */
+  if (!EVP_AEAD_CTX_open_gather(ctx,
+                                plaintext,
+                                iv,
+                                ATAP_GCM_IV_LEN,
+                                ciphertext,
+                                len,
+                                tag,
+                                ATAP_GCM_TAG_LEN,
+                                NULL,
+                                0)) {
+    atap_error("Error decrypting");
+    ret = ATAP_RESULT_ERROR_CRYPTO;
+  }
+  return ret;
+}
+
+AtapResult OpensslOps::aes_gcm_128_encrypt_in_place(
+    uint8_t* buf,
+    uint32_t len,
+    const uint8_t iv[ATAP_GCM_IV_LEN],
+    const uint8_t key[ATAP_AES_128_KEY_LEN],
+    uint8_t tag[ATAP_GCM_TAG_LEN]) {
+  return aes_gcm_128_encrypt(buf, len, iv, key, buf, tag);
+}
+
+AtapResult OpensslOps::aes_gcm_128_decrypt_in_place(
+    uint8_t* buf,
+    uint32_t len,
+    const uint8_t iv[ATAP_GCM_IV_LEN],
+    const uint8_t key[ATAP_AES_128_KEY_LEN],
+    const uint8_t tag[ATAP_GCM_TAG_LEN]) {
+  return aes_gcm_128_decrypt(buf, len, iv, key, tag, buf);
+}
+
+// EVP_AEAD has no incremental interface, so streaming decryption uses the
+// EVP_CIPHER GCM mode directly.
+AtapResult OpensslOps::aes_gcm_128_decrypt_begin(
+    const uint8_t iv[ATAP_GCM_IV_LEN],
+    const uint8_t key[ATAP_AES_128_KEY_LEN],
+    void** ctx) {
+  EVP_CIPHER_CTX* cipher_ctx = EVP_CIPHER_CTX_new();
+  if (!cipher_ctx) {
+    return ATAP_RESULT_ERROR_OOM;
+  }
+  if (!EVP_DecryptInit_ex(cipher_ctx, EVP_aes_128_gcm(), NULL, NULL, NULL) ||
+      !EVP_CIPHER_CTX_ctrl(
+          cipher_ctx, EVP_CTRL_GCM_SET_IVLEN, ATAP_GCM_IV_LEN, NULL) ||
+      !EVP_DecryptInit_ex(cipher_ctx, NULL, NULL, key, iv)) {
+    atap_error("Error initializing decryption");
+    EVP_CIPHER_CTX_free(cipher_ctx);
     return ATAP_RESULT_ERROR_CRYPTO;
   }
-  uint8_t* in_buf = (uint8_t*)atap_malloc(len + ATAP_GCM_TAG_LEN);
-  atap_memcpy(in_buf, ciphertext, len);
-  atap_memcpy(in_buf + len, tag, ATAP_GCM_TAG_LEN);
-  size_t out_len = len;
-  if (!EVP_AEAD_CTX_open(&ctx,
+  *ctx = cipher_ctx;
+  return ATAP_RESULT_OK;
+}
+
+AtapResult OpensslOps::aes_gcm_128_decrypt_update(void* ctx,
+                                                  const uint8_t* ciphertext,
+                                                  uint32_t len,
+                                                  uint8_t* plaintext) {
+  int out_len = 0;
+  if (!EVP_DecryptUpdate(static_cast<EVP_CIPHER_CTX*>(ctx),
                          plaintext,
                          &out_len,
-                         len,
-                         iv,
-                         ATAP_GCM_IV_LEN,
-                         in_buf,
-                         len + ATAP_GCM_TAG_LEN,
-                         NULL,
-                         0)) {
+                         ciphertext,
+                         len) ||
+      out_len != static_cast<int>(len)) {
+    atap_error("Error decrypting");
+    return ATAP_RESULT_ERROR_CRYPTO;
+  }
+  return ATAP_RESULT_OK;
+}
+
+AtapResult OpensslOps::aes_gcm_128_decrypt_finish(
+    void* ctx, const uint8_t tag[ATAP_GCM_TAG_LEN]) {
+  EVP_CIPHER_CTX* cipher_ctx = static_cast<EVP_CIPHER_CTX*>(ctx);
+  AtapResult ret = ATAP_RESULT_OK;
+  uint8_t unused[ATAP_GCM_TAG_LEN];
+  int out_len = 0;
+  if (tag &&
+      (!EVP_CIPHER_CTX_ctrl(cipher_ctx,
+                            EVP_CTRL_GCM_SET_TAG,
+                            ATAP_GCM_TAG_LEN,
+                            const_cast<uint8_t*>(tag)) ||
+       EVP_DecryptFinal_ex(cipher_ctx, unused, &out_len) <= 0)) {
     atap_error("Error decrypting");
     ret = ATAP_RESULT_ERROR_CRYPTO;
-    goto out;
   }
-out:
-  atap_free(in_buf);
-  EVP_AEAD_CTX_cleanup(&ctx);
+  EVP_CIPHER_CTX_free(cipher_ctx);
   return ret;
 }
 
@@ -254,6 +431,51 @@ AtapResult OpensslOps::hkdf_sha256(const uint8_t* salt,
   return ATAP_RESULT_OK;
 }
 
+AtapResult OpensslOps::hkdf_sha256_batch(AtapHkdfSha256Job* jobs,
+                                         size_t count) {
+  AtapResult ret = ATAP_RESULT_OK;
+  uint8_t prk[EVP_MAX_MD_SIZE];
+  size_t prk_len = 0;
+  const AtapHkdfSha256Job* prk_job = nullptr;
+
+  for (size_t i = 0; i < count; ++i) {
+    AtapHkdfSha256Job* job = &jobs[i];
+    job->result = ATAP_RESULT_OK;
+    if (!prk_job || prk_job->salt_len != job->salt_len ||
+        prk_job->ikm_len != job->ikm_len ||
+        CRYPTO_memcmp(prk_job->salt, job->salt, job->salt_len) != 0 ||
+        CRYPTO_memcmp(prk_job->ikm, job->ikm, job->ikm_len) != 0) {
+      if (HKDF_extract(prk,
+                       &prk_len,
+                       EVP_sha256(),
+                       job->ikm,
+                       job->ikm_len,
+                       job->salt,
+                       job->salt_len)) {
+        prk_job = job;
+      } else {
+        prk_job = nullptr;
+      }
+    }
+    if (!prk_job || job->okm_len < 0 ||
+        !HKDF_expand(job->okm,
+                     job->okm_len,
+                     EVP_sha256(),
+                     prk,
+                     prk_len,
+                     job->info,
+                     job->info_len)) {
+      atap_error("Error in key derivation");
+      job->result = ATAP_RESULT_ERROR_CRYPTO;
+    }
+    if (ret == ATAP_RESULT_OK) {
+      ret = job->result;
+    }
+  }
+  OPENSSL_cleanse(prk, sizeof(prk));
+  return ret;
+}
+
 void OpensslOps::SetEcdhKeyForTesting(const void* key_data,
                                       size_t size_in_bytes) {
   if (size_in_bytes > sizeof(test_key_)) {
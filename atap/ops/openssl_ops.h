@@ -25,12 +25,19 @@
 #ifndef OPENSSL_OPS_H_
 #define OPENSSL_OPS_H_
 
+#include <openssl/aead.h>
+#include <openssl/ec.h>
+
 #include "atap_ops_delegate.h"
+#include "ecdh_key_pool.h"
 
 namespace atap {
 
 // A partial delegate implementation which implements all crypto ops with
-// openssl. All instances of this class must be created on the same thread.
+// openssl. Instances share no mutable state with each other, so a worker pool
+// should create one instance (or one subclass instance) per thread. An
+// instance caches curve state between calls, so it must only be used by one
+// thread at a time.
 class OpensslOps : public AtapOpsDelegate {
  public:
   OpensslOps();
@@ -59,6 +66,32 @@ class OpensslOps : public AtapOpsDelegate {
                                  const uint8_t tag[ATAP_GCM_TAG_LEN],
                                  uint8_t* plaintext) override;
 
+  AtapResult aes_gcm_128_encrypt_in_place(
+      uint8_t* buf,
+      uint32_t len,
+      const uint8_t iv[ATAP_GCM_IV_LEN],
+      const uint8_t key[ATAP_AES_128_KEY_LEN],
+      uint8_t tag[ATAP_GCM_TAG_LEN]) override;
+
+  AtapResult aes_gcm_128_decrypt_in_place(
+      uint8_t* buf,
+      uint32_t len,
+      const uint8_t iv[ATAP_GCM_IV_LEN],
+      const uint8_t key[ATAP_AES_128_KEY_LEN],
+      const uint8_t tag[ATAP_GCM_TAG_LEN]) override;
+
+  AtapResult aes_gcm_128_decrypt_begin(const uint8_t iv[ATAP_GCM_IV_LEN],
+                                       const uint8_t key[ATAP_AES_128_KEY_LEN],
+                                       void** ctx) override;
+
+  AtapResult aes_gcm_128_decrypt_update(void* ctx,
+                                        const uint8_t* ciphertext,
+                                        uint32_t len,
+                                        uint8_t* plaintext) override;
+
+  AtapResult aes_gcm_128_decrypt_finish(
+      void* ctx, const uint8_t tag[ATAP_GCM_TAG_LEN]) override;
+
   AtapResult sha256(const uint8_t* plaintext,
                     uint32_t plaintext_len,
                     uint8_t hash[ATAP_SHA256_DIGEST_LEN]) override;
@@ -72,12 +105,75 @@ class OpensslOps : public AtapOpsDelegate {
                          uint8_t* okm,
                          int32_t okm_len) override;
 
+  // Consecutive jobs with the same salt and input key material share one
+  // HKDF-Extract, as the session key and nonce derivations of a handshake
+  // do. The other batch ops use the default loop: the per-call AES-GCM and
+  // SHA-256 already use the hardware kernels the library picks at runtime,
+  // and the AES-GCM key cache serves repeated keys.
+  AtapResult hkdf_sha256_batch(AtapHkdfSha256Job* jobs,
+                               size_t count) override;
+
   // Can be used during testing to get predictable 'ephemeral' ECDH keys. This
   // must never be called except during testing. For X25519, the expected format
   // is a 32-byte private key. For P256, the expected format is X9.62 DER.
   void SetEcdhKeyForTesting(const void* key_data, size_t size_in_bytes);
 
+  // Same as ecdh_shared_secret_compute(), but with the given private key
+  // instead of an ephemeral one. This is the CA side of the key exchange,
+  // where |private_key| is the private half of the public key sent in the
+  // Operation Start message. Key formats are as for SetEcdhKeyForTesting().
+  AtapResult ecdh_shared_secret_compute_with_key(
+      AtapCurveType curve,
+      const void* private_key,
+      size_t private_key_size,
+      const uint8_t other_public_key[ATAP_ECDH_KEY_LEN],
+      uint8_t public_key[ATAP_ECDH_KEY_LEN],
+      uint8_t shared_secret[ATAP_ECDH_SHARED_SECRET_LEN]);
+
+  // Uses ephemeral keypairs from |pool| for ECDH on the pool's curve, falling
+  // back to generating a keypair inline when the pool is empty. Does not take
+  // ownership of |pool|; pass nullptr to stop using it.
+  void set_ecdh_key_pool(EcdhKeyPool* pool) {
+    ecdh_key_pool_ = pool;
+  }
+
+  // Drops and zeroizes all cached AES-GCM key schedules. The cache is also
+  // cleared when the instance is destroyed.
+  void ClearAeadKeyCache();
+
  private:
+  // Sets up the long-lived P-256 group and peer point on first use, so
+  // ecdh_shared_secret_compute() only does key generation and the shared
+  // secret scalar multiplication per call.
+  AtapResult init_p256_context();
+
+  // ECDH with |private_key|, or with an ephemeral keypair if it is nullptr.
+  AtapResult ecdh_compute(AtapCurveType curve,
+                          const uint8_t* private_key,
+                          size_t private_key_size,
+                          const uint8_t other_public_key[ATAP_ECDH_KEY_LEN],
+                          uint8_t public_key[ATAP_ECDH_KEY_LEN],
+                          uint8_t shared_secret[ATAP_ECDH_SHARED_SECRET_LEN]);
+
+  // Returns an AES-128-GCM context for |key|. The key schedule and GHASH
+  // tables are kept in a small cache, so the session key and SoC global key
+  // of a handshake are each expanded once. Returns nullptr on failure.
+  const EVP_AEAD_CTX* get_aead_ctx(const uint8_t key[ATAP_AES_128_KEY_LEN]);
+
+  struct AeadKeyCacheEntry {
+    uint8_t key[ATAP_AES_128_KEY_LEN];
+    EVP_AEAD_CTX ctx;
+    bool valid;
+  };
+  static const size_t kAeadKeyCacheSize = 4;
+  AeadKeyCacheEntry aead_key_cache_[kAeadKeyCacheSize] = {};
+  // Index of the entry to replace on the next miss.
+  size_t aead_key_cache_next_{0};
+
+  EC_GROUP* p256_group_{nullptr};
+  EC_POINT* p256_other_point_{nullptr};
+  EcdhKeyPool* ecdh_key_pool_{nullptr};
+
   uint8_t test_key_[512];
   size_t test_key_size_{0};
 };
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "phase_histogram_delegate.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+namespace atap {
+
+PhaseHistogramDelegate::PhaseHistogramDelegate(AtapOpsDelegate* delegate)
+    : ForwardingAtapOpsDelegate(delegate) {}
+
+PhaseHistogramDelegate::~PhaseHistogramDelegate() {}
+
+void PhaseHistogramDelegate::trace(AtapTracePhase phase,
+                                   AtapTraceEvent event,
+                                   uint64_t timestamp_ns) {
+  if (phase >= 0 && phase < ATAP_TRACE_PHASE_COUNT) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (event == ATAP_TRACE_EVENT_BEGIN) {
+      begin_ns_[phase] = timestamp_ns;
+      begun_[phase] = true;
+    } else if (begun_[phase]) {
+      begun_[phase] = false;
+      histograms_[phase].Record(timestamp_ns - begin_ns_[phase]);
+    }
+  }
+  ForwardingAtapOpsDelegate::trace(phase, event, timestamp_ns);
+}
+
+LatencyHistogram PhaseHistogramDelegate::histogram(AtapTracePhase phase) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  atap_assert(phase >= 0 && phase < ATAP_TRACE_PHASE_COUNT);
+  return histograms_[phase];
+}
+
+void PhaseHistogramDelegate::Reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < ATAP_TRACE_PHASE_COUNT; ++i) {
+    histograms_[i] = LatencyHistogram();
+    begun_[i] = false;
+  }
+}
+
+std::string PhaseHistogramDelegate::ToString() const {
+  std::string out;
+  char line[160];
+
+  for (int i = 0; i < ATAP_TRACE_PHASE_COUNT; ++i) {
+    LatencyHistogram h = histogram(static_cast<AtapTracePhase>(i));
+    snprintf(line,
+             sizeof(line),
+             "%s count=%" PRIu64 " mean_us=%" PRIu64 " p50_us=%" PRIu64
+             " p99_us=%" PRIu64 " max_us=%" PRIu64 "\n",
+             PhaseName(static_cast<AtapTracePhase>(i)),
+             h.count,
+             h.count ? h.total_ns / h.count / 1000 : 0,
+             h.PercentileNs(50) / 1000,
+             h.PercentileNs(99) / 1000,
+             h.max_ns / 1000);
+    out += line;
+  }
+  return out;
+}
+
+const char* PhaseHistogramDelegate::PhaseName(AtapTracePhase phase) {
+  switch (phase) {
+    case ATAP_TRACE_PHASE_INITIALIZE_SESSION:
+      return "initialize_session";
+    case ATAP_TRACE_PHASE_COMPUTE_AUTH_SIGNATURE:
+      return "compute_auth_signature";
+    case ATAP_TRACE_PHASE_READ_AVAILABLE_PUBLIC_KEYS:
+      return "read_available_public_keys";
+    case ATAP_TRACE_PHASE_ENCRYPT_INNER_CA_REQUEST:
+      return "encrypt_inner_ca_request";
+    case ATAP_TRACE_PHASE_DECRYPT_ENCRYPTED_MESSAGE:
+      return "decrypt_encrypted_message";
+    case ATAP_TRACE_PHASE_WRITE_INNER_CA_RESPONSE:
+      return "write_inner_ca_response";
+    default:
+      return "unknown";
+  }
+}
+
+}  // namespace atap
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PHASE_HISTOGRAM_DELEGATE_H_
+#define PHASE_HISTOGRAM_DELEGATE_H_
+
+#include <mutex>
+#include <string>
+
+#include "forwarding_atap_ops_delegate.h"
+#include "latency_histogram.h"
+
+namespace atap {
+
+// Forwards all ops to another delegate, and aggregates the phase durations
+// reported by a libatap built with ATAP_ENABLE_TRACE into a histogram per
+// phase. Trace events are forwarded too, so this can wrap a delegate that
+// traces on its own. Phases that end without having begun are ignored.
+//
+// Like any delegate, an instance must only be driven by one AtapOps at a
+// time, but the histograms may be read from any thread.
+class PhaseHistogramDelegate : public ForwardingAtapOpsDelegate {
+ public:
+  // Does not take ownership of |delegate|, which must outlive this object.
+  explicit PhaseHistogramDelegate(AtapOpsDelegate* delegate);
+  ~PhaseHistogramDelegate() override;
+
+  void trace(AtapTracePhase phase,
+             AtapTraceEvent event,
+             uint64_t timestamp_ns) override;
+
+  // Returns a copy of the histogram of |phase|.
+  LatencyHistogram histogram(AtapTracePhase phase) const;
+
+  // Clears all histograms.
+  void Reset();
+
+  // Returns one line per phase with its count and mean, p50, p99 and maximum
+  // durations in microseconds.
+  std::string ToString() const;
+
+  // Returns the name of |phase|, the name of the libatap function it covers.
+  static const char* PhaseName(AtapTracePhase phase);
+
+ private:
+  mutable std::mutex mutex_;
+  uint64_t begin_ns_[ATAP_TRACE_PHASE_COUNT] = {};
+  bool begun_[ATAP_TRACE_PHASE_COUNT] = {};
+  LatencyHistogram histograms_[ATAP_TRACE_PHASE_COUNT];
+};
+
+}  // namespace atap
+
+#endif /* PHASE_HISTOGRAM_DELEGATE_H_ */
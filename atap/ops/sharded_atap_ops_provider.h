@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SHARDED_ATAP_OPS_PROVIDER_H_
+#define SHARDED_ATAP_OPS_PROVIDER_H_
+
+#include <memory>
+#include <vector>
+
+#include "atap_ops_provider.h"
+
+namespace atap {
+
+// Hands out independent AtapOps tables for a pool of worker threads. Each
+// shard is a separate AtapOpsProvider forwarding to its own delegate, so no
+// mutable state is shared between shards. A shard must only be used by one
+// thread at a time; the usual setup is one shard per worker thread, each
+// driving its own stream of AtapSession handshakes.
+class ShardedAtapOpsProvider {
+ public:
+  // Creates one shard per entry of |delegates|. Does not take ownership of
+  // the delegates, which must outlive this object and must be distinct
+  // instances.
+  explicit ShardedAtapOpsProvider(
+      const std::vector<AtapOpsDelegate*>& delegates);
+  virtual ~ShardedAtapOpsProvider();
+
+  size_t shard_count() const {
+    return providers_.size();
+  }
+
+  // Returns the AtapOps table of shard |index|, which must be less than
+  // shard_count().
+  AtapOps* atap_ops(size_t index) {
+    atap_assert(index < providers_.size());
+    return providers_[index]->atap_ops();
+  }
+
+  AtapOpsDelegate* delegate(size_t index) {
+    atap_assert(index < providers_.size());
+    return providers_[index]->delegate();
+  }
+
+ private:
+  std::vector<std::unique_ptr<AtapOpsProvider>> providers_;
+};
+
+}  // namespace atap
+
+#endif /* SHARDED_ATAP_OPS_PROVIDER_H_ */
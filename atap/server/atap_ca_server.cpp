@@ -0,0 +1,475 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "atap_ca_server.h"
+
+#include <openssl/mem.h>
+
+namespace atap {
+
+namespace {
+
+// Header, device public key, IV, ciphertext length and tag of a CA Request.
+const uint32_t kCaRequestOverhead = ATAP_HEADER_LEN + ATAP_ECDH_KEY_LEN +
+                                    ATAP_GCM_IV_LEN + sizeof(uint32_t) +
+                                    ATAP_GCM_TAG_LEN;
+
+// The crypto ops of OpensslOps. The CA has no device storage, so the other
+// ops are unsupported.
+class CaCryptoOps : public OpensslOps {
+ public:
+  AtapResult read_product_id(uint8_t product_id[ATAP_PRODUCT_ID_LEN]) override {
+    return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
+  }
+
+  AtapResult get_auth_key_type(AtapKeyType* key_type) override {
+    return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
+  }
+
+  AtapResult read_auth_key_cert_chain(AtapCertChain* cert_chain) override {
+    return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
+  }
+
+  AtapResult write_attestation_key(AtapKeyType key_type,
+                                   const AtapBlob* key,
+                                   const AtapCertChain* cert_chain) override {
+    return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
+  }
+
+  AtapResult read_attestation_public_key(AtapKeyType key_type,
+                                         uint8_t pubkey[ATAP_KEY_LEN_MAX],
+                                         uint32_t* pubkey_len) override {
+    return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
+  }
+
+  AtapResult read_soc_global_key(
+      uint8_t global_key[ATAP_AES_128_KEY_LEN]) override {
+    return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
+  }
+
+  AtapResult write_hex_uuid(const uint8_t uuid[ATAP_HEX_UUID_LEN]) override {
+    return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
+  }
+
+  AtapResult auth_key_sign(const uint8_t* nonce,
+                           uint32_t nonce_len,
+                           uint8_t sig[ATAP_SIGNATURE_LEN_MAX],
+                           uint32_t* sig_len) override {
+    return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
+  }
+};
+
+}  // namespace
+
+// State of one worker thread: its own crypto ops and a buffer for the
+// decrypted Inner CA Request, reused for every item.
+class AtapCaServer::Worker {
+ public:
+  explicit Worker(AtapCaIssuer* issuer) : issuer_(issuer) {}
+
+  AtapResult Process(AtapCaBatchItem* item);
+
+ private:
+  // Points |product| or |som| into the |len| bytes of Inner CA Request at
+  // |buf|.
+  AtapResult ParseInnerCaRequest(uint8_t* buf,
+                                 uint32_t len,
+                                 AtapOperation operation,
+                                 AtapInnerCaRequestProduct* product,
+                                 AtapInnerCaRequestSom* som);
+
+  // Derives the session key and the authentication nonce as
+  // derive_session_key() does on the device, in one batch so HKDF-Extract
+  // runs once.
+  AtapResult DeriveSessionKeys(
+      const uint8_t device_pubkey[ATAP_ECDH_KEY_LEN],
+      const uint8_t ca_pubkey[ATAP_ECDH_KEY_LEN],
+      const uint8_t shared_secret[ATAP_ECDH_SHARED_SECRET_LEN],
+      uint8_t session_key[ATAP_AES_128_KEY_LEN],
+      uint8_t auth_nonce[ATAP_NONCE_LEN]);
+
+  // Writes the Inner CA Response for |item| from response_ at |buf| and
+  // sets |*len| to its size. |capacity| bytes are available at |buf|.
+  AtapResult BuildInnerCaResponse(AtapOperation operation,
+                                  uint8_t* buf,
+                                  uint32_t capacity,
+                                  uint32_t* len);
+
+  // Encrypts the |len| bytes of plaintext at |buf| +
+  // ATAP_CA_RESPONSE_PREFIX_LEN in place with |key|, and adds the header,
+  // IV, length and tag around it to make an encrypted message.
+  AtapResult Seal(uint8_t* buf,
+                  uint32_t len,
+                  const uint8_t key[ATAP_AES_128_KEY_LEN]);
+
+  AtapCaIssuer* issuer_;
+  CaCryptoOps crypto_;
+  AtapOpsProvider provider_{&crypto_};
+  uint8_t inner_ca_request_[ATAP_INNER_CA_REQUEST_LEN_MAX];
+  AtapCaIssueResponse response_;
+};
+
+AtapResult AtapCaServer::Worker::ParseInnerCaRequest(
+    uint8_t* buf,
+    uint32_t len,
+    AtapOperation operation,
+    AtapInnerCaRequestProduct* product,
+    AtapInnerCaRequestSom* som) {
+  uint8_t* buf_ptr = buf + 4;
+  const uint8_t* buf_end = buf + len;
+  uint32_t message_len = 0;
+
+  if (len < ATAP_HEADER_LEN ||
+      (buf[0] != ATAP_PROTOCOL_VERSION && buf[0] != ATAP_PROTOCOL_VERSION_1)) {
+    return ATAP_RESULT_ERROR_INVALID_INPUT;
+  }
+  copy_uint32_from_buf(&buf_ptr, &message_len);
+  if (message_len != len - ATAP_HEADER_LEN) {
+    return ATAP_RESULT_ERROR_INVALID_INPUT;
+  }
+  if (is_som_operation(operation)) {
+    if (message_len != ATAP_SHA256_DIGEST_LEN) {
+      return ATAP_RESULT_ERROR_INVALID_INPUT;
+    }
+    atap_memcpy(som->header, buf, ATAP_HEADER_LEN);
+    copy_from_buf(&buf_ptr, som->som_id_hash, ATAP_SHA256_DIGEST_LEN);
+    return ATAP_RESULT_OK;
+  }
+
+  atap_memcpy(product->header, buf, ATAP_HEADER_LEN);
+  if (!view_cert_chain_from_buf(
+          &buf_ptr, buf_end, &product->auth_key_cert_chain) ||
+      !view_blob_from_buf(&buf_ptr, buf_end, &product->signature) ||
+      (size_t)(buf_end - buf_ptr) < ATAP_SHA256_DIGEST_LEN) {
+    return ATAP_RESULT_ERROR_INVALID_INPUT;
+  }
+  copy_from_buf(&buf_ptr, product->product_id_hash, ATAP_SHA256_DIGEST_LEN);
+  if (!view_blob_from_buf(&buf_ptr, buf_end, &product->RSA_pubkey) ||
+      !view_blob_from_buf(&buf_ptr, buf_end, &product->ECDSA_pubkey) ||
+      !view_blob_from_buf(&buf_ptr, buf_end, &product->edDSA_pubkey) ||
+      buf_ptr != buf_end) {
+    return ATAP_RESULT_ERROR_INVALID_INPUT;
+  }
+  return ATAP_RESULT_OK;
+}
+
+AtapResult AtapCaServer::Worker::DeriveSessionKeys(
+    const uint8_t device_pubkey[ATAP_ECDH_KEY_LEN],
+    const uint8_t ca_pubkey[ATAP_ECDH_KEY_LEN],
+    const uint8_t shared_secret[ATAP_ECDH_SHARED_SECRET_LEN],
+    uint8_t session_key[ATAP_AES_128_KEY_LEN],
+    uint8_t auth_nonce[ATAP_NONCE_LEN]) {
+  static const char kKeyInfo[] = "KEY";
+  static const char kSignInfo[] = "SIGN";
+  uint8_t salt[2 * ATAP_ECDH_KEY_LEN];
+  AtapHkdfSha256Job jobs[2];
+
+  atap_memcpy(salt, ca_pubkey, ATAP_ECDH_KEY_LEN);
+  atap_memcpy(salt + ATAP_ECDH_KEY_LEN, device_pubkey, ATAP_ECDH_KEY_LEN);
+  for (AtapHkdfSha256Job& job : jobs) {
+    job.salt = salt;
+    job.salt_len = sizeof(salt);
+    job.ikm = shared_secret;
+    job.ikm_len = ATAP_ECDH_SHARED_SECRET_LEN;
+  }
+  jobs[0].info = (const uint8_t*)kKeyInfo;
+  jobs[0].info_len = sizeof(kKeyInfo) - 1;
+  jobs[0].okm = session_key;
+  jobs[0].okm_len = ATAP_AES_128_KEY_LEN;
+  jobs[1].info = (const uint8_t*)kSignInfo;
+  jobs[1].info_len = sizeof(kSignInfo) - 1;
+  jobs[1].okm = auth_nonce;
+  jobs[1].okm_len = ATAP_NONCE_LEN;
+  return crypto_.hkdf_sha256_batch(jobs, 2);
+}
+
+AtapResult AtapCaServer::Worker::BuildInnerCaResponse(AtapOperation operation,
+                                                      uint8_t* buf,
+                                                      uint32_t capacity,
+                                                      uint32_t* len) {
+  bool som = is_som_operation(operation);
+  uint8_t* buf_ptr = NULL;
+  uint32_t i = 0;
+
+  *len = ATAP_HEADER_LEN + (som ? 0 : ATAP_HEX_UUID_LEN);
+  for (i = 0; i < response_.key_count; ++i) {
+    *len += cert_chain_serialized_size(&response_.keys[i].cert_chain) +
+            blob_serialized_size(&response_.keys[i].key);
+  }
+  if (*len > ATAP_INNER_CA_RESPONSE_LEN_MAX) {
+    return ATAP_RESULT_ERROR_INVALID_INPUT;
+  }
+  if (*len > capacity) {
+    return ATAP_RESULT_ERROR_OOM;
+  }
+
+  buf_ptr = append_header_to_buf(buf, *len - ATAP_HEADER_LEN);
+  if (!som) {
+    buf_ptr = append_to_buf(buf_ptr, response_.hex_uuid, ATAP_HEX_UUID_LEN);
+  }
+  for (i = 0; i < response_.key_count; ++i) {
+    buf_ptr = append_cert_chain_to_buf(buf_ptr, &response_.keys[i].cert_chain);
+    buf_ptr = append_blob_to_buf(buf_ptr, &response_.keys[i].key);
+  }
+  /* Hold the issuer to the rules the device checks. */
+  if (!validate_inner_ca_response(buf, *len, operation)) {
+    return ATAP_RESULT_ERROR_INVALID_INPUT;
+  }
+  return ATAP_RESULT_OK;
+}
+
+AtapResult AtapCaServer::Worker::Seal(uint8_t* buf,
+                                      uint32_t len,
+                                      const uint8_t key[ATAP_AES_128_KEY_LEN]) {
+  AtapOps* ops = provider_.atap_ops();
+  uint8_t* iv = buf + ATAP_HEADER_LEN;
+  uint8_t* plaintext = buf + ATAP_CA_RESPONSE_PREFIX_LEN;
+  AtapResult ret = ATAP_RESULT_OK;
+
+  append_header_to_buf(
+      buf, ATAP_GCM_IV_LEN + sizeof(uint32_t) + len + ATAP_GCM_TAG_LEN);
+  ret = ops->get_random_bytes(ops, iv, ATAP_GCM_IV_LEN);
+  if (ret != ATAP_RESULT_OK) {
+    return ret;
+  }
+  append_uint32_to_buf(iv + ATAP_GCM_IV_LEN, len);
+  return AtapOpsProvider::optional_ops()->aes_gcm_128_encrypt_in_place(
+      ops, plaintext, len, iv, key, plaintext + len);
+}
+
+AtapResult AtapCaServer::Worker::Process(AtapCaBatchItem* item) {
+  AtapOps* ops = provider_.atap_ops();
+  AtapCaIssueRequest request;
+  AtapInnerCaRequestProduct product;
+  AtapInnerCaRequestSom som;
+  uint8_t ca_pubkey[ATAP_ECDH_KEY_LEN];
+  uint8_t shared_secret[ATAP_ECDH_SHARED_SECRET_LEN];
+  uint8_t session_key[ATAP_AES_128_KEY_LEN];
+  const uint8_t* device_pubkey = item->ca_request + ATAP_HEADER_LEN;
+  const uint8_t* iv = device_pubkey + ATAP_ECDH_KEY_LEN;
+  uint8_t* buf_ptr = (uint8_t*)iv + ATAP_GCM_IV_LEN;
+  uint8_t* header_ptr = (uint8_t*)item->ca_request + 4;
+  const uint8_t* ciphertext = NULL;
+  const AtapKeyType* key_types = NULL;
+  uint32_t message_len = 0;
+  uint32_t encrypted_len = 0;
+  uint32_t inner_offset = ATAP_CA_RESPONSE_PREFIX_LEN;
+  uint32_t len = 0;
+  uint32_t i = 0;
+  bool som_operation = is_som_operation(item->operation);
+  bool encrypted = is_encrypted_operation(item->operation);
+  AtapResult ret = ATAP_RESULT_OK;
+
+  atap_memset(&request, 0, sizeof(request));
+  atap_memset(&product, 0, sizeof(product));
+  atap_memset(&som, 0, sizeof(som));
+  atap_memset(&response_, 0, sizeof(response_));
+  atap_memset(shared_secret, 0, sizeof(shared_secret));
+  atap_memset(session_key, 0, sizeof(session_key));
+
+  if (!validate_operation(item->operation)) {
+    return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
+  }
+  if (!validate_curve(item->curve)) {
+    return ATAP_RESULT_ERROR_UNSUPPORTED_ALGORITHM;
+  }
+  if (item->ca_request_size < kCaRequestOverhead ||
+      (item->ca_request[0] != ATAP_PROTOCOL_VERSION &&
+       item->ca_request[0] != ATAP_PROTOCOL_VERSION_1)) {
+    return ATAP_RESULT_ERROR_INVALID_INPUT;
+  }
+  copy_uint32_from_buf(&header_ptr, &message_len);
+  copy_uint32_from_buf(&buf_ptr, &encrypted_len);
+  ciphertext = buf_ptr;
+  if (message_len != item->ca_request_size - ATAP_HEADER_LEN ||
+      encrypted_len != item->ca_request_size - kCaRequestOverhead ||
+      encrypted_len > ATAP_INNER_CA_REQUEST_LEN_MAX) {
+    return ATAP_RESULT_ERROR_INVALID_INPUT;
+  }
+
+  ret = crypto_.ecdh_shared_secret_compute_with_key(item->curve,
+                                                    item->ca_private_key,
+                                                    item->ca_private_key_size,
+                                                    device_pubkey,
+                                                    ca_pubkey,
+                                                    shared_secret);
+  if (ret != ATAP_RESULT_OK) {
+    goto out;
+  }
+  ret = DeriveSessionKeys(device_pubkey,
+                          ca_pubkey,
+                          shared_secret,
+                          session_key,
+                          request.auth_nonce);
+  if (ret != ATAP_RESULT_OK) {
+    goto out;
+  }
+  ret = ops->aes_gcm_128_decrypt(ops,
+                                 ciphertext,
+                                 encrypted_len,
+                                 iv,
+                                 session_key,
+                                 ciphertext + encrypted_len,
+                                 inner_ca_request_);
+  if (ret != ATAP_RESULT_OK) {
+    goto out;
+  }
+  ret = ParseInnerCaRequest(
+      inner_ca_request_, encrypted_len, item->operation, &product, &som);
+  if (ret != ATAP_RESULT_OK) {
+    goto out;
+  }
+
+  request.operation = item->operation;
+  request.device_pubkey = device_pubkey;
+  request.product = som_operation ? nullptr : &product;
+  request.som = som_operation ? &som : nullptr;
+  key_types = inner_ca_response_key_types(item->operation,
+                                          &response_.key_count);
+  for (i = 0; i < response_.key_count; ++i) {
+    response_.keys[i].key_type = key_types[i];
+  }
+  ret = issuer_->Issue(request, &response_);
+  if (ret != ATAP_RESULT_OK) {
+    goto out;
+  }
+
+  /* Build the Inner CA Response where its plaintext ends up in the CA
+   * Response, then encrypt each layer in place around it.
+   */
+  if (encrypted) {
+    inner_offset += ATAP_CA_RESPONSE_PREFIX_LEN;
+  }
+  if (item->ca_response_capacity <
+      inner_offset + ATAP_GCM_TAG_LEN * (encrypted ? 2 : 1)) {
+    ret = ATAP_RESULT_ERROR_OOM;
+    goto out;
+  }
+  ret = BuildInnerCaResponse(
+      item->operation,
+      item->ca_response + inner_offset,
+      item->ca_response_capacity - inner_offset -
+          ATAP_GCM_TAG_LEN * (encrypted ? 2 : 1),
+      &len);
+  if (ret != ATAP_RESULT_OK) {
+    goto out;
+  }
+  if (encrypted) {
+    ret = Seal(item->ca_response + ATAP_CA_RESPONSE_PREFIX_LEN,
+               len,
+               response_.soc_global_key);
+    if (ret != ATAP_RESULT_OK) {
+      goto out;
+    }
+    len += ATAP_ENCRYPTED_MESSAGE_OVERHEAD;
+  }
+  ret = Seal(item->ca_response, len, session_key);
+  if (ret != ATAP_RESULT_OK) {
+    goto out;
+  }
+  item->ca_response_size = len + ATAP_ENCRYPTED_MESSAGE_OVERHEAD;
+
+out:
+  OPENSSL_cleanse(shared_secret, sizeof(shared_secret));
+  OPENSSL_cleanse(session_key, sizeof(session_key));
+  OPENSSL_cleanse(response_.soc_global_key, ATAP_AES_128_KEY_LEN);
+  OPENSSL_cleanse(inner_ca_request_, encrypted_len);
+  return ret;
+}
+
+AtapCaServer::AtapCaServer(AtapCaIssuer* issuer, size_t num_threads)
+    : issuer_(issuer) {
+  if (num_threads == 0) {
+    num_threads = 1;
+  }
+  for (size_t i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(new Worker(issuer_));
+  }
+  /* The thread calling ProcessBatch() runs the first worker. */
+  for (size_t i = 1; i < num_threads; ++i) {
+    threads_.emplace_back(&AtapCaServer::ThreadMain, this, workers_[i].get());
+  }
+}
+
+AtapCaServer::~AtapCaServer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void AtapCaServer::ProcessBatch(AtapCaBatchItem* items, size_t count) {
+  std::lock_guard<std::mutex> batch_lock(batch_mutex_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    items_ = items;
+    count_ = count;
+    next_ = 0;
+    busy_threads_ = threads_.size();
+    ++generation_;
+  }
+  work_cv_.notify_all();
+  RunBatch(workers_[0].get());
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this] { return busy_threads_ == 0; });
+  items_ = nullptr;
+  count_ = 0;
+}
+
+void AtapCaServer::RunBatch(Worker* worker) {
+  size_t i = 0;
+  while ((i = next_.fetch_add(1)) < count_) {
+    AtapCaBatchItem* item = &items_[i];
+    item->ca_response_size = 0;
+    item->result = worker->Process(item);
+  }
+}
+
+void AtapCaServer::ThreadMain(Worker* worker) {
+  uint64_t generation = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_cv_.wait(lock, [this, generation] {
+        return stopping_ || generation_ != generation;
+      });
+      if (stopping_) {
+        return;
+      }
+      generation = generation_;
+    }
+    RunBatch(worker);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--busy_threads_ == 0) {
+      done_cv_.notify_one();
+    }
+  }
+}
+
+}  // namespace atap
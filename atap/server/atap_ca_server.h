@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef ATAP_CA_SERVER_H_
+#define ATAP_CA_SERVER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <libatap/libatap.h>
+
+#include "ops/atap_ops_provider.h"
+#include "ops/openssl_ops.h"
+
+namespace atap {
+
+// The decrypted Inner CA Request of one device, handed to AtapCaIssuer. The
+// pointers stay valid only during AtapCaIssuer::Issue().
+struct AtapCaIssueRequest {
+  AtapOperation operation;
+  const uint8_t* device_pubkey;
+  // Set for product key operations. The blobs point into the decrypted
+  // request.
+  const AtapInnerCaRequestProduct* product;
+  // Set for SoM key operations.
+  const AtapInnerCaRequestSom* som;
+  // The nonce the device signed with its authentication key, if it has one.
+  uint8_t auth_nonce[ATAP_NONCE_LEN];
+};
+
+// The keys a CA issues for one device. On entry to AtapCaIssuer::Issue(),
+// keys[i].key_type is set to each key type of the Inner CA Response in
+// order, and every key and cert chain is empty. A key type left empty is
+// not issued. For certify operations, only the cert chains and the last
+// (special purpose) key may be set.
+struct AtapCaIssueResponse {
+  // Only used for product key operations.
+  uint8_t hex_uuid[ATAP_HEX_UUID_LEN];
+  AtapAttestationKey keys[ATAP_ATTESTATION_KEYS_MAX];
+  uint32_t key_count;
+  // Only used for encrypted issue operations: the key the device reads
+  // with read_soc_global_key().
+  uint8_t soc_global_key[ATAP_AES_128_KEY_LEN];
+};
+
+// CA policy: checks the request of a device and picks its keys and
+// certificates. Called concurrently from all worker threads of an
+// AtapCaServer. The data the response points to must stay valid until
+// ProcessBatch() returns.
+class AtapCaIssuer {
+ public:
+  virtual ~AtapCaIssuer() {}
+
+  // Returns ATAP_RESULT_OK and fills |response|, or an error that becomes
+  // the result of the batch item.
+  virtual AtapResult Issue(const AtapCaIssueRequest& request,
+                           AtapCaIssueResponse* response) = 0;
+};
+
+// One CA Request of a batch and the CA Response built for it.
+struct AtapCaBatchItem {
+  // The curve and operation of the Operation Start message the CA sent,
+  // and the private key of its ECDH public key, in the formats of
+  // OpensslOps::SetEcdhKeyForTesting().
+  AtapCurveType curve;
+  AtapOperation operation;
+  const uint8_t* ca_private_key;
+  size_t ca_private_key_size;
+
+  // The CA Request from atap_get_ca_request().
+  const uint8_t* ca_request;
+  uint32_t ca_request_size;
+
+  // Caller-owned buffer for the CA Response, at least
+  // AtapCaServer::kCaResponseLenMax bytes or the response may not fit.
+  uint8_t* ca_response;
+  uint32_t ca_response_capacity;
+
+  // Set by ProcessBatch(). The CA Response is only valid if |result| is
+  // ATAP_RESULT_OK.
+  uint32_t ca_response_size;
+  AtapResult result;
+};
+
+// CA side of the provisioning protocol for many devices. Each worker
+// thread owns an OpensslOps, so the ECDH, HKDF and AES-GCM work of a
+// batch runs on all threads without shared crypto state. The Inner CA
+// Response is serialized straight into the output buffer of the item and
+// encrypted in place.
+class AtapCaServer {
+ public:
+  // Largest CA Response: an Inner CA Response wrapped in the SoC global key
+  // layer and the session key layer.
+  static const uint32_t kCaResponseLenMax =
+      ATAP_INNER_CA_RESPONSE_LEN_MAX + 2 * ATAP_ENCRYPTED_MESSAGE_OVERHEAD;
+
+  // Uses |num_threads| workers, including the thread calling
+  // ProcessBatch(). Does not take ownership of |issuer|.
+  AtapCaServer(AtapCaIssuer* issuer, size_t num_threads);
+  AtapCaServer(const AtapCaServer&) = delete;
+  AtapCaServer& operator=(const AtapCaServer&) = delete;
+  virtual ~AtapCaServer();
+
+  size_t thread_count() const {
+    return workers_.size();
+  }
+
+  // Processes all |count| items and sets their results. Calls from
+  // different threads are serialized.
+  void ProcessBatch(AtapCaBatchItem* items, size_t count);
+
+ private:
+  class Worker;
+
+  // Processes items of the current batch until there are none left.
+  void RunBatch(Worker* worker);
+  void ThreadMain(Worker* worker);
+
+  AtapCaIssuer* issuer_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+
+  std::mutex batch_mutex_;
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  uint64_t generation_{0};
+  size_t busy_threads_{0};
+  bool stopping_{false};
+  AtapCaBatchItem* items_{nullptr};
+  size_t count_{0};
+  std::atomic<size_t> next_{0};
+};
+
+}  // namespace atap
+
+#endif /* ATAP_CA_SERVER_H_ */
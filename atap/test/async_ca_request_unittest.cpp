@@ -0,0 +1,337 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/files/file_util.h>
+#include <gtest/gtest.h>
+#include <libatap/libatap.h>
+
+#include "atap_unittest_util.h"
+#include "fake_atap_ops.h"
+#include "ops/async_ca_request.h"
+#include "ops/atap_ops_provider.h"
+#include "server/atap_ca_server.h"
+
+namespace atap {
+
+namespace {
+
+class AsyncStorageOps;
+
+// Storage work that has been started, in the order it finishes.
+struct PendingOp {
+  AsyncStorageOps* device;
+  std::function<AtapResult()> work;
+};
+
+// A device whose storage and TEE ops finish later, from an event loop:
+// each returns ATAP_RESULT_PENDING and queues the FakeAtapOps op.
+class AsyncStorageOps : public FakeAtapOps {
+ public:
+  explicit AsyncStorageOps(std::deque<PendingOp>* queue) : queue_(queue) {}
+
+  AtapResult read_product_id(uint8_t product_id[ATAP_PRODUCT_ID_LEN]) override {
+    return Defer([=] { return FakeAtapOps::read_product_id(product_id); });
+  }
+
+  AtapResult get_auth_key_type(AtapKeyType* key_type) override {
+    return Defer([=] { return FakeAtapOps::get_auth_key_type(key_type); });
+  }
+
+  AtapResult read_auth_key_cert_chain(AtapCertChain* cert_chain) override {
+    return Defer(
+        [=] { return FakeAtapOps::read_auth_key_cert_chain(cert_chain); });
+  }
+
+  AtapResult auth_key_sign(const uint8_t* nonce,
+                           uint32_t nonce_len,
+                           uint8_t sig[ATAP_SIGNATURE_LEN_MAX],
+                           uint32_t* sig_len) override {
+    return Defer([=] {
+      return fail_sign_ ? ATAP_RESULT_ERROR_STORAGE
+                        : FakeAtapOps::auth_key_sign(
+                              nonce, nonce_len, sig, sig_len);
+    });
+  }
+
+  AtapResult write_attestation_key(AtapKeyType key_type,
+                                   const AtapBlob* key,
+                                   const AtapCertChain* cert_chain) override {
+    if (defer_writes_) {
+      return Defer([] { return ATAP_RESULT_OK; });
+    }
+    return FakeAtapOps::write_attestation_key(key_type, key, cert_chain);
+  }
+
+  AtapResult write_attestation_keys(const AtapAttestationKey* keys,
+                                    uint32_t key_count) override {
+    if (defer_writes_) {
+      return Defer([] { return ATAP_RESULT_OK; });
+    }
+    return FakeAtapOps::write_attestation_keys(keys, key_count);
+  }
+
+  void set_fail_sign(bool fail) {
+    fail_sign_ = fail;
+  }
+
+  // Makes the attestation key writes return ATAP_RESULT_PENDING.
+  void set_defer_writes(bool defer) {
+    defer_writes_ = defer;
+  }
+
+  AtapOps* atap_ops() {
+    return provider_.atap_ops();
+  }
+
+  AsyncCaRequest* request = nullptr;
+
+ private:
+  AtapResult Defer(std::function<AtapResult()> work) {
+    queue_->push_back(PendingOp{this, std::move(work)});
+    return ATAP_RESULT_PENDING;
+  }
+
+  std::deque<PendingOp>* queue_;
+  AtapOpsProvider provider_{this};
+  bool fail_sign_ = false;
+  bool defer_writes_ = false;
+};
+
+// Issues one certificate and key per key type.
+class TestIssuer : public AtapCaIssuer {
+ public:
+  AtapResult Issue(const AtapCaIssueRequest& request,
+                   AtapCaIssueResponse* response) override {
+    memset(response->hex_uuid, 'a', ATAP_HEX_UUID_LEN);
+    for (uint32_t i = 0; i < response->key_count; ++i) {
+      AtapAttestationKey* key = &response->keys[i];
+      key->cert_chain.entry_count = 1;
+      key->cert_chain.entries[0].data = data_;
+      key->cert_chain.entries[0].data_length = sizeof(data_);
+      key->key.data = data_;
+      key->key.data_length = sizeof(data_);
+    }
+    return ATAP_RESULT_OK;
+  }
+
+ private:
+  uint8_t data_[32] = {0x30};
+};
+
+// One device and its session, with the outcome of its CA Request.
+struct Device {
+  explicit Device(std::deque<PendingOp>* queue)
+      : ops(queue), session(atap_session_create()) {}
+  ~Device() {
+    request.reset();
+    atap_session_destroy(session);
+    ops.set_auth(ATAP_KEY_TYPE_NONE, nullptr, 0, nullptr, 0);
+  }
+
+  AsyncStorageOps ops;
+  AtapSession* session;
+  std::unique_ptr<AsyncCaRequest> request;
+  bool done = false;
+  AtapResult result = ATAP_RESULT_ERROR_IO;
+  std::vector<uint8_t> ca_request;
+};
+
+}  // namespace
+
+class AsyncCaRequestTest : public BaseAtapTest {
+ protected:
+  void SetUp() override {
+    BaseAtapTest::SetUp();
+    ASSERT_TRUE(base::ReadFileToString(
+        base::FilePath(kIssueX25519OperationStartPath), &operation_start_));
+    ASSERT_TRUE(base::ReadFileToString(base::FilePath(kAuthSig), &sig_));
+    ASSERT_TRUE(base::ReadFileToString(base::FilePath(kAuthCert), &cert_));
+  }
+
+  std::unique_ptr<Device> MakeDevice() {
+    std::unique_ptr<Device> device(new Device(&queue_));
+    Device* d = device.get();
+    d->ops.set_auth(ATAP_KEY_TYPE_RSA,
+                    (uint8_t*)&sig_[0],
+                    sig_.size(),
+                    (uint8_t*)&cert_[0],
+                    cert_.size());
+    d->request.reset(new AsyncCaRequest(
+        d->session,
+        d->ops.atap_ops(),
+        [d](AtapResult result, const uint8_t* ca_request, uint32_t size) {
+          d->done = true;
+          d->result = result;
+          if (ca_request != nullptr) {
+            d->ca_request.assign(ca_request, ca_request + size);
+          }
+        }));
+    d->ops.request = d->request.get();
+    return device;
+  }
+
+  void Start(Device* device) {
+    device->request->Start((const uint8_t*)operation_start_.data(),
+                           operation_start_.size());
+  }
+
+  // Answers the finished CA Request of |device| and stores the keys.
+  AtapResult SetCaResponse(Device* device, AtapCaServer* server) {
+    std::string ca_private_key;
+    EXPECT_TRUE(base::ReadFileToString(base::FilePath(kCaX25519PrivateKey),
+                                       &ca_private_key));
+    std::vector<uint8_t> ca_response(AtapCaServer::kCaResponseLenMax);
+    AtapCaBatchItem item;
+    memset(&item, 0, sizeof(item));
+    item.curve = ATAP_CURVE_TYPE_X25519;
+    item.operation = ATAP_OPERATION_ISSUE;
+    item.ca_private_key = (const uint8_t*)ca_private_key.data();
+    item.ca_private_key_size = ca_private_key.size();
+    item.ca_request = device->ca_request.data();
+    item.ca_request_size = device->ca_request.size();
+    item.ca_response = ca_response.data();
+    item.ca_response_capacity = ca_response.size();
+    server->ProcessBatch(&item, 1);
+    EXPECT_EQ(ATAP_RESULT_OK, item.result);
+    return atap_set_ca_response_ex(device->session,
+                                   device->ops.atap_ops(),
+                                   item.ca_response,
+                                   item.ca_response_size);
+  }
+
+  // Finishes queued ops in order until none is left, and returns the
+  // largest number of ops that were pending at once.
+  size_t RunEventLoop() {
+    size_t max_pending = queue_.size();
+    while (!queue_.empty()) {
+      PendingOp op = std::move(queue_.front());
+      queue_.pop_front();
+      op.device->request->Complete(op.work());
+      max_pending = std::max(max_pending, queue_.size());
+    }
+    return max_pending;
+  }
+
+  std::deque<PendingOp> queue_;
+  std::string operation_start_;
+  std::string sig_;
+  std::string cert_;
+};
+
+TEST_F(AsyncCaRequestTest, InterleavesDevicesOnOneThread) {
+  const size_t kDevices = 8;
+  std::vector<std::unique_ptr<Device>> devices;
+  for (size_t i = 0; i < kDevices; ++i) {
+    devices.push_back(MakeDevice());
+    Start(devices.back().get());
+    EXPECT_TRUE(devices.back()->request->pending());
+  }
+  EXPECT_EQ(kDevices, RunEventLoop());
+
+  // Answer every CA Request and store the keys.
+  TestIssuer issuer;
+  AtapCaServer server(&issuer, 1);
+  for (std::unique_ptr<Device>& device : devices) {
+    ASSERT_TRUE(device->done);
+    ASSERT_EQ(ATAP_RESULT_OK, device->result);
+    EXPECT_FALSE(device->request->pending());
+    EXPECT_EQ(ATAP_RESULT_OK, SetCaResponse(device.get(), &server));
+  }
+}
+
+TEST_F(AsyncCaRequestTest, PendingWriteInSetCaResponse) {
+  TestIssuer issuer;
+  AtapCaServer server(&issuer, 1);
+  for (bool batch_writes : {false, true}) {
+    std::unique_ptr<Device> device = MakeDevice();
+    Start(device.get());
+    RunEventLoop();
+    ASSERT_EQ(ATAP_RESULT_OK, device->result);
+    device->ops.set_batch_writes_supported(batch_writes);
+    device->ops.set_defer_writes(true);
+    // atap_set_ca_response() cannot wait for storage, so the first pending
+    // write fails it without falling back to the next write.
+    EXPECT_EQ(ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION,
+              SetCaResponse(device.get(), &server));
+    EXPECT_EQ(1u, queue_.size());
+    queue_.clear();
+  }
+}
+
+TEST_F(AsyncCaRequestTest, PendingOpFailure) {
+  std::unique_ptr<Device> device = MakeDevice();
+  device->ops.set_fail_sign(true);
+  Start(device.get());
+  RunEventLoop();
+  EXPECT_TRUE(device->done);
+  EXPECT_EQ(ATAP_RESULT_ERROR_STORAGE, device->result);
+  EXPECT_TRUE(device->ca_request.empty());
+}
+
+TEST_F(AsyncCaRequestTest, AbortWhilePending) {
+  std::unique_ptr<Device> device = MakeDevice();
+  Start(device.get());
+  ASSERT_TRUE(device->request->pending());
+  // Let the pending op finish without resuming, as on cancellation.
+  queue_.front().work();
+  queue_.clear();
+  device.reset();
+}
+
+TEST_F(AsyncCaRequestTest, ResumeWithoutPendingOp) {
+  AtapSession* session = atap_session_create();
+  FakeAtapOps fake_ops;
+  AtapOpsProvider ops(&fake_ops);
+  uint8_t* ca_request = nullptr;
+  uint32_t ca_request_size = 0;
+  EXPECT_EQ(ATAP_RESULT_ERROR_INVALID_INPUT,
+            atap_get_ca_request_resume(session,
+                                       ops.atap_ops(),
+                                       ATAP_RESULT_OK,
+                                       &ca_request,
+                                       &ca_request_size));
+  EXPECT_EQ(nullptr, ca_request);
+
+  // Ops that never return ATAP_RESULT_PENDING finish in begin.
+  EXPECT_EQ(ATAP_RESULT_OK,
+            atap_get_ca_request_begin(session,
+                                      ops.atap_ops(),
+                                      (const uint8_t*)operation_start_.data(),
+                                      operation_start_.size(),
+                                      &ca_request,
+                                      &ca_request_size));
+  EXPECT_NE(nullptr, ca_request);
+  atap_free(ca_request);
+  atap_session_destroy(session);
+}
+
+}  // namespace atap
@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/files/file_util.h>
+#include <gtest/gtest.h>
+#include <libatap/libatap.h>
+
+#include "atap_unittest_util.h"
+#include "fake_atap_ops.h"
+#include "ops/atap_ops_provider.h"
+#include "server/atap_ca_server.h"
+
+namespace atap {
+
+namespace {
+
+const uint8_t kSocGlobalKey[ATAP_AES_128_KEY_LEN] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+
+// A device that holds kSocGlobalKey.
+class SocKeyAtapOps : public FakeAtapOps {
+ public:
+  AtapResult read_soc_global_key(
+      uint8_t global_key[ATAP_AES_128_KEY_LEN]) override {
+    memcpy(global_key, kSocGlobalKey, ATAP_AES_128_KEY_LEN);
+    return ATAP_RESULT_OK;
+  }
+};
+
+// Issues one certificate and a fixed key for each key type.
+class TestIssuer : public AtapCaIssuer {
+ public:
+  AtapResult Issue(const AtapCaIssueRequest& request,
+                   AtapCaIssueResponse* response) override {
+    ++issued_;
+    if (is_som_operation(request.operation)) {
+      EXPECT_TRUE(request.som != nullptr);
+      EXPECT_TRUE(request.product == nullptr);
+    } else {
+      EXPECT_TRUE(request.product != nullptr);
+      EXPECT_TRUE(request.som == nullptr);
+      memset(response->hex_uuid, 'a', ATAP_HEX_UUID_LEN);
+    }
+    for (uint32_t i = 0; i < response->key_count; ++i) {
+      AtapAttestationKey* key = &response->keys[i];
+      key->cert_chain.entry_count = 1;
+      key->cert_chain.entries[0].data = cert_;
+      key->cert_chain.entries[0].data_length = sizeof(cert_);
+      key->key.data = key_;
+      key->key.data_length = sizeof(key_);
+    }
+    memcpy(response->soc_global_key, kSocGlobalKey, ATAP_AES_128_KEY_LEN);
+    return ATAP_RESULT_OK;
+  }
+
+  int issued() const { return issued_; }
+
+ private:
+  std::atomic<int> issued_{0};
+  uint8_t cert_[64] = {0x30, 0x82};
+  uint8_t key_[32] = {0x42};
+};
+
+}  // namespace
+
+class CaServerTest : public BaseAtapTest {
+ protected:
+  void SetUp() override {
+    BaseAtapTest::SetUp();
+    ASSERT_TRUE(base::ReadFileToString(base::FilePath(kCaX25519PrivateKey),
+                                       &x25519_private_key_));
+    ASSERT_TRUE(base::ReadFileToString(base::FilePath(kCaP256PrivateKey),
+                                       &p256_private_key_));
+  }
+
+  // Reads the Operation Start at |path|, overriding its operation with
+  // |operation|.
+  std::string ReadOperationStart(const char* path, AtapOperation operation) {
+    std::string operation_start;
+    EXPECT_TRUE(
+        base::ReadFileToString(base::FilePath(path), &operation_start));
+    operation_start[ATAP_HEADER_LEN + 1] = operation;
+    return operation_start;
+  }
+
+  AtapCaBatchItem MakeItem(AtapCurveType curve,
+                           AtapOperation operation,
+                           const uint8_t* ca_request,
+                           uint32_t ca_request_size,
+                           std::vector<uint8_t>* ca_response) {
+    const std::string& key = (curve == ATAP_CURVE_TYPE_X25519)
+                                 ? x25519_private_key_
+                                 : p256_private_key_;
+    ca_response->resize(AtapCaServer::kCaResponseLenMax);
+    AtapCaBatchItem item;
+    memset(&item, 0, sizeof(item));
+    item.curve = curve;
+    item.operation = operation;
+    item.ca_private_key = (const uint8_t*)key.data();
+    item.ca_private_key_size = key.size();
+    item.ca_request = ca_request;
+    item.ca_request_size = ca_request_size;
+    item.ca_response = ca_response->data();
+    item.ca_response_capacity = ca_response->size();
+    return item;
+  }
+
+  // Runs one provisioning round trip through a server with |num_threads|.
+  void RoundTrip(const char* operation_start_path,
+                 AtapCurveType curve,
+                 AtapOperation operation,
+                 size_t num_threads) {
+    std::string operation_start =
+        ReadOperationStart(operation_start_path, operation);
+    uint8_t* ca_request = nullptr;
+    uint32_t ca_request_size = 0;
+    ASSERT_EQ(ATAP_RESULT_OK,
+              atap_get_ca_request(ops_.atap_ops(),
+                                  (uint8_t*)&operation_start[0],
+                                  operation_start.size(),
+                                  &ca_request,
+                                  &ca_request_size));
+
+    TestIssuer issuer;
+    AtapCaServer server(&issuer, num_threads);
+    std::vector<uint8_t> ca_response;
+    AtapCaBatchItem item =
+        MakeItem(curve, operation, ca_request, ca_request_size, &ca_response);
+    server.ProcessBatch(&item, 1);
+    atap_free(ca_request);
+
+    ASSERT_EQ(ATAP_RESULT_OK, item.result);
+    EXPECT_EQ(1, issuer.issued());
+    EXPECT_EQ(ATAP_RESULT_OK,
+              atap_set_ca_response(
+                  ops_.atap_ops(), item.ca_response, item.ca_response_size));
+  }
+
+  SocKeyAtapOps fake_ops_;
+  AtapOpsProvider ops_{&fake_ops_};
+  std::string x25519_private_key_;
+  std::string p256_private_key_;
+};
+
+TEST_F(CaServerTest, IssueX25519) {
+  RoundTrip(kIssueX25519OperationStartPath,
+            ATAP_CURVE_TYPE_X25519,
+            ATAP_OPERATION_ISSUE,
+            1);
+}
+
+TEST_F(CaServerTest, IssueP256) {
+  RoundTrip(kIssueP256OperationStartPath,
+            ATAP_CURVE_TYPE_P256,
+            ATAP_OPERATION_ISSUE,
+            1);
+}
+
+TEST_F(CaServerTest, IssueSomKeyX25519) {
+  RoundTrip(kIssueX25519SomOperationStartPath,
+            ATAP_CURVE_TYPE_X25519,
+            ATAP_OPERATION_ISSUE_SOM_KEY,
+            2);
+}
+
+TEST_F(CaServerTest, IssueEncryptedX25519) {
+  RoundTrip(kIssueX25519OperationStartPath,
+            ATAP_CURVE_TYPE_X25519,
+            ATAP_OPERATION_ISSUE_ENCRYPTED,
+            2);
+}
+
+TEST_F(CaServerTest, BatchOnThreads) {
+  const size_t kDevices = 16;
+  std::string operation_start =
+      ReadOperationStart(kIssueX25519OperationStartPath, ATAP_OPERATION_ISSUE);
+  std::vector<AtapSession*> sessions(kDevices);
+  std::vector<uint8_t*> ca_requests(kDevices);
+  std::vector<std::vector<uint8_t>> ca_responses(kDevices);
+  std::vector<AtapCaBatchItem> items(kDevices);
+  for (size_t i = 0; i < kDevices; ++i) {
+    uint32_t ca_request_size = 0;
+    sessions[i] = atap_session_create();
+    ASSERT_TRUE(sessions[i] != nullptr);
+    ASSERT_EQ(ATAP_RESULT_OK,
+              atap_get_ca_request_ex(sessions[i],
+                                     ops_.atap_ops(),
+                                     (uint8_t*)&operation_start[0],
+                                     operation_start.size(),
+                                     &ca_requests[i],
+                                     &ca_request_size));
+    items[i] = MakeItem(ATAP_CURVE_TYPE_X25519,
+                        ATAP_OPERATION_ISSUE,
+                        ca_requests[i],
+                        ca_request_size,
+                        &ca_responses[i]);
+  }
+  // Tamper with the ciphertext of one request.
+  ca_requests[5][items[5].ca_request_size - ATAP_GCM_TAG_LEN - 1] ^= 1;
+
+  TestIssuer issuer;
+  AtapCaServer server(&issuer, 4);
+  EXPECT_EQ(4u, server.thread_count());
+  server.ProcessBatch(items.data(), items.size());
+  EXPECT_EQ((int)kDevices - 1, issuer.issued());
+
+  for (size_t i = 0; i < kDevices; ++i) {
+    if (i == 5) {
+      EXPECT_NE(ATAP_RESULT_OK, items[i].result);
+      EXPECT_EQ(0u, items[i].ca_response_size);
+    } else {
+      EXPECT_EQ(ATAP_RESULT_OK, items[i].result);
+      EXPECT_EQ(ATAP_RESULT_OK,
+                atap_set_ca_response_ex(sessions[i],
+                                        ops_.atap_ops(),
+                                        items[i].ca_response,
+                                        items[i].ca_response_size));
+    }
+    atap_free(ca_requests[i]);
+    atap_session_destroy(sessions[i]);
+  }
+
+  // The server is reusable for the next batch.
+  server.ProcessBatch(items.data(), 0);
+  EXPECT_EQ((int)kDevices - 1, issuer.issued());
+}
+
+TEST_F(CaServerTest, RejectsMalformedRequests) {
+  TestIssuer issuer;
+  AtapCaServer server(&issuer, 1);
+  uint8_t ca_request[256] = {ATAP_PROTOCOL_VERSION};
+  std::vector<uint8_t> ca_response;
+
+  AtapCaBatchItem item = MakeItem(ATAP_CURVE_TYPE_X25519,
+                                  ATAP_OPERATION_ISSUE,
+                                  ca_request,
+                                  16,
+                                  &ca_response);
+  server.ProcessBatch(&item, 1);
+  EXPECT_EQ(ATAP_RESULT_ERROR_INVALID_INPUT, item.result);
+
+  item = MakeItem(ATAP_CURVE_TYPE_X25519,
+                  (AtapOperation)0x7f,
+                  ca_request,
+                  sizeof(ca_request),
+                  &ca_response);
+  server.ProcessBatch(&item, 1);
+  EXPECT_EQ(ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION, item.result);
+  EXPECT_EQ(0, issuer.issued());
+}
+
+}  // namespace atap
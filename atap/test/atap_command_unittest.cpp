@@ -16,6 +16,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
 #include <fstream>
 
 #include <gtest/gtest.h>
@@ -40,11 +41,32 @@ class CommandTest : public BaseAtapTest {
   FakeAtapOps fake_ops_;
   AtapOpsProvider ops_{&fake_ops_};
 
+  void SetUp() override {
+    BaseAtapTest::SetUp();
+    atap_set_optional_ops(AtapOpsProvider::optional_ops());
+  }
+
+  void TearDown() override {
+    atap_set_optional_ops(nullptr);
+    BaseAtapTest::TearDown();
+  }
+
+  // Creates a session with the same optional ops as the default session.
+  AtapSession* create_session() {
+    AtapSession* session = atap_session_create();
+    if (session != nullptr) {
+      atap_session_set_optional_ops(session, AtapOpsProvider::optional_ops());
+    }
+    return session;
+  }
+
   void validate_ca_request(const uint8_t* buf,
                            uint32_t buf_size,
                            AtapOperation operation,
                            bool auth);
   void compute_session_key(const uint8_t device_public_key[ATAP_ECDH_KEY_LEN]);
+  uint8_t* build_ca_response(const std::string& inner,
+                             uint32_t* ca_response_size);
   void set_curve(AtapCurveType curve) {
     curve_ = curve;
   }
@@ -93,6 +115,31 @@ void CommandTest::compute_session_key(
   ASSERT_EQ(ret, ATAP_RESULT_OK);
 }
 
+// Encrypts |inner| with the session key. Caller must free the returned CA
+// Response with atap_free().
+uint8_t* CommandTest::build_ca_response(const std::string& inner,
+                                        uint32_t* ca_response_size) {
+  *ca_response_size = ATAP_HEADER_LEN + ATAP_GCM_IV_LEN + sizeof(uint32_t) +
+                      inner.size() + ATAP_GCM_TAG_LEN;
+  uint8_t* ca_response = (uint8_t*)atap_malloc(*ca_response_size);
+  append_header_to_buf(ca_response, *ca_response_size - ATAP_HEADER_LEN);
+  uint32_t i = ATAP_HEADER_LEN;
+  uint8_t* iv = next(ca_response, &i, ATAP_GCM_IV_LEN);
+  fake_ops_.get_random_bytes(iv, ATAP_GCM_IV_LEN);
+  uint32_t* ciphertext_len = (uint32_t*)next(ca_response, &i, sizeof(uint32_t));
+  *ciphertext_len = inner.size();
+  uint8_t* ciphertext = next(ca_response, &i, *ciphertext_len);
+  uint8_t* tag = next(ca_response, &i, ATAP_GCM_TAG_LEN);
+  EXPECT_EQ(ATAP_RESULT_OK,
+            fake_ops_.aes_gcm_128_encrypt((uint8_t*)&inner[0],
+                                          inner.size(),
+                                          iv,
+                                          session_key,
+                                          ciphertext,
+                                          tag));
+  return ca_response;
+}
+
 void CommandTest::validate_ca_request(const uint8_t* buf,
                                       uint32_t buf_size,
                                       AtapOperation operation,
@@ -244,6 +291,83 @@ TEST_F(CommandTest, SetCaResponseIssueX25519) {
                                        &ca_request,
                                        &ca_request_size);
   atap_free(ca_request);
+  std::string inner;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519InnerCaResponsePath), &inner));
+  uint32_t ca_response_size;
+  uint8_t* ca_response = build_ca_response(inner, &ca_response_size);
+  res = atap_set_ca_response(ops_.atap_ops(), ca_response, ca_response_size);
+  EXPECT_EQ(ATAP_RESULT_OK, res);
+  atap_free(ca_response);
+}
+
+TEST_F(CommandTest, SetCaResponseIssueX25519BatchWrite) {
+  setup_test_key();
+  std::string operation_start;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519OperationStartPath), &operation_start));
+  uint32_t ca_request_size;
+  uint8_t* ca_request;
+  AtapResult res = atap_get_ca_request(ops_.atap_ops(),
+                                       (uint8_t*)&operation_start[0],
+                                       operation_start.size(),
+                                       &ca_request,
+                                       &ca_request_size);
+  ASSERT_EQ(ATAP_RESULT_OK, res);
+  atap_free(ca_request);
+  std::string inner;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519InnerCaResponsePath), &inner));
+  uint32_t ca_response_size;
+  uint8_t* ca_response = build_ca_response(inner, &ca_response_size);
+  // Without batch support every key is written on its own.
+  res = atap_set_ca_response(ops_.atap_ops(), ca_response, ca_response_size);
+  EXPECT_EQ(ATAP_RESULT_OK, res);
+  int key_count = fake_ops_.single_key_writes();
+  EXPECT_LT(0, key_count);
+  EXPECT_EQ(0, fake_ops_.batch_writes());
+  fake_ops_.set_batch_writes_supported(true);
+  res = atap_set_ca_response(ops_.atap_ops(), ca_response, ca_response_size);
+  EXPECT_EQ(ATAP_RESULT_OK, res);
+  EXPECT_EQ(key_count, fake_ops_.single_key_writes());
+  EXPECT_EQ(1, fake_ops_.batch_writes());
+  EXPECT_EQ(key_count, fake_ops_.batch_key_count());
+  atap_free(ca_response);
+}
+
+TEST_F(CommandTest, SetCaResponseIssueX25519ConcurrentSessions) {
+  setup_test_key();
+  std::string operation_start;
+  std::string som_operation_start;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519OperationStartPath), &operation_start));
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519SomOperationStartPath), &som_operation_start));
+  AtapSession* product_session = create_session();
+  AtapSession* som_session = create_session();
+  ASSERT_NE(nullptr, product_session);
+  ASSERT_NE(nullptr, som_session);
+  uint32_t ca_request_size;
+  uint8_t* ca_request;
+  AtapResult res = atap_get_ca_request_ex(product_session,
+                                          ops_.atap_ops(),
+                                          (uint8_t*)&operation_start[0],
+                                          operation_start.size(),
+                                          &ca_request,
+                                          &ca_request_size);
+  ASSERT_EQ(ATAP_RESULT_OK, res);
+  validate_ca_request(ca_request, ca_request_size, ATAP_OPERATION_ISSUE, false);
+  atap_free(ca_request);
+  // Starting a SoM handshake must not disturb the product session.
+  res = atap_get_ca_request_ex(som_session,
+                               ops_.atap_ops(),
+                               (uint8_t*)&som_operation_start[0],
+                               som_operation_start.size(),
+                               &ca_request,
+                               &ca_request_size);
+  ASSERT_EQ(ATAP_RESULT_OK, res);
+  atap_free(ca_request);
+
   std::string inner;
   ASSERT_TRUE(base::ReadFileToString(
       base::FilePath(kIssueX25519InnerCaResponsePath), &inner));
@@ -262,9 +386,340 @@ TEST_F(CommandTest, SetCaResponseIssueX25519) {
   res = fake_ops_.aes_gcm_128_encrypt(
       (uint8_t*)&inner[0], inner.size(), iv, session_key, ciphertext, tag);
   ASSERT_EQ(ATAP_RESULT_OK, res);
-  res = atap_set_ca_response(ops_.atap_ops(), ca_response, ca_response_size);
+  // A product inner CA response is rejected by the SoM session.
+  EXPECT_EQ(ATAP_RESULT_ERROR_INVALID_INPUT,
+            atap_set_ca_response_ex(
+                som_session, ops_.atap_ops(), ca_response, ca_response_size));
+  EXPECT_EQ(ATAP_RESULT_OK,
+            atap_set_ca_response_ex(product_session,
+                                    ops_.atap_ops(),
+                                    ca_response,
+                                    ca_response_size));
+  atap_free(ca_response);
+  atap_session_destroy(product_session);
+  atap_session_destroy(som_session);
+}
+
+TEST_F(CommandTest, SetCaResponseIssueX25519Arena) {
+  setup_test_key();
+  std::vector<uint64_t> arena_buf(ATAP_ARENA_SIZE / sizeof(uint64_t));
+  uint8_t* arena = (uint8_t*)arena_buf.data();
+  AtapSession* session = create_session();
+  ASSERT_NE(nullptr, session);
+  atap_session_set_arena(session, arena, ATAP_ARENA_SIZE);
+  std::string operation_start;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519OperationStartPath), &operation_start));
+  uint32_t ca_request_size;
+  uint8_t* ca_request;
+  AtapResult res = atap_get_ca_request_ex(session,
+                                          ops_.atap_ops(),
+                                          (uint8_t*)&operation_start[0],
+                                          operation_start.size(),
+                                          &ca_request,
+                                          &ca_request_size);
+  ASSERT_EQ(ATAP_RESULT_OK, res);
+  validate_ca_request(ca_request, ca_request_size, ATAP_OPERATION_ISSUE, false);
+  // The CA Request itself is returned on the heap.
+  EXPECT_TRUE(ca_request < arena || ca_request >= arena + ATAP_ARENA_SIZE);
+  atap_free(ca_request);
+  std::string inner;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519InnerCaResponsePath), &inner));
+  uint32_t ca_response_size;
+  uint8_t* ca_response = build_ca_response(inner, &ca_response_size);
+  res = atap_set_ca_response_ex(
+      session, ops_.atap_ops(), ca_response, ca_response_size);
+  EXPECT_EQ(ATAP_RESULT_OK, res);
+  atap_free(ca_response);
+  // Every call hands its arena memory back zeroized.
+  for (size_t i = 0; i < ATAP_ARENA_SIZE; ++i) {
+    ASSERT_EQ(0, arena[i]);
+  }
+  atap_session_destroy(session);
+}
+
+TEST_F(CommandTest, SetCaResponseInPlaceIssueX25519) {
+  setup_test_key();
+  std::string operation_start;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519OperationStartPath), &operation_start));
+  uint32_t ca_request_size;
+  uint8_t* ca_request;
+  AtapResult res = atap_get_ca_request(ops_.atap_ops(),
+                                       (uint8_t*)&operation_start[0],
+                                       operation_start.size(),
+                                       &ca_request,
+                                       &ca_request_size);
+  ASSERT_EQ(ATAP_RESULT_OK, res);
+  validate_ca_request(ca_request, ca_request_size, ATAP_OPERATION_ISSUE, false);
+  atap_free(ca_request);
+  std::string inner;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519InnerCaResponsePath), &inner));
+  uint32_t ca_response_size;
+  uint8_t* ca_response = build_ca_response(inner, &ca_response_size);
+  res = atap_set_ca_response_in_place(
+      ops_.atap_ops(), ca_response, ca_response_size);
   EXPECT_EQ(ATAP_RESULT_OK, res);
+  // OpensslOps decrypts in place, so the ciphertext was overwritten.
+  EXPECT_EQ(0,
+            memcmp(&inner[0],
+                   ca_response + ATAP_HEADER_LEN + ATAP_GCM_IV_LEN +
+                       sizeof(uint32_t),
+                   inner.size()));
+  atap_free(ca_response);
+}
+
+TEST_F(CommandTest, SetCaResponseInPlaceBadTag) {
+  setup_test_key();
+  std::string operation_start;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519OperationStartPath), &operation_start));
+  uint32_t ca_request_size;
+  uint8_t* ca_request;
+  AtapResult res = atap_get_ca_request(ops_.atap_ops(),
+                                       (uint8_t*)&operation_start[0],
+                                       operation_start.size(),
+                                       &ca_request,
+                                       &ca_request_size);
+  ASSERT_EQ(ATAP_RESULT_OK, res);
+  validate_ca_request(ca_request, ca_request_size, ATAP_OPERATION_ISSUE, false);
+  atap_free(ca_request);
+  std::string inner;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519InnerCaResponsePath), &inner));
+  uint32_t ca_response_size;
+  uint8_t* ca_response = build_ca_response(inner, &ca_response_size);
+  ca_response[ca_response_size - 1] ^= 0x01;
+  res = atap_set_ca_response_in_place(
+      ops_.atap_ops(), ca_response, ca_response_size);
+  EXPECT_EQ(ATAP_RESULT_ERROR_CRYPTO, res);
+  atap_free(ca_response);
+}
+
+TEST_F(CommandTest, SetCaResponseInPlaceFallback) {
+  setup_test_key();
+  // Without optional ops, libatap uses separate buffers instead.
+  atap_set_optional_ops(nullptr);
+  std::string operation_start;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519OperationStartPath), &operation_start));
+  uint32_t ca_request_size;
+  uint8_t* ca_request;
+  AtapResult res = atap_get_ca_request(ops_.atap_ops(),
+                                       (uint8_t*)&operation_start[0],
+                                       operation_start.size(),
+                                       &ca_request,
+                                       &ca_request_size);
+  ASSERT_EQ(ATAP_RESULT_OK, res);
+  validate_ca_request(ca_request, ca_request_size, ATAP_OPERATION_ISSUE, false);
+  atap_free(ca_request);
+  std::string inner;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519InnerCaResponsePath), &inner));
+  uint32_t ca_response_size;
+  uint8_t* ca_response = build_ca_response(inner, &ca_response_size);
+  res = atap_set_ca_response_in_place(
+      ops_.atap_ops(), ca_response, ca_response_size);
+  EXPECT_EQ(ATAP_RESULT_OK, res);
+  atap_free(ca_response);
+}
+
+TEST_F(CommandTest, OptionalOpsBeyondStructSizeAreNotCalled) {
+  setup_test_key();
+  // A table from an older header: members past |struct_size| may hold
+  // anything and must be treated as NULL.
+  AtapOptionalOps old_ops = *AtapOpsProvider::optional_ops();
+  old_ops.struct_size = offsetof(AtapOptionalOps, aes_gcm_128_encrypt_in_place);
+  old_ops.aes_gcm_128_encrypt_in_place =
+      [](AtapOps*, uint8_t*, uint32_t, const uint8_t*, const uint8_t*,
+         uint8_t*) {
+        ADD_FAILURE() << "op beyond struct_size called";
+        return ATAP_RESULT_ERROR_CRYPTO;
+      };
+  old_ops.aes_gcm_128_decrypt_in_place =
+      [](AtapOps*, uint8_t*, uint32_t, const uint8_t*, const uint8_t*,
+         const uint8_t*) {
+        ADD_FAILURE() << "op beyond struct_size called";
+        return ATAP_RESULT_ERROR_CRYPTO;
+      };
+  atap_set_optional_ops(&old_ops);
+  std::string operation_start;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519OperationStartPath), &operation_start));
+  uint32_t ca_request_size;
+  uint8_t* ca_request;
+  AtapResult res = atap_get_ca_request(ops_.atap_ops(),
+                                       (uint8_t*)&operation_start[0],
+                                       operation_start.size(),
+                                       &ca_request,
+                                       &ca_request_size);
+  ASSERT_EQ(ATAP_RESULT_OK, res);
+  atap_free(ca_request);
+  std::string inner;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519InnerCaResponsePath), &inner));
+  uint32_t ca_response_size;
+  uint8_t* ca_response = build_ca_response(inner, &ca_response_size);
+  res = atap_set_ca_response_in_place(
+      ops_.atap_ops(), ca_response, ca_response_size);
+  EXPECT_EQ(ATAP_RESULT_OK, res);
+  atap_free(ca_response);
+  atap_set_optional_ops(nullptr);
+}
+
+TEST_F(CommandTest, StreamCaResponseIssueX25519) {
+  setup_test_key();
+  AtapSession* session = create_session();
+  ASSERT_NE(nullptr, session);
+  std::string operation_start;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519OperationStartPath), &operation_start));
+  uint32_t ca_request_size;
+  uint8_t* ca_request;
+  AtapResult res = atap_get_ca_request_ex(session,
+                                          ops_.atap_ops(),
+                                          (uint8_t*)&operation_start[0],
+                                          operation_start.size(),
+                                          &ca_request,
+                                          &ca_request_size);
+  ASSERT_EQ(ATAP_RESULT_OK, res);
+  atap_free(ca_request);
+  std::string inner;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519InnerCaResponsePath), &inner));
+  uint32_t ca_response_size;
+  uint8_t* ca_response = build_ca_response(inner, &ca_response_size);
+  std::vector<uint8_t> original(ca_response, ca_response + ca_response_size);
+  // Chunks that split the header, the ciphertext and the tag.
+  const uint32_t chunk_sizes[] = {7, 1000, 4096};
+  for (uint32_t chunk_size : chunk_sizes) {
+    ASSERT_EQ(ATAP_RESULT_OK, atap_ca_response_begin(session, ops_.atap_ops()));
+    for (uint32_t i = 0; i < ca_response_size; i += chunk_size) {
+      uint32_t len = std::min(chunk_size, ca_response_size - i);
+      ASSERT_EQ(ATAP_RESULT_OK,
+                atap_ca_response_update(session, &ca_response[i], len));
+    }
+    EXPECT_EQ(ATAP_RESULT_OK, atap_ca_response_finish(session));
+  }
+  // The caller's buffer is never modified.
+  EXPECT_EQ(0, memcmp(original.data(), ca_response, ca_response_size));
+  atap_free(ca_response);
+  atap_session_destroy(session);
+}
+
+TEST_F(CommandTest, StreamCaResponseBadTag) {
+  setup_test_key();
+  std::string operation_start;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519OperationStartPath), &operation_start));
+  uint32_t ca_request_size;
+  uint8_t* ca_request;
+  AtapResult res = atap_get_ca_request(ops_.atap_ops(),
+                                       (uint8_t*)&operation_start[0],
+                                       operation_start.size(),
+                                       &ca_request,
+                                       &ca_request_size);
+  ASSERT_EQ(ATAP_RESULT_OK, res);
+  atap_free(ca_request);
+  std::string inner;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519InnerCaResponsePath), &inner));
+  uint32_t ca_response_size;
+  uint8_t* ca_response = build_ca_response(inner, &ca_response_size);
+  ca_response[ca_response_size - 1] ^= 0x01;
+  AtapSession* session = create_session();
+  ASSERT_NE(nullptr, session);
+  // Reuse the default session's keys.
+  res = atap_get_ca_request_ex(session,
+                               ops_.atap_ops(),
+                               (uint8_t*)&operation_start[0],
+                               operation_start.size(),
+                               &ca_request,
+                               &ca_request_size);
+  ASSERT_EQ(ATAP_RESULT_OK, res);
+  atap_free(ca_request);
+  ASSERT_EQ(ATAP_RESULT_OK, atap_ca_response_begin(session, ops_.atap_ops()));
+  ASSERT_EQ(ATAP_RESULT_OK,
+            atap_ca_response_update(session, ca_response, ca_response_size));
+  EXPECT_EQ(ATAP_RESULT_ERROR_CRYPTO, atap_ca_response_finish(session));
+  atap_free(ca_response);
+  atap_session_destroy(session);
+}
+
+TEST_F(CommandTest, StreamCaResponseFallback) {
+  setup_test_key();
+  // Ops without streaming AES-GCM decrypt once the CA Response is complete.
+  AtapOptionalOps optional_ops = *AtapOpsProvider::optional_ops();
+  optional_ops.aes_gcm_128_decrypt_begin = nullptr;
+  AtapSession* session = atap_session_create();
+  ASSERT_NE(nullptr, session);
+  atap_session_set_optional_ops(session, &optional_ops);
+  std::string operation_start;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519OperationStartPath), &operation_start));
+  uint32_t ca_request_size;
+  uint8_t* ca_request;
+  AtapResult res = atap_get_ca_request_ex(session,
+                                          ops_.atap_ops(),
+                                          (uint8_t*)&operation_start[0],
+                                          operation_start.size(),
+                                          &ca_request,
+                                          &ca_request_size);
+  ASSERT_EQ(ATAP_RESULT_OK, res);
+  atap_free(ca_request);
+  std::string inner;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519InnerCaResponsePath), &inner));
+  uint32_t ca_response_size;
+  uint8_t* ca_response = build_ca_response(inner, &ca_response_size);
+  ASSERT_EQ(ATAP_RESULT_OK, atap_ca_response_begin(session, ops_.atap_ops()));
+  uint32_t half = ca_response_size / 2;
+  ASSERT_EQ(ATAP_RESULT_OK, atap_ca_response_update(session, ca_response, half));
+  ASSERT_EQ(ATAP_RESULT_OK,
+            atap_ca_response_update(
+                session, ca_response + half, ca_response_size - half));
+  EXPECT_EQ(ATAP_RESULT_OK, atap_ca_response_finish(session));
+  atap_free(ca_response);
+  atap_session_destroy(session);
+}
+
+TEST_F(CommandTest, StreamCaResponseBadLength) {
+  setup_test_key();
+  AtapSession* session = create_session();
+  ASSERT_NE(nullptr, session);
+  std::string inner;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519InnerCaResponsePath), &inner));
+  uint32_t ca_response_size;
+  uint8_t* ca_response = build_ca_response(inner, &ca_response_size);
+  // Update without begin.
+  EXPECT_EQ(ATAP_RESULT_ERROR_INVALID_INPUT,
+            atap_ca_response_update(session, ca_response, ca_response_size));
+  // Truncated.
+  ASSERT_EQ(ATAP_RESULT_OK, atap_ca_response_begin(session, ops_.atap_ops()));
+  ASSERT_EQ(ATAP_RESULT_OK,
+            atap_ca_response_update(session, ca_response, ca_response_size - 1));
+  EXPECT_EQ(ATAP_RESULT_ERROR_INVALID_INPUT, atap_ca_response_finish(session));
+  // Too long.
+  ASSERT_EQ(ATAP_RESULT_OK, atap_ca_response_begin(session, ops_.atap_ops()));
+  ASSERT_EQ(ATAP_RESULT_OK,
+            atap_ca_response_update(session, ca_response, ca_response_size));
+  EXPECT_EQ(ATAP_RESULT_ERROR_INVALID_INPUT,
+            atap_ca_response_update(session, ca_response, 1));
+  EXPECT_EQ(ATAP_RESULT_ERROR_INVALID_INPUT, atap_ca_response_finish(session));
+  // Ciphertext length disagreeing with the header.
+  *(uint32_t*)&ca_response[ATAP_HEADER_LEN + ATAP_GCM_IV_LEN] += 1;
+  ASSERT_EQ(ATAP_RESULT_OK, atap_ca_response_begin(session, ops_.atap_ops()));
+  EXPECT_EQ(ATAP_RESULT_ERROR_INVALID_INPUT,
+            atap_ca_response_update(session, ca_response, ca_response_size));
+  // Unfinished CA Responses are released with the session.
+  *(uint32_t*)&ca_response[ATAP_HEADER_LEN + ATAP_GCM_IV_LEN] -= 1;
+  ASSERT_EQ(ATAP_RESULT_OK, atap_ca_response_begin(session, ops_.atap_ops()));
+  ASSERT_EQ(ATAP_RESULT_OK, atap_ca_response_update(session, ca_response, 100));
   atap_free(ca_response);
+  atap_session_destroy(session);
 }
 
 TEST_F(CommandTest, GetCaRequestIssueP256) {
@@ -0,0 +1,209 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <base/files/file_util.h>
+
+#include <libatap/libatap.h>
+
+#include "atap_unittest_util.h"
+#include "fake_atap_ops.h"
+#include "ops/sharded_atap_ops_provider.h"
+
+/* These tests run many provisioning handshakes at once, each worker thread
+ * using its own shard of a ShardedAtapOpsProvider and its own AtapSession.
+ */
+namespace atap {
+
+namespace {
+
+const size_t kHandshakesPerThread = 32;
+
+// Plays both the device and the CA side of one ISSUE handshake on |ops|.
+// The CA side reuses the fixed test ECDH key, so the session key can be
+// recomputed from the device public key in the CA request.
+bool RunHandshake(FakeAtapOps* delegate,
+                  AtapOps* ops,
+                  const std::string& operation_start,
+                  const std::string& inner) {
+  bool success = false;
+  uint8_t* ca_request = nullptr;
+  uint32_t ca_request_size = 0;
+  uint8_t* ca_response = nullptr;
+  uint32_t ca_response_size = 0;
+  const uint8_t* device_pubkey = nullptr;
+  uint8_t *iv = nullptr, *ciphertext = nullptr, *tag = nullptr;
+  uint32_t i = 0;
+  uint8_t shared_secret[ATAP_ECDH_SHARED_SECRET_LEN];
+  uint8_t ca_pubkey[ATAP_ECDH_KEY_LEN];
+  uint8_t key[ATAP_AES_128_KEY_LEN];
+  AtapSession* session = atap_session_create();
+  if (session == nullptr) {
+    return false;
+  }
+  if (atap_get_ca_request_ex(session,
+                             ops,
+                             (const uint8_t*)operation_start.data(),
+                             operation_start.size(),
+                             &ca_request,
+                             &ca_request_size) != ATAP_RESULT_OK) {
+    goto out;
+  }
+  device_pubkey = ca_request + ATAP_HEADER_LEN;
+  if (delegate->ecdh_shared_secret_compute(ATAP_CURVE_TYPE_X25519,
+                                           device_pubkey,
+                                           ca_pubkey,
+                                           shared_secret) != ATAP_RESULT_OK ||
+      derive_session_key(ops,
+                         device_pubkey,
+                         ca_pubkey,
+                         shared_secret,
+                         "KEY",
+                         key,
+                         ATAP_AES_128_KEY_LEN) != ATAP_RESULT_OK) {
+    goto out;
+  }
+
+  ca_response_size = ATAP_HEADER_LEN + ATAP_GCM_IV_LEN + sizeof(uint32_t) +
+                     inner.size() + ATAP_GCM_TAG_LEN;
+  ca_response = (uint8_t*)atap_malloc(ca_response_size);
+  append_header_to_buf(ca_response, ca_response_size - ATAP_HEADER_LEN);
+  i = ATAP_HEADER_LEN;
+  iv = next(ca_response, &i, ATAP_GCM_IV_LEN);
+  delegate->get_random_bytes(iv, ATAP_GCM_IV_LEN);
+  *(uint32_t*)next(ca_response, &i, sizeof(uint32_t)) = inner.size();
+  ciphertext = next(ca_response, &i, inner.size());
+  tag = next(ca_response, &i, ATAP_GCM_TAG_LEN);
+  if (delegate->aes_gcm_128_encrypt((const uint8_t*)inner.data(),
+                                    inner.size(),
+                                    iv,
+                                    key,
+                                    ciphertext,
+                                    tag) != ATAP_RESULT_OK) {
+    goto out;
+  }
+  success = atap_set_ca_response_ex(
+                session, ops, ca_response, ca_response_size) == ATAP_RESULT_OK;
+
+out:
+  if (ca_request) {
+    atap_free(ca_request);
+  }
+  if (ca_response) {
+    atap_free(ca_response);
+  }
+  atap_session_destroy(session);
+  return success;
+}
+
+}  // namespace
+
+// Subclass BaseAtapTest to check for memory leaks.
+class ConcurrencyTest : public BaseAtapTest {
+ public:
+  ConcurrencyTest() {}
+
+ protected:
+  void SetUp() override {
+    BaseAtapTest::SetUp();
+    ASSERT_TRUE(base::ReadFileToString(
+        base::FilePath(kIssueX25519OperationStartPath), &operation_start_));
+    ASSERT_TRUE(base::ReadFileToString(
+        base::FilePath(kIssueX25519InnerCaResponsePath), &inner_));
+    ASSERT_TRUE(base::ReadFileToString(base::FilePath(kCaX25519PrivateKey),
+                                       &test_key_));
+  }
+
+  // Runs |kHandshakesPerThread| handshakes on each of |num_threads| threads
+  // and returns the aggregate handshakes per second.
+  double RunWorkers(size_t num_threads) {
+    std::vector<std::unique_ptr<FakeAtapOps>> fake_ops;
+    std::vector<AtapOpsDelegate*> delegates;
+    for (size_t i = 0; i < num_threads; ++i) {
+      fake_ops.emplace_back(new FakeAtapOps());
+      fake_ops.back()->SetEcdhKeyForTesting(test_key_.data(),
+                                            test_key_.length());
+      delegates.push_back(fake_ops.back().get());
+    }
+    ShardedAtapOpsProvider provider(delegates);
+    EXPECT_EQ(num_threads, provider.shard_count());
+
+    std::vector<size_t> failures(num_threads, 0);
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < num_threads; ++t) {
+      workers.emplace_back([&, t]() {
+        for (size_t n = 0; n < kHandshakesPerThread; ++n) {
+          if (!RunHandshake(fake_ops[t].get(),
+                            provider.atap_ops(t),
+                            operation_start_,
+                            inner_)) {
+            ++failures[t];
+          }
+        }
+      });
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    for (size_t t = 0; t < num_threads; ++t) {
+      EXPECT_EQ(0u, failures[t]) << "worker " << t;
+    }
+    return (num_threads * kHandshakesPerThread) / elapsed.count();
+  }
+
+  std::string operation_start_;
+  std::string inner_;
+  std::string test_key_;
+};
+
+TEST_F(ConcurrencyTest, ShardsAreIndependent) {
+  FakeAtapOps first;
+  FakeAtapOps second;
+  ShardedAtapOpsProvider provider({&first, &second});
+  ASSERT_EQ(2u, provider.shard_count());
+  EXPECT_NE(provider.atap_ops(0), provider.atap_ops(1));
+  EXPECT_EQ(&first, provider.delegate(0));
+  EXPECT_EQ(&second, provider.delegate(1));
+  EXPECT_EQ(provider.atap_ops(0),
+            AtapOpsProvider::GetInstanceFromAtapOps(provider.atap_ops(0))
+                ->atap_ops());
+}
+
+TEST_F(ConcurrencyTest, HandshakeThroughputScalesWithThreads) {
+  const size_t kThreads = 4;
+  // Every worker must also succeed on machines too small to measure scaling.
+  double single_rate = RunWorkers(1);
+  double rate = RunWorkers(kThreads);
+  if (std::thread::hardware_concurrency() < kThreads) {
+    GTEST_SKIP() << "scaling needs " << kThreads << " cores";
+  }
+  // Shards share no state, so throughput should grow close to linearly. The
+  // bound is relaxed to half of linear to tolerate other load on the host.
+  EXPECT_GE(rate, 0.5 * kThreads * single_rate);
+}
+
+}  // namespace atap
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Fuzzes atap_set_ca_response_ex(), which devices run on CA Responses from
+// the network. The first input byte selects the operation and the rest is
+// the CA Response. AES-GCM decryption is replaced with a copy, so the
+// fuzzer input itself reaches the Inner CA Response parser.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libatap/libatap.h>
+
+#include "fake_atap_ops.h"
+#include "ops/atap_ops_provider.h"
+
+namespace atap {
+namespace {
+
+class FuzzAtapOps : public FakeAtapOps {
+ public:
+  AtapResult read_soc_global_key(
+      uint8_t global_key[ATAP_AES_128_KEY_LEN]) override {
+    atap_memset(global_key, 0, ATAP_AES_128_KEY_LEN);
+    return ATAP_RESULT_OK;
+  }
+
+  AtapResult write_hex_uuid(const uint8_t uuid[ATAP_HEX_UUID_LEN]) override {
+    Touch(uuid, ATAP_HEX_UUID_LEN);
+    return ATAP_RESULT_OK;
+  }
+
+  // Reads every byte the parser handed out, so the sanitizers catch views
+  // that point outside the CA Response.
+  AtapResult write_attestation_key(AtapKeyType key_type,
+                                   const AtapBlob* key,
+                                   const AtapCertChain* cert_chain) override {
+    if (key != nullptr) {
+      Touch(key->data, key->data_length);
+    }
+    for (uint32_t i = 0; i < cert_chain->entry_count; ++i) {
+      Touch(cert_chain->entries[i].data, cert_chain->entries[i].data_length);
+    }
+    return ATAP_RESULT_OK;
+  }
+
+  AtapResult aes_gcm_128_decrypt(const uint8_t* ciphertext,
+                                 uint32_t len,
+                                 const uint8_t iv[ATAP_GCM_IV_LEN],
+                                 const uint8_t key[ATAP_AES_128_KEY_LEN],
+                                 const uint8_t tag[ATAP_GCM_TAG_LEN],
+                                 uint8_t* plaintext) override {
+    atap_memcpy(plaintext, ciphertext, len);
+    return ATAP_RESULT_OK;
+  }
+
+  AtapResult aes_gcm_128_decrypt_in_place(
+      uint8_t* buf,
+      uint32_t len,
+      const uint8_t iv[ATAP_GCM_IV_LEN],
+      const uint8_t key[ATAP_AES_128_KEY_LEN],
+      const uint8_t tag[ATAP_GCM_TAG_LEN]) override {
+    return ATAP_RESULT_OK;
+  }
+
+ private:
+  void Touch(const uint8_t* data, uint32_t len) {
+    for (uint32_t i = 0; i < len; ++i) {
+      checksum_ += data[i];
+    }
+  }
+
+  volatile uint8_t checksum_ = 0;
+};
+
+}  // namespace
+}  // namespace atap
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  static atap::FuzzAtapOps fuzz_ops;
+  static atap::AtapOpsProvider provider(&fuzz_ops);
+
+  if (size < 1 || size - 1 > UINT32_MAX) {
+    return 0;
+  }
+  AtapSession* session = atap_session_create();
+  if (session == nullptr) {
+    return 0;
+  }
+  atap_session_set_optional_ops(session, atap::AtapOpsProvider::optional_ops());
+  // atap_get_ca_request_ex() only accepts operations 1 to 5.
+  session->operation = (AtapOperation)(1 + data[0] % 5);
+  atap_set_ca_response_ex(
+      session, provider.atap_ops(), data + 1, (uint32_t)(size - 1));
+  atap_session_destroy(session);
+  return 0;
+}
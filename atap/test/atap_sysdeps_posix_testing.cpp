@@ -18,7 +18,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <chrono>
 #include <map>
+#include <mutex>
 
 #include <base/debug/stack_trace.h>
 
@@ -55,23 +57,33 @@ size_t atap_strlen(const char* str) {
   return strlen(str);
 }
 
+uint64_t atap_get_monotonic_time_ns(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
 typedef struct {
   size_t size;
   base::debug::StackTrace stack_trace;
 } AtapAllocatedBlock;
 
 static std::map<void*, AtapAllocatedBlock> allocated_blocks;
+// Guards |allocated_blocks|, as multithreaded tests allocate concurrently.
+static std::mutex allocated_blocks_lock;
 
 void* atap_malloc(size_t size) {
   void* ptr = malloc(size);
   atap_assert(ptr != nullptr);
   AtapAllocatedBlock block;
   block.size = size;
+  std::lock_guard<std::mutex> lock(allocated_blocks_lock);
   allocated_blocks[ptr] = block;
   return ptr;
 }
 
 void atap_free(void* ptr) {
+  std::lock_guard<std::mutex> lock(allocated_blocks_lock);
   auto block_it = allocated_blocks.find(ptr);
   if (block_it == allocated_blocks.end()) {
     atap_fatal("Tried to free pointer to non-allocated block.\n");
@@ -84,10 +96,12 @@ void atap_free(void* ptr) {
 namespace atap {
 
 void testing_memory_reset() {
+  std::lock_guard<std::mutex> lock(allocated_blocks_lock);
   allocated_blocks.clear();
 }
 
 bool testing_memory_all_freed() {
+  std::lock_guard<std::mutex> lock(allocated_blocks_lock);
   if (allocated_blocks.size() == 0) {
     return true;
   }
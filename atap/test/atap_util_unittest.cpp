@@ -334,6 +334,169 @@ TEST_F(UtilTest, CaRequest) {
   free_ca_request(&req);
 }
 
+TEST_F(UtilTest, Arena) {
+  alignas(ATAP_ALIGNMENT_SIZE) uint8_t buf[64];
+  AtapArena arena;
+
+  atap_memset(buf, 0, sizeof(buf));
+  atap_arena_init(&arena, buf, sizeof(buf));
+  uint8_t* a = (uint8_t*)atap_arena_alloc(&arena, 3);
+  uint8_t* b = (uint8_t*)atap_arena_alloc(&arena, 16);
+  EXPECT_EQ(buf, a);
+  EXPECT_EQ(buf + ATAP_ALIGNMENT_SIZE, b);
+  atap_memset(a, 0x77, 3);
+  atap_memset(b, 0x77, 16);
+  size_t mark = atap_arena_mark(&arena);
+  // Allocations that don't fit come from the heap.
+  uint8_t* c = (uint8_t*)atap_arena_alloc(&arena, sizeof(buf));
+  ASSERT_NE(nullptr, c);
+  EXPECT_TRUE(c < buf || c >= buf + sizeof(buf));
+  atap_arena_free(&arena, c);
+  uint8_t* d = (uint8_t*)atap_arena_alloc(&arena, 8);
+  EXPECT_EQ(buf + mark, d);
+  atap_memset(d, 0x77, 8);
+  atap_arena_free(&arena, d);
+  atap_arena_release(&arena, mark);
+  EXPECT_EQ(mark, atap_arena_mark(&arena));
+  EXPECT_EQ(0, d[0]);
+  EXPECT_EQ(0x77, b[15]);
+  atap_arena_release(&arena, 0);
+  for (size_t i = 0; i < sizeof(buf); ++i) {
+    EXPECT_EQ(0, buf[i]);
+  }
+}
+
+TEST_F(UtilTest, ArenaCopyCertChain) {
+  alignas(ATAP_ALIGNMENT_SIZE) uint8_t arena_buf[256];
+  AtapArena arena;
+  AtapCertChain chain, copy;
+  uint8_t buf[256];
+
+  atap_arena_init(&arena, arena_buf, sizeof(arena_buf));
+  alloc_test_cert_chain(&chain);
+  append_cert_chain_to_buf(buf, &chain);
+  uint8_t* buf_ptr = buf;
+  ASSERT_TRUE(arena_copy_cert_chain_from_buf(&arena, &buf_ptr, &copy));
+  ASSERT_EQ(chain.entry_count, copy.entry_count);
+  for (size_t i = 0; i < copy.entry_count; ++i) {
+    EXPECT_TRUE(copy.entries[i].data >= arena_buf &&
+                copy.entries[i].data < arena_buf + sizeof(arena_buf));
+  }
+  validate_cert_chain(buf, &copy);
+  arena_free_cert_chain(&arena, copy);
+  atap_arena_release(&arena, 0);
+  free_cert_chain(chain);
+}
+
+TEST_F(UtilTest, ViewBlob) {
+  AtapBlob blob, view;
+  uint8_t buf[64];
+
+  alloc_test_blob(&blob);
+  uint32_t size = append_blob_to_buf(buf, &blob) - buf;
+  uint8_t* buf_ptr = buf;
+  ASSERT_TRUE(view_blob_from_buf(&buf_ptr, buf + size, &view));
+  EXPECT_EQ(buf + size, buf_ptr);
+  EXPECT_EQ(buf + sizeof(uint32_t), view.data);
+  validate_blob(buf, &view);
+  // Data running past the end of the buffer is rejected.
+  buf_ptr = buf;
+  EXPECT_FALSE(view_blob_from_buf(&buf_ptr, buf + size - 1, &view));
+  EXPECT_EQ(nullptr, view.data);
+  buf_ptr = buf;
+  EXPECT_FALSE(view_blob_from_buf(&buf_ptr, buf + 2, &view));
+  free_blob(blob);
+}
+
+TEST_F(UtilTest, ViewCertChain) {
+  AtapCertChain chain, view;
+  uint8_t buf[256];
+
+  alloc_test_cert_chain(&chain);
+  uint32_t size = append_cert_chain_to_buf(buf, &chain) - buf;
+  uint8_t* buf_ptr = buf;
+  ASSERT_TRUE(view_cert_chain_from_buf(&buf_ptr, buf + size, &view));
+  EXPECT_EQ(buf + size, buf_ptr);
+  ASSERT_EQ(chain.entry_count, view.entry_count);
+  for (size_t i = 0; i < view.entry_count; ++i) {
+    EXPECT_TRUE(view.entries[i].data > buf &&
+                view.entries[i].data < buf + size);
+  }
+  validate_cert_chain(buf, &view);
+  buf_ptr = buf;
+  EXPECT_FALSE(view_cert_chain_from_buf(&buf_ptr, buf + size - 1, &view));
+  EXPECT_EQ(0u, view.entry_count);
+  // An entry crossing the end of the chain is rejected.
+  *(uint32_t*)&buf[0] -= 1;
+  buf_ptr = buf;
+  EXPECT_FALSE(view_cert_chain_from_buf(&buf_ptr, buf + size, &view));
+  free_cert_chain(chain);
+}
+
+TEST_F(UtilTest, CertChainEntryLenMax) {
+  uint8_t buf[4 + 4 + ATAP_CERT_LEN_MAX + 1] = {};
+  AtapCertChain chain;
+  uint8_t* buf_ptr = buf;
+
+  // One entry, a byte longer than a certificate can be. The owning copy
+  // keeps accepting entries up to ATAP_BLOB_LEN_MAX.
+  *(uint32_t*)&buf[0] = sizeof(buf) - 4;
+  *(uint32_t*)&buf[4] = ATAP_CERT_LEN_MAX + 1;
+  EXPECT_FALSE(view_cert_chain_from_buf(&buf_ptr, buf + sizeof(buf), &chain));
+  buf_ptr = buf;
+  ASSERT_TRUE(copy_cert_chain_from_buf(&buf_ptr, &chain));
+  EXPECT_EQ((uint32_t)ATAP_CERT_LEN_MAX + 1, chain.entries[0].data_length);
+  free_cert_chain(chain);
+  *(uint32_t*)&buf[0] -= 1;
+  *(uint32_t*)&buf[4] -= 1;
+  buf_ptr = buf;
+  ASSERT_TRUE(
+      view_cert_chain_from_buf(&buf_ptr, buf + sizeof(buf) - 1, &chain));
+  EXPECT_EQ((uint32_t)ATAP_CERT_LEN_MAX, chain.entries[0].data_length);
+  buf_ptr = buf;
+  ASSERT_TRUE(copy_cert_chain_from_buf(&buf_ptr, &chain));
+  EXPECT_EQ((uint32_t)ATAP_CERT_LEN_MAX, chain.entries[0].data_length);
+  free_cert_chain(chain);
+}
+
+TEST_F(UtilTest, Cursor) {
+  uint8_t buf[12] = {4, 0, 0, 0, 1, 2, 3, 4, 0xff, 0xff, 0xff, 0x7f};
+  AtapCursor cursor;
+  AtapBlob blob;
+
+  atap_cursor_init(&cursor, buf, sizeof(buf));
+  ASSERT_TRUE(atap_cursor_read_blob(&cursor, 4, &blob));
+  EXPECT_EQ(buf + 4, blob.data);
+  EXPECT_EQ(4u, blob.data_length);
+  EXPECT_FALSE(atap_cursor_done(&cursor));
+  // A length past the end fails the cursor, and later reads fail too.
+  EXPECT_FALSE(atap_cursor_read_blob(&cursor, UINT32_MAX, &blob));
+  EXPECT_EQ(nullptr, blob.data);
+  EXPECT_FALSE(atap_cursor_ok(&cursor));
+  EXPECT_EQ(nullptr, atap_cursor_take(&cursor, 0));
+  // So does a blob longer than allowed.
+  atap_cursor_init(&cursor, buf, sizeof(buf));
+  EXPECT_FALSE(atap_cursor_read_blob(&cursor, 3, &blob));
+  EXPECT_FALSE(atap_cursor_ok(&cursor));
+}
+
+TEST_F(UtilTest, CursorCertChainEntriesMax) {
+  uint8_t buf[4 + 4 * (ATAP_CERT_CHAIN_ENTRIES_MAX + 1)] = {};
+  AtapCursor cursor;
+  AtapCertChain chain;
+
+  // Empty entries, one more than a chain can hold.
+  *(uint32_t*)&buf[0] = sizeof(buf) - 4;
+  atap_cursor_init(&cursor, buf, sizeof(buf));
+  EXPECT_FALSE(atap_cursor_read_cert_chain(&cursor, ATAP_CERT_LEN_MAX, &chain));
+  EXPECT_EQ(0u, chain.entry_count);
+  *(uint32_t*)&buf[0] -= 4;
+  atap_cursor_init(&cursor, buf, sizeof(buf) - 4);
+  ASSERT_TRUE(atap_cursor_read_cert_chain(&cursor, ATAP_CERT_LEN_MAX, &chain));
+  EXPECT_EQ((uint32_t)ATAP_CERT_CHAIN_ENTRIES_MAX, chain.entry_count);
+  EXPECT_TRUE(atap_cursor_done(&cursor));
+}
+
 TEST_F(UtilTest, ValidateEncryptedMessage) {
   uint8_t buf[128];
   uint32_t message_len = 128 - ATAP_HEADER_LEN;
@@ -366,4 +529,55 @@ TEST_F(UtilTest, ValidateInnerCaResponse) {
                                        ATAP_OPERATION_ISSUE));
 }
 
+TEST_F(UtilTest, ParseInnerCaResponse) {
+  std::string inner_ca_resp;
+  AtapInnerCaResponse response;
+
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519InnerCaResponsePath), &inner_ca_resp));
+  const uint8_t* buf = (const uint8_t*)&inner_ca_resp[0];
+  uint32_t size = inner_ca_resp.size();
+  ASSERT_TRUE(
+      parse_inner_ca_response(buf, size, ATAP_OPERATION_ISSUE, &response));
+  EXPECT_EQ(buf + ATAP_HEADER_LEN, response.hex_uuid);
+  ASSERT_LE(2u, response.key_count);
+  EXPECT_EQ(ATAP_KEY_TYPE_RSA, response.keys[0].key_type);
+  EXPECT_EQ(ATAP_KEY_TYPE_ECDSA, response.keys[1].key_type);
+  for (uint32_t i = 0; i < response.key_count; ++i) {
+    const AtapAttestationKey& key = response.keys[i];
+    EXPECT_TRUE(key.key.data > buf && key.key.data < buf + size);
+    ASSERT_LT(0u, key.cert_chain.entry_count);
+    EXPECT_TRUE(key.cert_chain.entries[0].data > buf &&
+                key.cert_chain.entries[0].data < key.key.data);
+  }
+  // An issue response has keys, so it is not a valid certify response.
+  EXPECT_FALSE(
+      parse_inner_ca_response(buf, size, ATAP_OPERATION_CERTIFY, &response));
+
+  // Every truncation is rejected, even with a matching message length.
+  std::string truncated;
+  for (uint32_t len = 0; len < size; len += 7) {
+    truncated.assign(inner_ca_resp, 0, len);
+    if (len >= ATAP_HEADER_LEN) {
+      *(uint32_t*)&truncated[4] = len - ATAP_HEADER_LEN;
+    }
+    EXPECT_FALSE(parse_inner_ca_response((const uint8_t*)truncated.data(),
+                                         len,
+                                         ATAP_OPERATION_ISSUE,
+                                         &response))
+        << len;
+  }
+}
+
+TEST_F(UtilTest, ParseInnerCaResponseMissingRequiredKey) {
+  uint8_t buf[ATAP_HEADER_LEN + ATAP_HEX_UUID_LEN +
+              ATAP_INNER_CA_RESPONSE_FIELDS_PRODUCT * sizeof(uint32_t)] = {};
+  AtapInnerCaResponse response;
+
+  // Well formed, but the RSA and ECDSA keys are left out.
+  append_header_to_buf(buf, sizeof(buf) - ATAP_HEADER_LEN);
+  EXPECT_FALSE(parse_inner_ca_response(
+      buf, sizeof(buf), ATAP_OPERATION_ISSUE, &response));
+}
+
 }  // namespace atap
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <base/files/file_util.h>
+
+#include <libatap/libatap.h>
+
+#include "atap_unittest_util.h"
+#include "fake_atap_ops.h"
+#include "ops/atap_ops_provider.h"
+#include "ops/ecdh_key_pool.h"
+
+/* These tests verify that OpensslOps uses pre-generated ephemeral keys from
+ * an EcdhKeyPool, and falls back to inline key generation on a miss.
+ */
+namespace atap {
+
+// Subclass BaseAtapTest to check for memory leaks.
+class EcdhKeyPoolTest : public BaseAtapTest {
+ public:
+  EcdhKeyPoolTest() {}
+
+  FakeAtapOps fake_ops_;
+  AtapOpsProvider ops_{&fake_ops_};
+
+  AtapResult get_ca_request(const char* operation_start_path) {
+    std::string operation_start;
+    EXPECT_TRUE(base::ReadFileToString(base::FilePath(operation_start_path),
+                                       &operation_start));
+    uint32_t ca_request_size;
+    uint8_t* ca_request;
+    AtapResult res = atap_get_ca_request(ops_.atap_ops(),
+                                         (uint8_t*)&operation_start[0],
+                                         operation_start.size(),
+                                         &ca_request,
+                                         &ca_request_size);
+    if (res == ATAP_RESULT_OK) {
+      atap_free(ca_request);
+    }
+    return res;
+  }
+};
+
+TEST_F(EcdhKeyPoolTest, X25519KeysAreTakenFromPool) {
+  EcdhKeyPool pool(ATAP_CURVE_TYPE_X25519, 2);
+  EXPECT_TRUE(pool.WaitUntilFull());
+  fake_ops_.set_ecdh_key_pool(&pool);
+  EXPECT_EQ(ATAP_RESULT_OK, get_ca_request(kIssueX25519OperationStartPath));
+  EXPECT_EQ(1u, pool.hits());
+  EXPECT_EQ(0u, pool.misses());
+  fake_ops_.set_ecdh_key_pool(nullptr);
+}
+
+TEST_F(EcdhKeyPoolTest, P256KeysAreTakenFromPool) {
+  EcdhKeyPool pool(ATAP_CURVE_TYPE_P256, 2);
+  EXPECT_TRUE(pool.WaitUntilFull());
+  fake_ops_.set_ecdh_key_pool(&pool);
+  EXPECT_EQ(ATAP_RESULT_OK, get_ca_request(kIssueP256OperationStartPath));
+  EXPECT_EQ(1u, pool.hits());
+  // A pool for another curve is ignored.
+  EXPECT_EQ(ATAP_RESULT_OK, get_ca_request(kIssueX25519OperationStartPath));
+  EXPECT_EQ(1u, pool.hits());
+  fake_ops_.set_ecdh_key_pool(nullptr);
+}
+
+TEST_F(EcdhKeyPoolTest, EmptyPoolCountsMiss) {
+  EcdhKeyPool pool(ATAP_CURVE_TYPE_X25519, 0);
+  fake_ops_.set_ecdh_key_pool(&pool);
+  EXPECT_EQ(ATAP_RESULT_OK, get_ca_request(kIssueX25519OperationStartPath));
+  EXPECT_EQ(0u, pool.hits());
+  EXPECT_EQ(1u, pool.misses());
+  fake_ops_.set_ecdh_key_pool(nullptr);
+}
+
+TEST_F(EcdhKeyPoolTest, PoolRefillsAfterUse) {
+  EcdhKeyPool pool(ATAP_CURVE_TYPE_X25519, 1);
+  uint8_t public_key[32];
+  uint8_t private_key[32];
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(pool.WaitUntilFull());
+    EXPECT_TRUE(pool.TakeX25519Keypair(public_key, private_key));
+  }
+  EXPECT_EQ(3u, pool.hits());
+  EXPECT_EQ(nullptr, pool.TakeP256Key());
+}
+
+}  // namespace atap
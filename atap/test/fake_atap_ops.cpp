@@ -57,6 +57,17 @@ AtapResult FakeAtapOps::read_auth_key_cert_chain(AtapCertChain* cert_chain) {
 AtapResult FakeAtapOps::write_attestation_key(AtapKeyType key_type,
                                               const AtapBlob* key,
                                               const AtapCertChain* cert_chain) {
+  ++single_key_writes_;
+  return ATAP_RESULT_OK;
+}
+
+AtapResult FakeAtapOps::write_attestation_keys(const AtapAttestationKey* keys,
+                                               uint32_t key_count) {
+  if (!batch_writes_supported_) {
+    return ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION;
+  }
+  ++batch_writes_;
+  batch_key_count_ += key_count;
   return ATAP_RESULT_OK;
 }
 
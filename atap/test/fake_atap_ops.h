@@ -30,8 +30,7 @@
 namespace atap {
 
 // An ops implementation for tests. This allows tests to override default fake
-// implementations. All instances of this class must be created on the same
-// thread.
+// implementations. An instance must only be used by one thread at a time.
 class FakeAtapOps : public OpensslOps {
  public:
   FakeAtapOps();
@@ -48,6 +47,9 @@ class FakeAtapOps : public OpensslOps {
                                    const AtapBlob* key,
                                    const AtapCertChain* cert_chain) override;
 
+  AtapResult write_attestation_keys(const AtapAttestationKey* keys,
+                                    uint32_t key_count) override;
+
   AtapResult read_attestation_public_key(AtapKeyType key_type,
                                          uint8_t pubkey[ATAP_KEY_LEN_MAX],
                                          uint32_t* pubkey_len) override;
@@ -65,12 +67,27 @@ class FakeAtapOps : public OpensslOps {
     const AtapKeyType key_type, uint8_t* sig, uint32_t sig_len, uint8_t* cert,
     uint32_t cert_len);
 
+  // Makes write_attestation_keys() accept batches instead of returning
+  // ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION.
+  void set_batch_writes_supported(bool supported) {
+    batch_writes_supported_ = supported;
+  }
+  // Counts write_attestation_key() calls, accepted write_attestation_keys()
+  // calls, and keys passed to those.
+  int single_key_writes() const { return single_key_writes_; }
+  int batch_writes() const { return batch_writes_; }
+  int batch_key_count() const { return batch_key_count_; }
+
  private:
   AtapKeyType key_type_ = ATAP_KEY_TYPE_NONE;
   uint32_t auth_sig_len_ = 0;
   uint8_t *auth_sig_ = nullptr;
   uint32_t auth_cert_len_ = 0;
   uint8_t *auth_cert_ = nullptr;
+  bool batch_writes_supported_ = false;
+  int single_key_writes_ = 0;
+  int batch_writes_ = 0;
+  int batch_key_count_ = 0;
 };
 
 }  // namespace atap
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <base/files/file_util.h>
+
+#include <libatap/libatap.h>
+
+#include "atap_unittest_util.h"
+#include "fake_atap_ops.h"
+#include "ops/atap_ops_provider.h"
+#include "ops/metrics_atap_ops_delegate.h"
+
+namespace atap {
+
+class MetricsAtapOpsDelegateTest : public BaseAtapTest {
+ public:
+  MetricsAtapOpsDelegateTest() {}
+
+  FakeAtapOps fake_ops_;
+  MetricsAtapOpsDelegate metrics_ops_{&fake_ops_};
+  AtapOpsProvider ops_{&metrics_ops_};
+};
+
+TEST_F(MetricsAtapOpsDelegateTest, CountsGetCaRequest) {
+  std::string test_key;
+  ASSERT_TRUE(base::ReadFileToString(base::FilePath(kCaX25519PrivateKey),
+                                     &test_key));
+  fake_ops_.SetEcdhKeyForTesting(test_key.data(), test_key.length());
+  std::string operation_start;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519OperationStartPath), &operation_start));
+
+  uint32_t ca_request_size;
+  uint8_t* ca_request;
+  EXPECT_EQ(ATAP_RESULT_OK,
+            atap_get_ca_request(ops_.atap_ops(),
+                                (uint8_t*)&operation_start[0],
+                                operation_start.size(),
+                                &ca_request,
+                                &ca_request_size));
+  atap_free(ca_request);
+
+  AtapOpMetrics ecdh =
+      metrics_ops_.metrics(MetricsAtapOpsDelegate::kEcdhSharedSecretCompute);
+  EXPECT_STREQ("ecdh_shared_secret_compute", ecdh.method);
+  EXPECT_EQ(1u, ecdh.calls);
+  EXPECT_EQ(0u, ecdh.errors);
+  EXPECT_EQ((uint64_t)ATAP_ECDH_KEY_LEN, ecdh.bytes);
+  EXPECT_EQ(1u, ecdh.latency.count);
+  AtapOpMetrics random =
+      metrics_ops_.metrics(MetricsAtapOpsDelegate::kGetRandomBytes);
+  EXPECT_EQ(1u, random.calls);
+  EXPECT_EQ((uint64_t)ATAP_GCM_IV_LEN, random.bytes);
+  EXPECT_EQ(
+      1u, metrics_ops_.metrics(MetricsAtapOpsDelegate::kReadProductId).calls);
+  EXPECT_EQ(
+      0u, metrics_ops_.metrics(MetricsAtapOpsDelegate::kAuthKeySign).calls);
+
+  metrics_ops_.Reset();
+  EXPECT_EQ(0u,
+            metrics_ops_
+                .metrics(MetricsAtapOpsDelegate::kEcdhSharedSecretCompute)
+                .calls);
+}
+
+TEST_F(MetricsAtapOpsDelegateTest, CountsErrorsAndUnsupported) {
+  uint8_t buf[16] = {};
+  uint8_t iv[ATAP_GCM_IV_LEN] = {};
+  uint8_t key[ATAP_AES_128_KEY_LEN] = {};
+  uint8_t tag[ATAP_GCM_TAG_LEN] = {};
+  EXPECT_NE(ATAP_RESULT_OK,
+            metrics_ops_.aes_gcm_128_decrypt(
+                buf, sizeof(buf), iv, key, tag, buf));
+  EXPECT_EQ(ATAP_RESULT_ERROR_UNSUPPORTED_OPERATION,
+            metrics_ops_.write_attestation_keys(nullptr, 0));
+
+  AtapOpMetrics decrypt =
+      metrics_ops_.metrics(MetricsAtapOpsDelegate::kAesGcm128Decrypt);
+  EXPECT_EQ(1u, decrypt.calls);
+  EXPECT_EQ(1u, decrypt.errors);
+  EXPECT_EQ(0u, decrypt.unsupported);
+  EXPECT_EQ(sizeof(buf), decrypt.bytes);
+  AtapOpMetrics write =
+      metrics_ops_.metrics(MetricsAtapOpsDelegate::kWriteAttestationKeys);
+  EXPECT_EQ(1u, write.calls);
+  EXPECT_EQ(0u, write.errors);
+  EXPECT_EQ(1u, write.unsupported);
+}
+
+TEST_F(MetricsAtapOpsDelegateTest, ExportsSnapshots) {
+  uint8_t hash[ATAP_SHA256_DIGEST_LEN];
+  EXPECT_EQ(ATAP_RESULT_OK,
+            metrics_ops_.sha256((const uint8_t*)"abc", 3, hash));
+
+  std::vector<AtapOpMetrics> snapshot = metrics_ops_.Snapshot();
+  ASSERT_EQ((size_t)MetricsAtapOpsDelegate::kMethodCount, snapshot.size());
+  MetricsAtapOpsDelegate::MergeSnapshot(metrics_ops_.Snapshot(), &snapshot);
+  EXPECT_EQ(2u, snapshot[MetricsAtapOpsDelegate::kSha256].calls);
+  EXPECT_EQ(6u, snapshot[MetricsAtapOpsDelegate::kSha256].bytes);
+  EXPECT_EQ(2u, snapshot[MetricsAtapOpsDelegate::kSha256].latency.count);
+
+  std::string text =
+      MetricsAtapOpsDelegate::ToPrometheusText(snapshot, "atap_ops");
+  EXPECT_NE(std::string::npos,
+            text.find("# TYPE atap_ops_calls_total counter\n"));
+  EXPECT_NE(std::string::npos,
+            text.find("atap_ops_calls_total{method=\"sha256\"} 2\n"));
+  EXPECT_NE(std::string::npos,
+            text.find("atap_ops_bytes_total{method=\"sha256\"} 6\n"));
+  EXPECT_NE(std::string::npos,
+            text.find("atap_ops_latency_seconds_bucket{method=\"sha256\","
+                      "le=\"+Inf\"} 2\n"));
+  EXPECT_NE(std::string::npos,
+            text.find("atap_ops_latency_seconds_count{method=\"sha256\"} 2\n"));
+  EXPECT_EQ(std::string::npos, text.find("method=\"hkdf_sha256\""));
+
+  EXPECT_EQ(0u,
+            MetricsAtapOpsDelegate::ToString(snapshot).find(
+                "sha256 calls=2 errors=0 unsupported=0 bytes=6 "));
+}
+
+}  // namespace atap
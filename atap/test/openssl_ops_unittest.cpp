@@ -0,0 +1,223 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include <libatap/libatap.h>
+
+#include "atap_unittest_util.h"
+#include "fake_atap_ops.h"
+
+/* These tests verify the crypto ops implemented by OpensslOps. */
+namespace atap {
+
+// Subclass BaseAtapTest to check for memory leaks.
+class OpensslOpsTest : public BaseAtapTest {
+ public:
+  OpensslOpsTest() {}
+
+  // OpensslOps is a partial delegate, so test it through FakeAtapOps.
+  FakeAtapOps ops_;
+};
+
+TEST_F(OpensslOpsTest, AesGcmRoundTripManyKeys) {
+  // Uses more keys than the AEAD key cache holds, so entries are evicted and
+  // later re-initialized.
+  const size_t kNumKeys = 6;
+  uint8_t keys[kNumKeys][ATAP_AES_128_KEY_LEN];
+  uint8_t iv[ATAP_GCM_IV_LEN];
+  uint8_t plaintext[64];
+  uint8_t ciphertext[kNumKeys][sizeof(plaintext)];
+  uint8_t tags[kNumKeys][ATAP_GCM_TAG_LEN];
+  uint8_t decrypted[sizeof(plaintext)];
+  ASSERT_EQ(ATAP_RESULT_OK, ops_.get_random_bytes(iv, sizeof(iv)));
+  atap_memset(plaintext, 0x5a, sizeof(plaintext));
+
+  for (int round = 0; round < 2; ++round) {
+    for (size_t i = 0; i < kNumKeys; ++i) {
+      atap_memset(keys[i], (int)i, ATAP_AES_128_KEY_LEN);
+      ASSERT_EQ(ATAP_RESULT_OK,
+                ops_.aes_gcm_128_encrypt(plaintext,
+                                         sizeof(plaintext),
+                                         iv,
+                                         keys[i],
+                                         ciphertext[i],
+                                         tags[i]));
+    }
+    for (size_t i = 0; i < kNumKeys; ++i) {
+      ASSERT_EQ(ATAP_RESULT_OK,
+                ops_.aes_gcm_128_decrypt(ciphertext[i],
+                                         sizeof(plaintext),
+                                         iv,
+                                         keys[i],
+                                         tags[i],
+                                         decrypted));
+      EXPECT_EQ(0, memcmp(plaintext, decrypted, sizeof(plaintext)));
+    }
+    // Distinct keys give distinct ciphertexts.
+    EXPECT_NE(0, memcmp(ciphertext[0], ciphertext[1], sizeof(plaintext)));
+  }
+}
+
+TEST_F(OpensslOpsTest, AesGcmWrongKeyFails) {
+  uint8_t key[ATAP_AES_128_KEY_LEN];
+  uint8_t other_key[ATAP_AES_128_KEY_LEN];
+  uint8_t iv[ATAP_GCM_IV_LEN];
+  uint8_t buf[32];
+  uint8_t tag[ATAP_GCM_TAG_LEN];
+  atap_memset(key, 0x11, sizeof(key));
+  atap_memset(other_key, 0x22, sizeof(other_key));
+  atap_memset(iv, 0, sizeof(iv));
+  atap_memset(buf, 0x33, sizeof(buf));
+  ASSERT_EQ(ATAP_RESULT_OK,
+            ops_.aes_gcm_128_encrypt_in_place(buf, sizeof(buf), iv, key, tag));
+  EXPECT_EQ(
+      ATAP_RESULT_ERROR_CRYPTO,
+      ops_.aes_gcm_128_decrypt_in_place(buf, sizeof(buf), iv, other_key, tag));
+}
+
+TEST_F(OpensslOpsTest, AesGcmAfterClearAeadKeyCache) {
+  uint8_t key[ATAP_AES_128_KEY_LEN];
+  uint8_t iv[ATAP_GCM_IV_LEN];
+  uint8_t plaintext[32];
+  uint8_t buf[32];
+  uint8_t tag[ATAP_GCM_TAG_LEN];
+  atap_memset(key, 0x44, sizeof(key));
+  atap_memset(iv, 0, sizeof(iv));
+  atap_memset(plaintext, 0x55, sizeof(plaintext));
+  atap_memcpy(buf, plaintext, sizeof(buf));
+  ASSERT_EQ(ATAP_RESULT_OK,
+            ops_.aes_gcm_128_encrypt_in_place(buf, sizeof(buf), iv, key, tag));
+  ops_.ClearAeadKeyCache();
+  ASSERT_EQ(ATAP_RESULT_OK,
+            ops_.aes_gcm_128_decrypt_in_place(buf, sizeof(buf), iv, key, tag));
+  EXPECT_EQ(0, memcmp(plaintext, buf, sizeof(buf)));
+}
+
+TEST_F(OpensslOpsTest, AesGcmEncryptBatchMatchesSingleOps) {
+  // Keys repeat, and the last job encrypts in place.
+  const size_t kNumJobs = 6;
+  const int kKeyIds[kNumJobs] = {0, 0, 1, 1, 1, 0};
+  uint8_t keys[2][ATAP_AES_128_KEY_LEN];
+  uint8_t ivs[kNumJobs][ATAP_GCM_IV_LEN];
+  uint8_t plaintext[kNumJobs][48];
+  uint8_t ciphertext[kNumJobs][sizeof(plaintext[0])];
+  uint8_t tags[kNumJobs][ATAP_GCM_TAG_LEN];
+  uint8_t expected[sizeof(plaintext[0])];
+  uint8_t expected_tag[ATAP_GCM_TAG_LEN];
+  AtapAesGcmEncryptJob jobs[kNumJobs];
+  atap_memset(keys[0], 0x11, ATAP_AES_128_KEY_LEN);
+  atap_memset(keys[1], 0x22, ATAP_AES_128_KEY_LEN);
+  ASSERT_EQ(ATAP_RESULT_OK, ops_.get_random_bytes(&ivs[0][0], sizeof(ivs)));
+  ASSERT_EQ(ATAP_RESULT_OK,
+            ops_.get_random_bytes(&plaintext[0][0], sizeof(plaintext)));
+
+  for (size_t i = 0; i < kNumJobs; ++i) {
+    jobs[i].plaintext = plaintext[i];
+    jobs[i].len = sizeof(plaintext[i]) - i;
+    jobs[i].iv = ivs[i];
+    jobs[i].key = keys[kKeyIds[i]];
+    jobs[i].ciphertext = (i == kNumJobs - 1) ? plaintext[i] : ciphertext[i];
+    jobs[i].tag = tags[i];
+    jobs[i].result = ATAP_RESULT_ERROR_CRYPTO;
+  }
+  uint8_t last_plaintext[sizeof(plaintext[0])];
+  atap_memcpy(last_plaintext, plaintext[kNumJobs - 1], sizeof(last_plaintext));
+  EXPECT_EQ(ATAP_RESULT_OK, ops_.aes_gcm_128_encrypt_batch(jobs, kNumJobs));
+
+  for (size_t i = 0; i < kNumJobs; ++i) {
+    const uint8_t* in = (i == kNumJobs - 1) ? last_plaintext : plaintext[i];
+    EXPECT_EQ(ATAP_RESULT_OK, jobs[i].result);
+    ASSERT_EQ(ATAP_RESULT_OK,
+              ops_.aes_gcm_128_encrypt(in,
+                                       jobs[i].len,
+                                       ivs[i],
+                                       keys[kKeyIds[i]],
+                                       expected,
+                                       expected_tag));
+    EXPECT_EQ(0, memcmp(expected, jobs[i].ciphertext, jobs[i].len));
+    EXPECT_EQ(0, memcmp(expected_tag, tags[i], ATAP_GCM_TAG_LEN));
+  }
+}
+
+TEST_F(OpensslOpsTest, Sha256BatchMatchesSingleOps) {
+  const size_t kNumJobs = 3;
+  uint8_t data[100];
+  uint8_t hashes[kNumJobs][ATAP_SHA256_DIGEST_LEN];
+  uint8_t expected[kNumJobs][ATAP_SHA256_DIGEST_LEN];
+  AtapSha256Job jobs[kNumJobs];
+  atap_memset(data, 0x33, sizeof(data));
+
+  for (size_t i = 0; i < kNumJobs; ++i) {
+    jobs[i] = {data, (uint32_t)(i * 50), hashes[i], ATAP_RESULT_ERROR_CRYPTO};
+  }
+  EXPECT_EQ(ATAP_RESULT_OK, ops_.sha256_batch(jobs, kNumJobs));
+  for (size_t i = 0; i < kNumJobs; ++i) {
+    EXPECT_EQ(ATAP_RESULT_OK, jobs[i].result);
+  }
+  for (size_t i = 0; i < kNumJobs; ++i) {
+    EXPECT_EQ(ATAP_RESULT_OK,
+              ops_.sha256(data, jobs[i].plaintext_len, expected[i]));
+  }
+  EXPECT_EQ(0, memcmp(expected, hashes, sizeof(hashes)));
+}
+
+TEST_F(OpensslOpsTest, HkdfSha256BatchMatchesSingleOps) {
+  // The first two jobs share salt and input key material, the third does not.
+  const size_t kNumJobs = 3;
+  uint8_t salts[2][2 * ATAP_ECDH_KEY_LEN];
+  uint8_t ikm[ATAP_ECDH_SHARED_SECRET_LEN];
+  const char* infos[kNumJobs] = {"KEY", "SIGN", "KEY"};
+  const int32_t okm_lens[kNumJobs] = {
+      ATAP_AES_128_KEY_LEN, ATAP_NONCE_LEN, ATAP_AES_128_KEY_LEN};
+  uint8_t okm[kNumJobs][ATAP_AES_128_KEY_LEN];
+  uint8_t expected[ATAP_AES_128_KEY_LEN];
+  AtapHkdfSha256Job jobs[kNumJobs];
+  atap_memset(salts[0], 0x44, sizeof(salts[0]));
+  atap_memset(salts[1], 0x55, sizeof(salts[1]));
+  atap_memset(ikm, 0x66, sizeof(ikm));
+
+  for (size_t i = 0; i < kNumJobs; ++i) {
+    jobs[i].salt = salts[i / 2];
+    jobs[i].salt_len = sizeof(salts[0]);
+    jobs[i].ikm = ikm;
+    jobs[i].ikm_len = sizeof(ikm);
+    jobs[i].info = (const uint8_t*)infos[i];
+    jobs[i].info_len = strlen(infos[i]);
+    jobs[i].okm = okm[i];
+    jobs[i].okm_len = okm_lens[i];
+  }
+  EXPECT_EQ(ATAP_RESULT_OK, ops_.hkdf_sha256_batch(jobs, kNumJobs));
+
+  for (size_t i = 0; i < kNumJobs; ++i) {
+    EXPECT_EQ(ATAP_RESULT_OK, jobs[i].result);
+    ASSERT_EQ(ATAP_RESULT_OK,
+              ops_.hkdf_sha256(jobs[i].salt,
+                               jobs[i].salt_len,
+                               ikm,
+                               sizeof(ikm),
+                               jobs[i].info,
+                               jobs[i].info_len,
+                               expected,
+                               okm_lens[i]));
+    EXPECT_EQ(0, memcmp(expected, okm[i], okm_lens[i]));
+  }
+  EXPECT_NE(0, memcmp(okm[0], okm[2], ATAP_AES_128_KEY_LEN));
+}
+
+}  // namespace atap
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <base/files/file_util.h>
+
+#include <libatap/libatap.h>
+
+#include "atap_unittest_util.h"
+#include "fake_atap_ops.h"
+#include "ops/atap_ops_provider.h"
+#include "ops/phase_histogram_delegate.h"
+
+namespace atap {
+
+class PhaseHistogramDelegateTest : public BaseAtapTest {
+ public:
+  PhaseHistogramDelegateTest() {}
+
+  FakeAtapOps fake_ops_;
+  PhaseHistogramDelegate histogram_ops_{&fake_ops_};
+  AtapOpsProvider ops_{&histogram_ops_};
+};
+
+TEST_F(PhaseHistogramDelegateTest, RecordsDurations) {
+  histogram_ops_.trace(
+      ATAP_TRACE_PHASE_INITIALIZE_SESSION, ATAP_TRACE_EVENT_BEGIN, 1000);
+  histogram_ops_.trace(
+      ATAP_TRACE_PHASE_INITIALIZE_SESSION, ATAP_TRACE_EVENT_END, 3500);
+  histogram_ops_.trace(
+      ATAP_TRACE_PHASE_INITIALIZE_SESSION, ATAP_TRACE_EVENT_BEGIN, 10000);
+  histogram_ops_.trace(
+      ATAP_TRACE_PHASE_INITIALIZE_SESSION, ATAP_TRACE_EVENT_END, 10500);
+
+  LatencyHistogram h =
+      histogram_ops_.histogram(ATAP_TRACE_PHASE_INITIALIZE_SESSION);
+  EXPECT_EQ(2u, h.count);
+  EXPECT_EQ(3000u, h.total_ns);
+  EXPECT_EQ(500u, h.min_ns);
+  EXPECT_EQ(2500u, h.max_ns);
+  EXPECT_EQ(1u, h.buckets[0]);
+  EXPECT_EQ(1u, h.buckets[2]);
+  EXPECT_EQ(1000u, h.PercentileNs(50));
+  EXPECT_EQ(2500u, h.PercentileNs(99));
+  EXPECT_EQ(
+      0u,
+      histogram_ops_.histogram(ATAP_TRACE_PHASE_ENCRYPT_INNER_CA_REQUEST).count);
+
+  histogram_ops_.Reset();
+  EXPECT_EQ(
+      0u, histogram_ops_.histogram(ATAP_TRACE_PHASE_INITIALIZE_SESSION).count);
+}
+
+TEST_F(PhaseHistogramDelegateTest, IgnoresEndWithoutBegin) {
+  histogram_ops_.trace(
+      ATAP_TRACE_PHASE_WRITE_INNER_CA_RESPONSE, ATAP_TRACE_EVENT_END, 5000);
+  EXPECT_EQ(
+      0u,
+      histogram_ops_.histogram(ATAP_TRACE_PHASE_WRITE_INNER_CA_RESPONSE).count);
+}
+
+TEST_F(PhaseHistogramDelegateTest, TracesGetCaRequest) {
+  std::string test_key;
+  ASSERT_TRUE(base::ReadFileToString(base::FilePath(kCaX25519PrivateKey),
+                                     &test_key));
+  fake_ops_.SetEcdhKeyForTesting(test_key.data(), test_key.length());
+  std::string sig;
+  std::string cert;
+  ASSERT_TRUE(base::ReadFileToString(base::FilePath(kAuthSig), &sig));
+  ASSERT_TRUE(base::ReadFileToString(base::FilePath(kAuthCert), &cert));
+  fake_ops_.set_auth(ATAP_KEY_TYPE_RSA,
+                     (uint8_t*)sig.data(),
+                     sig.length(),
+                     (uint8_t*)cert.data(),
+                     cert.length());
+  std::string operation_start;
+  ASSERT_TRUE(base::ReadFileToString(
+      base::FilePath(kIssueX25519OperationStartPath), &operation_start));
+
+  uint32_t ca_request_size;
+  uint8_t* ca_request;
+  atap_set_optional_ops(AtapOpsProvider::optional_ops());
+  EXPECT_EQ(ATAP_RESULT_OK,
+            atap_get_ca_request(ops_.atap_ops(),
+                                (uint8_t*)&operation_start[0],
+                                operation_start.size(),
+                                &ca_request,
+                                &ca_request_size));
+  atap_set_optional_ops(nullptr);
+  atap_free(ca_request);
+  fake_ops_.set_auth(ATAP_KEY_TYPE_NONE, nullptr, 0, nullptr, 0);
+
+  EXPECT_EQ(
+      1u, histogram_ops_.histogram(ATAP_TRACE_PHASE_INITIALIZE_SESSION).count);
+  EXPECT_EQ(
+      1u,
+      histogram_ops_.histogram(ATAP_TRACE_PHASE_COMPUTE_AUTH_SIGNATURE).count);
+  EXPECT_EQ(
+      0u,
+      histogram_ops_.histogram(ATAP_TRACE_PHASE_READ_AVAILABLE_PUBLIC_KEYS)
+          .count);
+  EXPECT_EQ(
+      1u,
+      histogram_ops_.histogram(ATAP_TRACE_PHASE_ENCRYPT_INNER_CA_REQUEST).count);
+  EXPECT_NE(std::string::npos,
+            histogram_ops_.ToString().find("initialize_session count=1 "));
+}
+
+}  // namespace atap
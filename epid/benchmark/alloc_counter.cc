@@ -0,0 +1,70 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "benchmark/alloc_counter.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+namespace {
+
+std::atomic<uint64_t> alloc_count{0};
+std::atomic<uint64_t> bytes_copied{0};
+
+}  // namespace
+
+extern "C" {
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void* __real_memcpy(void* dest, const void* src, size_t n);
+
+void* __wrap_malloc(size_t size) {
+  alloc_count.fetch_add(1, std::memory_order_relaxed);
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size) {
+  alloc_count.fetch_add(1, std::memory_order_relaxed);
+  return __real_calloc(nmemb, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+  alloc_count.fetch_add(1, std::memory_order_relaxed);
+  return __real_realloc(ptr, size);
+}
+
+void* __wrap_memcpy(void* dest, const void* src, size_t n) {
+  bytes_copied.fetch_add(n, std::memory_order_relaxed);
+  return __real_memcpy(dest, src, n);
+}
+
+}  // extern "C"
+
+void StartCounting() {
+  alloc_count = 0;
+  bytes_copied = 0;
+}
+
+void ReportCounters(benchmark::State& state) {
+  state.counters["allocs/op"] =
+      benchmark::Counter(alloc_count, benchmark::Counter::kAvgIterations);
+  state.counters["bytes_copied/op"] =
+      benchmark::Counter(bytes_copied, benchmark::Counter::kAvgIterations);
+}
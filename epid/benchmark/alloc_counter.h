@@ -0,0 +1,34 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Counts heap allocations and memcpy() bytes of the benchmark binary. The
+// code under test is linked with -Wl,--wrap for malloc, calloc, realloc and
+// memcpy, see Android.bp, so calls from libepid and the EPID SDK static
+// libraries are counted. Copies the compiler inlines are not.
+
+#ifndef EPID_BENCHMARK_ALLOC_COUNTER_H_
+#define EPID_BENCHMARK_ALLOC_COUNTER_H_
+
+#include <benchmark/benchmark.h>
+
+// Resets the counters. Call right before the timed loop.
+void StartCounting();
+
+// Reports the allocations and copies since StartCounting() as allocs/op and
+// bytes_copied/op of |state|.
+void ReportCounters(benchmark::State& state);
+
+#endif  // EPID_BENCHMARK_ALLOC_COUNTER_H_
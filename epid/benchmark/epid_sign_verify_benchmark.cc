@@ -0,0 +1,288 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Sign and verify cost, one-shot and with reusable handles, with and
+// without precomp blobs.
+
+#include "benchmark/alloc_counter.h"
+#include "interface/signmsg.h"
+#include "interface/verifysig.h"
+
+#include <string>
+#include <vector>
+
+#include <base/files/file_util.h>
+#include <benchmark/benchmark.h>
+
+namespace {
+
+constexpr char kEpidGroup1Pubkey[] = "testdata/group1pubkey.bin";
+constexpr char kEpidGroup1Privkey1[] = "testdata/group1privkey1.bin";
+
+constexpr size_t kEpidSigLen = 360;
+constexpr size_t kEpidSignPrecompLen = 1536;
+constexpr size_t kEpidVerifyPrecompLen = 1552;
+
+// Keys, precomp blobs and a signature of kMsg, shared by the benchmarks.
+struct TestData {
+  std::string privkey;
+  std::string pubkey;
+  std::string sign_precomp;
+  std::string verify_precomp;
+  std::string sig;
+};
+
+const char kMsg[] = "test message";
+
+const TestData* GetTestData() {
+  static TestData* data = [] {
+    auto* data = new TestData;
+    data->sign_precomp.resize(kEpidSignPrecompLen);
+    data->verify_precomp.resize(kEpidVerifyPrecompLen);
+    data->sig.resize(kEpidSigLen);
+    size_t sig_len = data->sig.size();
+    if (!base::ReadFileToString(base::FilePath(kEpidGroup1Privkey1),
+                                &data->privkey) ||
+        !base::ReadFileToString(base::FilePath(kEpidGroup1Pubkey),
+                                &data->pubkey) ||
+        kEpidNoErr != EpidApiSignPrecomp(data->privkey.data(),
+                                         data->privkey.size(),
+                                         &data->sign_precomp[0],
+                                         data->sign_precomp.size()) ||
+        kEpidNoErr != EpidApiVerifyPrecomp(data->pubkey.data(),
+                                           data->pubkey.size(),
+                                           &data->verify_precomp[0],
+                                           data->verify_precomp.size()) ||
+        kEpidNoErr != EpidApiSignAtap(kMsg, sizeof(kMsg) - 1, nullptr, 0,
+                                      data->privkey.data(),
+                                      data->privkey.size(), nullptr, 0,
+                                      nullptr, 0, kSha256, &data->sig[0],
+                                      &sig_len)) {
+      delete data;
+      data = nullptr;
+    }
+    return data;
+  }();
+  return data;
+}
+
+// range(0) selects whether the precomp blob is passed.
+const std::string* Precomp(benchmark::State& state, const std::string& blob) {
+  return state.range(0) ? &blob : nullptr;
+}
+
+void BM_SignAtap(benchmark::State& state) {
+  const TestData* data = GetTestData();
+  if (!data) {
+    state.SkipWithError("missing test data");
+    return;
+  }
+  const std::string* precomp = Precomp(state, data->sign_precomp);
+  std::string sig(kEpidSigLen, 0);
+  StartCounting();
+  for (auto _ : state) {
+    size_t sig_len = sig.size();
+    if (kEpidNoErr !=
+        EpidApiSignAtap(kMsg, sizeof(kMsg) - 1, nullptr, 0,
+                        data->privkey.data(), data->privkey.size(), nullptr,
+                        0, precomp ? precomp->data() : nullptr,
+                        precomp ? precomp->size() : 0, kSha256, &sig[0],
+                        &sig_len)) {
+      state.SkipWithError("signature failed");
+      break;
+    }
+  }
+  ReportCounters(state);
+}
+BENCHMARK(BM_SignAtap)
+    ->ArgName("precomp")
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMillisecond);
+
+void BM_MemberOpen(benchmark::State& state) {
+  const TestData* data = GetTestData();
+  if (!data) {
+    state.SkipWithError("missing test data");
+    return;
+  }
+  const std::string* precomp = Precomp(state, data->sign_precomp);
+  StartCounting();
+  for (auto _ : state) {
+    EpidApiMember* member = nullptr;
+    if (kEpidNoErr != EpidApiMemberOpen(data->privkey.data(),
+                                        data->privkey.size(),
+                                        precomp ? precomp->data() : nullptr,
+                                        precomp ? precomp->size() : 0,
+                                        kSha256, &member)) {
+      state.SkipWithError("member creation failed");
+      break;
+    }
+    EpidApiMemberClose(member);
+  }
+  ReportCounters(state);
+}
+BENCHMARK(BM_MemberOpen)
+    ->ArgName("precomp")
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMillisecond);
+
+void BM_SignWithHandle(benchmark::State& state) {
+  const TestData* data = GetTestData();
+  EpidApiMember* member = nullptr;
+  if (!data ||
+      kEpidNoErr != EpidApiMemberOpen(data->privkey.data(),
+                                      data->privkey.size(),
+                                      data->sign_precomp.data(),
+                                      data->sign_precomp.size(), kSha256,
+                                      &member)) {
+    state.SkipWithError("member creation failed");
+    return;
+  }
+  std::string sig(EpidApiMemberGetSigSize(member), 0);
+  StartCounting();
+  for (auto _ : state) {
+    size_t sig_len = sig.size();
+    if (kEpidNoErr != EpidApiSignWithHandle(member, kMsg, sizeof(kMsg) - 1,
+                                            nullptr, 0, &sig[0], &sig_len)) {
+      state.SkipWithError("signature failed");
+      break;
+    }
+  }
+  ReportCounters(state);
+  EpidApiMemberClose(member);
+}
+BENCHMARK(BM_SignWithHandle)->Unit(benchmark::kMillisecond);
+
+void BM_Verify(benchmark::State& state) {
+  const TestData* data = GetTestData();
+  if (!data) {
+    state.SkipWithError("missing test data");
+    return;
+  }
+  const std::string* precomp = Precomp(state, data->verify_precomp);
+  StartCounting();
+  for (auto _ : state) {
+    if (kEpidNoErr !=
+        EpidApiVerify(data->sig.data(), data->sig.size(), kMsg,
+                      sizeof(kMsg) - 1, nullptr, 0, nullptr, 0, nullptr, 0,
+                      nullptr, 0, nullptr, 0, data->pubkey.data(),
+                      data->pubkey.size(), precomp ? precomp->data() : nullptr,
+                      precomp ? precomp->size() : 0, kSha256)) {
+      state.SkipWithError("verification failed");
+      break;
+    }
+  }
+  ReportCounters(state);
+}
+BENCHMARK(BM_Verify)
+    ->ArgName("precomp")
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMillisecond);
+
+void BM_VerifierOpen(benchmark::State& state) {
+  const TestData* data = GetTestData();
+  if (!data) {
+    state.SkipWithError("missing test data");
+    return;
+  }
+  const std::string* precomp = Precomp(state, data->verify_precomp);
+  StartCounting();
+  for (auto _ : state) {
+    EpidApiVerifier* verifier = nullptr;
+    if (kEpidNoErr != EpidApiVerifierOpen(data->pubkey.data(),
+                                          data->pubkey.size(),
+                                          precomp ? precomp->data() : nullptr,
+                                          precomp ? precomp->size() : 0,
+                                          kSha256, &verifier)) {
+      state.SkipWithError("verifier creation failed");
+      break;
+    }
+    EpidApiVerifierClose(verifier);
+  }
+  ReportCounters(state);
+}
+BENCHMARK(BM_VerifierOpen)
+    ->ArgName("precomp")
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMillisecond);
+
+void BM_VerifyWithHandle(benchmark::State& state) {
+  const TestData* data = GetTestData();
+  EpidApiVerifier* verifier = nullptr;
+  if (!data ||
+      kEpidNoErr != EpidApiVerifierOpen(data->pubkey.data(),
+                                        data->pubkey.size(),
+                                        data->verify_precomp.data(),
+                                        data->verify_precomp.size(), kSha256,
+                                        &verifier)) {
+    state.SkipWithError("verifier creation failed");
+    return;
+  }
+  StartCounting();
+  for (auto _ : state) {
+    if (kEpidNoErr != EpidApiVerifyWithHandle(verifier, data->sig.data(),
+                                              data->sig.size(), kMsg,
+                                              sizeof(kMsg) - 1, nullptr, 0)) {
+      state.SkipWithError("verification failed");
+      break;
+    }
+  }
+  ReportCounters(state);
+  EpidApiVerifierClose(verifier);
+}
+BENCHMARK(BM_VerifyWithHandle)->Unit(benchmark::kMillisecond);
+
+// Time per signature of EpidApiVerifyBatch() on range(0) threads.
+void BM_VerifyBatch(benchmark::State& state) {
+  constexpr size_t kBatch = 64;
+  const TestData* data = GetTestData();
+  EpidApiVerifierCache* cache = nullptr;
+  if (!data || kEpidNoErr != EpidApiVerifierCacheCreate(8, &cache)) {
+    state.SkipWithError("missing test data");
+    return;
+  }
+  std::vector<EpidApiSignedMsg> msgs(
+      kBatch, EpidApiSignedMsg{data->sig.data(), data->sig.size(), kMsg,
+                               sizeof(kMsg) - 1});
+  std::vector<EpidStatus> results(kBatch);
+  StartCounting();
+  for (auto _ : state) {
+    if (kEpidNoErr !=
+        EpidApiVerifyBatch(cache, data->pubkey.data(), data->pubkey.size(),
+                           data->verify_precomp.data(),
+                           data->verify_precomp.size(), kSha256, nullptr, 0,
+                           msgs.data(), msgs.size(), state.range(0),
+                           results.data())) {
+      state.SkipWithError("batch verification failed");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kBatch);
+  ReportCounters(state);
+  EpidApiVerifierCacheDelete(cache);
+}
+BENCHMARK(BM_VerifyBatch)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(4)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace
@@ -0,0 +1,121 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Signing cost against signature revocation list size.
+
+#include "benchmark/alloc_counter.h"
+#include "interface/signmsg.h"
+#include "test/rl_file.h"
+
+#include <string>
+#include <vector>
+
+#include <base/files/file_util.h>
+#include <benchmark/benchmark.h>
+
+namespace {
+
+constexpr char kEpidGroup1Pubkey[] = "testdata/group1pubkey.bin";
+constexpr char kEpidGroup1Privkey1[] = "testdata/group1privkey1.bin";
+constexpr char kEpidGroup1Privkey2[] = "testdata/group1privkey2.bin";
+
+// Distinct revoked signatures; bigger lists repeat them.
+constexpr size_t kDistinctEntries = 64;
+
+// SigRl entries made by a second member of the group, so the signer is
+// never revoked.
+const std::vector<std::string>& RevokedSigs() {
+  static std::vector<std::string>* sigs = [] {
+    auto* sigs = new std::vector<std::string>;
+    std::string privkey;
+    EpidApiMember* member = nullptr;
+    if (!base::ReadFileToString(base::FilePath(kEpidGroup1Privkey2),
+                                &privkey) ||
+        kEpidNoErr != EpidApiMemberOpen(privkey.data(), privkey.size(),
+                                        nullptr, 0, kSha256, &member)) {
+      return sigs;
+    }
+    for (size_t i = 0; i < kDistinctEntries; ++i) {
+      std::string msg("revoked message" + std::to_string(i));
+      std::string sig(EpidApiMemberGetSigSize(member), 0);
+      size_t sig_len = sig.size();
+      if (kEpidNoErr == EpidApiSignWithHandle(member, msg.data(), msg.size(),
+                                              nullptr, 0, &sig[0], &sig_len)) {
+        sigs->push_back(sig);
+      }
+    }
+    EpidApiMemberClose(member);
+    return sigs;
+  }();
+  return *sigs;
+}
+
+void BM_SignWithSigRl(benchmark::State& state) {
+  std::string pubkey, privkey;
+  if (!base::ReadFileToString(base::FilePath(kEpidGroup1Pubkey), &pubkey) ||
+      !base::ReadFileToString(base::FilePath(kEpidGroup1Privkey1),
+                              &privkey) ||
+      RevokedSigs().size() != kDistinctEntries) {
+    state.SkipWithError("missing test data");
+    return;
+  }
+  std::vector<std::string> revoked;
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    revoked.push_back(RevokedSigs()[i % kDistinctEntries]);
+  }
+
+  EpidApiMember* member = nullptr;
+  if (kEpidNoErr != EpidApiMemberOpen(privkey.data(), privkey.size(), nullptr,
+                                      0, kSha256, &member)) {
+    state.SkipWithError("member creation failed");
+    return;
+  }
+  if (!revoked.empty()) {
+    std::string sig_rl = BuildSigRlFile(pubkey, revoked, 1);
+    if (kEpidNoErr !=
+        EpidApiMemberSetSigRl(member, sig_rl.data(), sig_rl.size())) {
+      EpidApiMemberClose(member);
+      state.SkipWithError("setting SigRl failed");
+      return;
+    }
+  }
+
+  std::string msg("test message");
+  std::string sig(EpidApiMemberGetSigSize(member), 0);
+  StartCounting();
+  for (auto _ : state) {
+    size_t sig_len = sig.size();
+    if (kEpidNoErr != EpidApiSignWithHandle(member, msg.data(), msg.size(),
+                                            nullptr, 0, &sig[0], &sig_len)) {
+      state.SkipWithError("signature failed");
+      break;
+    }
+  }
+  ReportCounters(state);
+  state.counters["sig_bytes"] = sig.size();
+  EpidApiMemberClose(member);
+}
+BENCHMARK(BM_SignWithSigRl)
+    ->Arg(0)
+    ->Arg(10)
+    ->Arg(100)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
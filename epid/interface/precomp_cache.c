@@ -0,0 +1,449 @@
+/*############################################################################
+  # Copyright 2016-2017 Intel Corporation
+  #
+  # Licensed under the Apache License, Version 2.0 (the "License");
+  # you may not use this file except in compliance with the License.
+  # You may obtain a copy of the License at
+  #
+  #     http://www.apache.org/licenses/LICENSE-2.0
+  #
+  # Unless required by applicable law or agreed to in writing, software
+  # distributed under the License is distributed on an "AS IS" BASIS,
+  # WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  # See the License for the specific language governing permissions and
+  # limitations under the License.
+  ############################################################################
+
+  Original location: https://github.com/Intel-EPID-SDK/epid-sdk
+  Modified EPID SDK interface for Android things
+
+*/
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "epid/common/math/hash.h"
+#include "epid/common/src/memory.h"
+#include "interface/precomp_cache.h"
+#include "interface/signmsg.h"
+
+#define EPID_PRECOMP_VERSION 2
+#define EPID_PRECOMP_SIZE_MAX 1552
+#define EPID_PRECOMP_SALT_SIZE 32
+
+static uint8_t const kPrecompFileMagic[4] = {'E', 'P', 'P', 'F'};
+static uint8_t const kPrecompMagic[4] = {'E', 'P', 'P', 'C'};
+
+typedef struct PrecompHeader {
+  uint8_t magic[4];
+  uint8_t version;
+  uint8_t reserved[3];
+  uint8_t salt[EPID_PRECOMP_SALT_SIZE];
+} PrecompHeader;
+
+typedef struct PrecompRecord {
+  uint8_t magic[4];
+  uint8_t version;
+  uint8_t kind;
+  uint8_t size[2];
+  uint8_t key_hash[sizeof(Sha256Digest)];
+  uint8_t precomp[EPID_PRECOMP_SIZE_MAX];
+  uint8_t checksum[sizeof(Sha256Digest)];
+} PrecompRecord;
+
+struct EpidApiPrecompCache {
+  // guards the records below
+  pthread_mutex_t lock;
+  // serializes appends within the process, flock those of other processes
+  pthread_mutex_t append_lock;
+  // threads using the cache as the default, guarded by default_lock
+  size_t users;
+  int fd;
+  // hashed in front of every key, so the file does not identify the keys
+  uint8_t salt[EPID_PRECOMP_SALT_SIZE];
+  void* map;
+  size_t map_size;
+  // valid records of the mapped file
+  PrecompRecord const** index;
+  size_t index_count;
+  // records stored since the file was mapped
+  PrecompRecord* appended;
+  size_t appended_count;
+};
+
+// guards default_cache and the users of every cache
+static pthread_mutex_t default_lock = PTHREAD_MUTEX_INITIALIZER;
+// signaled when a cache has no users left
+static pthread_cond_t default_idle = PTHREAD_COND_INITIALIZER;
+static EpidApiPrecompCache* default_cache = NULL;
+
+static bool RecordIsValid(PrecompRecord const* record) {
+  Sha256Digest checksum;
+  size_t size = ((size_t)record->size[0] << 8) | record->size[1];
+  if (memcmp(record->magic, kPrecompMagic, sizeof(kPrecompMagic)) ||
+      EPID_PRECOMP_VERSION != record->version ||
+      size > EPID_PRECOMP_SIZE_MAX) {
+    return false;
+  }
+  if (kEpidNoErr != Sha256MessageDigest(record,
+                                        offsetof(PrecompRecord, checksum),
+                                        &checksum)) {
+    return false;
+  }
+  return 0 == memcmp(&checksum, record->checksum, sizeof(record->checksum));
+}
+
+static bool RecordMatches(PrecompRecord const* record, EpidApiPrecompKind kind,
+                          Sha256Digest const* key_hash, size_t size) {
+  return record->kind == (uint8_t)kind &&
+         (((size_t)record->size[0] << 8) | record->size[1]) == size &&
+         0 == memcmp(record->key_hash, key_hash, sizeof(record->key_hash));
+}
+
+static EpidStatus WriteAll(int fd, void const* buf, size_t len) {
+  uint8_t const* p = (uint8_t const*)buf;
+
+  while (len) {
+    ssize_t ret = write(fd, p, len);
+    if (ret < 0 && EINTR == errno) continue;
+    if (ret <= 0) return kEpidErr;
+    p += ret;
+    len -= (size_t)ret;
+  }
+  return kEpidNoErr;
+}
+
+// Read the file header to salt, writing a header with a new salt if the
+// file is empty, from another version or torn; its records are dropped
+// then, since they cannot be matched without their salt.
+static EpidStatus ReadHeader(int fd, uint8_t* salt) {
+  EpidStatus sts = kEpidErr;
+  PrecompHeader header;
+  struct stat st;
+
+  if (flock(fd, LOCK_EX)) {
+    return kEpidErr;
+  }
+  do {
+    if (fstat(fd, &st)) {
+      break;
+    }
+    if ((size_t)st.st_size >= sizeof(header) &&
+        sizeof(header) == pread(fd, &header, sizeof(header), 0) &&
+        0 == memcmp(header.magic, kPrecompFileMagic,
+                    sizeof(kPrecompFileMagic)) &&
+        EPID_PRECOMP_VERSION == header.version) {
+      memcpy(salt, header.salt, sizeof(header.salt));
+      sts = kEpidNoErr;
+      break;
+    }
+    if (ftruncate(fd, 0)) {
+      break;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kPrecompFileMagic, sizeof(kPrecompFileMagic));
+    header.version = EPID_PRECOMP_VERSION;
+    if (SysPrngGen((unsigned int*)header.salt, 8 * sizeof(header.salt),
+                   NULL)) {
+      break;
+    }
+    sts = WriteAll(fd, &header, sizeof(header));
+    if (kEpidNoErr == sts) {
+      memcpy(salt, header.salt, sizeof(header.salt));
+    }
+  } while (0);  // do
+  flock(fd, LOCK_UN);
+  return sts;
+}
+
+EpidStatus EpidApiPrecompCacheOpen(char const* path,
+                                   EpidApiPrecompCache** cache) {
+  EpidApiPrecompCache* new_cache = NULL;
+  struct stat st;
+  size_t count = 0;
+  size_t i = 0;
+
+  if (!path || !cache) {
+    return kEpidBadArgErr;
+  }
+  *cache = NULL;
+  new_cache = (EpidApiPrecompCache*)calloc(1, sizeof(EpidApiPrecompCache));
+  if (!new_cache) {
+    return kEpidMemAllocErr;
+  }
+  if (pthread_mutex_init(&new_cache->lock, NULL)) {
+    free(new_cache);
+    return kEpidErr;
+  }
+  if (pthread_mutex_init(&new_cache->append_lock, NULL)) {
+    pthread_mutex_destroy(&new_cache->lock);
+    free(new_cache);
+    return kEpidErr;
+  }
+  new_cache->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (new_cache->fd < 0 ||
+      kEpidNoErr != ReadHeader(new_cache->fd, new_cache->salt) ||
+      fstat(new_cache->fd, &st) || (size_t)st.st_size < sizeof(PrecompHeader)) {
+    EpidApiPrecompCacheClose(new_cache);
+    return kEpidErr;
+  }
+
+  count = ((size_t)st.st_size - sizeof(PrecompHeader)) / sizeof(PrecompRecord);
+  if (count) {
+    new_cache->map_size =
+        sizeof(PrecompHeader) + count * sizeof(PrecompRecord);
+    new_cache->map = mmap(NULL, new_cache->map_size, PROT_READ, MAP_SHARED,
+                          new_cache->fd, 0);
+    if (MAP_FAILED == new_cache->map) {
+      new_cache->map = NULL;
+      EpidApiPrecompCacheClose(new_cache);
+      return kEpidErr;
+    }
+    new_cache->index =
+        (PrecompRecord const**)calloc(count, sizeof(PrecompRecord const*));
+    if (!new_cache->index) {
+      EpidApiPrecompCacheClose(new_cache);
+      return kEpidMemAllocErr;
+    }
+    for (i = 0; i < count; ++i) {
+      PrecompRecord const* record =
+          (PrecompRecord const*)((uint8_t const*)new_cache->map +
+                                 sizeof(PrecompHeader)) +
+          i;
+      if (RecordIsValid(record)) {
+        new_cache->index[new_cache->index_count++] = record;
+      }
+    }
+  }
+  *cache = new_cache;
+  return kEpidNoErr;
+}
+
+void EpidApiPrecompCacheClose(EpidApiPrecompCache* cache) {
+  if (!cache) {
+    return;
+  }
+  if (cache->map) {
+    munmap(cache->map, cache->map_size);
+  }
+  if (cache->fd >= 0) {
+    close(cache->fd);
+  }
+  pthread_mutex_destroy(&cache->append_lock);
+  pthread_mutex_destroy(&cache->lock);
+  free(cache->index);
+  free(cache->appended);
+  EpidZeroMemory(cache->salt, sizeof(cache->salt));
+  free(cache);
+}
+
+void EpidApiPrecompCacheSetDefault(EpidApiPrecompCache* cache) {
+  EpidApiPrecompCache* old_cache = NULL;
+
+  pthread_mutex_lock(&default_lock);
+  old_cache = default_cache;
+  default_cache = cache;
+  // the old cache may be closed once this returns
+  while (old_cache && old_cache != cache && old_cache->users) {
+    pthread_cond_wait(&default_idle, &default_lock);
+  }
+  pthread_mutex_unlock(&default_lock);
+}
+
+// Take a reference to the default cache, so it can be used without holding
+// default_lock. Returns NULL if there is no default cache.
+static EpidApiPrecompCache* AcquireDefault(void) {
+  EpidApiPrecompCache* cache = NULL;
+
+  pthread_mutex_lock(&default_lock);
+  cache = default_cache;
+  if (cache) {
+    ++cache->users;
+  }
+  pthread_mutex_unlock(&default_lock);
+  return cache;
+}
+
+static void ReleaseDefault(EpidApiPrecompCache* cache) {
+  pthread_mutex_lock(&default_lock);
+  if (0 == --cache->users) {
+    pthread_cond_broadcast(&default_idle);
+  }
+  pthread_mutex_unlock(&default_lock);
+}
+
+static bool CacheGet(EpidApiPrecompCache* cache, EpidApiPrecompKind kind,
+                     Sha256Digest const* key_hash, void* buf_precomp,
+                     size_t precomp_size) {
+  PrecompRecord const* found = NULL;
+  size_t i = 0;
+
+  pthread_mutex_lock(&cache->lock);
+  // newest first
+  for (i = cache->appended_count; i > 0 && !found; --i) {
+    if (RecordMatches(&cache->appended[i - 1], kind, key_hash, precomp_size)) {
+      found = &cache->appended[i - 1];
+    }
+  }
+  for (i = cache->index_count; i > 0 && !found; --i) {
+    if (RecordMatches(cache->index[i - 1], kind, key_hash, precomp_size)) {
+      found = cache->index[i - 1];
+    }
+  }
+  if (found) {
+    memcpy(buf_precomp, found->precomp, precomp_size);
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return found != NULL;
+}
+
+// Append record to the file. A torn record left by a crash is cut off
+// first, so later records stay aligned.
+static EpidStatus AppendRecord(int fd, PrecompRecord const* record) {
+  EpidStatus sts = kEpidErr;
+  struct stat st;
+  size_t torn = 0;
+
+  if (flock(fd, LOCK_EX)) {
+    return kEpidErr;
+  }
+  do {
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(PrecompHeader)) {
+      break;
+    }
+    torn = ((size_t)st.st_size - sizeof(PrecompHeader)) % sizeof(PrecompRecord);
+    if (torn && ftruncate(fd, st.st_size - (off_t)torn)) {
+      break;
+    }
+    sts = WriteAll(fd, record, sizeof(*record));
+  } while (0);  // do
+  flock(fd, LOCK_UN);
+  return sts;
+}
+
+static EpidStatus CachePut(EpidApiPrecompCache* cache, EpidApiPrecompKind kind,
+                           Sha256Digest const* key_hash,
+                           void const* buf_precomp, size_t precomp_size) {
+  EpidStatus sts = kEpidErr;
+  PrecompRecord record;
+  PrecompRecord* appended = NULL;
+  Sha256Digest checksum;
+
+  memset(&record, 0, sizeof(record));
+  memcpy(record.magic, kPrecompMagic, sizeof(kPrecompMagic));
+  record.version = EPID_PRECOMP_VERSION;
+  record.kind = (uint8_t)kind;
+  record.size[0] = (uint8_t)(precomp_size >> 8);
+  record.size[1] = (uint8_t)precomp_size;
+  memcpy(record.key_hash, key_hash, sizeof(record.key_hash));
+  memcpy(record.precomp, buf_precomp, precomp_size);
+  sts = Sha256MessageDigest(&record, offsetof(PrecompRecord, checksum),
+                            &checksum);
+  if (kEpidNoErr != sts) {
+    return sts;
+  }
+  memcpy(record.checksum, &checksum, sizeof(record.checksum));
+
+  // lookups only wait for the copy below, not for the disk
+  pthread_mutex_lock(&cache->append_lock);
+  sts = AppendRecord(cache->fd, &record);
+  pthread_mutex_unlock(&cache->append_lock);
+  if (kEpidNoErr != sts) {
+    return sts;
+  }
+  pthread_mutex_lock(&cache->lock);
+  appended = (PrecompRecord*)realloc(
+      cache->appended, (cache->appended_count + 1) * sizeof(PrecompRecord));
+  if (appended) {
+    cache->appended = appended;
+    cache->appended[cache->appended_count++] = record;
+  } else {
+    // the record is on disk and is found after the next open
+    sts = kEpidMemAllocErr;
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return sts;
+}
+
+// SHA-256 of the salt of cache followed by key
+static EpidStatus KeyHash(EpidApiPrecompCache const* cache, void const* key,
+                          size_t key_size, Sha256Digest* key_hash) {
+  EpidStatus sts = kEpidErr;
+  size_t salted_size = sizeof(cache->salt) + key_size;
+  uint8_t* salted = NULL;
+
+  if (key_size > SIZE_MAX - sizeof(cache->salt)) {
+    return kEpidBadArgErr;
+  }
+  salted = (uint8_t*)malloc(salted_size);
+  if (!salted) {
+    return kEpidMemAllocErr;
+  }
+  memcpy(salted, cache->salt, sizeof(cache->salt));
+  memcpy(salted + sizeof(cache->salt), key, key_size);
+  sts = Sha256MessageDigest(salted, salted_size, key_hash);
+  EpidZeroMemory(salted, salted_size);
+  free(salted);
+  return sts;
+}
+
+bool EpidApiPrecompCacheGet(EpidApiPrecompCache* cache,
+                            EpidApiPrecompKind kind, void const* key,
+                            size_t key_size, void* buf_precomp,
+                            size_t precomp_size) {
+  EpidApiPrecompCache* used = cache;
+  Sha256Digest key_hash;
+  bool found = false;
+
+  if (!key || !buf_precomp || precomp_size > EPID_PRECOMP_SIZE_MAX) {
+    return false;
+  }
+  if (!used) {
+    used = AcquireDefault();
+    if (!used) {
+      return false;
+    }
+  }
+  if (kEpidNoErr == KeyHash(used, key, key_size, &key_hash)) {
+    found = CacheGet(used, kind, &key_hash, buf_precomp, precomp_size);
+  }
+  if (!cache) {
+    ReleaseDefault(used);
+  }
+  return found;
+}
+
+EpidStatus EpidApiPrecompCachePut(EpidApiPrecompCache* cache,
+                                  EpidApiPrecompKind kind, void const* key,
+                                  size_t key_size, void const* buf_precomp,
+                                  size_t precomp_size) {
+  EpidApiPrecompCache* used = cache;
+  EpidStatus sts = kEpidNoErr;
+  Sha256Digest key_hash;
+
+  if (!key || !buf_precomp || precomp_size > EPID_PRECOMP_SIZE_MAX) {
+    return kEpidBadArgErr;
+  }
+  if (!used) {
+    used = AcquireDefault();
+    if (!used) {
+      return kEpidNoErr;
+    }
+  }
+  sts = KeyHash(used, key, key_size, &key_hash);
+  if (kEpidNoErr == sts) {
+    sts = CachePut(used, kind, &key_hash, buf_precomp, precomp_size);
+  }
+  if (!cache) {
+    ReleaseDefault(used);
+  }
+  return sts;
+}
@@ -0,0 +1,125 @@
+/*############################################################################
+  # Copyright 2016-2017 Intel Corporation
+  #
+  # Licensed under the Apache License, Version 2.0 (the "License");
+  # you may not use this file except in compliance with the License.
+  # You may obtain a copy of the License at
+  #
+  #     http://www.apache.org/licenses/LICENSE-2.0
+  #
+  # Unless required by applicable law or agreed to in writing, software
+  # distributed under the License is distributed on an "AS IS" BASIS,
+  # WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  # See the License for the specific language governing permissions and
+  # limitations under the License.
+  ############################################################################
+
+  Original location: https://github.com/Intel-EPID-SDK/epid-sdk
+  Modified EPID SDK interface for Android things
+
+*/
+
+#ifndef EPID_INTERFACE_PRECOMP_CACHE_H_
+#define EPID_INTERFACE_PRECOMP_CACHE_H_
+
+#include <stddef.h>
+#include "epid/common/errors.h"
+#include "epid/common/stdtypes.h"
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/* On-disk cache of member and verifier precomp blobs, keyed by a salted
+ * SHA-256 hash of the key they were computed for. The file starts with a
+ * version 2 header:
+ *
+ *      magic:        4  "EPPF"
+ *      version:      1  2
+ *      reserved:     3  zero
+ *      salt:         32 random, chosen when the file is created
+ *
+ * followed by a sequence of fixed-size records:
+ *
+ *      magic:        4  "EPPC"
+ *      version:      1  2
+ *      kind:         1  EpidApiPrecompKind
+ *      size:         2  precomp size, big endian
+ *      key hash:     32 SHA-256 of the salt followed by the key
+ *      precomp:      1552, zero padded
+ *      checksum:     32 SHA-256 of all of the above
+ *
+ * The salt keeps the file from holding a fingerprint of the key that
+ * matches across devices. A file with a missing or unknown header is
+ * emptied and given a new salt when opened. The file is memory-mapped when
+ * opened. Records with a bad checksum or an unknown version are skipped;
+ * for a key stored twice the last record wins. New records are appended, so several processes may share a file.
+ * A precomp blob is trusted like the key itself, so the file must only be
+ * writable by whoever provisions the keys.
+ */
+typedef struct EpidApiPrecompCache EpidApiPrecompCache;
+
+typedef enum {
+  kEpidApiMemberPrecomp = 1,    // MemberPrecomp, 1536 bytes
+  kEpidApiVerifierPrecomp = 2,  // VerifierPrecomp, 1552 bytes
+} EpidApiPrecompKind;
+
+/* Open or create the cache file at path.
+ *
+ * output:
+ * cache: new cache, release with EpidApiPrecompCacheClose
+ *
+ * return:
+ * EpidStatus: 0->success, others->error
+ */
+EpidStatus EpidApiPrecompCacheOpen(char const* path,
+                                   EpidApiPrecompCache** cache);
+
+/* Unmap and close cache. cache may be NULL. It must not be the default
+ * cache any more.
+ */
+void EpidApiPrecompCacheClose(EpidApiPrecompCache* cache);
+
+/* Make EpidApiSign, EpidApiVerify, the precomp functions and the member and
+ * verifier handles look up precomp blobs in cache whenever the caller
+ * passes none, and store the ones they compute. NULL turns this off.
+ * Returns once no thread uses the previous default cache any more, so it
+ * may then be closed.
+ */
+void EpidApiPrecompCacheSetDefault(EpidApiPrecompCache* cache);
+
+/* Copy the precomp of kind stored for key to buf_precomp.
+ *
+ * input:
+ * cache: cache to look in, NULL for the default cache
+ * key, key_size: key the precomp belongs to
+ * precomp_size: size of buf_precomp, must match kind
+ *
+ * return:
+ * true if found
+ */
+bool EpidApiPrecompCacheGet(EpidApiPrecompCache* cache,
+                            EpidApiPrecompKind kind,
+                            void const* key,
+                            size_t key_size,
+                            void* buf_precomp,
+                            size_t precomp_size);
+
+/* Store the precomp of kind for key. Does nothing if cache is NULL and
+ * there is no default cache.
+ *
+ * return:
+ * EpidStatus: 0->stored, others->error
+ */
+EpidStatus EpidApiPrecompCachePut(EpidApiPrecompCache* cache,
+                                  EpidApiPrecompKind kind,
+                                  void const* key,
+                                  size_t key_size,
+                                  void const* buf_precomp,
+                                  size_t precomp_size);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif  // EPID_INTERFACE_PRECOMP_CACHE_H_
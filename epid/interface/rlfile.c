@@ -0,0 +1,87 @@
+/*############################################################################
+  # Copyright 2016-2017 Intel Corporation
+  #
+  # Licensed under the Apache License, Version 2.0 (the "License");
+  # you may not use this file except in compliance with the License.
+  # You may obtain a copy of the License at
+  #
+  #     http://www.apache.org/licenses/LICENSE-2.0
+  #
+  # Unless required by applicable law or agreed to in writing, software
+  # distributed under the License is distributed on an "AS IS" BASIS,
+  # WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  # See the License for the specific language governing permissions and
+  # limitations under the License.
+  ############################################################################
+
+  Original location: https://github.com/Intel-EPID-SDK/epid-sdk
+  Modified EPID SDK interface for Android things
+
+*/
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "epid/common/file_parser.h"
+#include "interface/rlfile.h"
+
+static uint32_t ReadOctStr32(OctStr32 const* str) {
+  return ((uint32_t)str->data[0] << 24) | ((uint32_t)str->data[1] << 16) |
+         ((uint32_t)str->data[2] << 8) | (uint32_t)str->data[3];
+}
+
+// empty_rl_size is the size of the RL without entries, count_offset the
+// offset of its OctStr32 entry count.
+static EpidStatus CopyRl(void const* buf_rl, size_t buf_rl_size,
+                         size_t empty_rl_size, size_t count_offset,
+                         size_t entry_size, void** rl, size_t* rl_size) {
+  size_t const min_rl_file_size =
+      sizeof(EpidFileHeader) + empty_rl_size + sizeof(EcdsaSignature);
+  uint8_t const* file_rl = NULL;
+  size_t size = 0;
+  uint32_t count = 0;
+
+  if (!buf_rl || buf_rl_size < min_rl_file_size || !rl || !rl_size) {
+    return kEpidBadArgErr;
+  }
+  size = buf_rl_size - sizeof(EpidFileHeader) - sizeof(EcdsaSignature);
+  file_rl = (uint8_t const*)buf_rl + sizeof(EpidFileHeader);
+  count = ReadOctStr32((OctStr32 const*)(file_rl + count_offset));
+  if (count > (size - empty_rl_size) / entry_size ||
+      size != empty_rl_size + count * entry_size) {
+    return kEpidBadArgErr;
+  }
+
+  *rl = malloc(size);
+  if (!*rl) {
+    return kEpidMemAllocErr;
+  }
+  memcpy(*rl, file_rl, size);
+  *rl_size = size;
+  return kEpidNoErr;
+}
+
+EpidStatus EpidApiCopyPrivRl(void const* buf_rl, size_t buf_rl_size,
+                             PrivRl** rl, size_t* rl_size) {
+  return CopyRl(buf_rl, buf_rl_size,
+                sizeof(PrivRl) - sizeof(((PrivRl*)0)->f[0]),
+                offsetof(PrivRl, n1), sizeof(((PrivRl*)0)->f[0]),
+                (void**)rl, rl_size);
+}
+
+EpidStatus EpidApiCopySigRl(void const* buf_rl, size_t buf_rl_size,
+                            SigRl** rl, size_t* rl_size) {
+  return CopyRl(buf_rl, buf_rl_size,
+                sizeof(SigRl) - sizeof(((SigRl*)0)->bk[0]),
+                offsetof(SigRl, n2), sizeof(((SigRl*)0)->bk[0]),
+                (void**)rl, rl_size);
+}
+
+EpidStatus EpidApiCopyGroupRl(void const* buf_rl, size_t buf_rl_size,
+                              GroupRl** rl, size_t* rl_size) {
+  return CopyRl(buf_rl, buf_rl_size,
+                sizeof(GroupRl) - sizeof(((GroupRl*)0)->gid[0]),
+                offsetof(GroupRl, n3), sizeof(((GroupRl*)0)->gid[0]),
+                (void**)rl, rl_size);
+}
@@ -0,0 +1,52 @@
+/*############################################################################
+  # Copyright 2016-2017 Intel Corporation
+  #
+  # Licensed under the Apache License, Version 2.0 (the "License");
+  # you may not use this file except in compliance with the License.
+  # You may obtain a copy of the License at
+  #
+  #     http://www.apache.org/licenses/LICENSE-2.0
+  #
+  # Unless required by applicable law or agreed to in writing, software
+  # distributed under the License is distributed on an "AS IS" BASIS,
+  # WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  # See the License for the specific language governing permissions and
+  # limitations under the License.
+  ############################################################################
+
+  Original location: https://github.com/Intel-EPID-SDK/epid-sdk
+  Modified EPID SDK interface for Android things
+
+*/
+
+#ifndef EPID_INTERFACE_RLFILE_H_
+#define EPID_INTERFACE_RLFILE_H_
+
+#include <stddef.h>
+#include "epid/common/errors.h"
+#include "epid/common/types.h"
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/* Copy the revocation list out of a signed RL file: EpidFileHeader, RL and
+ * EcdsaSignature. The entry count must match the file size. The file
+ * signature is not checked, the interface has no CA certificate.
+ *
+ * output:
+ * rl: RL in a new buffer, release with free()
+ * rl_size: size of *rl
+ */
+EpidStatus EpidApiCopyPrivRl(void const* buf_rl, size_t buf_rl_size,
+                             PrivRl** rl, size_t* rl_size);
+EpidStatus EpidApiCopySigRl(void const* buf_rl, size_t buf_rl_size,
+                            SigRl** rl, size_t* rl_size);
+EpidStatus EpidApiCopyGroupRl(void const* buf_rl, size_t buf_rl_size,
+                              GroupRl** rl, size_t* rl_size);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif  // EPID_INTERFACE_RLFILE_H_
@@ -19,31 +19,104 @@
 
 */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/random.h>
+#include <unistd.h>
 #include "epid/common/src/memory.h"
 #include "epid/common/stdtypes.h"
 #include "epid/member/api.h"
 #include "epid/member/src/context.h"
 #include "epid/member/src/write_precomp.h"
+#include "interface/precomp_cache.h"
+#include "interface/rlfile.h"
 #include "util/convutil.h"
 
-// read random numbers from /dev/urandom
+// Bytes of randomness each thread fetches from the kernel at once. A
+// signature draws a few dozen small numbers.
+#define EPID_RNG_POOL_SIZE 256
+
+typedef struct RngPool {
+  unsigned char buf[EPID_RNG_POOL_SIZE];
+  // unused bytes at the start of buf
+  size_t avail;
+} RngPool;
+
+static _Thread_local RngPool rng_pool;
+static pthread_once_t rng_once = PTHREAD_ONCE_INIT;
+
+// A forked child must not hand out the bytes its parent still holds. Only
+// the forking thread exists in the child, so clearing its pool is enough.
+static void RngPoolForkChild(void) {
+  EpidZeroMemory(&rng_pool, sizeof(rng_pool));
+}
+
+static void RngPoolInit(void) {
+  pthread_atfork(NULL, NULL, RngPoolForkChild);
+}
+
+// read from /dev/urandom, for kernels without getrandom()
+static int ReadUrandom(unsigned char* buf, size_t len) {
+  int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return 1;
+  while (len) {
+    ssize_t ret = read(fd, buf, len);
+    if (ret < 0 && EINTR == errno) continue;
+    if (ret <= 0) break;
+    buf += ret;
+    len -= (size_t)ret;
+  }
+  close(fd);
+  return len ? 1 : 0;
+}
+
+// Fill all len bytes of buf from the kernel. Short reads are retried, never
+// reported as success.
+static int ReadKernelRandom(unsigned char* buf, size_t len) {
+  while (len) {
+    ssize_t ret = getrandom(buf, len, 0);
+    if (ret < 0) {
+      if (EINTR == errno) continue;
+      if (ENOSYS == errno) return ReadUrandom(buf, len);
+      return 1;
+    }
+    buf += ret;
+    len -= (size_t)ret;
+  }
+  return 0;
+}
+
 int SysPrngGen(unsigned int* rand_data, int num_bits, void* user_data) {
+  unsigned char* out = (unsigned char*)rand_data;
+  size_t bytes = 0;
   (void)user_data;
   if (num_bits <= 0) return 0;
   if (num_bits % 8) return 1;
-  FILE* urnd = fopen("/dev/urandom", "r");
-  if (urnd) {
-    int bytes = num_bits / 8;
-    size_t ret = fread(rand_data, 1, bytes, urnd);
-    fclose(urnd);
-    if (!ret) return 1;
-    return 0;
-  } else {
-    return 1;
+  bytes = (size_t)num_bits / 8;
+  if (bytes > EPID_RNG_POOL_SIZE) return ReadKernelRandom(out, bytes);
+
+  pthread_once(&rng_once, RngPoolInit);
+  while (bytes) {
+    size_t n = 0;
+    unsigned char* src = NULL;
+    if (!rng_pool.avail) {
+      if (ReadKernelRandom(rng_pool.buf, sizeof(rng_pool.buf))) return 1;
+      rng_pool.avail = sizeof(rng_pool.buf);
+    }
+    n = bytes < rng_pool.avail ? bytes : rng_pool.avail;
+    src = rng_pool.buf + rng_pool.avail - n;
+    memcpy(out, src, n);
+    // bytes handed out must not be found again
+    EpidZeroMemory(src, n);
+    rng_pool.avail -= n;
+    out += n;
+    bytes -= n;
   }
+  return 0;
 }
 
 typedef struct EpidKeyATAP{
@@ -59,6 +132,149 @@ typedef struct EpidKeyATAP{
 
 } EpidKeyATAP;
 
+struct EpidApiMember {
+  MemberCtx* ctx;
+  size_t ctx_size;
+  // signature RL set on ctx, the member keeps a pointer to it
+  SigRl* sig_rl;
+  size_t sig_rl_size;
+};
+
+// Split a bundled EpidKeyATAP into its public and private keys.
+static EpidStatus SplitAtapKey(void const* buf_key, size_t buf_key_size,
+                               GroupPubKey* pubkey, PrivKey* privkey) {
+  // get public key and private key from buf, no CA checks
+  if (!buf_key || buf_key_size != sizeof(EpidKeyATAP)) {
+    return kEpidBadArgErr;
+  }
+  EpidKeyATAP const* buf_key_tmp = (EpidKeyATAP const*)buf_key;
+
+  pubkey->gid = buf_key_tmp->gid;
+  pubkey->h1 = buf_key_tmp->h1;
+  pubkey->h2 = buf_key_tmp->h2;
+  pubkey->w = buf_key_tmp->w;
+
+  privkey->gid = buf_key_tmp->gid;
+  privkey->A = buf_key_tmp->A;
+  privkey->x = buf_key_tmp->x;
+  privkey->f = buf_key_tmp->f;
+  return kEpidNoErr;
+}
+
+// Key of a member in the precomp cache: its private and public key.
+typedef struct MemberCacheKey {
+  PrivKey privkey;
+  GroupPubKey pubkey;
+} MemberCacheKey;
+
+// Create a started member for pubkey/privkey. hash_alg may be NULL to keep
+// the default, rnd_func NULL to use SysPrngGen. Without precomp, the
+// default precomp cache is tried, and filled on a miss. On success the
+// caller owns *member.
+static EpidStatus CreateMember(GroupPubKey const* pubkey,
+                               PrivKey const* privkey,
+                               MemberPrecomp const* precomp,
+                               HashAlg const* hash_alg,
+                               BitSupplier rnd_func, void* rnd_param,
+                               EpidApiMember* member) {
+  EpidStatus sts = kEpidErr;
+  MemberParams params = {0};
+  MemberCtx* ctx = NULL;
+  size_t ctx_size = 0;
+  MemberCacheKey cache_key;
+  MemberPrecomp cached_precomp;
+  bool use_cache = !precomp;
+  bool cache_miss = false;
+
+  if (use_cache) {
+    cache_key.privkey = *privkey;
+    cache_key.pubkey = *pubkey;
+    if (EpidApiPrecompCacheGet(NULL, kEpidApiMemberPrecomp, &cache_key,
+                               sizeof(cache_key), &cached_precomp,
+                               sizeof(cached_precomp))) {
+      precomp = &cached_precomp;
+    } else {
+      cache_miss = true;
+    }
+  }
+
+  do {
+    // need link RNG
+    params.rnd_func = rnd_func ? rnd_func : &SysPrngGen;
+    params.rnd_param = rnd_func ? rnd_param : NULL;
+    params.f = NULL;
+
+    // create member
+    sts = EpidMemberGetSize(&params, &ctx_size);
+    if (kEpidNoErr != sts) {
+      break;
+    }
+    ctx = (MemberCtx*)calloc(1, ctx_size);
+    if (!ctx) {
+      sts = kEpidNoMemErr;
+      break;
+    }
+    sts = EpidMemberInit(&params, ctx);
+    if (kEpidNoErr != sts) {
+      break;
+    }
+
+    if (hash_alg) {
+      sts = EpidMemberSetHashAlg(ctx, *hash_alg);
+      if (kEpidNoErr != sts) {
+        break;
+      }
+    }
+
+    sts = EpidProvisionKey(ctx, pubkey, privkey, precomp);
+    if (kEpidNoErr != sts) {
+      break;
+    }
+
+    // start member
+    sts = EpidMemberStartup(ctx);
+    if (kEpidNoErr != sts) {
+      break;
+    }
+
+    // keep the precomputation for the next start, best effort
+    if (cache_miss &&
+        kEpidNoErr == EpidMemberWritePrecomp(ctx, &cached_precomp)) {
+      EpidApiPrecompCachePut(NULL, kEpidApiMemberPrecomp, &cache_key,
+                             sizeof(cache_key), &cached_precomp,
+                             sizeof(cached_precomp));
+    }
+  } while (0);  // do
+
+  if (use_cache) {
+    EpidZeroMemory(&cache_key, sizeof(cache_key));
+  }
+  if (kEpidNoErr != sts) {
+    EpidMemberDeinit(ctx);
+    if (ctx) {
+      EpidZeroMemory(ctx, ctx_size);
+      free(ctx);
+    }
+    return sts;
+  }
+  member->ctx = ctx;
+  member->ctx_size = ctx_size;
+  return kEpidNoErr;
+}
+
+static void DestroyMember(EpidApiMember* member) {
+  EpidMemberDeinit(member->ctx);
+  if (member->ctx) {
+    EpidZeroMemory(member->ctx, member->ctx_size);
+    free(member->ctx);
+  }
+  member->ctx = NULL;
+  member->ctx_size = 0;
+  free(member->sig_rl);
+  member->sig_rl = NULL;
+  member->sig_rl_size = 0;
+}
+
 EpidStatus EpidApiSign(void const* msg, size_t msg_len,
                        void const* basename, size_t basename_len,
                        void const* buf_privkey, size_t buf_privkey_size,
@@ -68,12 +284,10 @@ EpidStatus EpidApiSign(void const* msg, size_t msg_len,
                        HashAlg hash_alg,
                        EpidSignature* sig) {
   EpidStatus sts = kEpidErr;
-  MemberCtx* member = NULL;
+  EpidApiMember member = {0};
   SigRl* sig_rl = NULL;
   size_t sig_len = 360;
   do {
-    MemberParams params = {0};
-    size_t member_size = 0;
     if (!sig) {
       sts = kEpidBadArgErr;
       break;
@@ -92,57 +306,23 @@ EpidStatus EpidApiSign(void const* msg, size_t msg_len,
       precomp = (MemberPrecomp const*)buf_precomp;
     }
 
-    // need link RNG
-    params.rnd_func = &SysPrngGen;
-    params.rnd_param = NULL;
-    params.f = NULL;
-
-    // create member
-    sts = EpidMemberGetSize(&params, &member_size);
-    if (kEpidNoErr != sts) {
-      break;
-    }
-    member = (MemberCtx*)calloc(1, member_size);
-    if (!member) {
-      sts = kEpidNoMemErr;
-      break;
-    }
-    sts = EpidMemberInit(&params, member);
-    if (kEpidNoErr != sts) {
-      break;
-    }
-
-    sts = EpidMemberSetHashAlg(member, hash_alg);
-    if (kEpidNoErr != sts) {
-      break;
-    }
-
-    if (buf_privkey_size == sizeof(PrivKey)) {
-      sts = EpidProvisionKey(member, (GroupPubKey const*)buf_pubkey,
-                             (PrivKey const*)buf_privkey, precomp);
-      if (kEpidNoErr != sts) {
-        break;
-      }
-    } else {
-      sts = kEpidBadArgErr;
-      break;
-    }
-
-    // start member
-    sts = EpidMemberStartup(member);
+    sts = CreateMember((GroupPubKey const*)buf_pubkey,
+                       (PrivKey const*)buf_privkey, precomp, &hash_alg, NULL,
+                       NULL, &member);
     if (kEpidNoErr != sts) {
       break;
     }
 
     // register any provided basename as allowed
     if (0 != basename_len) {
-      sts = EpidRegisterBasename(member, basename, basename_len);
+      sts = EpidRegisterBasename(member.ctx, basename, basename_len);
       if (kEpidNoErr != sts) {
         break;
       }
     }
 
-    // TODO the interface does not support revocation lists
+    // TODO the caller's sig buffer has no size, so a signature with
+    // non-revoked proofs cannot be returned here. Use EpidApiMemberSetSigRl.
     // register sigRl if any
     if (buf_sig_rl && buf_sig_rl_size) {
       /*
@@ -191,15 +371,15 @@ EpidStatus EpidApiSign(void const* msg, size_t msg_len,
     }
 
     // sign message
-    sts = EpidSign(member, msg, msg_len, basename, basename_len, sig, sig_len);
+    sts = EpidSign(member.ctx, msg, msg_len, basename, basename_len, sig,
+                   sig_len);
     if (kEpidNoErr != sts) {
       break;
     }
     sts = kEpidNoErr;
   } while (0);  // do
 
-  EpidMemberDeinit(member);
-  if (member) free(member);
+  DestroyMember(&member);
 
   if (sig_rl) free(sig_rl);
   return sts;
@@ -221,22 +401,10 @@ EpidStatus EpidApiSignAtap(void const* msg, size_t msg_len,
 
   GroupPubKey pubkey = {0};
   PrivKey privkey = {0};
-
-  // get public key and private key from buf, no CA checks
-  if (!buf_key || buf_key_size != sizeof(EpidKeyATAP)) {
-    return kEpidBadArgErr;
+  EpidStatus sts = SplitAtapKey(buf_key, buf_key_size, &pubkey, &privkey);
+  if (kEpidNoErr != sts) {
+    return sts;
   }
-  EpidKeyATAP* buf_key_tmp = (EpidKeyATAP*)buf_key;
-
-  pubkey.gid = buf_key_tmp->gid;
-  pubkey.h1 = buf_key_tmp->h1;
-  pubkey.h2 = buf_key_tmp->h2;
-  pubkey.w = buf_key_tmp->w;
-
-  privkey.gid = buf_key_tmp->gid;
-  privkey.A = buf_key_tmp->A;
-  privkey.x = buf_key_tmp->x;
-  privkey.f = buf_key_tmp->f;
 
   return EpidApiSign(msg, msg_len,
                      basename, basename_len,
@@ -254,71 +422,152 @@ EpidStatus EpidApiSignPrecomp(void const* buf_key, size_t buf_key_size,
   EpidStatus sts = kEpidErr;
   GroupPubKey pubkey = {0};
   PrivKey privkey = {0};
-  MemberCtx* member = NULL;
-  MemberParams params = {0};
-  size_t member_size = 0;
+  EpidApiMember member = {0};
 
   if (!buf_precomp || buf_precomp_size != sizeof(MemberPrecomp)) {
     return kEpidBadArgErr;
   }
 
-  // get public key and private key from buf, no CA checks
-  if (!buf_key || buf_key_size != sizeof(EpidKeyATAP)) {
-    return kEpidBadArgErr;
+  sts = SplitAtapKey(buf_key, buf_key_size, &pubkey, &privkey);
+  if (kEpidNoErr != sts) {
+    return sts;
   }
-  EpidKeyATAP* buf_key_tmp = (EpidKeyATAP*)buf_key;
-
-  pubkey.gid = buf_key_tmp->gid;
-  pubkey.h1 = buf_key_tmp->h1;
-  pubkey.h2 = buf_key_tmp->h2;
-  pubkey.w = buf_key_tmp->w;
-
-  privkey.gid = buf_key_tmp->gid;
-  privkey.A = buf_key_tmp->A;
-  privkey.x = buf_key_tmp->x;
-  privkey.f = buf_key_tmp->f;
 
   do {
-    // need link RNG
-    params.rnd_func = &SysPrngGen;
-    params.rnd_param = NULL;
-    params.f = NULL;
-
-    // create member
-    sts = EpidMemberGetSize(&params, &member_size);
-    if (kEpidNoErr != sts) {
-      break;
-    }
-    member = (MemberCtx*)calloc(1, member_size);
-    if (!member) {
-      sts = kEpidNoMemErr;
-      break;
-    }
-    sts = EpidMemberInit(&params, member);
+    // start member and compute precomp, unless the precomp cache has it
+    sts = CreateMember(&pubkey, &privkey, NULL, NULL, NULL, NULL, &member);
     if (kEpidNoErr != sts) {
       break;
     }
 
-    sts = EpidProvisionKey(member, &pubkey, &privkey, NULL);
+    // write precomp to buf
+    sts = EpidMemberWritePrecomp(member.ctx, (MemberPrecomp*)buf_precomp);
     if (kEpidNoErr != sts) {
       break;
     }
+  } while (0);  // do
 
-    // start member and compute precomp
-    sts = EpidMemberStartup(member);
-    if (kEpidNoErr != sts) {
-      break;
-    }
+  DestroyMember(&member);
+  EpidZeroMemory(&privkey, sizeof(privkey));
+  return sts;
+}
 
-    // write precomp to buf
-    sts = EpidMemberWritePrecomp(member, (MemberPrecomp*)buf_precomp);
-    if (kEpidNoErr != sts) {
-      break;
+EpidStatus EpidApiMemberOpen(void const* buf_key, size_t buf_key_size,
+                             void const* buf_precomp, size_t buf_precomp_size,
+                             HashAlg hash_alg, EpidApiMember** member) {
+  return EpidApiMemberOpenWithRng(buf_key, buf_key_size, buf_precomp,
+                                  buf_precomp_size, hash_alg, NULL, NULL,
+                                  member);
+}
+
+EpidStatus EpidApiMemberOpenWithRng(void const* buf_key, size_t buf_key_size,
+                                    void const* buf_precomp,
+                                    size_t buf_precomp_size, HashAlg hash_alg,
+                                    BitSupplier rnd_func, void* rnd_param,
+                                    EpidApiMember** member) {
+  EpidStatus sts = kEpidErr;
+  GroupPubKey pubkey = {0};
+  PrivKey privkey = {0};
+  MemberPrecomp const* precomp = NULL;
+  EpidApiMember* handle = NULL;
+
+  if (!member) {
+    return kEpidBadArgErr;
+  }
+  *member = NULL;
+  sts = SplitAtapKey(buf_key, buf_key_size, &pubkey, &privkey);
+  if (kEpidNoErr != sts) {
+    return sts;
+  }
+  if (buf_precomp && buf_precomp_size == sizeof(MemberPrecomp)) {
+    precomp = (MemberPrecomp const*)buf_precomp;
+  }
+
+  handle = (EpidApiMember*)calloc(1, sizeof(EpidApiMember));
+  if (!handle) {
+    sts = kEpidNoMemErr;
+  } else {
+    sts = CreateMember(&pubkey, &privkey, precomp, &hash_alg, rnd_func,
+                       rnd_param, handle);
+  }
+  EpidZeroMemory(&privkey, sizeof(privkey));
+  if (kEpidNoErr != sts) {
+    free(handle);
+    return sts;
+  }
+  *member = handle;
+  return kEpidNoErr;
+}
+
+EpidStatus EpidApiSignWithHandle(EpidApiMember* member, void const* msg,
+                                 size_t msg_len, void const* basename,
+                                 size_t basename_len, void* buf_sig,
+                                 size_t* sig_len) {
+  EpidStatus sts = kEpidErr;
+  size_t required_len = 0;
+
+  if (!member || !member->ctx || !buf_sig || !sig_len) {
+    return kEpidBadArgErr;
+  }
+  required_len = EpidGetSigSize(member->sig_rl);
+  if (*sig_len < required_len) {
+    return kEpidBadArgErr;
+  }
+
+  // register the basename the first time it is used
+  if (0 != basename_len) {
+    sts = EpidRegisterBasename(member->ctx, basename, basename_len);
+    if (kEpidNoErr != sts && kEpidDuplicateErr != sts) {
+      return sts;
     }
-  } while (0);  // do
+  }
 
-  EpidMemberDeinit(member);
-  if (member) free(member);
+  sts = EpidSign(member->ctx, msg, msg_len, basename, basename_len,
+                 (EpidSignature*)buf_sig, required_len);
+  if (kEpidNoErr != sts) {
+    return sts;
+  }
+  *sig_len = required_len;
+  return kEpidNoErr;
+}
+
+EpidStatus EpidApiMemberSetSigRl(EpidApiMember* member,
+                                 void const* buf_sig_rl,
+                                 size_t buf_sig_rl_size) {
+  EpidStatus sts = kEpidErr;
+  SigRl* sig_rl = NULL;
+  size_t sig_rl_size = 0;
 
+  if (!member || !member->ctx) {
+    return kEpidBadArgErr;
+  }
+  sts = EpidApiCopySigRl(buf_sig_rl, buf_sig_rl_size, &sig_rl, &sig_rl_size);
+  if (kEpidNoErr != sts) {
+    return sts;
+  }
+  sts = EpidMemberSetSigRl(member->ctx, sig_rl, sig_rl_size);
+  if (kEpidNoErr != sts) {
+    free(sig_rl);
+    return sts;
+  }
+  // the member now points at the new list
+  free(member->sig_rl);
+  member->sig_rl = sig_rl;
+  member->sig_rl_size = sig_rl_size;
   return kEpidNoErr;
 }
+
+size_t EpidApiMemberGetSigSize(EpidApiMember const* member) {
+  if (!member) {
+    return EpidGetSigSize(NULL);
+  }
+  return EpidGetSigSize(member->sig_rl);
+}
+
+void EpidApiMemberClose(EpidApiMember* member) {
+  if (!member) {
+    return;
+  }
+  DestroyMember(member);
+  free(member);
+}
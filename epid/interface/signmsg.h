@@ -29,6 +29,12 @@
 extern "C" {
 #endif
 
+/* Default random number source of the members, a BitSupplier. Serves
+ * getrandom() output from a per-thread pool. Returns 0 only if all
+ * num_bits were filled, num_bits must be a multiple of 8.
+ */
+int SysPrngGen(unsigned int* rand_data, int num_bits, void* user_data);
+
 /* Sign message with EPID key, separate public/private keys.
  *
  * input:
@@ -142,6 +148,101 @@ EpidStatus EpidApiSignPrecomp(void const* buf_key,
                               size_t buf_key_size,
                               void* buf_precomp,
                               size_t buf_size);
+
+/* Provisioned EPID member that can sign many messages. Setting up a member
+ * costs far more than one signature, so use this instead of
+ * EpidApiSignAtap to sign repeatedly with the same key. A handle must only
+ * be used by one thread at a time.
+ */
+typedef struct EpidApiMember EpidApiMember;
+
+/* Create a member for a bundled key.
+ *
+ * input:
+ * buf_key: bundled private and public key, same format as EpidApiSignAtap
+ * buf_key_size: 400
+ * buf_precomp: precomp blob from EpidApiSignPrecomp, no use if NULL
+ * precomp_size: 1536
+ * hash_algo: digest sha-256 ->0; sha-512->2
+ *
+ * output:
+ * member: new handle, release with EpidApiMemberClose
+ *
+ * return:
+ * EpidStatus: 0->created, others->error
+ */
+EpidStatus EpidApiMemberOpen(void const* buf_key,
+                             size_t buf_key_size,
+                             void const* buf_precomp,
+                             size_t buf_precomp_size,
+                             HashAlg hash_alg,
+                             EpidApiMember** member);
+
+/* Same as EpidApiMemberOpen, but the member draws its random numbers from
+ * rnd_func(rnd_param) instead of SysPrngGen, e.g. a DRBG. rnd_func must
+ * fill all requested bits or return nonzero, and stays in use until the
+ * member is closed.
+ */
+EpidStatus EpidApiMemberOpenWithRng(void const* buf_key,
+                                    size_t buf_key_size,
+                                    void const* buf_precomp,
+                                    size_t buf_precomp_size,
+                                    HashAlg hash_alg,
+                                    BitSupplier rnd_func,
+                                    void* rnd_param,
+                                    EpidApiMember** member);
+
+/* Sign message with an open member.
+ *
+ * input:
+ * member: handle from EpidApiMemberOpen
+ * msg: message to sign
+ * msg_len: message length
+ * basename: basename, see documentation for details. Registered with the
+ *      member on first use.
+ * basename_len: basename length
+ * sig_len: size of buf_sig, >=EpidApiMemberGetSigSize(member)
+ *
+ * output:
+ * buf_sig: signature
+ * sig_len: signature size
+ *
+ * return:
+ * EpidStatus: 0->signed, others->error
+ */
+EpidStatus EpidApiSignWithHandle(EpidApiMember* member,
+                                 void const* msg,
+                                 size_t msg_len,
+                                 void const* basename,
+                                 size_t basename_len,
+                                 void* buf_sig,
+                                 size_t* sig_len);
+
+/* Parse a signature revocation list once and keep it with the member, so
+ * later signatures carry non-revoked proofs without re-reading the list.
+ * Replaces any list set before; the SDK rejects a list older than the
+ * current one.
+ *
+ * input:
+ * member: handle from EpidApiMemberOpen
+ * buf_sig_rl: SigRl file, EpidFileHeader + SigRl + EcdsaSignature. The file
+ *      signature is not checked.
+ * buf_sig_rl_size: size of buf_sig_rl
+ *
+ * return:
+ * EpidStatus: 0->set, others->error
+ */
+EpidStatus EpidApiMemberSetSigRl(EpidApiMember* member,
+                                 void const* buf_sig_rl,
+                                 size_t buf_sig_rl_size);
+
+/* Size of the signatures member creates: 360 + 160 per SigRl entry.
+ */
+size_t EpidApiMemberGetSigSize(EpidApiMember const* member);
+
+/* Clear the key material held by member and free it. member may be NULL.
+ */
+void EpidApiMemberClose(EpidApiMember* member);
 #if defined __cplusplus
 }
 #endif  // defined __cplusplus
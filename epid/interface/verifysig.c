@@ -19,8 +19,28 @@
 
 */
 
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "epid/verifier/api.h"
+#include "interface/precomp_cache.h"
+#include "interface/rlfile.h"
+#include "interface/verifysig.h"
+
+struct EpidApiVerifier {
+  VerifierCtx* ctx;
+  GroupPubKey pubkey;
+  HashAlg hash_alg;
+  // basename last set on ctx
+  bool basename_set;
+  void* basename;
+  size_t basename_len;
+  // revocation lists set on ctx, which points into them
+  EpidApiRevocationLists* rls;
+  bool grp_revoked;
+};
 
 EpidStatus EpidApiVerify(void const* sig, size_t sig_len,
                          void const* msg,size_t msg_len,
@@ -34,201 +54,812 @@ EpidStatus EpidApiVerify(void const* sig, size_t sig_len,
                          void const* buf_precomp, size_t buf_precomp_size,
                          HashAlg hash_alg) {
   EpidStatus result = kEpidErr;
-  VerifierCtx* ctx = NULL;
-  PrivRl* priv_rl = NULL;
-  SigRl* sig_rl = NULL;
-  GroupRl* grp_rl = NULL;
+  EpidApiVerifier* verifier = NULL;
+  EpidApiRevocationLists* rls = NULL;
+  bool has_priv_rl = signed_priv_rl && signed_priv_rl_size;
+  bool has_sig_rl = signed_sig_rl && signed_sig_rl_size;
+  bool has_grp_rl = signed_grp_rl && signed_grp_rl_size;
+
+  // no need to enable verifier RL
+  (void)ver_rl;
+  (void)ver_rl_size;
 
   do {
-    if (!buf_pubkey || buf_pubkey_size != sizeof(GroupPubKey)) {
+    // create verifier
+    result = EpidApiVerifierOpen(buf_pubkey, buf_pubkey_size, buf_precomp,
+                                 buf_precomp_size, hash_alg, &verifier);
+    if (kEpidNoErr != result) {
+      break;
+    }
+
+    if (has_priv_rl || has_sig_rl || has_grp_rl) {
+      result = EpidApiRevocationListsCreate(
+          has_grp_rl ? signed_grp_rl : NULL,
+          has_grp_rl ? signed_grp_rl_size : 0, &rls);
+      if (kEpidNoErr != result) {
+        break;
+      }
+      if (has_priv_rl) {
+        result = EpidApiRevocationListsAddPrivRl(rls, signed_priv_rl,
+                                                 signed_priv_rl_size);
+        if (kEpidNoErr != result) {
+          break;
+        }
+      }
+      if (has_sig_rl) {
+        result = EpidApiRevocationListsAddSigRl(rls, signed_sig_rl,
+                                                signed_sig_rl_size);
+        if (kEpidNoErr != result) {
+          break;
+        }
+      }
+      result = EpidApiVerifierSetRevocationLists(verifier, rls);
+      if (kEpidNoErr != result) {
+        break;
+      }
+    }
+
+    // verify signature
+    result = EpidApiVerifyWithHandle(verifier, sig, sig_len, msg, msg_len,
+                                     basename, basename_len);
+  } while (0);  // do
+
+  EpidApiRevocationListsRelease(rls);
+  EpidApiVerifierClose(verifier);
+  return result;
+}
+
+EpidStatus EpidApiVerifyPrecomp(void const* buf_key, size_t buf_key_size,
+                                void* buf_precomp, size_t buf_size) {
+  EpidStatus result = kEpidErr;
+  EpidApiVerifier* verifier = NULL;
+
+  do {
+    if (!buf_key || buf_key_size != sizeof(GroupPubKey)) {
+      result = kEpidBadArgErr;
+      break;
+    }
+    if (!buf_precomp || buf_size != sizeof(VerifierPrecomp)) {
       result = kEpidBadArgErr;
       break;
     }
 
-    VerifierPrecomp const* precomp = NULL;
-    if (buf_precomp && buf_precomp_size == sizeof(VerifierPrecomp)) {
-      precomp = (VerifierPrecomp const*)buf_precomp;
+    // create verifier and precompute, unless the precomp cache has it
+    result = EpidApiVerifierOpen(buf_key, buf_key_size, NULL, 0, kSha512,
+                                 &verifier);
+    if (kEpidNoErr != result) {
+      break;
     }
 
-    // create verifier
-    result = EpidVerifierCreate((GroupPubKey const*)buf_pubkey, precomp, &ctx);
+    // write precomp to buf
+    result = EpidVerifierWritePrecomp(verifier->ctx,
+                                      (VerifierPrecomp*)buf_precomp);
     if (kEpidNoErr != result) {
       break;
     }
-    /*
-    // serialize verifier pre-computation blob
-    if (!*verifier_precomp) {
-      *verifier_precomp = calloc(1, *verifier_precomp_size);
+
+  } while(0);  // do
+
+  // delete verifier
+  EpidApiVerifierClose(verifier);
+  return result;
+}
+
+typedef struct GroupRls {
+  GroupId gid;
+  PrivRl* priv_rl;
+  size_t priv_rl_size;
+  SigRl* sig_rl;
+  size_t sig_rl_size;
+} GroupRls;
+
+struct EpidApiRevocationLists {
+  atomic_size_t refs;
+  // private key and signature RLs, one entry per group
+  GroupRls* groups;
+  size_t group_count;
+  // set of GroupIds revoked by the group RL, open addressing with linear
+  // probing. revoked_capacity is 0 or a power of two.
+  GroupId* revoked;
+  bool* revoked_used;
+  size_t revoked_capacity;
+};
+
+// FNV-1a
+static size_t HashGroupId(GroupId const* gid) {
+  uint8_t const* bytes = (uint8_t const*)gid;
+  uint32_t hash = 2166136261u;
+  size_t i = 0;
+  for (i = 0; i < sizeof(GroupId); ++i) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// Slot of gid in the revoked set, or of the empty slot it would go to.
+static size_t FindRevokedSlot(EpidApiRevocationLists const* rls,
+                              GroupId const* gid) {
+  size_t mask = rls->revoked_capacity - 1;
+  size_t slot = HashGroupId(gid) & mask;
+  while (rls->revoked_used[slot] &&
+         memcmp(&rls->revoked[slot], gid, sizeof(GroupId))) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+static EpidStatus IndexGroupRl(EpidApiRevocationLists* rls,
+                               GroupRl const* grp_rl, size_t grp_rl_size) {
+  size_t const empty_rl_size = sizeof(GroupRl) - sizeof(grp_rl->gid[0]);
+  size_t count = (grp_rl_size - empty_rl_size) / sizeof(grp_rl->gid[0]);
+  size_t capacity = 1;
+  size_t i = 0;
+
+  if (!count) {
+    return kEpidNoErr;
+  }
+  // keep the load factor at or below one half
+  while (capacity < 2 * count) {
+    if (capacity > ((size_t)-1) / 4 / sizeof(GroupId)) {
+      return kEpidMemAllocErr;
+    }
+    capacity *= 2;
+  }
+  rls->revoked = (GroupId*)calloc(capacity, sizeof(GroupId));
+  rls->revoked_used = (bool*)calloc(capacity, sizeof(bool));
+  if (!rls->revoked || !rls->revoked_used) {
+    return kEpidMemAllocErr;
+  }
+  rls->revoked_capacity = capacity;
+  for (i = 0; i < count; ++i) {
+    size_t slot = FindRevokedSlot(rls, &grp_rl->gid[i]);
+    rls->revoked[slot] = grp_rl->gid[i];
+    rls->revoked_used[slot] = true;
+  }
+  return kEpidNoErr;
+}
+
+static void FreeRevocationLists(EpidApiRevocationLists* rls) {
+  size_t i = 0;
+  for (i = 0; i < rls->group_count; ++i) {
+    free(rls->groups[i].priv_rl);
+    free(rls->groups[i].sig_rl);
+  }
+  free(rls->groups);
+  free(rls->revoked);
+  free(rls->revoked_used);
+  free(rls);
+}
+
+static void RetainRevocationLists(EpidApiRevocationLists* rls) {
+  if (rls) {
+    atomic_fetch_add(&rls->refs, 1);
+  }
+}
+
+static GroupRls* FindGroupRls(EpidApiRevocationLists const* rls,
+                              GroupId const* gid) {
+  size_t i = 0;
+  for (i = 0; i < rls->group_count; ++i) {
+    if (0 == memcmp(&rls->groups[i].gid, gid, sizeof(GroupId))) {
+      return &rls->groups[i];
     }
-    result = EpidVerifierWritePrecomp(ctx, *verifier_precomp);
+  }
+  return NULL;
+}
+
+static GroupRls* FindOrAddGroupRls(EpidApiRevocationLists* rls,
+                                   GroupId const* gid) {
+  GroupRls* groups = NULL;
+  GroupRls* group = FindGroupRls(rls, gid);
+  if (group) {
+    return group;
+  }
+  groups = (GroupRls*)realloc(rls->groups,
+                              (rls->group_count + 1) * sizeof(GroupRls));
+  if (!groups) {
+    return NULL;
+  }
+  rls->groups = groups;
+  group = &groups[rls->group_count++];
+  memset(group, 0, sizeof(*group));
+  group->gid = *gid;
+  return group;
+}
+
+EpidStatus EpidApiRevocationListsCreate(void const* signed_grp_rl,
+                                        size_t signed_grp_rl_size,
+                                        EpidApiRevocationLists** rls) {
+  EpidStatus result = kEpidErr;
+  EpidApiRevocationLists* lists = NULL;
+  GroupRl* grp_rl = NULL;
+  size_t grp_rl_size = 0;
+
+  if (!rls) {
+    return kEpidBadArgErr;
+  }
+  *rls = NULL;
+  lists = (EpidApiRevocationLists*)calloc(1, sizeof(EpidApiRevocationLists));
+  if (!lists) {
+    return kEpidMemAllocErr;
+  }
+  atomic_init(&lists->refs, 1);
+
+  if (signed_grp_rl) {
+    result = EpidApiCopyGroupRl(signed_grp_rl, signed_grp_rl_size, &grp_rl,
+                                &grp_rl_size);
+    if (kEpidNoErr == result) {
+      result = IndexGroupRl(lists, grp_rl, grp_rl_size);
+    }
+    free(grp_rl);
+    if (kEpidNoErr != result) {
+      FreeRevocationLists(lists);
+      return result;
+    }
+  }
+  *rls = lists;
+  return kEpidNoErr;
+}
+
+EpidStatus EpidApiRevocationListsAddPrivRl(EpidApiRevocationLists* rls,
+                                           void const* signed_priv_rl,
+                                           size_t signed_priv_rl_size) {
+  EpidStatus result = kEpidErr;
+  PrivRl* priv_rl = NULL;
+  size_t priv_rl_size = 0;
+  GroupRls* group = NULL;
+
+  if (!rls) {
+    return kEpidBadArgErr;
+  }
+  result = EpidApiCopyPrivRl(signed_priv_rl, signed_priv_rl_size, &priv_rl,
+                             &priv_rl_size);
+  if (kEpidNoErr != result) {
+    return result;
+  }
+  group = FindOrAddGroupRls(rls, &priv_rl->gid);
+  if (!group) {
+    free(priv_rl);
+    return kEpidMemAllocErr;
+  }
+  free(group->priv_rl);
+  group->priv_rl = priv_rl;
+  group->priv_rl_size = priv_rl_size;
+  return kEpidNoErr;
+}
+
+EpidStatus EpidApiRevocationListsAddSigRl(EpidApiRevocationLists* rls,
+                                          void const* signed_sig_rl,
+                                          size_t signed_sig_rl_size) {
+  EpidStatus result = kEpidErr;
+  SigRl* sig_rl = NULL;
+  size_t sig_rl_size = 0;
+  GroupRls* group = NULL;
+
+  if (!rls) {
+    return kEpidBadArgErr;
+  }
+  result = EpidApiCopySigRl(signed_sig_rl, signed_sig_rl_size, &sig_rl,
+                            &sig_rl_size);
+  if (kEpidNoErr != result) {
+    return result;
+  }
+  group = FindOrAddGroupRls(rls, &sig_rl->gid);
+  if (!group) {
+    free(sig_rl);
+    return kEpidMemAllocErr;
+  }
+  free(group->sig_rl);
+  group->sig_rl = sig_rl;
+  group->sig_rl_size = sig_rl_size;
+  return kEpidNoErr;
+}
+
+bool EpidApiRevocationListsIsGroupRevoked(EpidApiRevocationLists const* rls,
+                                          GroupId const* gid) {
+  if (!rls || !gid || !rls->revoked_capacity) {
+    return false;
+  }
+  return rls->revoked_used[FindRevokedSlot(rls, gid)];
+}
+
+void EpidApiRevocationListsRelease(EpidApiRevocationLists* rls) {
+  if (rls && 1 == atomic_fetch_sub(&rls->refs, 1)) {
+    FreeRevocationLists(rls);
+  }
+}
+
+EpidStatus EpidApiVerifierOpen(void const* buf_pubkey, size_t buf_pubkey_size,
+                               void const* buf_precomp,
+                               size_t buf_precomp_size, HashAlg hash_alg,
+                               EpidApiVerifier** verifier) {
+  EpidStatus result = kEpidErr;
+  EpidApiVerifier* handle = NULL;
+  VerifierPrecomp cached_precomp;
+  bool cache_miss = false;
+
+  if (!verifier) {
+    return kEpidBadArgErr;
+  }
+  *verifier = NULL;
+  if (!buf_pubkey || buf_pubkey_size != sizeof(GroupPubKey)) {
+    return kEpidBadArgErr;
+  }
+  VerifierPrecomp const* precomp = NULL;
+  if (buf_precomp && buf_precomp_size == sizeof(VerifierPrecomp)) {
+    precomp = (VerifierPrecomp const*)buf_precomp;
+  } else if (EpidApiPrecompCacheGet(NULL, kEpidApiVerifierPrecomp, buf_pubkey,
+                                    buf_pubkey_size, &cached_precomp,
+                                    sizeof(cached_precomp))) {
+    precomp = &cached_precomp;
+  } else {
+    cache_miss = true;
+  }
+
+  handle = (EpidApiVerifier*)calloc(1, sizeof(EpidApiVerifier));
+  if (!handle) {
+    return kEpidMemAllocErr;
+  }
+  do {
+    result = EpidVerifierCreate((GroupPubKey const*)buf_pubkey, precomp,
+                                &handle->ctx);
     if (kEpidNoErr != result) {
       break;
     }
-    */
-    // set hash algorithm used for signing
-    result = EpidVerifierSetHashAlg(ctx, hash_alg);
+    result = EpidVerifierSetHashAlg(handle->ctx, hash_alg);
     if (kEpidNoErr != result) {
       break;
     }
 
+    // keep the precomputation for the next start, best effort
+    if (cache_miss &&
+        kEpidNoErr == EpidVerifierWritePrecomp(handle->ctx, &cached_precomp)) {
+      EpidApiPrecompCachePut(NULL, kEpidApiVerifierPrecomp, buf_pubkey,
+                             buf_pubkey_size, &cached_precomp,
+                             sizeof(cached_precomp));
+    }
+  } while (0);  // do
+
+  if (kEpidNoErr != result) {
+    EpidApiVerifierClose(handle);
+    return result;
+  }
+  handle->pubkey = *(GroupPubKey const*)buf_pubkey;
+  handle->hash_alg = hash_alg;
+  *verifier = handle;
+  return kEpidNoErr;
+}
+
+EpidStatus EpidApiVerifyWithHandle(EpidApiVerifier* verifier, void const* sig,
+                                   size_t sig_len, void const* msg,
+                                   size_t msg_len, void const* basename,
+                                   size_t basename_len) {
+  EpidStatus result = kEpidErr;
+
+  if (!verifier || !verifier->ctx) {
+    return kEpidBadArgErr;
+  }
+  if (verifier->grp_revoked) {
+    return kEpidSigRevokedInGroupRl;
+  }
+  if (!verifier->basename_set || basename_len != verifier->basename_len ||
+      (basename_len && memcmp(basename, verifier->basename, basename_len))) {
+    void* basename_copy = NULL;
+    if (basename_len) {
+      basename_copy = malloc(basename_len);
+      if (!basename_copy) {
+        return kEpidMemAllocErr;
+      }
+      memcpy(basename_copy, basename, basename_len);
+    }
     // set the basename used for signing
-    result = EpidVerifierSetBasename(ctx, basename, basename_len);
+    result = EpidVerifierSetBasename(verifier->ctx, basename, basename_len);
+    if (kEpidNoErr != result) {
+      free(basename_copy);
+      verifier->basename_set = false;
+      return result;
+    }
+    free(verifier->basename);
+    verifier->basename = basename_copy;
+    verifier->basename_len = basename_len;
+    verifier->basename_set = true;
+  }
+
+  // verify signature
+  return EpidVerify(verifier->ctx, sig, sig_len, msg, msg_len);
+}
+
+void EpidApiVerifierClose(EpidApiVerifier* verifier) {
+  if (!verifier) {
+    return;
+  }
+  EpidVerifierDelete(&verifier->ctx);
+  EpidApiRevocationListsRelease(verifier->rls);
+  free(verifier->basename);
+  free(verifier);
+}
+
+// Replace the verifier's ctx by a new one without revocation lists, the SDK
+// can neither remove a list nor go back to an older version.
+static EpidStatus ResetVerifierCtx(EpidApiVerifier* verifier) {
+  EpidStatus result = kEpidErr;
+  VerifierPrecomp precomp;
+  VerifierCtx* ctx = NULL;
+
+  do {
+    result = EpidVerifierWritePrecomp(verifier->ctx, &precomp);
     if (kEpidNoErr != result) {
       break;
     }
+    result = EpidVerifierCreate(&verifier->pubkey, &precomp, &ctx);
+    if (kEpidNoErr != result) {
+      break;
+    }
+    result = EpidVerifierSetHashAlg(ctx, verifier->hash_alg);
+    if (kEpidNoErr != result) {
+      break;
+    }
+  } while (0);  // do
 
-    if (signed_priv_rl && signed_priv_rl_size) {
-      // TODO enable private key RL
-      /*
-      // authenticate and determine space needed for RL
-      size_t priv_rl_size = 0;
-      result = EpidParsePrivRlFile(signed_priv_rl, signed_priv_rl_size, cacert,
-                                   NULL, &priv_rl_size);
-      if (kEpidNoErr != result) {
-        break;
-      }
+  if (kEpidNoErr != result) {
+    EpidVerifierDelete(&ctx);
+    return result;
+  }
+  EpidVerifierDelete(&verifier->ctx);
+  verifier->ctx = ctx;
+  verifier->basename_set = false;
+  EpidApiRevocationListsRelease(verifier->rls);
+  verifier->rls = NULL;
+  verifier->grp_revoked = false;
+  return kEpidNoErr;
+}
 
-      priv_rl = calloc(1, priv_rl_size);
-      if (!priv_rl) {
-        result = kEpidMemAllocErr;
-        break;
-      }
+EpidStatus EpidApiVerifierSetRevocationLists(EpidApiVerifier* verifier,
+                                             EpidApiRevocationLists* rls) {
+  EpidStatus result = kEpidNoErr;
+  GroupRls const* group = NULL;
 
-      // fill the rl
-      result = EpidParsePrivRlFile(signed_priv_rl, signed_priv_rl_size, cacert,
-                                   priv_rl, &priv_rl_size);
-      if (kEpidNoErr != result) {
-        break;
-      }
+  if (!verifier || !verifier->ctx) {
+    return kEpidBadArgErr;
+  }
+  if (rls == verifier->rls) {
+    return kEpidNoErr;
+  }
+  if (verifier->rls) {
+    result = ResetVerifierCtx(verifier);
+    if (kEpidNoErr != result) {
+      return result;
+    }
+  }
+  if (!rls) {
+    return kEpidNoErr;
+  }
 
+  do {
+    group = FindGroupRls(rls, &verifier->pubkey.gid);
+    if (group && group->priv_rl) {
       // set private key based revocation list
-      result = EpidVerifierSetPrivRl(ctx, priv_rl, priv_rl_size);
+      result = EpidVerifierSetPrivRl(verifier->ctx, group->priv_rl,
+                                     group->priv_rl_size);
       if (kEpidNoErr != result) {
         break;
-      }*/
-    }  // if (signed_priv_rl)
-
-    if (signed_sig_rl && signed_sig_rl_size) {
-      // no need to enable signature RL
-      /*
-      // authenticate and determine space needed for RL
-      size_t sig_rl_size = 0;
-      result = EpidParseSigRlFile(signed_sig_rl, signed_sig_rl_size, cacert,
-                                  NULL, &sig_rl_size);
+      }
+    }
+    if (group && group->sig_rl) {
+      // set signature based revocation list
+      result = EpidVerifierSetSigRl(verifier->ctx, group->sig_rl,
+                                    group->sig_rl_size);
       if (kEpidNoErr != result) {
         break;
       }
+    }
+  } while (0);  // do
 
-      sig_rl = calloc(1, sig_rl_size);
-      if (!sig_rl) {
-        result = kEpidMemAllocErr;
-        break;
-      }
+  if (kEpidNoErr != result) {
+    // ctx may hold part of rls, which is not retained
+    if (kEpidNoErr != ResetVerifierCtx(verifier)) {
+      EpidVerifierDelete(&verifier->ctx);
+    }
+    return result;
+  }
+  RetainRevocationLists(rls);
+  verifier->rls = rls;
+  // the group RL is checked here once, not per signature
+  verifier->grp_revoked =
+      EpidApiRevocationListsIsGroupRevoked(rls, &verifier->pubkey.gid);
+  return kEpidNoErr;
+}
 
-      // fill the rl
-      result = EpidParseSigRlFile(signed_sig_rl, signed_sig_rl_size, cacert,
-                                  sig_rl, &sig_rl_size);
-      if (kEpidNoErr != result) {
-        break;
-      }
+struct EpidApiVerifierCache {
+  pthread_mutex_t lock;
+  // idle verifiers, oldest first
+  EpidApiVerifier** idle;
+  size_t idle_count;
+  size_t max_idle;
+  // lists applied to verifiers as they are acquired
+  EpidApiRevocationLists* rls;
+};
 
-      // set signature based revocation list
-      result = EpidVerifierSetSigRl(ctx, sig_rl, sig_rl_size);
-      if (kEpidNoErr != result) {
-        break;
-      }
-      */
-    }  // if (signed_sig_rl)
-
-    if (signed_grp_rl && signed_grp_rl_size) {
-      // TODO enable public key RL
-      /*
-      // authenticate and determine space needed for RL
-      size_t grp_rl_size = 0;
-      result = EpidParseGroupRlFile(signed_grp_rl, signed_grp_rl_size, cacert,
-                                    NULL, &grp_rl_size);
-      if (kEpidNoErr != result) {
-        break;
-      }
+EpidStatus EpidApiVerifierCacheCreate(size_t max_idle,
+                                      EpidApiVerifierCache** cache) {
+  EpidApiVerifierCache* new_cache = NULL;
 
-      grp_rl = calloc(1, grp_rl_size);
-      if (!grp_rl) {
-        result = kEpidMemAllocErr;
-        break;
-      }
+  if (!cache || !max_idle) {
+    return kEpidBadArgErr;
+  }
+  *cache = NULL;
+  new_cache = (EpidApiVerifierCache*)calloc(1, sizeof(EpidApiVerifierCache));
+  if (!new_cache) {
+    return kEpidMemAllocErr;
+  }
+  new_cache->idle =
+      (EpidApiVerifier**)calloc(max_idle, sizeof(EpidApiVerifier*));
+  if (!new_cache->idle) {
+    free(new_cache);
+    return kEpidMemAllocErr;
+  }
+  if (pthread_mutex_init(&new_cache->lock, NULL)) {
+    free(new_cache->idle);
+    free(new_cache);
+    return kEpidErr;
+  }
+  new_cache->max_idle = max_idle;
+  *cache = new_cache;
+  return kEpidNoErr;
+}
 
-      // fill the rl
-      result = EpidParseGroupRlFile(signed_grp_rl, signed_grp_rl_size, cacert,
-                                    grp_rl, &grp_rl_size);
-      if (kEpidNoErr != result) {
-        break;
-      }
-      // set group revocation list
-      result = EpidVerifierSetGroupRl(ctx, grp_rl, grp_rl_size);
-      if (kEpidNoErr != result) {
-        break;
-      }
-      */
-    }  // if (signed_grp_rl)
-
-    if (ver_rl && ver_rl_size) {
-      //no need to enable verifier RL
-      /*
-      // set verifier based revocation list
-      result = EpidVerifierSetVerifierRl(ctx, ver_rl, ver_rl_size);
-      if (kEpidNoErr != result) {
-        break;
-      }
-      */
+void EpidApiVerifierCacheDelete(EpidApiVerifierCache* cache) {
+  size_t i = 0;
+
+  if (!cache) {
+    return;
+  }
+  for (i = 0; i < cache->idle_count; ++i) {
+    EpidApiVerifierClose(cache->idle[i]);
+  }
+  EpidApiRevocationListsRelease(cache->rls);
+  pthread_mutex_destroy(&cache->lock);
+  free(cache->idle);
+  free(cache);
+}
+
+EpidStatus EpidApiVerifierCacheAcquire(EpidApiVerifierCache* cache,
+                                       void const* buf_pubkey,
+                                       size_t buf_pubkey_size,
+                                       void const* buf_precomp,
+                                       size_t buf_precomp_size,
+                                       HashAlg hash_alg,
+                                       EpidApiVerifier** verifier) {
+  EpidStatus result = kEpidNoErr;
+  EpidApiRevocationLists* rls = NULL;
+  size_t i = 0;
+
+  if (!cache || !verifier) {
+    return kEpidBadArgErr;
+  }
+  *verifier = NULL;
+  if (!buf_pubkey || buf_pubkey_size != sizeof(GroupPubKey)) {
+    return kEpidBadArgErr;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  // newest first, since it is the most likely to be warm
+  for (i = cache->idle_count; i > 0; --i) {
+    EpidApiVerifier* candidate = cache->idle[i - 1];
+    if (candidate->hash_alg == hash_alg &&
+        0 == memcmp(&candidate->pubkey, buf_pubkey, sizeof(GroupPubKey))) {
+      memmove(&cache->idle[i - 1], &cache->idle[i],
+              (cache->idle_count - i) * sizeof(EpidApiVerifier*));
+      --cache->idle_count;
+      *verifier = candidate;
+      break;
     }
+  }
+  rls = cache->rls;
+  RetainRevocationLists(rls);
+  pthread_mutex_unlock(&cache->lock);
 
-    // verify signature
-    result = EpidVerify(ctx, sig, sig_len, msg, msg_len);
+  if (!*verifier) {
+    result = EpidApiVerifierOpen(buf_pubkey, buf_pubkey_size, buf_precomp,
+                                 buf_precomp_size, hash_alg, verifier);
+  }
+  if (kEpidNoErr == result) {
+    // no-op unless the lists were swapped since the verifier last ran
+    result = EpidApiVerifierSetRevocationLists(*verifier, rls);
     if (kEpidNoErr != result) {
-      break;
+      EpidApiVerifierClose(*verifier);
+      *verifier = NULL;
     }
-  } while (0);  // do
+  }
+  EpidApiRevocationListsRelease(rls);
+  return result;
+}
 
-  // delete verifier
-  EpidVerifierDelete(&ctx);
+void EpidApiVerifierCacheRelease(EpidApiVerifierCache* cache,
+                                 EpidApiVerifier* verifier) {
+  EpidApiVerifier* evicted = NULL;
 
-  if (priv_rl) free(priv_rl);
-  if (sig_rl) free(sig_rl);
-  if (grp_rl) free(grp_rl);
+  if (!cache || !verifier) {
+    EpidApiVerifierClose(verifier);
+    return;
+  }
+  pthread_mutex_lock(&cache->lock);
+  if (cache->idle_count == cache->max_idle) {
+    evicted = cache->idle[0];
+    memmove(&cache->idle[0], &cache->idle[1],
+            (cache->idle_count - 1) * sizeof(EpidApiVerifier*));
+    --cache->idle_count;
+  }
+  cache->idle[cache->idle_count++] = verifier;
+  pthread_mutex_unlock(&cache->lock);
 
-  return result;
+  // close outside the lock, it frees the SDK context
+  EpidApiVerifierClose(evicted);
 }
 
-EpidStatus EpidApiVerifyPrecomp(void const* buf_key, size_t buf_key_size,
-                                void* buf_precomp, size_t buf_size) {
-  EpidStatus result = kEpidErr;
-  VerifierCtx* ctx = NULL;
+void EpidApiVerifierCacheSetRevocationLists(EpidApiVerifierCache* cache,
+                                             EpidApiRevocationLists* rls) {
+  EpidApiRevocationLists* old = NULL;
 
-  do {
-    if (!buf_key || buf_key_size != sizeof(GroupPubKey)) {
-      result = kEpidBadArgErr;
-      break;
+  if (!cache) {
+    return;
+  }
+  RetainRevocationLists(rls);
+  pthread_mutex_lock(&cache->lock);
+  old = cache->rls;
+  cache->rls = rls;
+  pthread_mutex_unlock(&cache->lock);
+  // verifiers still running keep their own reference to old
+  EpidApiRevocationListsRelease(old);
+}
+
+typedef struct VerifyBatchJob {
+  EpidApiVerifierCache* cache;
+  void const* buf_pubkey;
+  VerifierPrecomp const* precomp;
+  HashAlg hash_alg;
+  void const* basename;
+  size_t basename_len;
+  EpidApiSignedMsg const* msgs;
+  size_t count;
+  EpidStatus* results;
+  pthread_mutex_t lock;
+  size_t next;
+} VerifyBatchJob;
+
+static EpidStatus AcquireVerifier(VerifyBatchJob* job,
+                                  EpidApiVerifier** verifier) {
+  size_t precomp_size = job->precomp ? sizeof(VerifierPrecomp) : 0;
+  if (job->cache) {
+    return EpidApiVerifierCacheAcquire(job->cache, job->buf_pubkey,
+                                       sizeof(GroupPubKey), job->precomp,
+                                       precomp_size, job->hash_alg, verifier);
+  }
+  return EpidApiVerifierOpen(job->buf_pubkey, sizeof(GroupPubKey),
+                             job->precomp, precomp_size, job->hash_alg,
+                             verifier);
+}
+
+static void ReleaseVerifier(VerifyBatchJob* job, EpidApiVerifier* verifier) {
+  if (job->cache) {
+    EpidApiVerifierCacheRelease(job->cache, verifier);
+  } else {
+    EpidApiVerifierClose(verifier);
+  }
+}
+
+// Verify signatures from job with verifier until none are left. Indices are
+// handed out in small chunks so workers stay balanced.
+static void VerifyBatchRun(VerifyBatchJob* job, EpidApiVerifier* verifier) {
+  static const size_t kChunk = 16;
+  size_t begin = 0;
+  size_t end = 0;
+  size_t i = 0;
+
+  for (;;) {
+    pthread_mutex_lock(&job->lock);
+    begin = job->next;
+    end = begin + kChunk < job->count ? begin + kChunk : job->count;
+    job->next = end;
+    pthread_mutex_unlock(&job->lock);
+    if (begin >= end) {
+      return;
     }
-    if (!buf_precomp || buf_size != sizeof(VerifierPrecomp)) {
-      result = kEpidBadArgErr;
-      break;
+    for (i = begin; i < end; ++i) {
+      EpidApiSignedMsg const* m = &job->msgs[i];
+      job->results[i] =
+          EpidApiVerifyWithHandle(verifier, m->sig, m->sig_len, m->msg,
+                                  m->msg_len, job->basename, job->basename_len);
     }
+  }
+}
 
-    // create verifier and precompute
-    result = EpidVerifierCreate((GroupPubKey const*)buf_key, NULL, &ctx);
-    if (kEpidNoErr != result) {
-      break;
+static void* VerifyBatchWorker(void* arg) {
+  VerifyBatchJob* job = (VerifyBatchJob*)arg;
+  EpidApiVerifier* verifier = NULL;
+  EpidStatus result = AcquireVerifier(job, &verifier);
+  if (kEpidNoErr != result) {
+    // leave the signatures to the other workers
+    return NULL;
+  }
+  VerifyBatchRun(job, verifier);
+  ReleaseVerifier(job, verifier);
+  return NULL;
+}
+
+EpidStatus EpidApiVerifyBatch(EpidApiVerifierCache* cache,
+                              void const* buf_pubkey, size_t buf_pubkey_size,
+                              void const* buf_precomp,
+                              size_t buf_precomp_size, HashAlg hash_alg,
+                              void const* basename, size_t basename_len,
+                              EpidApiSignedMsg const* msgs, size_t count,
+                              size_t num_threads, EpidStatus* results) {
+  EpidStatus result = kEpidErr;
+  EpidApiVerifier* verifier = NULL;
+  VerifierPrecomp precomp;
+  pthread_t* threads = NULL;
+  size_t started = 0;
+  size_t i = 0;
+  VerifyBatchJob job;
+
+  if (!buf_pubkey || buf_pubkey_size != sizeof(GroupPubKey)) {
+    return kEpidBadArgErr;
+  }
+  if (count && (!msgs || !results)) {
+    return kEpidBadArgErr;
+  }
+  memset(&job, 0, sizeof(job));
+  job.cache = cache;
+  job.buf_pubkey = buf_pubkey;
+  job.hash_alg = hash_alg;
+  job.basename = basename;
+  job.basename_len = basename_len;
+  job.msgs = msgs;
+  job.count = count;
+  job.results = results;
+  if (buf_precomp && buf_precomp_size == sizeof(VerifierPrecomp)) {
+    job.precomp = (VerifierPrecomp const*)buf_precomp;
+  }
+
+  // The calling thread always takes part, so the batch completes even if
+  // no worker could start.
+  result = AcquireVerifier(&job, &verifier);
+  if (kEpidNoErr != result) {
+    return result;
+  }
+  if (!job.precomp) {
+    // let the workers skip the group precomputation
+    if (kEpidNoErr == EpidVerifierWritePrecomp(verifier->ctx, &precomp)) {
+      job.precomp = &precomp;
     }
+  }
+  if (pthread_mutex_init(&job.lock, NULL)) {
+    ReleaseVerifier(&job, verifier);
+    return kEpidErr;
+  }
 
-    // write precomp to buf
-    result = EpidVerifierWritePrecomp(ctx, (VerifierPrecomp*)buf_precomp);
-    if (kEpidNoErr != result) {
-      break;
+  if (num_threads > count) {
+    num_threads = count;
+  }
+  if (num_threads > 1) {
+    threads = (pthread_t*)calloc(num_threads - 1, sizeof(pthread_t));
+  }
+  if (threads) {
+    for (i = 0; i < num_threads - 1; ++i) {
+      if (pthread_create(&threads[i], NULL, VerifyBatchWorker, &job)) {
+        break;
+      }
+      ++started;
     }
+  }
 
-  } while(0);  // do
+  VerifyBatchRun(&job, verifier);
+  ReleaseVerifier(&job, verifier);
 
-  // delete verifier
-  EpidVerifierDelete(&ctx);
-  return result;
+  for (i = 0; i < started; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+  pthread_mutex_destroy(&job.lock);
+  return kEpidNoErr;
 }
@@ -41,7 +41,9 @@ extern "C" {
  * basename: basename, see documentation for details
  * basename_len: basename length
  *
- * *rl: revocation lists
+ * *rl: revocation lists files, may be NULL. ver_rl is not used. The
+ *      files are parsed on every call; use EpidApiRevocationListsCreate
+ *      and a verifier handle to parse them once.
  *
  * buf_pubkey: public key format:  (data, size(byte))
  *      groupID:      16
@@ -98,6 +100,188 @@ EpidStatus EpidApiVerifyPrecomp(void const* buf_key,
                                 size_t buf_key_size,
                                 void* buf_precomp,
                                 size_t buf_size);
+
+/* Verifier for one group public key and hash algorithm that can check many
+ * signatures. Creating a verifier costs far more than one verification. A
+ * handle must only be used by one thread at a time.
+ */
+typedef struct EpidApiVerifier EpidApiVerifier;
+
+/* Create a verifier.
+ *
+ * input:
+ * buf_pubkey: public key, same format as EpidApiVerify
+ * buf_pubkey_size: 272
+ * buf_precomp: precomp blob from EpidApiVerifyPrecomp, no use if NULL
+ * precomp_size: 1552
+ * hash_algo: digest sha-256 ->0; sha-512->2
+ *
+ * output:
+ * verifier: new handle, release with EpidApiVerifierClose
+ *
+ * return:
+ * EpidStatus 0->success; others->not
+ */
+EpidStatus EpidApiVerifierOpen(void const* buf_pubkey,
+                               size_t buf_pubkey_size,
+                               void const* buf_precomp,
+                               size_t buf_precomp_size,
+                               HashAlg hash_alg,
+                               EpidApiVerifier** verifier);
+
+/* Verify EPID signature with an open verifier. The basename is only
+ * handed to the SDK again when it changes between calls.
+ *
+ * return:
+ * EpidStatus 0->verified; others->not
+ */
+EpidStatus EpidApiVerifyWithHandle(EpidApiVerifier* verifier,
+                                   void const* sig,
+                                   size_t sig_len,
+                                   void const* msg,
+                                   size_t msg_len,
+                                   void const* basename,
+                                   size_t basename_len);
+
+/* Free verifier. verifier may be NULL. */
+void EpidApiVerifierClose(EpidApiVerifier* verifier);
+
+/* Parsed revocation lists shared by verifiers. Each list file is read once
+ * when added; the group RL is kept as a hash set of revoked GroupIds. The
+ * lists are reference counted and must not be changed once handed to a
+ * verifier or cache; to update, build new lists and swap them in.
+ */
+typedef struct EpidApiRevocationLists EpidApiRevocationLists;
+
+/* Create revocation lists.
+ *
+ * input:
+ * signed_grp_rl: group RL file, EpidFileHeader + GroupRl + EcdsaSignature,
+ *      may be NULL. The file signature is not checked.
+ * signed_grp_rl_size: size of signed_grp_rl
+ *
+ * output:
+ * rls: new lists with one reference, see EpidApiRevocationListsRelease
+ *
+ * return:
+ * EpidStatus 0->success; others->not
+ */
+EpidStatus EpidApiRevocationListsCreate(void const* signed_grp_rl,
+                                        size_t signed_grp_rl_size,
+                                        EpidApiRevocationLists** rls);
+
+/* Add the private key RL file of one group, replacing an earlier one for
+ * the same group. The file signature is not checked.
+ */
+EpidStatus EpidApiRevocationListsAddPrivRl(EpidApiRevocationLists* rls,
+                                           void const* signed_priv_rl,
+                                           size_t signed_priv_rl_size);
+
+/* Add the signature RL file of one group, replacing an earlier one for the
+ * same group. The file signature is not checked.
+ */
+EpidStatus EpidApiRevocationListsAddSigRl(EpidApiRevocationLists* rls,
+                                          void const* signed_sig_rl,
+                                          size_t signed_sig_rl_size);
+
+/* Whether the group RL in rls revokes gid, in constant time. */
+bool EpidApiRevocationListsIsGroupRevoked(EpidApiRevocationLists const* rls,
+                                          GroupId const* gid);
+
+/* Drop a reference to rls. rls may be NULL. */
+void EpidApiRevocationListsRelease(EpidApiRevocationLists* rls);
+
+/* Make verifier check signatures against rls, which it references until
+ * closed or given other lists. If verifier's group is revoked, every
+ * signature fails with kEpidSigRevokedInGroupRl. NULL removes the lists.
+ *
+ * return:
+ * EpidStatus 0->success; others->not
+ */
+EpidStatus EpidApiVerifierSetRevocationLists(EpidApiVerifier* verifier,
+                                             EpidApiRevocationLists* rls);
+
+/* Thread-safe cache of idle verifiers keyed by group public key and hash
+ * algorithm, so that verifiers for the few groups a backend sees are
+ * created once and reused.
+ */
+typedef struct EpidApiVerifierCache EpidApiVerifierCache;
+
+/* Create a cache holding at most max_idle idle verifiers. */
+EpidStatus EpidApiVerifierCacheCreate(size_t max_idle,
+                                      EpidApiVerifierCache** cache);
+
+/* Free cache and every idle verifier in it. Verifiers still acquired
+ * must be closed with EpidApiVerifierClose instead of released. cache may
+ * be NULL.
+ */
+void EpidApiVerifierCacheDelete(EpidApiVerifierCache* cache);
+
+/* Take an idle verifier for buf_pubkey and hash_alg out of cache, or
+ * create one if there is none. buf_precomp is only used for creating.
+ * The caller has exclusive use of *verifier until it is handed back with
+ * EpidApiVerifierCacheRelease.
+ */
+EpidStatus EpidApiVerifierCacheAcquire(EpidApiVerifierCache* cache,
+                                       void const* buf_pubkey,
+                                       size_t buf_pubkey_size,
+                                       void const* buf_precomp,
+                                       size_t buf_precomp_size,
+                                       HashAlg hash_alg,
+                                       EpidApiVerifier** verifier);
+
+/* Hand verifier back to cache. If the cache is full, the oldest idle
+ * verifier is closed.
+ */
+void EpidApiVerifierCacheRelease(EpidApiVerifierCache* cache,
+                                 EpidApiVerifier* verifier);
+
+/* Swap the revocation lists of cache atomically. Verifiers acquired from
+ * now on check against rls; verifiers already acquired finish with the
+ * lists they had. The cache takes its own reference to rls, which may be
+ * NULL.
+ */
+void EpidApiVerifierCacheSetRevocationLists(EpidApiVerifierCache* cache,
+                                             EpidApiRevocationLists* rls);
+
+/* One signature and the message it signs, for EpidApiVerifyBatch. */
+typedef struct EpidApiSignedMsg {
+  void const* sig;
+  size_t sig_len;
+  void const* msg;
+  size_t msg_len;
+} EpidApiSignedMsg;
+
+/* Verify count signatures made by members of one group.
+ *
+ * input:
+ * cache: verifiers are taken from and returned to cache, and check its
+ *      revocation lists. May be NULL.
+ * buf_pubkey, buf_precomp, hash_alg: as for EpidApiVerifierOpen
+ * basename: basename shared by all signatures
+ * msgs: signatures and messages
+ * num_threads: number of worker threads, each with its own verifier.
+ *      0 or 1 verifies on the calling thread.
+ *
+ * output:
+ * results: verification status of msgs[i] in results[i]
+ *
+ * return:
+ * EpidStatus 0->all signatures were checked and results filled in;
+ * others->the batch could not be run
+ */
+EpidStatus EpidApiVerifyBatch(EpidApiVerifierCache* cache,
+                              void const* buf_pubkey,
+                              size_t buf_pubkey_size,
+                              void const* buf_precomp,
+                              size_t buf_precomp_size,
+                              HashAlg hash_alg,
+                              void const* basename,
+                              size_t basename_len,
+                              EpidApiSignedMsg const* msgs,
+                              size_t count,
+                              size_t num_threads,
+                              EpidStatus* results);
 #if defined __cplusplus
 }
 #endif  // defined __cplusplus
@@ -21,9 +21,11 @@
   3. verify a EPID key certificate
 """
 
+from ctypes import c_char_p
 from ctypes import c_int
 from ctypes import c_size_t
 from ctypes import c_ubyte
+from ctypes import c_void_p
 from ctypes import cdll
 from ctypes import create_string_buffer
 from ctypes import POINTER
@@ -37,6 +39,13 @@ from pyasn1.type import namedtype
 from pyasn1.type import univ
 import sh
 
+# Native bindings, built with setup.py. They avoid copying the inputs and
+# release the GIL while signing and verifying.
+try:
+  import epid_native  # pylint: disable=g-import-not-at-top
+except ImportError:
+  epid_native = None
+
 # EPID signature size without signature RL
 EPID_SIG_SIZE = 360
 # 256bit ECC curve byte size is 32
@@ -192,6 +201,9 @@ def signmsg_atap(key, msg, hashalgo='SHA-512'):
   except RuntimeError as e:
     raise e
 
+  if epid_native:
+    return epid_native.sign_atap(msg, key, hashalg.value)
+
   # create buffer to store signature
   sig = (c_ubyte * EPID_SIG_SIZE).from_buffer(bytearray(EPID_SIG_SIZE))
   sig_p = POINTER(c_ubyte)(sig)
@@ -225,6 +237,172 @@ def signmsg_atap(key, msg, hashalgo='SHA-512'):
   return bytes(bytearray(sig[0:360]))
 
 
+class EpidMember(object):
+  """A provisioned EPID member that signs many messages with one key.
+
+  Setting up a member takes much longer than a signature, so use this
+  instead of signmsg_atap() to sign repeatedly with the same key. Call
+  close() when done, or use the member as a context manager.
+  """
+
+  def __init__(self, key, hashalgo='SHA-512', precomp=None):
+    """Provisions a member.
+
+    Args:
+      key: size must be 400; same format as signmsg_atap()
+      hashalgo: supported option see: _HASH_ALGOS
+      precomp: optional precomp blob for key, size 1536
+
+    Raises:
+      RuntimeError: Errors while provisioning
+    """
+    hashalg = convertHashAlg(hashalgo)
+    self._native = None
+    self._handle = None
+    if epid_native:
+      self._native = epid_native.Member(key, hashalg.value, precomp)
+      return
+    self._helper = cdll.LoadLibrary('./libepid.so')
+    self._helper.EpidApiMemberOpen.argtypes = [
+        POINTER(c_ubyte), c_size_t,
+        POINTER(c_ubyte), c_size_t,
+        c_int,
+        POINTER(c_void_p)
+    ]
+    self._helper.EpidApiSignWithHandle.argtypes = [
+        c_void_p,
+        POINTER(c_ubyte), c_size_t,
+        POINTER(c_ubyte), c_size_t,
+        POINTER(c_ubyte), POINTER(c_size_t)
+    ]
+    self._helper.EpidApiMemberClose.argtypes = [c_void_p]
+    self._helper.EpidApiMemberClose.restype = None
+    self._sig_size = EPID_SIG_SIZE
+
+    self._handle = c_void_p()
+    if precomp:
+      precomp_p = POINTER(c_ubyte)(create_string_buffer(precomp))
+    else:
+      precomp_p = None
+    status = self._helper.EpidApiMemberOpen(
+        POINTER(c_ubyte)(create_string_buffer(key)), len(key),
+        precomp_p, len(precomp) if precomp else 0,
+        hashalg,
+        POINTER(c_void_p)(self._handle)
+    )
+    if status:
+      self._handle = None
+      raise RuntimeError('member creation failed: ', status)
+
+  def sign(self, msg):
+    """Create signature with the member's key.
+
+    Args:
+      msg: message to sign
+
+    Returns:
+      signature: size=360, plus 160 per entry of the SigRl if one is set
+
+    Raises:
+      RuntimeError: Errors while signing
+    """
+    if self._native:
+      return self._native.sign(msg)
+    if not self._handle:
+      raise RuntimeError('member is closed')
+    sig = (c_ubyte * self._sig_size).from_buffer(bytearray(self._sig_size))
+    sig_len = c_size_t(self._sig_size)
+    status = self._helper.EpidApiSignWithHandle(
+        self._handle,
+        POINTER(c_ubyte)(create_string_buffer(msg)), len(msg),
+        None, 0,
+        POINTER(c_ubyte)(sig), POINTER(c_size_t)(sig_len)
+    )
+    if status:
+      raise RuntimeError('signature failed: ', status)
+    return bytes(bytearray(sig[0:sig_len.value]))
+
+  def set_sig_rl(self, sig_rl):
+    """Sets the signature revocation list used for later signatures.
+
+    The list is parsed once here, not on every sign().
+
+    Args:
+      sig_rl: SigRl file, EpidFileHeader + SigRl + EcdsaSignature
+
+    Raises:
+      RuntimeError: Errors while parsing or setting the list
+    """
+    if self._native:
+      self._native.set_sig_rl(sig_rl)
+      return
+    if not self._handle:
+      raise RuntimeError('member is closed')
+    self._helper.EpidApiMemberSetSigRl.argtypes = [
+        c_void_p, POINTER(c_ubyte), c_size_t
+    ]
+    self._helper.EpidApiMemberGetSigSize.argtypes = [c_void_p]
+    self._helper.EpidApiMemberGetSigSize.restype = c_size_t
+    status = self._helper.EpidApiMemberSetSigRl(
+        self._handle,
+        POINTER(c_ubyte)(create_string_buffer(sig_rl)), len(sig_rl)
+    )
+    if status:
+      raise RuntimeError('setting SigRl failed: ', status)
+    self._sig_size = self._helper.EpidApiMemberGetSigSize(self._handle)
+
+  def close(self):
+    """Clears the member's key material."""
+    if self._native:
+      self._native.close()
+    if self._handle:
+      self._helper.EpidApiMemberClose(self._handle)
+      self._handle = None
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, exc_type, exc_value, traceback):
+    self.close()
+
+  def __del__(self):
+    self.close()
+
+
+_precomp_cache = c_void_p()
+
+
+def use_precomp_cache(path):
+  """Keeps precomp blobs in the file at path across runs.
+
+  Signing and verification without a precomp blob look the key up there,
+  and store what they compute, so the pairing precomputation runs once per
+  key rather than once per process.
+
+  Args:
+    path: cache file, created if missing. None stops using the cache.
+
+  Raises:
+    RuntimeError: Errors while opening the file
+  """
+  helper = cdll.LoadLibrary('./libepid.so')
+  helper.EpidApiPrecompCacheOpen.argtypes = [c_char_p, POINTER(c_void_p)]
+  helper.EpidApiPrecompCacheSetDefault.argtypes = [c_void_p]
+  helper.EpidApiPrecompCacheSetDefault.restype = None
+  helper.EpidApiPrecompCacheClose.argtypes = [c_void_p]
+  helper.EpidApiPrecompCacheClose.restype = None
+
+  cache = c_void_p()
+  if path is not None:
+    status = helper.EpidApiPrecompCacheOpen(path, POINTER(c_void_p)(cache))
+    if status:
+      raise RuntimeError('opening precomp cache failed: ', status)
+  helper.EpidApiPrecompCacheSetDefault(cache)
+  if _precomp_cache:
+    helper.EpidApiPrecompCacheClose(_precomp_cache)
+  _precomp_cache.value = cache.value
+
+
 def verifysig(sig, msg, pubkey, hashalgo='SHA-512'):
   """Verify EPID key signature.
 
@@ -247,6 +425,9 @@ def verifysig(sig, msg, pubkey, hashalgo='SHA-512'):
   except RuntimeError:
     return False
 
+  if epid_native:
+    return epid_native.verify(sig, msg, pubkey, hashalg.value) == 0
+
   helper = cdll.LoadLibrary('./libepid.so')
   verify = helper.EpidApiVerify
   verify.argtypes = [
@@ -19,6 +19,7 @@
 Tests include EPID signature/verification and EPID certificate check.
 """
 
+from ctypes import cdll
 import datetime
 import epid_interface
 import hashlib
@@ -64,6 +65,41 @@ class EpidSignatureTest(unittest.TestCase):
                     sig, msg, self.g1pubkey, '-sha512'))
 
 
+def hasMemberApi():
+  # the prebuilt libepid.so may predate the member handle API
+  try:
+    return hasattr(cdll.LoadLibrary('./libepid.so'), 'EpidApiMemberOpen')
+  except OSError:
+    return False
+
+
+@unittest.skipUnless(hasMemberApi(), 'libepid.so has no member handle API')
+class EpidMemberTest(unittest.TestCase):
+  g1pubkey = epid_interface.read_file('../testdata/group1pubkey.bin')
+  g1privkey1 = epid_interface.read_file('../testdata/group1privkey1.bin')
+
+  # test signing several messages with one member
+  def testMemberSignVerify(self):
+    with epid_interface.EpidMember(self.g1privkey1) as member:
+      sig1 = member.sign('test message1')
+      sig2 = member.sign('test message2')
+    self.assertTrue(epid_interface.verifysig(
+        sig1, 'test message1', self.g1pubkey))
+    self.assertTrue(epid_interface.verifysig(
+        sig2, 'test message2', self.g1pubkey))
+    self.assertFalse(epid_interface.verifysig(
+        sig2, 'test message1', self.g1pubkey))
+
+  def testMemberClosed(self):
+    member = epid_interface.EpidMember(self.g1privkey1)
+    member.close()
+    self.assertRaises(RuntimeError, member.sign, 'test message')
+
+  def testMemberBadKey(self):
+    self.assertRaises(RuntimeError, epid_interface.EpidMember,
+                      self.g1privkey1[:-1])
+
+
 def checkTempFiles():
   # check tmp files are not deleted
   files = sh.ls().splitlines()
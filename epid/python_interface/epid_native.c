@@ -0,0 +1,573 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Native python bindings for libepid.
+ *
+ * Inputs are taken through the buffer protocol without copying, and the
+ * GIL is released while signing, verifying and precomputing, so several
+ * python threads can use separate cores. A Member or Verifier may be shared
+ * between threads; calls on one handle are serialized by its lock.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pythread.h>
+
+#include "interface/signmsg.h"
+#include "interface/verifysig.h"
+
+#if PY_MAJOR_VERSION >= 3
+#define BUF "y*"
+#else
+#define BUF "s*"
+#endif
+#define OPT_BUF "z*"
+
+/* Size of a signature made without a SigRl. */
+#define EPID_SIG_SIZE 360
+/* Idle verifiers kept by verify_batch(). */
+#define VERIFIER_CACHE_SIZE 16
+
+static PyObject* EpidError;
+static EpidApiVerifierCache* verifier_cache;
+
+static PyObject* raise_status(const char* what, EpidStatus sts) {
+  PyErr_Format(EpidError, "%s failed: %d", what, (int)sts);
+  return NULL;
+}
+
+static void release_buffers(Py_buffer* bufs, size_t count) {
+  size_t i;
+  for (i = 0; i < count; ++i) {
+    if (bufs[i].obj) {
+      PyBuffer_Release(&bufs[i]);
+    }
+  }
+}
+
+/* Member */
+
+typedef struct {
+  PyObject_HEAD
+  EpidApiMember* member;
+  PyThread_type_lock lock;
+} MemberObject;
+
+static int Member_init(MemberObject* self, PyObject* args, PyObject* kwds) {
+  static char* kwlist[] = {"key", "hashalg", "precomp", NULL};
+  Py_buffer key = {0}, precomp = {0};
+  int hashalg = kSha512;
+  EpidApiMember* member = NULL;
+  EpidApiMember* old = NULL;
+  EpidStatus sts;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, BUF "|i" OPT_BUF, kwlist,
+                                   &key, &hashalg, &precomp)) {
+    return -1;
+  }
+  Py_BEGIN_ALLOW_THREADS
+  sts = EpidApiMemberOpen(key.buf, key.len, precomp.buf, precomp.len,
+                          (HashAlg)hashalg, &member);
+  Py_END_ALLOW_THREADS
+  PyBuffer_Release(&key);
+  if (precomp.obj) PyBuffer_Release(&precomp);
+  if (sts != kEpidNoErr) {
+    raise_status("member creation", sts);
+    return -1;
+  }
+
+  if (!self->lock) {
+    self->lock = PyThread_allocate_lock();
+    if (!self->lock) {
+      EpidApiMemberClose(member);
+      PyErr_NoMemory();
+      return -1;
+    }
+  }
+  /* a sign or verify call may be using the old handle, so it is swapped
+   * under the lock and closed after */
+  Py_BEGIN_ALLOW_THREADS
+  PyThread_acquire_lock(self->lock, WAIT_LOCK);
+  old = self->member;
+  self->member = member;
+  PyThread_release_lock(self->lock);
+  EpidApiMemberClose(old);
+  Py_END_ALLOW_THREADS
+  return 0;
+}
+
+static PyObject* Member_close(MemberObject* self, PyObject* unused) {
+  EpidApiMember* member = NULL;
+  (void)unused;
+  if (self->lock) {
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(self->lock, WAIT_LOCK);
+    member = self->member;
+    self->member = NULL;
+    PyThread_release_lock(self->lock);
+    EpidApiMemberClose(member);
+    Py_END_ALLOW_THREADS
+  }
+  Py_RETURN_NONE;
+}
+
+static void Member_dealloc(MemberObject* self) {
+  EpidApiMemberClose(self->member);
+  if (self->lock) PyThread_free_lock(self->lock);
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* Member_sign(MemberObject* self, PyObject* args,
+                             PyObject* kwds) {
+  static char* kwlist[] = {"msg", "basename", NULL};
+  Py_buffer msg = {0}, basename = {0};
+  PyObject* sig = NULL;
+  size_t sig_len = 0;
+  size_t required_len = 0;
+  EpidStatus sts = kEpidBadArgErr;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, BUF "|" OPT_BUF, kwlist, &msg,
+                                   &basename)) {
+    return NULL;
+  }
+  if (!self->lock) {
+    PyErr_SetString(PyExc_RuntimeError, "member is not initialized");
+    goto out;
+  }
+  /* The signature size depends on the SigRl, which set_sig_rl() may
+   * replace, so it is read under the lock and checked again before
+   * signing. sig is not visible to other threads until it is returned.
+   */
+  for (;;) {
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(self->lock, WAIT_LOCK);
+    required_len = 0;
+    if (self->member) {
+      required_len = EpidApiMemberGetSigSize(self->member);
+      if (sig && sig_len >= required_len) {
+        sts = EpidApiSignWithHandle(self->member, msg.buf, msg.len,
+                                    basename.buf, basename.len,
+                                    PyBytes_AS_STRING(sig), &sig_len);
+      }
+    }
+    PyThread_release_lock(self->lock);
+    Py_END_ALLOW_THREADS
+    if (!required_len) {
+      Py_CLEAR(sig);
+      PyErr_SetString(EpidError, "member is closed");
+      goto out;
+    }
+    if (sig && sig_len >= required_len) {
+      break;
+    }
+    Py_CLEAR(sig);
+    sig_len = required_len;
+    sig = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)sig_len);
+    if (!sig) {
+      goto out;
+    }
+  }
+  if (sts != kEpidNoErr) {
+    Py_CLEAR(sig);
+    raise_status("signature", sts);
+    goto out;
+  }
+  if ((Py_ssize_t)sig_len != PyBytes_GET_SIZE(sig)) {
+    _PyBytes_Resize(&sig, (Py_ssize_t)sig_len);
+  }
+
+out:
+  PyBuffer_Release(&msg);
+  if (basename.obj) PyBuffer_Release(&basename);
+  return sig;
+}
+
+static PyObject* Member_set_sig_rl(MemberObject* self, PyObject* args) {
+  Py_buffer sig_rl = {0};
+  EpidStatus sts = kEpidBadArgErr;
+
+  if (!PyArg_ParseTuple(args, BUF, &sig_rl)) {
+    return NULL;
+  }
+  if (!self->lock) {
+    PyBuffer_Release(&sig_rl);
+    PyErr_SetString(PyExc_RuntimeError, "member is not initialized");
+    return NULL;
+  }
+  Py_BEGIN_ALLOW_THREADS
+  PyThread_acquire_lock(self->lock, WAIT_LOCK);
+  if (self->member) {
+    sts = EpidApiMemberSetSigRl(self->member, sig_rl.buf, sig_rl.len);
+  }
+  PyThread_release_lock(self->lock);
+  Py_END_ALLOW_THREADS
+  PyBuffer_Release(&sig_rl);
+  if (sts != kEpidNoErr) {
+    return raise_status("setting SigRl", sts);
+  }
+  Py_RETURN_NONE;
+}
+
+static PyMethodDef Member_methods[] = {
+    {"sign", (PyCFunction)Member_sign, METH_VARARGS | METH_KEYWORDS,
+     "sign(msg, basename=None) -> signature"},
+    {"set_sig_rl", (PyCFunction)Member_set_sig_rl, METH_VARARGS,
+     "set_sig_rl(sig_rl): use a SigRl file for later signatures"},
+    {"close", (PyCFunction)Member_close, METH_NOARGS,
+     "close(): clear the key material"},
+    {NULL, NULL, 0, NULL},
+};
+
+static PyTypeObject MemberType = {
+    PyVarObject_HEAD_INIT(NULL, 0) "epid_native.Member",
+    sizeof(MemberObject),
+};
+
+/* Verifier */
+
+typedef struct {
+  PyObject_HEAD
+  EpidApiVerifier* verifier;
+  PyThread_type_lock lock;
+} VerifierObject;
+
+static int Verifier_init(VerifierObject* self, PyObject* args,
+                         PyObject* kwds) {
+  static char* kwlist[] = {"pubkey", "hashalg", "precomp", NULL};
+  Py_buffer pubkey = {0}, precomp = {0};
+  int hashalg = kSha512;
+  EpidApiVerifier* verifier = NULL;
+  EpidApiVerifier* old = NULL;
+  EpidStatus sts;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, BUF "|i" OPT_BUF, kwlist,
+                                   &pubkey, &hashalg, &precomp)) {
+    return -1;
+  }
+  Py_BEGIN_ALLOW_THREADS
+  sts = EpidApiVerifierOpen(pubkey.buf, pubkey.len, precomp.buf, precomp.len,
+                            (HashAlg)hashalg, &verifier);
+  Py_END_ALLOW_THREADS
+  PyBuffer_Release(&pubkey);
+  if (precomp.obj) PyBuffer_Release(&precomp);
+  if (sts != kEpidNoErr) {
+    raise_status("verifier creation", sts);
+    return -1;
+  }
+
+  if (!self->lock) {
+    self->lock = PyThread_allocate_lock();
+    if (!self->lock) {
+      EpidApiVerifierClose(verifier);
+      PyErr_NoMemory();
+      return -1;
+    }
+  }
+  /* a sign or verify call may be using the old handle, so it is swapped
+   * under the lock and closed after */
+  Py_BEGIN_ALLOW_THREADS
+  PyThread_acquire_lock(self->lock, WAIT_LOCK);
+  old = self->verifier;
+  self->verifier = verifier;
+  PyThread_release_lock(self->lock);
+  EpidApiVerifierClose(old);
+  Py_END_ALLOW_THREADS
+  return 0;
+}
+
+static PyObject* Verifier_close(VerifierObject* self, PyObject* unused) {
+  EpidApiVerifier* verifier = NULL;
+  (void)unused;
+  if (self->lock) {
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(self->lock, WAIT_LOCK);
+    verifier = self->verifier;
+    self->verifier = NULL;
+    PyThread_release_lock(self->lock);
+    EpidApiVerifierClose(verifier);
+    Py_END_ALLOW_THREADS
+  }
+  Py_RETURN_NONE;
+}
+
+static void Verifier_dealloc(VerifierObject* self) {
+  EpidApiVerifierClose(self->verifier);
+  if (self->lock) PyThread_free_lock(self->lock);
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* Verifier_verify(VerifierObject* self, PyObject* args,
+                                 PyObject* kwds) {
+  static char* kwlist[] = {"sig", "msg", "basename", NULL};
+  Py_buffer sig = {0}, msg = {0}, basename = {0};
+  EpidStatus sts = kEpidBadArgErr;
+  bool closed = false;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, BUF BUF "|" OPT_BUF, kwlist,
+                                   &sig, &msg, &basename)) {
+    return NULL;
+  }
+  if (!self->lock) {
+    PyBuffer_Release(&sig);
+    PyBuffer_Release(&msg);
+    if (basename.obj) PyBuffer_Release(&basename);
+    PyErr_SetString(PyExc_RuntimeError, "verifier is not initialized");
+    return NULL;
+  }
+  Py_BEGIN_ALLOW_THREADS
+  PyThread_acquire_lock(self->lock, WAIT_LOCK);
+  if (self->verifier) {
+    sts = EpidApiVerifyWithHandle(self->verifier, sig.buf, sig.len, msg.buf,
+                                  msg.len, basename.buf, basename.len);
+  } else {
+    closed = true;
+  }
+  PyThread_release_lock(self->lock);
+  Py_END_ALLOW_THREADS
+  PyBuffer_Release(&sig);
+  PyBuffer_Release(&msg);
+  if (basename.obj) PyBuffer_Release(&basename);
+  if (closed) {
+    PyErr_SetString(EpidError, "verifier is closed");
+    return NULL;
+  }
+  return PyLong_FromLong((long)sts);
+}
+
+static PyMethodDef Verifier_methods[] = {
+    {"verify", (PyCFunction)Verifier_verify, METH_VARARGS | METH_KEYWORDS,
+     "verify(sig, msg, basename=None) -> status, 0 if verified"},
+    {"close", (PyCFunction)Verifier_close, METH_NOARGS,
+     "close(): free the verifier"},
+    {NULL, NULL, 0, NULL},
+};
+
+static PyTypeObject VerifierType = {
+    PyVarObject_HEAD_INIT(NULL, 0) "epid_native.Verifier",
+    sizeof(VerifierObject),
+};
+
+/* Module functions */
+
+static PyObject* sign_atap(PyObject* module, PyObject* args, PyObject* kwds) {
+  static char* kwlist[] = {"msg", "key", "hashalg", "precomp", NULL};
+  Py_buffer msg = {0}, key = {0}, precomp = {0};
+  int hashalg = kSha512;
+  PyObject* sig = NULL;
+  size_t sig_len = 0;
+  EpidStatus sts;
+  (void)module;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, BUF BUF "|i" OPT_BUF, kwlist,
+                                   &msg, &key, &hashalg, &precomp)) {
+    return NULL;
+  }
+  sig_len = EPID_SIG_SIZE;
+  sig = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)sig_len);
+  if (sig) {
+    Py_BEGIN_ALLOW_THREADS
+    sts = EpidApiSignAtap(msg.buf, msg.len, NULL, 0, key.buf, key.len, NULL, 0,
+                          precomp.buf, precomp.len, (HashAlg)hashalg,
+                          PyBytes_AS_STRING(sig), &sig_len);
+    Py_END_ALLOW_THREADS
+    if (sts != kEpidNoErr) {
+      Py_CLEAR(sig);
+      raise_status("signature", sts);
+    }
+  }
+  PyBuffer_Release(&msg);
+  PyBuffer_Release(&key);
+  if (precomp.obj) PyBuffer_Release(&precomp);
+  return sig;
+}
+
+static PyObject* verify(PyObject* module, PyObject* args, PyObject* kwds) {
+  static char* kwlist[] = {"sig", "msg", "pubkey", "hashalg", "precomp",
+                           NULL};
+  Py_buffer sig = {0}, msg = {0}, pubkey = {0}, precomp = {0};
+  int hashalg = kSha512;
+  EpidStatus sts;
+  (void)module;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, BUF BUF BUF "|i" OPT_BUF,
+                                   kwlist, &sig, &msg, &pubkey, &hashalg,
+                                   &precomp)) {
+    return NULL;
+  }
+  Py_BEGIN_ALLOW_THREADS
+  sts = EpidApiVerify(sig.buf, sig.len, msg.buf, msg.len, NULL, 0, NULL, 0,
+                      NULL, 0, NULL, 0, NULL, 0, pubkey.buf, pubkey.len,
+                      precomp.buf, precomp.len, (HashAlg)hashalg);
+  Py_END_ALLOW_THREADS
+  PyBuffer_Release(&sig);
+  PyBuffer_Release(&msg);
+  PyBuffer_Release(&pubkey);
+  if (precomp.obj) PyBuffer_Release(&precomp);
+  return PyLong_FromLong((long)sts);
+}
+
+static PyObject* verify_batch(PyObject* module, PyObject* args,
+                              PyObject* kwds) {
+  static char* kwlist[] = {"pubkey", "items",   "hashalg", "precomp",
+                           "basename", "threads", NULL};
+  Py_buffer pubkey = {0}, precomp = {0}, basename = {0};
+  PyObject* items = NULL;
+  PyObject* seq = NULL;
+  PyObject* result = NULL;
+  Py_buffer* bufs = NULL;
+  EpidApiSignedMsg* msgs = NULL;
+  EpidStatus* statuses = NULL;
+  Py_ssize_t count = 0, i;
+  int hashalg = kSha512;
+  int threads = 0;
+  EpidStatus sts;
+  (void)module;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds,
+                                   BUF "O|i" OPT_BUF OPT_BUF "i", kwlist,
+                                   &pubkey, &items, &hashalg, &precomp,
+                                   &basename, &threads)) {
+    return NULL;
+  }
+  seq = PySequence_Fast(items, "items must be a sequence of (sig, msg)");
+  if (!seq) {
+    goto out;
+  }
+  count = PySequence_Fast_GET_SIZE(seq);
+  bufs = (Py_buffer*)PyMem_Malloc((2 * count + 1) * sizeof(Py_buffer));
+  msgs = (EpidApiSignedMsg*)PyMem_Malloc((count + 1) *
+                                         sizeof(EpidApiSignedMsg));
+  statuses = (EpidStatus*)PyMem_Malloc((count + 1) * sizeof(EpidStatus));
+  if (!bufs || !msgs || !statuses) {
+    PyErr_NoMemory();
+    goto out;
+  }
+  memset(bufs, 0, (2 * count + 1) * sizeof(Py_buffer));
+  for (i = 0; i < count; ++i) {
+    PyObject* item = PySequence_Fast_GET_ITEM(seq, i);
+    if (!PyArg_ParseTuple(item, BUF BUF, &bufs[2 * i], &bufs[2 * i + 1])) {
+      goto out;
+    }
+    msgs[i].sig = bufs[2 * i].buf;
+    msgs[i].sig_len = bufs[2 * i].len;
+    msgs[i].msg = bufs[2 * i + 1].buf;
+    msgs[i].msg_len = bufs[2 * i + 1].len;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  sts = EpidApiVerifyBatch(verifier_cache, pubkey.buf, pubkey.len,
+                           precomp.buf, precomp.len, (HashAlg)hashalg,
+                           basename.buf, basename.len, msgs, (size_t)count,
+                           threads > 0 ? (size_t)threads : 0, statuses);
+  Py_END_ALLOW_THREADS
+  if (sts != kEpidNoErr) {
+    raise_status("batch verification", sts);
+    goto out;
+  }
+  result = PyList_New(count);
+  for (i = 0; result && i < count; ++i) {
+    PyObject* status = PyLong_FromLong((long)statuses[i]);
+    if (!status) {
+      Py_CLEAR(result);
+      break;
+    }
+    PyList_SET_ITEM(result, i, status);
+  }
+
+out:
+  if (bufs) release_buffers(bufs, 2 * (size_t)count);
+  PyMem_Free(bufs);
+  PyMem_Free(msgs);
+  PyMem_Free(statuses);
+  Py_XDECREF(seq);
+  PyBuffer_Release(&pubkey);
+  if (precomp.obj) PyBuffer_Release(&precomp);
+  if (basename.obj) PyBuffer_Release(&basename);
+  return result;
+}
+
+static PyMethodDef module_methods[] = {
+    {"sign_atap", (PyCFunction)sign_atap, METH_VARARGS | METH_KEYWORDS,
+     "sign_atap(msg, key, hashalg=2, precomp=None) -> signature"},
+    {"verify", (PyCFunction)verify, METH_VARARGS | METH_KEYWORDS,
+     "verify(sig, msg, pubkey, hashalg=2, precomp=None) -> status"},
+    {"verify_batch", (PyCFunction)verify_batch, METH_VARARGS | METH_KEYWORDS,
+     "verify_batch(pubkey, [(sig, msg), ...], hashalg=2, precomp=None, "
+     "basename=None, threads=0) -> [status, ...]"},
+    {NULL, NULL, 0, NULL},
+};
+
+static int init_types(PyObject* module) {
+  MemberType.tp_flags = Py_TPFLAGS_DEFAULT;
+  MemberType.tp_doc = "Member(key, hashalg=2, precomp=None)";
+  MemberType.tp_new = PyType_GenericNew;
+  MemberType.tp_init = (initproc)Member_init;
+  MemberType.tp_dealloc = (destructor)Member_dealloc;
+  MemberType.tp_methods = Member_methods;
+  VerifierType.tp_flags = Py_TPFLAGS_DEFAULT;
+  VerifierType.tp_doc = "Verifier(pubkey, hashalg=2, precomp=None)";
+  VerifierType.tp_new = PyType_GenericNew;
+  VerifierType.tp_init = (initproc)Verifier_init;
+  VerifierType.tp_dealloc = (destructor)Verifier_dealloc;
+  VerifierType.tp_methods = Verifier_methods;
+  if (PyType_Ready(&MemberType) < 0 || PyType_Ready(&VerifierType) < 0) {
+    return -1;
+  }
+  if (!verifier_cache &&
+      EpidApiVerifierCacheCreate(VERIFIER_CACHE_SIZE, &verifier_cache) !=
+          kEpidNoErr) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  EpidError = PyErr_NewException("epid_native.EpidError", PyExc_RuntimeError,
+                                 NULL);
+  if (!EpidError) {
+    return -1;
+  }
+  Py_INCREF(&MemberType);
+  Py_INCREF(&VerifierType);
+  Py_INCREF(EpidError);
+  PyModule_AddObject(module, "Member", (PyObject*)&MemberType);
+  PyModule_AddObject(module, "Verifier", (PyObject*)&VerifierType);
+  PyModule_AddObject(module, "EpidError", EpidError);
+  PyModule_AddIntConstant(module, "SHA256", kSha256);
+  PyModule_AddIntConstant(module, "SHA512", kSha512);
+  return 0;
+}
+
+#if PY_MAJOR_VERSION >= 3
+static struct PyModuleDef epid_native_module = {
+    PyModuleDef_HEAD_INIT, "epid_native", "Native bindings for libepid", -1,
+    module_methods,
+};
+
+PyMODINIT_FUNC PyInit_epid_native(void) {
+  PyObject* module = PyModule_Create(&epid_native_module);
+  if (module && init_types(module) < 0) {
+    Py_CLEAR(module);
+  }
+  return module;
+}
+#else
+PyMODINIT_FUNC initepid_native(void) {
+  PyObject* module =
+      Py_InitModule3("epid_native", module_methods,
+                     "Native bindings for libepid");
+  if (module) {
+    init_types(module);
+  }
+}
+#endif
@@ -0,0 +1,48 @@
+#
+# Copyright 2018 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+"""Builds epid_native, the native python bindings for libepid.
+
+  EPID_SDK=<path to platform/external/epid-sdk> \
+      python setup.py build_ext --inplace
+
+libepid.so in this directory is linked, and loaded from here at run time.
+epid_interface uses the module when it is built, and ctypes otherwise.
+"""
+
+import os
+
+from setuptools import Extension
+from setuptools import setup
+
+_HERE = os.path.dirname(os.path.abspath(__file__))
+_SDK = os.environ.get('EPID_SDK')
+if not _SDK:
+  raise SystemExit('set EPID_SDK to the epid-sdk source directory')
+
+setup(
+    name='epid_native',
+    ext_modules=[
+        Extension(
+            'epid_native',
+            sources=['epid_native.c'],
+            include_dirs=[os.path.join(_HERE, '..'), _SDK],
+            library_dirs=[_HERE],
+            libraries=[':libepid.so'],
+            runtime_library_dirs=['$ORIGIN'],
+        )
+    ],
+)
@@ -14,12 +14,15 @@
  * limitations under the License.
  */
 
+#include "interface/precomp_cache.h"
 #include "interface/signmsg.h"
 #include "interface/verifysig.h"
+#include "test/rl_file.h"
 
 #include <cstdio>
 #include <cstdlib>
 #include <string>
+#include <vector>
 
 #include <base/files/file_util.h>
 #include <gtest/gtest.h>
@@ -652,3 +655,576 @@ TEST_F(EpidTest, PrecompBadInput) {
   status = verify_precomp(pubkey, &precompv);
   EXPECT_EQ(status, kEpidBadArgErr);
 }
+
+TEST_F(EpidTest, MemberHandleSignVerify) {
+  // one member handle signs several messages
+  std::string privkey, pubkey;
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Pubkey), &pubkey));
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Privkey1), &privkey));
+
+  std::string precomps(kEpidSignPrecompLen, 0), precompv;
+  HashAlg alg = kSha256;
+  EpidStatus status = sign_precomp(privkey, &precomps);
+  EXPECT_EQ(status, kEpidNoErr);
+
+  EpidApiMember* member = nullptr;
+  status = EpidApiMemberOpen(privkey.data(), privkey.size(), precomps.data(),
+                             precomps.size(), alg, &member);
+  ASSERT_EQ(status, kEpidNoErr);
+  ASSERT_NE(member, nullptr);
+
+  std::string sigs[3];
+  for (int i = 0; i < 3; ++i) {
+    std::string msg("test message" + std::to_string(i));
+    sigs[i].assign(kEpidSigLen, 0);
+    size_t sig_len = sigs[i].size();
+    status = EpidApiSignWithHandle(member, msg.data(), msg.size(), nullptr, 0,
+                                   &sigs[i][0], &sig_len);
+    EXPECT_EQ(status, kEpidNoErr);
+    EXPECT_EQ(sig_len, kEpidSigLen);
+    status = verify(msg, sigs[i], pubkey, precompv, alg);
+    EXPECT_EQ(status, kEpidNoErr);
+  }
+  EXPECT_NE(sigs[0], sigs[1]);
+  EXPECT_NE(sigs[1], sigs[2]);
+  EpidApiMemberClose(member);
+}
+
+TEST_F(EpidTest, MemberHandleBasename) {
+  // a basename may be used for many signatures
+  std::string privkey, pubkey;
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Pubkey), &pubkey));
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Privkey1), &privkey));
+
+  HashAlg alg = kSha512;
+  EpidApiMember* member = nullptr;
+  EpidStatus status = EpidApiMemberOpen(privkey.data(), privkey.size(),
+                                        nullptr, 0, alg, &member);
+  ASSERT_EQ(status, kEpidNoErr);
+
+  std::string msg("test message");
+  std::string basename("basename");
+  for (int i = 0; i < 2; ++i) {
+    std::string sig(kEpidSigLen, 0);
+    size_t sig_len = sig.size();
+    status = EpidApiSignWithHandle(member, msg.data(), msg.size(),
+                                   basename.data(), basename.size(), &sig[0],
+                                   &sig_len);
+    EXPECT_EQ(status, kEpidNoErr);
+    status = EpidApiVerify(sig.data(), sig.size(), msg.data(), msg.size(),
+                           basename.data(), basename.size(), nullptr, 0,
+                           nullptr, 0, nullptr, 0, nullptr, 0, pubkey.data(),
+                           pubkey.size(), nullptr, 0, alg);
+    EXPECT_EQ(status, kEpidNoErr);
+  }
+  EpidApiMemberClose(member);
+}
+
+TEST_F(EpidTest, MemberHandleBadInput) {
+  std::string privkey;
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Privkey1), &privkey));
+
+  EpidApiMember* member = nullptr;
+  EpidStatus status = EpidApiMemberOpen(privkey.data(), privkey.size() - 1,
+                                        nullptr, 0, kSha256, &member);
+  EXPECT_EQ(status, kEpidBadArgErr);
+  EXPECT_EQ(member, nullptr);
+
+  status = EpidApiMemberOpen(privkey.data(), privkey.size(), nullptr, 0,
+                             kSha256, &member);
+  ASSERT_EQ(status, kEpidNoErr);
+  std::string msg("test message");
+  std::string sig(kEpidSigLen, 0);
+  size_t sig_len = kEpidSigLen - 1;
+  status = EpidApiSignWithHandle(member, msg.data(), msg.size(), nullptr, 0,
+                                 &sig[0], &sig_len);
+  EXPECT_EQ(status, kEpidBadArgErr);
+  status = EpidApiSignWithHandle(nullptr, msg.data(), msg.size(), nullptr, 0,
+                                 &sig[0], &sig_len);
+  EXPECT_EQ(status, kEpidBadArgErr);
+  EpidApiMemberClose(member);
+  EpidApiMemberClose(nullptr);
+}
+
+TEST_F(EpidTest, VerifierHandle) {
+  // one verifier handle checks signatures from several members
+  std::string pubkey, privkeys[3];
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Pubkey), &pubkey));
+  ASSERT_TRUE(base::ReadFileToString(base::FilePath(kEpidGroup1Privkey1),
+                                     &privkeys[0]));
+  ASSERT_TRUE(base::ReadFileToString(base::FilePath(kEpidGroup1Privkey2),
+                                     &privkeys[1]));
+  ASSERT_TRUE(base::ReadFileToString(base::FilePath(kEpidGroup1Privkey3),
+                                     &privkeys[2]));
+
+  HashAlg alg = kSha256;
+  std::string precomps;
+  EpidApiVerifier* verifier = nullptr;
+  EpidStatus status = EpidApiVerifierOpen(pubkey.data(), pubkey.size(),
+                                          nullptr, 0, alg, &verifier);
+  ASSERT_EQ(status, kEpidNoErr);
+  ASSERT_NE(verifier, nullptr);
+  for (int i = 0; i < 3; ++i) {
+    std::string msg("test message" + std::to_string(i));
+    std::string sig(kEpidSigLen, 0);
+    size_t sig_len = sig.size();
+    status = sign(msg, privkeys[i], precomps, alg, &sig, &sig_len);
+    EXPECT_EQ(status, kEpidNoErr);
+    status = EpidApiVerifyWithHandle(verifier, sig.data(), sig_len,
+                                     msg.data(), msg.size(), nullptr, 0);
+    EXPECT_EQ(status, kEpidNoErr);
+    msg[0] ^= 1;
+    status = EpidApiVerifyWithHandle(verifier, sig.data(), sig_len,
+                                     msg.data(), msg.size(), nullptr, 0);
+    EXPECT_NE(status, kEpidNoErr);
+  }
+  EpidApiVerifierClose(verifier);
+  EpidApiVerifierClose(nullptr);
+
+  status = EpidApiVerifierOpen(pubkey.data(), pubkey.size() - 1, nullptr, 0,
+                               alg, &verifier);
+  EXPECT_EQ(status, kEpidBadArgErr);
+  EXPECT_EQ(verifier, nullptr);
+}
+
+TEST_F(EpidTest, VerifierCache) {
+  std::string pubkey1, pubkey2;
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Pubkey), &pubkey1));
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup2Pubkey), &pubkey2));
+
+  EpidApiVerifierCache* cache = nullptr;
+  ASSERT_EQ(EpidApiVerifierCacheCreate(2, &cache), kEpidNoErr);
+  EpidApiVerifier* v1 = nullptr;
+  EpidApiVerifier* v2 = nullptr;
+  ASSERT_EQ(EpidApiVerifierCacheAcquire(cache, pubkey1.data(), pubkey1.size(),
+                                        nullptr, 0, kSha256, &v1),
+            kEpidNoErr);
+  EpidApiVerifierCacheRelease(cache, v1);
+
+  // same group and hash reuses the idle verifier
+  ASSERT_EQ(EpidApiVerifierCacheAcquire(cache, pubkey1.data(), pubkey1.size(),
+                                        nullptr, 0, kSha256, &v2),
+            kEpidNoErr);
+  EXPECT_EQ(v1, v2);
+
+  // while it is in use, or for another key, a new one is created
+  EpidApiVerifier* v3 = nullptr;
+  ASSERT_EQ(EpidApiVerifierCacheAcquire(cache, pubkey1.data(), pubkey1.size(),
+                                        nullptr, 0, kSha256, &v3),
+            kEpidNoErr);
+  EXPECT_NE(v3, v2);
+  EpidApiVerifier* v4 = nullptr;
+  ASSERT_EQ(EpidApiVerifierCacheAcquire(cache, pubkey2.data(), pubkey2.size(),
+                                        nullptr, 0, kSha256, &v4),
+            kEpidNoErr);
+  EpidApiVerifier* v5 = nullptr;
+  ASSERT_EQ(EpidApiVerifierCacheAcquire(cache, pubkey1.data(), pubkey1.size(),
+                                        nullptr, 0, kSha512, &v5),
+            kEpidNoErr);
+  EXPECT_NE(v5, v2);
+  EXPECT_NE(v5, v3);
+
+  // releasing past capacity closes the oldest
+  EpidApiVerifierCacheRelease(cache, v2);
+  EpidApiVerifierCacheRelease(cache, v3);
+  EpidApiVerifierCacheRelease(cache, v4);
+  EpidApiVerifierCacheRelease(cache, v5);
+  EpidApiVerifierCacheDelete(cache);
+  EpidApiVerifierCacheDelete(nullptr);
+}
+
+TEST_F(EpidTest, VerifyBatch) {
+  std::string pubkey, privkey;
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Pubkey), &pubkey));
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Privkey1), &privkey));
+
+  HashAlg alg = kSha256;
+  std::string precomps;
+  constexpr size_t kCount = 40;
+  std::string msgs[kCount], sigs[kCount];
+  EpidApiSignedMsg items[kCount];
+  for (size_t i = 0; i < kCount; ++i) {
+    msgs[i] = "test message" + std::to_string(i);
+    sigs[i].assign(kEpidSigLen, 0);
+    size_t sig_len = sigs[i].size();
+    ASSERT_EQ(sign(msgs[i], privkey, precomps, alg, &sigs[i], &sig_len),
+              kEpidNoErr);
+    items[i].sig = sigs[i].data();
+    items[i].sig_len = sig_len;
+    items[i].msg = msgs[i].data();
+    items[i].msg_len = msgs[i].size();
+  }
+  // break two of them
+  msgs[3][0] ^= 1;
+  sigs[kCount - 1][kEpidSigLen / 2] ^= 1;
+
+  EpidApiVerifierCache* cache = nullptr;
+  ASSERT_EQ(EpidApiVerifierCacheCreate(4, &cache), kEpidNoErr);
+  for (size_t threads : {0, 1, 4}) {
+    EpidStatus results[kCount];
+    EpidStatus status = EpidApiVerifyBatch(
+        threads == 4 ? cache : nullptr, pubkey.data(), pubkey.size(), nullptr,
+        0, alg, nullptr, 0, items, kCount, threads, results);
+    ASSERT_EQ(status, kEpidNoErr);
+    for (size_t i = 0; i < kCount; ++i) {
+      if (i == 3 || i == kCount - 1) {
+        EXPECT_NE(results[i], kEpidNoErr) << i;
+      } else {
+        EXPECT_EQ(results[i], kEpidNoErr) << i;
+      }
+    }
+  }
+  EpidApiVerifierCacheDelete(cache);
+
+  EpidStatus results[1];
+  EXPECT_EQ(EpidApiVerifyBatch(nullptr, pubkey.data(), pubkey.size() - 1,
+                               nullptr, 0, alg, nullptr, 0, items, 1, 1,
+                               results),
+            kEpidBadArgErr);
+}
+
+TEST_F(EpidTest, MemberHandleSigRl) {
+  // signatures grow by one non-revoked proof per SigRl entry
+  std::string pubkey, privkey1, privkey2;
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Pubkey), &pubkey));
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Privkey1), &privkey1));
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Privkey2), &privkey2));
+
+  HashAlg alg = kSha256;
+  std::string precomps;
+  std::vector<std::string> revoked(3);
+  for (size_t i = 0; i < revoked.size(); ++i) {
+    std::string msg("revoked message" + std::to_string(i));
+    revoked[i].assign(kEpidSigLen, 0);
+    size_t sig_len = kEpidSigLen;
+    ASSERT_EQ(sign(msg, privkey2, precomps, alg, &revoked[i], &sig_len),
+              kEpidNoErr);
+  }
+
+  EpidApiMember* member = nullptr;
+  ASSERT_EQ(EpidApiMemberOpen(privkey1.data(), privkey1.size(), nullptr, 0,
+                              alg, &member),
+            kEpidNoErr);
+  EXPECT_EQ(EpidApiMemberGetSigSize(member), kEpidSigLen);
+
+  std::string sig_rl = BuildSigRlFile(pubkey, revoked, 1);
+  ASSERT_EQ(EpidApiMemberSetSigRl(member, sig_rl.data(), sig_rl.size()),
+            kEpidNoErr);
+  size_t expected_len = EpidApiMemberGetSigSize(member);
+  EXPECT_GT(expected_len, kEpidSigLen);
+
+  std::string msg("test message");
+  std::string sig(expected_len, 0);
+  size_t sig_len = expected_len - 1;
+  EXPECT_EQ(EpidApiSignWithHandle(member, msg.data(), msg.size(), nullptr, 0,
+                                  &sig[0], &sig_len),
+            kEpidBadArgErr);
+  for (int i = 0; i < 2; ++i) {
+    sig_len = sig.size();
+    EXPECT_EQ(EpidApiSignWithHandle(member, msg.data(), msg.size(), nullptr, 0,
+                                    &sig[0], &sig_len),
+              kEpidNoErr);
+    EXPECT_EQ(sig_len, expected_len);
+  }
+
+  // a newer list replaces the old one
+  revoked.pop_back();
+  sig_rl = BuildSigRlFile(pubkey, revoked, 2);
+  ASSERT_EQ(EpidApiMemberSetSigRl(member, sig_rl.data(), sig_rl.size()),
+            kEpidNoErr);
+  EXPECT_LT(EpidApiMemberGetSigSize(member), expected_len);
+
+  // truncated list
+  EXPECT_EQ(EpidApiMemberSetSigRl(member, sig_rl.data(), sig_rl.size() - 1),
+            kEpidBadArgErr);
+  EXPECT_EQ(EpidApiMemberSetSigRl(member, nullptr, 0), kEpidBadArgErr);
+  EpidApiMemberClose(member);
+}
+
+TEST_F(EpidTest, VerifierGroupRl) {
+  std::string pubkey1, pubkey2, privkey1, privkey2;
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Pubkey), &pubkey1));
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup2Pubkey), &pubkey2));
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Privkey1), &privkey1));
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup2Privkey1), &privkey2));
+
+  HashAlg alg = kSha256;
+  std::string precomps, precompv;
+  std::string msg("test message");
+  std::string sig1(kEpidSigLen, 0), sig2(kEpidSigLen, 0);
+  size_t sig_len = kEpidSigLen;
+  ASSERT_EQ(sign(msg, privkey1, precomps, alg, &sig1, &sig_len), kEpidNoErr);
+  ASSERT_EQ(sign(msg, privkey2, precomps, alg, &sig2, &sig_len), kEpidNoErr);
+
+  // revoke group1 among many other groups
+  std::vector<std::string> gids;
+  for (int i = 0; i < 1000; ++i) {
+    std::string gid(16, 0);
+    ASSERT_TRUE(random_msg(&gid));
+    gids.push_back(gid);
+  }
+  gids.push_back(pubkey1.substr(0, 16));
+  std::string grp_rl = BuildGroupRlFile(gids, 1);
+
+  EpidApiRevocationLists* rls = nullptr;
+  ASSERT_EQ(EpidApiRevocationListsCreate(grp_rl.data(), grp_rl.size(), &rls),
+            kEpidNoErr);
+  EXPECT_TRUE(EpidApiRevocationListsIsGroupRevoked(
+      rls, reinterpret_cast<const GroupId*>(pubkey1.data())));
+  EXPECT_FALSE(EpidApiRevocationListsIsGroupRevoked(
+      rls, reinterpret_cast<const GroupId*>(pubkey2.data())));
+
+  EpidApiVerifier* verifier1 = nullptr;
+  EpidApiVerifier* verifier2 = nullptr;
+  ASSERT_EQ(EpidApiVerifierOpen(pubkey1.data(), pubkey1.size(), nullptr, 0,
+                                alg, &verifier1),
+            kEpidNoErr);
+  ASSERT_EQ(EpidApiVerifierOpen(pubkey2.data(), pubkey2.size(), nullptr, 0,
+                                alg, &verifier2),
+            kEpidNoErr);
+  ASSERT_EQ(EpidApiVerifierSetRevocationLists(verifier1, rls), kEpidNoErr);
+  ASSERT_EQ(EpidApiVerifierSetRevocationLists(verifier2, rls), kEpidNoErr);
+  // the verifiers keep their own references
+  EpidApiRevocationListsRelease(rls);
+
+  EXPECT_EQ(EpidApiVerifyWithHandle(verifier1, sig1.data(), sig1.size(),
+                                    msg.data(), msg.size(), nullptr, 0),
+            kEpidSigRevokedInGroupRl);
+  EXPECT_EQ(EpidApiVerifyWithHandle(verifier2, sig2.data(), sig2.size(),
+                                    msg.data(), msg.size(), nullptr, 0),
+            kEpidNoErr);
+
+  // removing the lists un-revokes the group
+  ASSERT_EQ(EpidApiVerifierSetRevocationLists(verifier1, nullptr),
+            kEpidNoErr);
+  EXPECT_EQ(EpidApiVerifyWithHandle(verifier1, sig1.data(), sig1.size(),
+                                    msg.data(), msg.size(), nullptr, 0),
+            kEpidNoErr);
+  EpidApiVerifierClose(verifier1);
+  EpidApiVerifierClose(verifier2);
+
+  // the one-shot API parses the same file
+  EXPECT_EQ(EpidApiVerify(sig1.data(), sig1.size(), msg.data(), msg.size(),
+                          nullptr, 0, nullptr, 0, nullptr, 0, grp_rl.data(),
+                          grp_rl.size(), nullptr, 0, pubkey1.data(),
+                          pubkey1.size(), precompv.data(), precompv.size(),
+                          alg),
+            kEpidSigRevokedInGroupRl);
+
+  // truncated file
+  EXPECT_EQ(EpidApiRevocationListsCreate(grp_rl.data(), grp_rl.size() - 1,
+                                         &rls),
+            kEpidBadArgErr);
+}
+
+TEST_F(EpidTest, VerifierCacheRevocationSwap) {
+  std::string pubkey, privkey;
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Pubkey), &pubkey));
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Privkey1), &privkey));
+
+  HashAlg alg = kSha256;
+  std::string precomps;
+  std::string msg("test message");
+  std::string sig(kEpidSigLen, 0);
+  size_t sig_len = kEpidSigLen;
+  ASSERT_EQ(sign(msg, privkey, precomps, alg, &sig, &sig_len), kEpidNoErr);
+
+  EpidApiVerifierCache* cache = nullptr;
+  ASSERT_EQ(EpidApiVerifierCacheCreate(2, &cache), kEpidNoErr);
+  EpidApiVerifier* verifier = nullptr;
+  ASSERT_EQ(EpidApiVerifierCacheAcquire(cache, pubkey.data(), pubkey.size(),
+                                        nullptr, 0, alg, &verifier),
+            kEpidNoErr);
+
+  std::string grp_rl = BuildGroupRlFile({pubkey.substr(0, 16)}, 1);
+  EpidApiRevocationLists* rls = nullptr;
+  ASSERT_EQ(EpidApiRevocationListsCreate(grp_rl.data(), grp_rl.size(), &rls),
+            kEpidNoErr);
+  EpidApiVerifierCacheSetRevocationLists(cache, rls);
+  EpidApiRevocationListsRelease(rls);
+
+  // an acquired verifier finishes with the lists it had
+  EXPECT_EQ(EpidApiVerifyWithHandle(verifier, sig.data(), sig.size(),
+                                    msg.data(), msg.size(), nullptr, 0),
+            kEpidNoErr);
+  EpidApiVerifierCacheRelease(cache, verifier);
+
+  // the next acquire picks up the new lists
+  ASSERT_EQ(EpidApiVerifierCacheAcquire(cache, pubkey.data(), pubkey.size(),
+                                        nullptr, 0, alg, &verifier),
+            kEpidNoErr);
+  EXPECT_EQ(EpidApiVerifyWithHandle(verifier, sig.data(), sig.size(),
+                                    msg.data(), msg.size(), nullptr, 0),
+            kEpidSigRevokedInGroupRl);
+  EpidApiVerifierCacheRelease(cache, verifier);
+
+  EpidApiSignedMsg item = {sig.data(), sig.size(), msg.data(), msg.size()};
+  EpidStatus result = kEpidNoErr;
+  ASSERT_EQ(EpidApiVerifyBatch(cache, pubkey.data(), pubkey.size(), nullptr, 0,
+                               alg, nullptr, 0, &item, 1, 1, &result),
+            kEpidNoErr);
+  EXPECT_EQ(result, kEpidSigRevokedInGroupRl);
+
+  EpidApiVerifierCacheSetRevocationLists(cache, nullptr);
+  ASSERT_EQ(EpidApiVerifierCacheAcquire(cache, pubkey.data(), pubkey.size(),
+                                        nullptr, 0, alg, &verifier),
+            kEpidNoErr);
+  EXPECT_EQ(EpidApiVerifyWithHandle(verifier, sig.data(), sig.size(),
+                                    msg.data(), msg.size(), nullptr, 0),
+            kEpidNoErr);
+  EpidApiVerifierCacheRelease(cache, verifier);
+  EpidApiVerifierCacheDelete(cache);
+}
+
+TEST_F(EpidTest, SysPrngGen) {
+  std::string a(64, 0), b(64, 0);
+  EXPECT_EQ(SysPrngGen(reinterpret_cast<unsigned int*>(&a[0]), 8 * 64, nullptr),
+            0);
+  EXPECT_EQ(SysPrngGen(reinterpret_cast<unsigned int*>(&b[0]), 8 * 64, nullptr),
+            0);
+  EXPECT_NE(a, b);
+  EXPECT_NE(a, std::string(64, 0));
+  // more than one pool refill at once
+  std::string big(4096, 0);
+  EXPECT_EQ(SysPrngGen(reinterpret_cast<unsigned int*>(&big[0]), 8 * 4096,
+                       nullptr),
+            0);
+  EXPECT_NE(big.substr(4000), std::string(96, 0));
+  EXPECT_NE(SysPrngGen(reinterpret_cast<unsigned int*>(&a[0]), 7, nullptr), 0);
+}
+
+namespace {
+
+struct CountingRng {
+  int calls = 0;
+  bool fail = false;
+};
+
+int CountingRngGen(unsigned int* rand_data, int num_bits, void* user_data) {
+  CountingRng* rng = static_cast<CountingRng*>(user_data);
+  ++rng->calls;
+  if (rng->fail) return 1;
+  return SysPrngGen(rand_data, num_bits, nullptr);
+}
+
+}  // namespace
+
+TEST_F(EpidTest, MemberHandleInjectedRng) {
+  std::string privkey, pubkey;
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Pubkey), &pubkey));
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Privkey1), &privkey));
+
+  HashAlg alg = kSha256;
+  std::string precompv;
+  CountingRng rng;
+  EpidApiMember* member = nullptr;
+  ASSERT_EQ(EpidApiMemberOpenWithRng(privkey.data(), privkey.size(), nullptr,
+                                     0, alg, &CountingRngGen, &rng, &member),
+            kEpidNoErr);
+
+  std::string msg("test message");
+  std::string sig(kEpidSigLen, 0);
+  size_t sig_len = sig.size();
+  int calls = rng.calls;
+  EXPECT_EQ(EpidApiSignWithHandle(member, msg.data(), msg.size(), nullptr, 0,
+                                  &sig[0], &sig_len),
+            kEpidNoErr);
+  EXPECT_GT(rng.calls, calls);
+  EXPECT_EQ(verify(msg, sig, pubkey, precompv, alg), kEpidNoErr);
+
+  // a failing source fails the signature
+  rng.fail = true;
+  sig_len = sig.size();
+  EXPECT_NE(EpidApiSignWithHandle(member, msg.data(), msg.size(), nullptr, 0,
+                                  &sig[0], &sig_len),
+            kEpidNoErr);
+  EpidApiMemberClose(member);
+}
+
+TEST_F(EpidTest, PrecompCache) {
+  std::string privkey, pubkey;
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Pubkey), &pubkey));
+  ASSERT_TRUE(
+      base::ReadFileToString(base::FilePath(kEpidGroup1Privkey1), &privkey));
+  base::FilePath path;
+  ASSERT_TRUE(base::CreateTemporaryFile(&path));
+
+  EpidApiPrecompCache* cache = nullptr;
+  ASSERT_EQ(EpidApiPrecompCacheOpen(path.value().c_str(), &cache), kEpidNoErr);
+  EpidApiPrecompCacheSetDefault(cache);
+
+  // the first computation fills the cache, the second reads it
+  std::string precomps1(kEpidSignPrecompLen, 0);
+  std::string precomps2(kEpidSignPrecompLen, 0);
+  std::string precompv1(kEpidVerifyPrecompLen, 0);
+  std::string precompv2(kEpidVerifyPrecompLen, 0);
+  EXPECT_EQ(sign_precomp(privkey, &precomps1), kEpidNoErr);
+  EXPECT_EQ(verify_precomp(pubkey, &precompv1), kEpidNoErr);
+  int64_t size = 0;
+  ASSERT_TRUE(base::GetFileSize(path, &size));
+  EXPECT_GT(size, 0);
+  EXPECT_EQ(sign_precomp(privkey, &precomps2), kEpidNoErr);
+  EXPECT_EQ(verify_precomp(pubkey, &precompv2), kEpidNoErr);
+  EXPECT_EQ(precomps1, precomps2);
+  EXPECT_EQ(precompv1, precompv2);
+  int64_t size2 = 0;
+  ASSERT_TRUE(base::GetFileSize(path, &size2));
+  EXPECT_EQ(size, size2);
+
+  // signing and verifying without a precomp use it
+  std::string msg("test message");
+  std::string sig(kEpidSigLen, 0);
+  size_t sig_len = sig.size();
+  std::string none;
+  EXPECT_EQ(sign(msg, privkey, none, kSha256, &sig, &sig_len), kEpidNoErr);
+  EXPECT_EQ(verify(msg, sig, pubkey, none, kSha256), kEpidNoErr);
+  EpidApiPrecompCacheSetDefault(nullptr);
+  EpidApiPrecompCacheClose(cache);
+
+  // the blobs survive a restart
+  ASSERT_EQ(EpidApiPrecompCacheOpen(path.value().c_str(), &cache), kEpidNoErr);
+  std::string found(kEpidVerifyPrecompLen, 0);
+  EXPECT_TRUE(EpidApiPrecompCacheGet(cache, kEpidApiVerifierPrecomp,
+                                     pubkey.data(), pubkey.size(), &found[0],
+                                     found.size()));
+  EXPECT_EQ(found, precompv1);
+  EXPECT_FALSE(EpidApiPrecompCacheGet(cache, kEpidApiMemberPrecomp,
+                                      pubkey.data(), pubkey.size(), &found[0],
+                                      kEpidSignPrecompLen));
+  EpidApiPrecompCacheClose(cache);
+
+  // a corrupted record is ignored
+  std::string contents;
+  ASSERT_TRUE(base::ReadFileToString(path, &contents));
+  for (char& c : contents) c ^= 1;
+  ASSERT_EQ(base::WriteFile(path, contents.data(), contents.size()),
+            static_cast<int>(contents.size()));
+  ASSERT_EQ(EpidApiPrecompCacheOpen(path.value().c_str(), &cache), kEpidNoErr);
+  EXPECT_FALSE(EpidApiPrecompCacheGet(cache, kEpidApiVerifierPrecomp,
+                                      pubkey.data(), pubkey.size(), &found[0],
+                                      found.size()));
+  EpidApiPrecompCacheClose(cache);
+  base::DeleteFile(path, false);
+}
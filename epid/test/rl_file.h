@@ -0,0 +1,65 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EPID_TEST_RL_FILE_H_
+#define EPID_TEST_RL_FILE_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+inline void AppendBe32(std::string* s, uint32_t v) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    s->push_back(static_cast<char>((v >> shift) & 0xff));
+  }
+}
+
+// Build a SigRl file (EpidFileHeader, SigRl, EcdsaSignature) for the group
+// in pubkey, revoking the (B, K) pair of each signature in sigs. The file
+// signature is left zero, libepid does not check it.
+inline std::string BuildSigRlFile(const std::string& pubkey,
+                                  const std::vector<std::string>& sigs,
+                                  uint32_t version) {
+  // epid version 2, file type SigRl
+  std::string rl("\x02\x00\x00\x0e", 4);
+  // GroupPubKey starts with the 16 byte GroupId
+  rl.append(pubkey, 0, 16);
+  AppendBe32(&rl, version);
+  AppendBe32(&rl, static_cast<uint32_t>(sigs.size()));
+  for (const std::string& sig : sigs) {
+    // BasicSignature starts with B and K, 64 bytes each
+    rl.append(sig, 0, 128);
+  }
+  rl.append(64, '\0');
+  return rl;
+}
+
+// Build a GroupRl file revoking the 16 byte GroupIds in gids.
+inline std::string BuildGroupRlFile(const std::vector<std::string>& gids,
+                                    uint32_t version) {
+  // epid version 2, file type GroupRl
+  std::string rl("\x02\x00\x00\x0f", 4);
+  AppendBe32(&rl, version);
+  AppendBe32(&rl, static_cast<uint32_t>(gids.size()));
+  for (const std::string& gid : gids) {
+    rl.append(gid, 0, 16);
+  }
+  rl.append(64, '\0');
+  return rl;
+}
+
+#endif  // EPID_TEST_RL_FILE_H_
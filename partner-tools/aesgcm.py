@@ -19,11 +19,18 @@ Class to organize GCM-related functions
 """
 
 import os
+from cryptography.exceptions import InvalidTag
 from cryptography.hazmat.backends import default_backend
 from cryptography.hazmat.primitives.ciphers import algorithms
 from cryptography.hazmat.primitives.ciphers import Cipher
 from cryptography.hazmat.primitives.ciphers import modes
 
+# Built by 'make atap_crypto_native'; see ec_helper.py.
+try:
+  import atap_crypto_native  # pylint: disable=g-import-not-at-top
+except ImportError:
+  atap_crypto_native = None
+
 
 class AESGCM(object):
   """Contains static methods for AES GCM operations.
@@ -55,6 +62,11 @@ class AESGCM(object):
 
     iv = os.urandom(12)
 
+    if atap_crypto_native:
+      ciphertext, tag = atap_crypto_native.aes_gcm_encrypt(
+          plaintext, key, iv, associated_data)
+      return (iv, ciphertext, tag)
+
     encryptor = Cipher(
         algorithms.AES(key), modes.GCM(iv),
         backend=default_backend()).encryptor()
@@ -83,9 +95,17 @@ class AESGCM(object):
       The plaintext
 
     Raises:
-      cryptography.exceptions.InvalidTag
+      cryptography.exceptions.InvalidTag: the tag does not match.
+      ValueError: the key, IV or tag has an invalid size.
     """
 
+    if atap_crypto_native:
+      try:
+        return atap_crypto_native.aes_gcm_decrypt(
+            ciphertext, key, iv, tag, associated_data)
+      except atap_crypto_native.TagMismatchError:
+        raise InvalidTag()
+
     decryptor = Cipher(
         algorithms.AES(key), modes.GCM(iv, tag),
         backend=default_backend()).decryptor()
@@ -0,0 +1,310 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Python extension for the provisioning crypto: P256 ECDH with X9.62
+ * compressed keys, and AES-GCM. Inputs are read through the buffer protocol
+ * without copying and the GIL is released while OpenSSL runs, so threads
+ * provisioning different devices do not serialize on it.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+
+#define ECDH_KEY_LEN 33
+#define ECDH_SHARED_SECRET_LEN 32
+#define GCM_IV_LEN 12
+#define GCM_TAG_LEN 16
+#define GCM_TAG_MISMATCH -2
+
+#if PY_MAJOR_VERSION >= 3
+#define BUF "y*"
+#define BYTES "y#"
+#else
+#define BUF "s*"
+#define BYTES "s#"
+#endif
+
+/* From ec_helper_native.c */
+int shared_secret_compute(const uint8_t* private_key,
+                          uint32_t private_key_len,
+                          const uint8_t other_public_key[ECDH_KEY_LEN],
+                          uint8_t shared_secret[ECDH_SHARED_SECRET_LEN]);
+int generate_p256_key(uint8_t** private_key, uint32_t* private_key_len,
+                      uint8_t public_key[ECDH_KEY_LEN]);
+
+/* Raised by aes_gcm_decrypt for a tag mismatch only. */
+static PyObject* TagMismatchError = NULL;
+
+static const EVP_CIPHER* gcm_cipher(size_t key_len) {
+  switch (key_len) {
+    case 16:
+      return EVP_aes_128_gcm();
+    case 24:
+      return EVP_aes_192_gcm();
+    case 32:
+      return EVP_aes_256_gcm();
+    default:
+      return NULL;
+  }
+}
+
+/* Runs AES-GCM over |in| into |out|, which has room for |in_len| bytes.
+ * Encrypting writes the tag to |tag|; decrypting checks it. Returns 0 on
+ * success, GCM_TAG_MISMATCH if the tag does not match and -1 on other
+ * failures.
+ */
+static int gcm_crypt(int encrypt, const Py_buffer* key, const Py_buffer* iv,
+                     const Py_buffer* aad, const Py_buffer* in, uint8_t* out,
+                     uint8_t tag[GCM_TAG_LEN]) {
+  int ret = -1, len = 0;
+  EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+
+  if (!ctx ||
+      !EVP_CipherInit_ex(ctx, gcm_cipher(key->len), NULL, NULL, NULL,
+                         encrypt) ||
+      !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, (int)iv->len, NULL) ||
+      !EVP_CipherInit_ex(ctx, NULL, NULL, key->buf, iv->buf, encrypt)) {
+    goto end;
+  }
+  if (aad->len &&
+      !EVP_CipherUpdate(ctx, NULL, &len, aad->buf, (int)aad->len)) {
+    goto end;
+  }
+  if (in->len && !EVP_CipherUpdate(ctx, out, &len, in->buf, (int)in->len)) {
+    goto end;
+  }
+  if (!encrypt &&
+      !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, GCM_TAG_LEN, tag)) {
+    goto end;
+  }
+  if (!EVP_CipherFinal_ex(ctx, out + len, &len)) {
+    /* only the tag check fails here when decrypting */
+    ret = encrypt ? -1 : GCM_TAG_MISMATCH;
+    goto end;
+  }
+  if (encrypt &&
+      !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, GCM_TAG_LEN, tag)) {
+    goto end;
+  }
+  ret = 0;
+
+end:
+  EVP_CIPHER_CTX_free(ctx);
+  return ret;
+}
+
+static PyObject* py_generate_p256_key(PyObject* self, PyObject* unused) {
+  uint8_t* private_key = NULL;
+  uint32_t private_key_len = 0;
+  uint8_t public_key[ECDH_KEY_LEN];
+  PyObject* result = NULL;
+  int res;
+  (void)self;
+  (void)unused;
+
+  Py_BEGIN_ALLOW_THREADS
+  res = generate_p256_key(&private_key, &private_key_len, public_key);
+  Py_END_ALLOW_THREADS
+  if (res != 0) {
+    PyErr_SetString(PyExc_RuntimeError, "Failed to generate EC key");
+    return NULL;
+  }
+  result = Py_BuildValue("[" BYTES BYTES "]", (const char*)private_key,
+                         (Py_ssize_t)private_key_len, (const char*)public_key,
+                         (Py_ssize_t)ECDH_KEY_LEN);
+  OPENSSL_cleanse(private_key, private_key_len);
+  free(private_key);
+  return result;
+}
+
+static PyObject* py_compute_p256_shared_secret(PyObject* self,
+                                               PyObject* args) {
+  Py_buffer private_key = {0}, device_public_key = {0};
+  uint8_t shared_secret[ECDH_SHARED_SECRET_LEN];
+  PyObject* result = NULL;
+  int res = -1;
+  (void)self;
+
+  if (!PyArg_ParseTuple(args, BUF BUF, &private_key, &device_public_key)) {
+    return NULL;
+  }
+  if (device_public_key.len == ECDH_KEY_LEN &&
+      private_key.len <= UINT32_MAX) {
+    Py_BEGIN_ALLOW_THREADS
+    res = shared_secret_compute(private_key.buf, (uint32_t)private_key.len,
+                                device_public_key.buf, shared_secret);
+    Py_END_ALLOW_THREADS
+  }
+  PyBuffer_Release(&private_key);
+  PyBuffer_Release(&device_public_key);
+  if (res != 0) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "Failed to compute P256 shared secret");
+    return NULL;
+  }
+  result = PyBytes_FromStringAndSize((const char*)shared_secret,
+                                     ECDH_SHARED_SECRET_LEN);
+  OPENSSL_cleanse(shared_secret, sizeof(shared_secret));
+  return result;
+}
+
+static int check_gcm_args(const Py_buffer* key, const Py_buffer* iv,
+                          const Py_buffer* aad, const Py_buffer* in) {
+  if (!gcm_cipher(key->len)) {
+    PyErr_SetString(PyExc_ValueError, "AES key must be 16, 24 or 32 bytes");
+    return -1;
+  }
+  if (iv->len < 1 || iv->len > INT32_MAX || aad->len > INT32_MAX ||
+      in->len > INT32_MAX) {
+    PyErr_SetString(PyExc_ValueError, "Bad AES-GCM input size");
+    return -1;
+  }
+  return 0;
+}
+
+static PyObject* py_aes_gcm_encrypt(PyObject* self, PyObject* args) {
+  Py_buffer plaintext = {0}, key = {0}, iv = {0}, aad = {0};
+  uint8_t tag[GCM_TAG_LEN];
+  PyObject* ciphertext = NULL;
+  PyObject* result = NULL;
+  int res = -1;
+  (void)self;
+
+  if (!PyArg_ParseTuple(args, BUF BUF BUF BUF, &plaintext, &key, &iv,
+                        &aad)) {
+    return NULL;
+  }
+  if (check_gcm_args(&key, &iv, &aad, &plaintext) == 0) {
+    ciphertext = PyBytes_FromStringAndSize(NULL, plaintext.len);
+  }
+  if (ciphertext) {
+    /* ciphertext is not visible to other threads until it is returned */
+    Py_BEGIN_ALLOW_THREADS
+    res = gcm_crypt(1, &key, &iv, &aad, &plaintext,
+                    (uint8_t*)PyBytes_AS_STRING(ciphertext), tag);
+    Py_END_ALLOW_THREADS
+    if (res == 0) {
+      result = Py_BuildValue("(O" BYTES ")", ciphertext, (const char*)tag,
+                             (Py_ssize_t)GCM_TAG_LEN);
+    } else {
+      PyErr_SetString(PyExc_RuntimeError, "AES-GCM encryption failed");
+    }
+  }
+  Py_XDECREF(ciphertext);
+  PyBuffer_Release(&plaintext);
+  PyBuffer_Release(&key);
+  PyBuffer_Release(&iv);
+  PyBuffer_Release(&aad);
+  return result;
+}
+
+static PyObject* py_aes_gcm_decrypt(PyObject* self, PyObject* args) {
+  Py_buffer ciphertext = {0}, key = {0}, iv = {0}, tag = {0}, aad = {0};
+  PyObject* plaintext = NULL;
+  int res = -1;
+  (void)self;
+
+  if (!PyArg_ParseTuple(args, BUF BUF BUF BUF BUF, &ciphertext, &key, &iv,
+                        &tag, &aad)) {
+    return NULL;
+  }
+  if (check_gcm_args(&key, &iv, &aad, &ciphertext) == 0) {
+    if (tag.len != GCM_TAG_LEN) {
+      PyErr_SetString(PyExc_ValueError, "GCM tag must be 16 bytes");
+    } else {
+      plaintext = PyBytes_FromStringAndSize(NULL, ciphertext.len);
+    }
+  }
+  if (plaintext) {
+    Py_BEGIN_ALLOW_THREADS
+    res = gcm_crypt(0, &key, &iv, &aad, &ciphertext,
+                    (uint8_t*)PyBytes_AS_STRING(plaintext), tag.buf);
+    Py_END_ALLOW_THREADS
+    if (res != 0) {
+      /* Do not hand out plaintext that failed authentication. */
+      OPENSSL_cleanse(PyBytes_AS_STRING(plaintext), ciphertext.len);
+      Py_CLEAR(plaintext);
+      if (res == GCM_TAG_MISMATCH) {
+        PyErr_SetString(TagMismatchError, "AES-GCM tag mismatch");
+      } else {
+        PyErr_SetString(PyExc_RuntimeError, "AES-GCM decryption failed");
+      }
+    }
+  }
+  PyBuffer_Release(&ciphertext);
+  PyBuffer_Release(&key);
+  PyBuffer_Release(&iv);
+  PyBuffer_Release(&tag);
+  PyBuffer_Release(&aad);
+  return plaintext;
+}
+
+static PyMethodDef module_methods[] = {
+    {"generate_p256_key", py_generate_p256_key, METH_NOARGS,
+     "generate_p256_key() -> [der private key, compressed public key]"},
+    {"compute_p256_shared_secret", py_compute_p256_shared_secret,
+     METH_VARARGS,
+     "compute_p256_shared_secret(private_key, device_public_key) -> secret"},
+    {"aes_gcm_encrypt", py_aes_gcm_encrypt, METH_VARARGS,
+     "aes_gcm_encrypt(plaintext, key, iv, aad) -> (ciphertext, tag)"},
+    {"aes_gcm_decrypt", py_aes_gcm_decrypt, METH_VARARGS,
+     "aes_gcm_decrypt(ciphertext, key, iv, tag, aad) -> plaintext; raises "
+     "TagMismatchError if the tag does not match and ValueError for bad "
+     "parameters"},
+    {NULL, NULL, 0, NULL},
+};
+
+static int init_errors(PyObject* module) {
+  /* a ValueError, so callers catching that for a bad tag still work */
+  TagMismatchError = PyErr_NewException(
+      "atap_crypto_native.TagMismatchError", PyExc_ValueError, NULL);
+  if (!TagMismatchError) {
+    return -1;
+  }
+  Py_INCREF(TagMismatchError);
+  PyModule_AddObject(module, "TagMismatchError", TagMismatchError);
+  return 0;
+}
+
+#if PY_MAJOR_VERSION >= 3
+static struct PyModuleDef atap_crypto_native_module = {
+    PyModuleDef_HEAD_INIT, "atap_crypto_native",
+    "Native P256 ECDH and AES-GCM for provisioning", -1, module_methods,
+};
+
+PyMODINIT_FUNC PyInit_atap_crypto_native(void) {
+  PyObject* module = PyModule_Create(&atap_crypto_native_module);
+  if (module && init_errors(module) < 0) {
+    Py_CLEAR(module);
+  }
+  return module;
+}
+#else
+PyMODINIT_FUNC initatap_crypto_native(void) {
+  PyObject* module =
+      Py_InitModule3("atap_crypto_native", module_methods,
+                     "Native P256 ECDH and AES-GCM for provisioning");
+  if (module) {
+    init_errors(module);
+  }
+}
+#endif
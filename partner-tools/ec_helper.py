@@ -29,6 +29,13 @@ from ctypes import create_string_buffer
 from ctypes import POINTER
 from ctypes.util import find_library
 
+# Built by 'make atap_crypto_native'. Takes the inputs without copying and
+# releases the GIL while OpenSSL runs.
+try:
+  import atap_crypto_native  # pylint: disable=g-import-not-at-top
+except ImportError:
+  atap_crypto_native = None
+
 _ECDH_KEY_LEN = 33
 
 
@@ -53,6 +60,8 @@ def generate_p256_key():
     A tuple containing the der-encoded private key and the X9.62 compressed
     public key.
   """
+  if atap_crypto_native:
+    return atap_crypto_native.generate_p256_key()
   ec_helper = _ec_helper_native()
   native_generate_p256_key = ec_helper.generate_p256_key
   native_generate_p256_key.argtypes = [
@@ -87,6 +96,9 @@ def compute_p256_shared_secret(private_key, device_public_key):
   Returns:
     The shared secret.
   """
+  if atap_crypto_native:
+    return atap_crypto_native.compute_p256_shared_secret(
+        private_key, device_public_key)
   ec_helper = _ec_helper_native()
   shared_secret_compute = ec_helper.shared_secret_compute
   shared_secret_compute.argtypes = [